@@ -1,5 +1,6 @@
 #include "buffer.h"
 
+#include <algorithm>
 #include <sstream>
 
 #include "aixlog.hpp"
@@ -39,12 +40,27 @@ void Buffer::InitAsBuffer(Device* device, size_t size_in_bytes,
       &alloc_desc, &resource_desc_, D3D12_RESOURCE_STATE_COMMON, nullptr,
       allocation_.GetForInit(), IID_NULL, nullptr));
 #else
-  // TODO: Actually put the buffers in GPU mem..
-  D3D12_HEAP_PROPERTIES heap_props = kSystemMemHeapProps;
-  ASSERT_HR(device->device()->CreateCommittedResource(
-      &heap_props, D3D12_HEAP_FLAG_NONE, &resource_desc_,
-      D3D12_RESOURCE_STATE_COMMON, nullptr,
-      IID_PPV_ARGS(resource_.GetForInit())));
+  BufferAllocator* allocator = GetAllocator();
+  if (is_gpu_local()) {
+    // Static buffers live in GPU memory. The CPU side only ever touches the
+    // shadow copy, which is uploaded on Unlock.
+    shadow_.resize(size_in_bytes);
+  }
+  if (!IsDynamic() && allocator->CanAllocate(size_)) {
+    // Small static buffers share resources. Buffer copies into the shared
+    // resource are only done for GPU-local buffers, whose state the device
+    // tracks per resource.
+    suballocation_ = allocator->Allocate(size_);
+    resource_ = ComWrap(suballocation_.resource);
+    resource_offset_ = suballocation_.offset;
+  } else {
+    D3D12_HEAP_PROPERTIES heap_props =
+        is_gpu_local() ? kGpuLocalHeapProps : kSystemMemHeapProps;
+    ASSERT_HR(device->device()->CreateCommittedResource(
+        &heap_props, D3D12_HEAP_FLAG_NONE, &resource_desc_,
+        D3D12_RESOURCE_STATE_COMMON, nullptr,
+        IID_PPV_ARGS(resource_.GetForInit())));
+  }
 #endif
 
   // wchar_t name[128];
@@ -61,7 +77,7 @@ void Buffer::InitAsVertexBuffer(Device* device, size_t size_in_bytes,
   std::wstringstream name;
   name << "VBuffer" << std::dec << name_index++ << ":" << std::hex << fvf;
   name_ = name.str();
-  resource_->SetName(name_.c_str());
+  if (!is_suballocated()) resource_->SetName(name_.c_str());
 #endif
 }
 
@@ -72,6 +88,17 @@ void Buffer::InitAsIndexBuffer(Device* device, size_t size_in_bytes,
   index_buffer_fmt_ = DXGIFromD3DFormat(format);
 }
 
+Buffer::~Buffer() {
+  // Buffers used by the GPU are kept alive until their frame completes, so the
+  // slot is free to be reused right away.
+  if (is_suballocated()) GetAllocator()->Free(suballocation_);
+}
+
+BufferAllocator* Buffer::GetAllocator() const {
+  return is_gpu_local() ? device_->gpu_buffer_allocator()
+                        : device_->buffer_allocator();
+}
+
 ID3D12Resource* Buffer::resource() {
 #ifdef DX8TO12_USE_ALLOCATOR
   return allocation_->GetResource();
@@ -92,6 +119,21 @@ HRESULT STDMETHODCALLTYPE Buffer::Lock(UINT OffsetToLock, UINT SizeToLock,
   LOG(kLog) << "Going into static lock.\n";
 
   if (SizeToLock == 0) SizeToLock = size_;
+  if (is_gpu_local()) {
+    *ppbData = reinterpret_cast<BYTE*>(shadow_.data()) + OffsetToLock;
+    if (!HasFlag(Flags, D3DLOCK_READONLY)) {
+      dirty_begin_ = std::min(dirty_begin_, static_cast<int>(OffsetToLock));
+      dirty_end_ = std::max(
+          dirty_end_,
+          std::min(size_, static_cast<int>(OffsetToLock + SizeToLock)));
+    }
+    return S_OK;
+  }
+  if (is_suballocated()) {
+    // Shared blocks are mapped forever.
+    *ppbData = reinterpret_cast<BYTE*>(suballocation_.cpu_ptr) + OffsetToLock;
+    return S_OK;
+  }
   D3D12_RANGE range{.Begin = OffsetToLock,
                     .End = OffsetToLock +
                            SizeToLock};  // TODO: Don't do if we're not reading.
@@ -102,15 +144,34 @@ HRESULT STDMETHODCALLTYPE Buffer::Lock(UINT OffsetToLock, UINT SizeToLock,
 }
 
 HRESULT STDMETHODCALLTYPE Buffer::Unlock() {
+  if (is_gpu_local()) {
+    if (dirty_end_ > dirty_begin_) UploadShadow(dirty_begin_, dirty_end_);
+    dirty_begin_ = INT_MAX;
+    dirty_end_ = 0;
+    return S_OK;
+  }
+  if (is_suballocated()) return S_OK;
   resource()->Unmap(0, nullptr);
   return S_OK;
 }
 
+void Buffer::UploadShadow(int begin, int end) {
+  ASSERT(begin >= 0 && end <= size_);
+  DynamicRingBuffer* ring = device_->dynamic_ring_buffer();
+  const int num_bytes = end - begin;
+  DynamicRingBuffer::Allocation alloc = ring->Allocate(num_bytes);
+  memcpy(ring->GetCpuPtrFor(alloc), shadow_.data() + begin, num_bytes);
+  device_->QueueBufferUpload(this, resource_offset_ + begin, alloc);
+}
+
 void Buffer::PersistDynamicChanges() {
   FAIL("Unexpected dynamic change persist in static buffer.");
 }
 
-GpuPtr Buffer::GetGpuPtr() { return resource()->GetGPUVirtualAddress(); }
+GpuPtr Buffer::GetGpuPtr() {
+  return GpuPtr(resource()->GetGPUVirtualAddress())
+      .WithOffset(safe_cast<int>(resource_offset_));
+}
 
 // BIG TODO: Persist dynamic buffers at the end of the frame in case they are
 // read the next frame.
@@ -144,7 +205,20 @@ HRESULT STDMETHODCALLTYPE DynamicBuffer::Lock(UINT OffsetToLock,
   device_->MarkBufferForPersist(this);
 
   prev_lock_frame_ = device_->CurrentFrame();
-  if (is_discard) {
+  if (is_discard && kZeroCopyDynamicDiscard) {
+    ASSERT(offset == 0);
+    // Hand out ring memory sized to the lock. A later NOOVERWRITE lock past
+    // the end of it falls back to GrowRingAllocation.
+    speculative_write_cache_.clear();
+    is_speculative_write_persisted_ = true;
+    DynamicRingBuffer* ring = device_->dynamic_ring_buffer();
+    current_ring_alloc_ = ring->Allocate(size_to_lock);
+    *ppbData = reinterpret_cast<BYTE*>(ring->GetCpuPtrFor(current_ring_alloc_));
+    device_->dynamic_buffer_stats().bytes_avoided += size_to_lock;
+
+    written_ranges_.clear();
+    written_ranges_.insert({offset, size_to_lock});
+  } else if (is_discard) {
     ASSERT(offset == 0);
     if (!speculative_write_cache_.empty()) {
       // This was either not used, or already persisted by a call to GetGpuPtr.
@@ -157,7 +231,7 @@ HRESULT STDMETHODCALLTYPE DynamicBuffer::Lock(UINT OffsetToLock,
     // But save a spot in the CSV heap for it.
     *ppbData = reinterpret_cast<BYTE*>(speculative_write_cache_.data());
 
-    written_ranges_.ranges.clear();
+    written_ranges_.clear();
     written_ranges_.insert({offset, size_to_lock});
   } else {
     ASSERT(is_nooverwrite);
@@ -168,6 +242,8 @@ HRESULT STDMETHODCALLTYPE DynamicBuffer::Lock(UINT OffsetToLock,
       // allocate the entire buffer size and copy the previous value.
       PersistSpeculativeWrite(size_);
       speculative_write_cache_.clear();
+    } else if (offset + size_to_lock > current_ring_alloc_.size) {
+      GrowRingAllocation();
     }
     char* dest =
         device_->dynamic_ring_buffer()->GetCpuPtrFor(current_ring_alloc_) +
@@ -191,11 +267,24 @@ void DynamicBuffer::PersistSpeculativeWrite(int alloc_size) {
       device_->dynamic_ring_buffer()->GetCpuPtrFor(current_ring_alloc_);
   memcpy(dest, speculative_write_cache_.data(),
          speculative_write_cache_.size());
+  device_->dynamic_buffer_stats().bytes_copied +=
+      speculative_write_cache_.size();
   prev_lock_frame_ = device_->CurrentFrame();
 
   is_speculative_write_persisted_ = true;
 }
 
+void DynamicBuffer::GrowRingAllocation() {
+  DynamicRingBuffer* ring = device_->dynamic_ring_buffer();
+  const DynamicRingBuffer::Allocation prev_alloc = current_ring_alloc_;
+  ASSERT(prev_alloc.size > 0 && prev_alloc.size < size_);
+  // Draws that were already recorded keep using the previous allocation.
+  current_ring_alloc_ = ring->Allocate(size_);
+  memcpy(ring->GetCpuPtrFor(current_ring_alloc_),
+         ring->GetCpuPtrFor(prev_alloc), prev_alloc.size);
+  device_->dynamic_buffer_stats().bytes_copied += prev_alloc.size;
+}
+
 GpuPtr DynamicBuffer::GetGpuPtr() {
   if (!is_speculative_write_persisted_ && !speculative_write_cache_.empty()) {
     // Persist the speculative write.
@@ -214,13 +303,15 @@ void DynamicBuffer::PersistDynamicChanges() {
   GetGpuPtr();
   ASSERT(current_ring_alloc_.frame == device_->CurrentFrame());
   ASSERT(current_ring_alloc_.size > 0);
-  ASSERT(written_ranges_.ranges.size() == 1);
-  for (auto [offset, size] : written_ranges_.ranges) {
-    device_->CopyBuffer(resource(), 0,
-                        device_->dynamic_ring_buffer()->GetBackingResource(),
-                        current_ring_alloc_.offset + offset, size);
+  // NOOVERWRITE locks may have left several disjoint ranges. The device merges
+  // them back together where it can.
+  ID3D12Resource* src =
+      device_->dynamic_ring_buffer()->GetBackingResource(current_ring_alloc_);
+  for (auto [offset, size] : written_ranges_) {
+    device_->QueuePersistCopy(resource(), resource_offset_ + offset, src,
+                              current_ring_alloc_.offset + offset, size);
   }
-  written_ranges_.ranges.clear();
+  written_ranges_.clear();
   current_ring_alloc_ = {};
 }
 }  // namespace Dx8to12
\ No newline at end of file
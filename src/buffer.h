@@ -2,10 +2,12 @@
 
 #include <d3d12.h>
 
+#include <climits>
 #include <cstdint>
 #include <memory>
 #include <vector>
 
+#include "buffer_allocator.h"
 #include "d3d8.h"
 #include "dynamic_ring_buffer.h"
 #include "util.h"
@@ -36,6 +38,11 @@ class Buffer : public IDirect3DVertexBuffer8,
   void ReleaseDevice() {}
 
   bool IsDynamic() const { return usage_.Has(Dx8::Usage::Dynamic); }
+  // Static buffers outside of the system memory pool live in the default heap
+  // and are written through a CPU shadow copy.
+  bool is_gpu_local() const {
+    return !IsDynamic() && d3d8_pool_ != D3DPOOL_SYSTEMMEM;
+  }
   // Called at the end of a frame to persist any changes made to dynamic
   // buffers.
   virtual void PersistDynamicChanges();
@@ -87,12 +94,30 @@ class Buffer : public IDirect3DVertexBuffer8,
   virtual HRESULT STDMETHODCALLTYPE GetDesc(D3DINDEXBUFFER_DESC* pDesc) PURE;
 
  protected:
+  ~Buffer() override;
+
+  bool is_suballocated() const { return suballocation_.resource != nullptr; }
+  BufferAllocator* GetAllocator() const;
+  // Copies [begin, end) of the shadow into the ring and has the device copy it
+  // to the GPU-local resource.
+  void UploadShadow(int begin, int end);
+
   Device* device_;
 #ifdef USE_ALLOCATOR
   ComPtr<D3D12MA::Allocation> allocation_;
 #else
   ComPtr<ID3D12Resource> resource_;
 #endif
+  // Set when the buffer lives inside one of the device's shared buffer blocks,
+  // in which case resource_ is the block and resource_offset_ is where the
+  // buffer starts in it.
+  BufferAllocator::Allocation suballocation_;
+  int64_t resource_offset_ = 0;
+  // CPU copy of GPU-local buffers, and the range written since the last
+  // Unlock.
+  std::vector<char> shadow_;
+  int dirty_begin_ = INT_MAX;
+  int dirty_end_ = 0;
   D3D12_RESOURCE_DESC resource_desc_;
   DWORD fvf_ = 0;
   D3DPOOL d3d8_pool_ = D3DPOOL_DEFAULT;
@@ -119,6 +144,9 @@ class DynamicBuffer : public Buffer {
 
  private:
   void PersistSpeculativeWrite(int alloc_size);
+  // Moves the current ring allocation to a new one that covers the whole
+  // buffer.
+  void GrowRingAllocation();
   void UpdateCbvForRingBuffer(int offset, int size);
 
   // We store the last dynamic write that the user has done.
@@ -0,0 +1,66 @@
+#include "buffer_allocator.h"
+
+#include "aixlog.hpp"
+#include "device_limits.h"
+
+namespace Dx8to12 {
+
+BufferAllocator::BufferAllocator(ID3D12Device *device,
+                                 D3D12_HEAP_PROPERTIES heap_props)
+    : device_(device),
+      heap_props_(heap_props),
+      slots_(D3D12_CONSTANT_BUFFER_DATA_PLACEMENT_ALIGNMENT,
+             kBufferAllocatorMaxSize, kBufferAllocatorPageSize,
+             kBufferAllocatorBlockSize) {}
+
+BufferAllocator::~BufferAllocator() {
+  if (!is_mappable()) return;
+  for (Block &block : blocks_) {
+    block.resource->Unmap(0, nullptr);
+  }
+}
+
+BufferAllocator::Allocation BufferAllocator::Allocate(int num_bytes) {
+  bool new_block;
+  SizeClassAllocator::Allocation slot = slots_.Allocate(num_bytes, &new_block);
+  if (new_block) {
+    D3D12_RESOURCE_DESC desc{
+        .Dimension = D3D12_RESOURCE_DIMENSION_BUFFER,
+        .Alignment = D3D12_DEFAULT_RESOURCE_PLACEMENT_ALIGNMENT,
+        .Width = static_cast<UINT64>(kBufferAllocatorBlockSize),
+        .Height = 1,
+        .DepthOrArraySize = 1,
+        .MipLevels = 1,
+        .Format = DXGI_FORMAT_UNKNOWN,
+        .SampleDesc = {.Count = 1, .Quality = 0},
+        .Layout = D3D12_TEXTURE_LAYOUT_ROW_MAJOR,
+        .Flags = D3D12_RESOURCE_FLAG_NONE};
+    Block block;
+    ASSERT_HR(device_->CreateCommittedResource(
+        &heap_props_, D3D12_HEAP_FLAG_NONE, &desc, D3D12_RESOURCE_STATE_COMMON,
+        nullptr, IID_PPV_ARGS(block.resource.GetForInit())));
+    block.resource->SetName(L"BufferAllocatorBlock");
+    if (is_mappable()) {
+      // Map the block forever.
+      D3D12_RANGE no_reads = {};
+      ASSERT_HR(block.resource->Map(
+          0, &no_reads, reinterpret_cast<void **>(&block.cpu_ptr)));
+    }
+    blocks_.push_back(std::move(block));
+    ASSERT((int)blocks_.size() == slots_.num_blocks());
+    const SizeClassAllocator::Stats stats = slots_.stats();
+    LOG(INFO) << "Buffer allocator grew to " << std::dec
+              << stats.bytes_reserved / 1024 << "kB for "
+              << stats.num_allocations << " buffers. Internal fragmentation "
+              << stats.internal_fragmentation * 100.0f << "%.\n";
+  }
+  Block &block = blocks_[slot.block];
+  return {.resource = block.resource.get(),
+          .cpu_ptr = block.cpu_ptr ? block.cpu_ptr + slot.offset : nullptr,
+          .offset = slot.offset,
+          .slot = slot};
+}
+
+void BufferAllocator::Free(const Allocation &alloc) { slots_.Free(alloc.slot); }
+
+}  // namespace Dx8to12
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <d3d12.h>
+
+#include <vector>
+
+#include "util.h"
+#include "utils/dx_utils.h"
+#include "utils/size_class_allocator.h"
+
+namespace Dx8to12 {
+
+// Sub-allocates small buffers out of large buffer resources, so that each D3D8
+// buffer does not cost a committed resource (and its 64kB placement alignment).
+// Blocks in CPU-visible heaps are persistently mapped. Allocations are aligned
+// to their size class, which is at least 256 bytes, so they can be used as
+// CBVs.
+class BufferAllocator {
+ public:
+  struct Allocation {
+    ID3D12Resource* resource = nullptr;
+    // nullptr for blocks in the default heap.
+    char* cpu_ptr = nullptr;
+    int64_t offset = 0;
+    SizeClassAllocator::Allocation slot;
+  };
+
+  BufferAllocator(ID3D12Device* device, D3D12_HEAP_PROPERTIES heap_props);
+  ~BufferAllocator();
+
+  // Returns false if num_bytes is too large to be sub-allocated.
+  bool CanAllocate(int num_bytes) const {
+    return slots_.CanAllocate(num_bytes);
+  }
+  Allocation Allocate(int num_bytes);
+  // The allocation must not be in use by the GPU anymore.
+  void Free(const Allocation& alloc);
+
+  SizeClassAllocator::Stats stats() const { return slots_.stats(); }
+
+ private:
+  struct Block {
+    ComPtr<ID3D12Resource> resource;
+    char* cpu_ptr = nullptr;
+  };
+
+  bool is_mappable() const {
+    return heap_props_.Type != D3D12_HEAP_TYPE_DEFAULT;
+  }
+
+  ID3D12Device* device_;
+  const D3D12_HEAP_PROPERTIES heap_props_;
+  SizeClassAllocator slots_;
+  std::vector<Block> blocks_;
+};
+}  // namespace Dx8to12
@@ -0,0 +1,98 @@
+#include "copy_queue.h"
+
+#include "aixlog.hpp"
+
+namespace Dx8to12 {
+
+CopyQueue::CopyQueue(ID3D12Device *device) : device_(device) {
+  D3D12_COMMAND_QUEUE_DESC queue_desc = {
+      .Type = D3D12_COMMAND_LIST_TYPE_COPY,
+      .Priority = D3D12_COMMAND_QUEUE_PRIORITY_NORMAL,
+      .Flags = D3D12_COMMAND_QUEUE_FLAG_NONE,
+      .NodeMask = 0};
+  ASSERT_HR(device_->CreateCommandQueue(&queue_desc,
+                                        IID_PPV_ARGS(queue_.GetForInit())));
+  ASSERT_HR(device_->CreateFence(0, D3D12_FENCE_FLAG_NONE,
+                                 IID_PPV_ARGS(fence_.GetForInit())));
+  fence_event_handle_ = CreateEventEx(nullptr, nullptr, 0, EVENT_ALL_ACCESS);
+  ASSERT(fence_event_handle_ != INVALID_HANDLE_VALUE);
+}
+
+CopyQueue::~CopyQueue() {
+  // The device submits and waits for everything before it goes away. Batches
+  // that were never submitted are simply dropped.
+  WaitForFrame(UINT64_MAX);
+  CloseHandle(fence_event_handle_);
+}
+
+ID3D12GraphicsCommandList *CopyQueue::BeginUpload(uint64_t last_used_frame,
+                                                  uint64_t *copy_value) {
+  if (!sync_.has_open_batch()) {
+    Retire();
+    if (!retired_cmd_allocators_.empty() &&
+        retired_cmd_allocators_.front().first <= CompletedValue()) {
+      cmd_allocator_ = std::move(retired_cmd_allocators_.front().second);
+      retired_cmd_allocators_.pop_front();
+      ASSERT_HR(cmd_allocator_->Reset());
+    } else {
+      ASSERT_HR(device_->CreateCommandAllocator(
+          D3D12_COMMAND_LIST_TYPE_COPY,
+          IID_PPV_ARGS(cmd_allocator_.GetForInit())));
+    }
+    if (!cmd_list_) {
+      ASSERT_HR(device_->CreateCommandList(
+          0, D3D12_COMMAND_LIST_TYPE_COPY, cmd_allocator_.get(), nullptr,
+          IID_PPV_ARGS(cmd_list_.GetForInit())));
+    } else {
+      ASSERT_HR(cmd_list_->Reset(cmd_allocator_.get(), nullptr));
+    }
+  }
+  *copy_value = sync_.AddUpload(last_used_frame);
+  return cmd_list_.get();
+}
+
+void CopyQueue::Submit(ID3D12Fence *direct_fence, uint64_t frame) {
+  if (!sync_.has_open_batch()) return;
+  const CopyQueueSync::Batch batch = sync_.SubmitBatch(frame);
+  ASSERT_HR(cmd_list_->Close());
+  if (batch.direct_wait_value != 0) {
+    ASSERT_HR(queue_->Wait(direct_fence, batch.direct_wait_value));
+  }
+  ID3D12CommandList *cmd_list = cmd_list_.Get();
+  queue_->ExecuteCommandLists(1, &cmd_list);
+  ASSERT_HR(queue_->Signal(fence_.get(), batch.signal_value));
+  retired_cmd_allocators_.push_back(
+      {batch.signal_value, std::move(cmd_allocator_)});
+  LOG(TRACE) << "Submitted copy batch " << batch.signal_value << ".\n";
+}
+
+void CopyQueue::RequireForDirect(ID3D12Fence *direct_fence, uint64_t frame,
+                                 uint64_t copy_value) {
+  if (copy_value == 0 || copy_value <= CompletedValue()) return;
+  if (sync_.IsOpen(copy_value)) Submit(direct_fence, frame);
+  sync_.RequireForDirect(copy_value);
+}
+
+void CopyQueue::QueueDirectWait(ID3D12CommandQueue *direct_queue) {
+  if (uint64_t value = sync_.TakeDirectWait(CompletedValue()); value != 0) {
+    ASSERT_HR(direct_queue->Wait(fence_.get(), value));
+  }
+}
+
+uint64_t CopyQueue::CompletedFrame(uint64_t completed_frame) const {
+  return sync_.CompletedFrame(completed_frame, CompletedValue());
+}
+
+void CopyQueue::WaitForFrame(uint64_t frame) {
+  const uint64_t value = sync_.CopyValueFor(frame);
+  if (CompletedValue() < value) {
+    LOG(TRACE) << "Waiting for copy batch " << value << ".\n";
+    ASSERT_HR(fence_->SetEventOnCompletion(value, fence_event_handle_));
+    WaitForSingleObjectEx(fence_event_handle_, 60 * 1000, FALSE);
+  }
+  Retire();
+}
+
+void CopyQueue::Retire() { sync_.Retire(CompletedValue()); }
+
+}  // namespace Dx8to12
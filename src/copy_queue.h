@@ -0,0 +1,73 @@
+#pragma once
+
+#include <d3d12.h>
+
+#include <cstdint>
+#include <deque>
+#include <utility>
+
+#include "util.h"
+#include "utils/copy_queue_sync.h"
+
+interface ID3D12Device;
+interface ID3D12CommandQueue;
+interface ID3D12CommandAllocator;
+interface ID3D12Fence;
+
+namespace Dx8to12 {
+
+// A D3D12_COMMAND_LIST_TYPE_COPY queue that texture uploads are recorded on,
+// so that they run next to rendering instead of in the middle of it. Uploads
+// are batched into one command list, which is submitted before the direct
+// command list that first uses one of its textures, or else together with the
+// direct list. CopyQueueSync decides which queue waits for which.
+//
+// The copy queue can only move textures between COMMON and COPY_DEST, and they
+// decay back to COMMON once a batch is done. So only textures in COMMON can be
+// uploaded here.
+class CopyQueue {
+ public:
+  explicit CopyQueue(ID3D12Device* device);
+  ~CopyQueue();
+
+  // Returns the command list to record an upload into, opening a new batch if
+  // needed. The texture was last used on the direct queue in last_used_frame
+  // (0 if never). Sets copy_value to the batch's fence value.
+  ID3D12GraphicsCommandList* BeginUpload(uint64_t last_used_frame,
+                                         uint64_t* copy_value);
+  // Submits the open batch, if any, as part of frame. direct_fence is the
+  // direct queue's frame fence.
+  void Submit(ID3D12Fence* direct_fence, uint64_t frame);
+  // Called when the direct command list being recorded uses a texture that
+  // was uploaded by copy_value. Submits its batch if it is still open.
+  void RequireForDirect(ID3D12Fence* direct_fence, uint64_t frame,
+                        uint64_t copy_value);
+  // Called right before the direct command list is executed on direct_queue.
+  // Makes it wait for the batches it uses that may still be running.
+  void QueueDirectWait(ID3D12CommandQueue* direct_queue);
+
+  // Last frame that is done on both queues.
+  uint64_t CompletedFrame(uint64_t completed_frame) const;
+  // Blocks until the batches submitted up to frame are done.
+  void WaitForFrame(uint64_t frame);
+  // Forgets about batches that are done.
+  void Retire();
+
+  uint64_t CompletedValue() const {
+    return fence_.get()->GetCompletedValue();
+  }
+
+ private:
+  ID3D12Device* device_;
+  CopyQueueSync sync_;
+  ComPtr<ID3D12CommandQueue> queue_;
+  ComPtr<ID3D12GraphicsCommandList> cmd_list_;
+  ComPtr<ID3D12CommandAllocator> cmd_allocator_;
+  // Allocators of submitted batches, tagged with their fence values.
+  std::deque<std::pair<uint64_t, ComPtr<ID3D12CommandAllocator>>>
+      retired_cmd_allocators_;
+  ComPtr<ID3D12Fence> fence_;
+  HANDLE fence_event_handle_ = nullptr;
+};
+
+}  // namespace Dx8to12
@@ -5,16 +5,24 @@
 #include <dxgi1_4.h>
 
 #include <algorithm>
+#include <functional>
 #include <sstream>
 #include <utility>
 
 #include "SimpleMath.h"
 #include "aixlog.hpp"
 #include "buffer.h"
+#include "buffer_allocator.h"
+#include "copy_queue.h"
 #include "dynamic_ring_buffer.h"
+#include "pipeline_library.h"
 #include "shader_parser.h"
 #include "surface.h"
 #include "texture.h"
+#include "texture_deduplicator.h"
+#include "texture_transcoder.h"
+#include "texture_uploader.h"
+#include "utils/bindless_indices.h"
 #include "utils/dx_utils.h"
 #include "vertex_shader.h"
 
@@ -34,6 +42,7 @@
 namespace Dx8to12 {
 
 // static_assert(sizeof(void *) == 4, "Does not support 64-bit.");
+static_assert(BindlessIndices::kNumStages == kMaxTexStages);
 
 Device::DirtyFlags &operator|=(Device::DirtyFlags &a, Device::DirtyFlags b) {
   a = static_cast<Device::DirtyFlags>(static_cast<uint32_t>(a) |
@@ -70,6 +79,18 @@ HRESULT STDMETHODCALLTYPE Device::QueryInterface(REFIID riid, void **ppvObj) {
   }
 }
 
+// Flip model swap chains need at least two buffers.
+static UINT NumSwapChainBuffers(const D3DPRESENT_PARAMETERS &params) {
+  ASSERT(params.BackBufferCount < kMaxBackBuffers);
+  return std::max<UINT>(kNumBackBuffers, params.BackBufferCount + 1);
+}
+
+static UINT SwapChainFlags() {
+  return kUseFrameLatencyWaitableObject
+             ? DXGI_SWAP_CHAIN_FLAG_FRAME_LATENCY_WAITABLE_OBJECT
+             : 0;
+}
+
 static void __stdcall DebugInfoQueueMessageCallback(
     D3D12_MESSAGE_CATEGORY category, D3D12_MESSAGE_SEVERITY severity,
     D3D12_MESSAGE_ID id, LPCSTR pDescription, void *pContext) {
@@ -150,7 +171,7 @@ bool Device::Create(HWND window, ComPtr<IDXGIFactory2> factory,
 }
 
 HRESULT Device::Init(const D3DPRESENT_PARAMETERS &presentParams) {
-  fence_values_ = {};
+  frame_pacer_ = FramePacer(kMaxFramesInFlight);
   next_fence_ = 1;
 
   srv_heap_ = DescriptorPoolHeap(
@@ -167,6 +188,34 @@ HRESULT Device::Init(const D3DPRESENT_PARAMETERS &presentParams) {
       d3d12_device_.get(), kDynamicRingBufferSize);
 
   dynamic_ring_buffer_->SetCurrentFrame(CurrentFrame());
+  texture_uploader_ = std::make_unique<TextureUploader>(this);
+  if (kUseCopyQueue) {
+    copy_queue_ = std::make_unique<CopyQueue>(d3d12_device_.get());
+  }
+  if (kTranscodeManagedTextures) {
+    texture_transcoder_ = std::make_unique<TextureTranscoder>(this);
+  }
+  if (kDeduplicateManagedTextures) {
+    texture_deduplicator_ = std::make_unique<TextureDeduplicator>(this);
+  }
+  if (kPsoCompileMode != PsoCompileMode::kSynchronous && !kDisablePsoCache) {
+    if (!kDisablePixelShaderCache) {
+      ps_compiler_ = std::make_unique<
+          AsyncCompiler<PixelShaderState, ComPtr<ID3DBlob>>>(
+          kNumPsoCompileThreads);
+    }
+    pso_compiler_ = std::make_unique<
+        AsyncCompiler<PSOState, ComPtr<ID3D12PipelineState>>>(
+        kNumPsoCompileThreads);
+  }
+  if (kFFPixelShaderMode != FFPixelShaderMode::kSpecialized) {
+    ff_ubershader_ = CreateFFUbershader();
+  }
+
+  buffer_allocator_ = std::make_unique<BufferAllocator>(d3d12_device_.get(),
+                                                        kSystemMemHeapProps);
+  gpu_buffer_allocator_ = std::make_unique<BufferAllocator>(
+      d3d12_device_.get(), kGpuLocalHeapProps);
 
 #ifdef DX8TO12_USE_ALLOCATOR
   {
@@ -201,6 +250,8 @@ HRESULT Device::Init(const D3DPRESENT_PARAMETERS &presentParams) {
       .NodeMask = 0};
   ASSERT_HR(d3d12_device_->CreateCommandQueue(
       &cmd_queue_desc, IID_PPV_ARGS(cmd_queue_.GetForInit())));
+  cmd_allocators_.resize(frame_pacer_.frames_in_flight());
+  frame_resources_to_free_.resize(frame_pacer_.frames_in_flight());
   for (auto &allocator : cmd_allocators_) {
     ASSERT_HR(d3d12_device_->CreateCommandAllocator(
         D3D12_COMMAND_LIST_TYPE_DIRECT, IID_PPV_ARGS(allocator.GetForInit())));
@@ -223,9 +274,10 @@ HRESULT Device::Init(const D3DPRESENT_PARAMETERS &presentParams) {
       .Format = DXGIFromD3DFormat(presentParams.BackBufferFormat),
       .SampleDesc = {.Count = 1, .Quality = 0},
       .BufferUsage = DXGI_USAGE_RENDER_TARGET_OUTPUT,
-      .BufferCount = kNumBackBuffers,
+      .BufferCount = NumSwapChainBuffers(presentParams),
       .Scaling = DXGI_SCALING_NONE,
       .SwapEffect = DXGI_SWAP_EFFECT_FLIP_DISCARD,
+      .Flags = SwapChainFlags(),
   };
   // Don't crash if creating the swap chain fails. This might happen during
   // device reset.
@@ -234,11 +286,15 @@ HRESULT Device::Init(const D3DPRESENT_PARAMETERS &presentParams) {
       cmd_queue_.get(), window_, &swap_chain_desc, nullptr, nullptr,
       swap_chain1.GetForInit()));
   ASSERT_HR(swap_chain1->QueryInterface(swap_chain_.GetForInit()));
+  if (kUseFrameLatencyWaitableObject) {
+    ASSERT_HR(swap_chain_->SetMaximumFrameLatency(
+        static_cast<UINT>(frame_pacer_.frames_in_flight())));
+    frame_latency_waitable_ = swap_chain_->GetFrameLatencyWaitableObject();
+  }
 
   current_back_buffer_ = swap_chain_->GetCurrentBackBufferIndex();
 
   // Create the back buffer.
-  ASSERT(presentParams.BackBufferCount <= 1);
   ASSERT(back_buffers_.empty());
   for (uint32_t i = 0; i < swap_chain_desc.BufferCount; ++i) {
     ComPtr<ID3D12Resource> back_buffer_resource;
@@ -256,7 +312,28 @@ HRESULT Device::Init(const D3DPRESENT_PARAMETERS &presentParams) {
   return S_OK;
 }
 
-Device::~Device() { WaitForFrame(next_fence_ - 1); }
+Device::~Device() {
+  WaitForFrame(next_fence_ - 1);
+  // Their threads use the device.
+  ps_compiler_.reset();
+  pso_compiler_.reset();
+  const FrameTimeStats::Summary frames = frame_times_.Summarize();
+  LOG(INFO) << "Frame times: " << frames.num_frames << " frames, mean "
+            << frames.mean_ms << " ms, median " << frames.median_ms
+            << " ms, p99 " << frames.p99_ms << " ms, max " << frames.max_ms
+            << " ms, " << frames.num_spikes << " spikes. Stalled "
+            << compile_stall_seconds_ * 1000.0
+            << " ms compiling shaders and pipelines on the spot, "
+            << num_fallback_draws_ << " fallback draws, " << num_skipped_draws_
+            << " skipped draws.\n";
+  if (frames.num_frames > 0) {
+    LOG(INFO) << "Texture uploads: mean "
+              << frame_upload_bytes_total_ / frames.num_frames / 1024
+              << " KiB, max " << frame_upload_bytes_max_ / 1024
+              << " KiB per frame.\n";
+  }
+  if (frame_latency_waitable_) CloseHandle(frame_latency_waitable_);
+}
 
 HRESULT STDMETHODCALLTYPE
 Device::Reset(D3DPRESENT_PARAMETERS *pPresentationParameters) {
@@ -287,8 +364,9 @@ Device::Reset(D3DPRESENT_PARAMETERS *pPresentationParameters) {
 
   ASSERT_HR(swap_chain_->ResizeTarget(&mode_desc));
   ASSERT_HR(swap_chain_->ResizeBuffers(
-      2, pPresentationParameters->BackBufferWidth,
-      pPresentationParameters->BackBufferHeight, new_format, 0));
+      NumSwapChainBuffers(*pPresentationParameters),
+      pPresentationParameters->BackBufferWidth,
+      pPresentationParameters->BackBufferHeight, new_format, SwapChainFlags()));
 
   DXGI_SWAP_CHAIN_DESC swap_chain_desc;
   ASSERT_HR(swap_chain_->GetDesc(&swap_chain_desc));
@@ -317,9 +395,9 @@ Device::Reset(D3DPRESENT_PARAMETERS *pPresentationParameters) {
 
   current_back_buffer_ = swap_chain_->GetCurrentBackBufferIndex();
 
-  ASSERT_HR(cmd_allocators_[current_back_buffer_]->Reset());
-  ASSERT_HR(
-      cmd_list_->Reset(cmd_allocators_[current_back_buffer_].get(), nullptr));
+  const int slot = frame_pacer_.current_slot();
+  ASSERT_HR(cmd_allocators_[slot]->Reset());
+  ASSERT_HR(cmd_list_->Reset(cmd_allocators_[slot].get(), nullptr));
   dirty_flags_ ^= DIRTY_FLAG_CMD_LIST_CLOSED;
 
   return S_OK;
@@ -369,7 +447,7 @@ D3DCAPS8 Device::GetDefaultCaps(UINT adapter_index) {
       .TextureCaps = D3DPTEXTURECAPS_PERSPECTIVE | D3DPTEXTURECAPS_ALPHA |
                      D3DPTEXTURECAPS_CUBEMAP | D3DPTEXTURECAPS_VOLUMEMAP |
                      D3DPTEXTURECAPS_MIPMAP | D3DPTEXTURECAPS_MIPVOLUMEMAP |
-                     D3DPTEXTURECAPS_MIPCUBEMAP,
+                     D3DPTEXTURECAPS_MIPCUBEMAP | D3DPTEXTURECAPS_ALPHAPALETTE,
       .TextureFilterCaps =
           D3DPTFILTERCAPS_MINFPOINT | D3DPTFILTERCAPS_MINFLINEAR |
           D3DPTFILTERCAPS_MINFANISOTROPIC | D3DPTFILTERCAPS_MIPFPOINT |
@@ -456,32 +534,77 @@ void Device::InitRootSignatures() {
       },
   };
   textures_start_bindslot_ = root_params.size();
-  // Add all kMaxTexStages textures.
-  std::array<D3D12_DESCRIPTOR_RANGE, kMaxTexStages> srv_ranges;
-  std::array<D3D12_DESCRIPTOR_RANGE, kMaxTexStages> sampler_ranges;
-  for (unsigned int i = 0; i < kMaxTexStages; ++i) {
-    srv_ranges[i] = {.RangeType = D3D12_DESCRIPTOR_RANGE_TYPE_SRV,
-                     .NumDescriptors = 1,
-                     .BaseShaderRegister = i,
-                     .OffsetInDescriptorsFromTableStart = 0};
-    sampler_ranges[i] = {.RangeType = D3D12_DESCRIPTOR_RANGE_TYPE_SAMPLER,
-                         .NumDescriptors = 1,
-                         .BaseShaderRegister = i};
+  // Bindless layout: Texture2D table (t0, space1), TextureCube table (t0,
+  // space2) and sampler table (s0, space1), each spanning its whole heap,
+  // followed by per-stage heap indices as root constants (b11).
+  std::array<D3D12_DESCRIPTOR_RANGE, 3> bindless_ranges{
+      D3D12_DESCRIPTOR_RANGE{.RangeType = D3D12_DESCRIPTOR_RANGE_TYPE_SRV,
+                             .NumDescriptors = UINT_MAX,
+                             .BaseShaderRegister = 0,
+                             .RegisterSpace = 1,
+                             .OffsetInDescriptorsFromTableStart = 0},
+      D3D12_DESCRIPTOR_RANGE{.RangeType = D3D12_DESCRIPTOR_RANGE_TYPE_SRV,
+                             .NumDescriptors = UINT_MAX,
+                             .BaseShaderRegister = 0,
+                             .RegisterSpace = 2,
+                             .OffsetInDescriptorsFromTableStart = 0},
+      D3D12_DESCRIPTOR_RANGE{.RangeType = D3D12_DESCRIPTOR_RANGE_TYPE_SAMPLER,
+                             .NumDescriptors = UINT_MAX,
+                             .BaseShaderRegister = 0,
+                             .RegisterSpace = 1,
+                             .OffsetInDescriptorsFromTableStart = 0}};
+  if (kUseBindlessTextures) {
+    D3D12_FEATURE_DATA_D3D12_OPTIONS options = {};
+    ASSERT_HR(d3d12_device_->CheckFeatureSupport(
+        D3D12_FEATURE_D3D12_OPTIONS, &options, sizeof(options)));
+    if (options.ResourceBindingTier < D3D12_RESOURCE_BINDING_TIER_2) {
+      FAIL("Bindless textures need resource binding tier 2 (have %d).",
+           options.ResourceBindingTier);
+    }
+    for (auto &range : bindless_ranges) {
+      root_params.push_back(D3D12_ROOT_PARAMETER{
+          .ParameterType = D3D12_ROOT_PARAMETER_TYPE_DESCRIPTOR_TABLE,
+          .DescriptorTable = {.NumDescriptorRanges = 1,
+                              .pDescriptorRanges = &range},
+          .ShaderVisibility = D3D12_SHADER_VISIBILITY_PIXEL,
+      });
+    }
     root_params.push_back(D3D12_ROOT_PARAMETER{
-        .ParameterType = D3D12_ROOT_PARAMETER_TYPE_DESCRIPTOR_TABLE,
-        .DescriptorTable = {.NumDescriptorRanges = 1,
-                            .pDescriptorRanges = &srv_ranges[i]},
+        .ParameterType = D3D12_ROOT_PARAMETER_TYPE_32BIT_CONSTANTS,
+        .Constants = {.ShaderRegister = 11,
+                      .RegisterSpace = 0,
+                      .Num32BitValues = kNumBindlessIndices},
         .ShaderVisibility = D3D12_SHADER_VISIBILITY_PIXEL,
     });
   }
-  // And all samplers.
-  for (unsigned int i = 0; i < kMaxTexStages; ++i) {
-    root_params.push_back(D3D12_ROOT_PARAMETER{
-        .ParameterType = D3D12_ROOT_PARAMETER_TYPE_DESCRIPTOR_TABLE,
-        .DescriptorTable = {.NumDescriptorRanges = 1,
-                            .pDescriptorRanges = &sampler_ranges[i]},
-        .ShaderVisibility = D3D12_SHADER_VISIBILITY_PIXEL,
-    });
+  // Add all kMaxTexStages textures.
+  std::array<D3D12_DESCRIPTOR_RANGE, kMaxTexStages> srv_ranges;
+  std::array<D3D12_DESCRIPTOR_RANGE, kMaxTexStages> sampler_ranges;
+  if (!kUseBindlessTextures) {
+    for (unsigned int i = 0; i < kMaxTexStages; ++i) {
+      srv_ranges[i] = {.RangeType = D3D12_DESCRIPTOR_RANGE_TYPE_SRV,
+                       .NumDescriptors = 1,
+                       .BaseShaderRegister = i,
+                       .OffsetInDescriptorsFromTableStart = 0};
+      sampler_ranges[i] = {.RangeType = D3D12_DESCRIPTOR_RANGE_TYPE_SAMPLER,
+                           .NumDescriptors = 1,
+                           .BaseShaderRegister = i};
+      root_params.push_back(D3D12_ROOT_PARAMETER{
+          .ParameterType = D3D12_ROOT_PARAMETER_TYPE_DESCRIPTOR_TABLE,
+          .DescriptorTable = {.NumDescriptorRanges = 1,
+                              .pDescriptorRanges = &srv_ranges[i]},
+          .ShaderVisibility = D3D12_SHADER_VISIBILITY_PIXEL,
+      });
+    }
+    // And all samplers.
+    for (unsigned int i = 0; i < kMaxTexStages; ++i) {
+      root_params.push_back(D3D12_ROOT_PARAMETER{
+          .ParameterType = D3D12_ROOT_PARAMETER_TYPE_DESCRIPTOR_TABLE,
+          .DescriptorTable = {.NumDescriptorRanges = 1,
+                              .pDescriptorRanges = &sampler_ranges[i]},
+          .ShaderVisibility = D3D12_SHADER_VISIBILITY_PIXEL,
+      });
+    }
   }
 
   D3D12_ROOT_SIGNATURE_DESC sig_desc{
@@ -503,6 +626,11 @@ void Device::InitRootSignatures() {
   ASSERT_HR(d3d12_device_->CreateRootSignature(
       0, sig_blob->GetBufferPointer(), sig_blob->GetBufferSize(),
       IID_PPV_ARGS(main_root_sig_.GetForInit())));
+  if (kUsePipelineCache) {
+    // Cached pipelines are tied to the root signature they were built with.
+    pipeline_library_ = std::make_unique<PipelineLibrary>(
+        d3d12_device_.get(), adapter_.get(), sig_blob.get());
+  }
 
   // Create the cbuffers.
   vs_cbuffer_ = ComOwn(new DynamicBuffer());
@@ -532,6 +660,25 @@ HRESULT STDMETHODCALLTYPE Device::GetDeviceCaps(D3DCAPS8 *pCaps) {
 
 HRESULT STDMETHODCALLTYPE Device::TestCooperativeLevel() { return S_OK; }
 
+UINT STDMETHODCALLTYPE Device::GetAvailableTextureMem() {
+  // Like D3D8, round down to the nearest MB.
+  constexpr uint64_t kMb = 1024 * 1024;
+  const uint64_t available_bytes =
+      std::min<uint64_t>(residency_.available_bytes(), UINT_MAX);
+  return static_cast<UINT>(available_bytes / kMb * kMb);
+}
+
+HRESULT STDMETHODCALLTYPE Device::ResourceManagerDiscardBytes(DWORD Bytes) {
+  TRACE_ENTRY(Bytes);
+  // Textures that the GPU might still be using stay resident.
+  for (void *owner : residency_.Evict(Bytes, CompletedFrame())) {
+    GpuTexture *texture = static_cast<GpuTexture *>(owner);
+    texture->Evict();
+    RebindTexture(texture);
+  }
+  return S_OK;
+}
+
 HRESULT STDMETHODCALLTYPE
 Device::GetBackBuffer(UINT BackBuffer, D3DBACKBUFFER_TYPE Type,
                       IDirect3DSurface8 **ppBackBuffer) {
@@ -602,6 +749,7 @@ Device::CreateIndexBuffer(UINT Length, DWORD Usage, D3DFORMAT Format,
 
 void Device::TransitionTexture(GpuTexture *texture, uint32_t subresource,
                                D3D12_RESOURCE_STATES state_after) {
+  MarkDirectUse(texture);
   if (texture->current_state() == state_after) return;
   LOG(TRACE) << "Transitioning " << std::hex << texture << "From "
              << texture->current_state() << " to " << state_after << "\n";
@@ -618,21 +766,147 @@ void Device::TransitionTexture(GpuTexture *texture, uint32_t subresource,
   MarkResourceAsUsed(InternalPtr(texture));
 }
 
-void Device::CopyBuffer(ID3D12Resource *dest, int64_t dest_offset,
-                        ID3D12Resource *src, int64_t src_offset,
-                        int64_t num_bytes) {
-  cmd_list_->CopyBufferRegion(dest, static_cast<UINT64>(dest_offset), src,
-                              static_cast<UINT64>(src_offset),
-                              static_cast<UINT64>(num_bytes));
-  // Transition destination back to common.
-  D3D12_RESOURCE_BARRIER barrier = CreateBufferTransition(
-      dest, D3D12_RESOURCE_STATE_COPY_DEST, D3D12_RESOURCE_STATE_COMMON);
-  cmd_list_->ResourceBarrier(1, &barrier);
+void Device::MarkResourceAsUsed(InternalPtr<GpuTexture> texture) {
+  if (texture->is_evictable() && !texture->is_evicted()) {
+    residency_.MarkUsed(texture->residency_handle(), CurrentFrame());
+  }
+  frame_resources_to_free_.at(frame_pacer_.current_slot())
+      .push_back(InternalPtr<RefCounted>(texture.Get()));
+}
+
+void Device::PrepareTextureForDraw(GpuTexture *texture) {
+  texture->MakeResident();
+  texture->RefreshPalette();
+  texture->UploadDirtyRegions();
+  texture_uploader_->FlushUploadsFor(texture);
+  if (texture_deduplicator_) texture_deduplicator_->MaybeDeduplicate(texture);
+  if (texture_transcoder_) texture_transcoder_->MaybeTranscode(texture);
+  // Copy queue uploads leave textures in COMMON. Later uploads go through the
+  // main command list.
+  if (texture->copy_queue_value() != 0 &&
+      texture->current_state() == D3D12_RESOURCE_STATE_COMMON) {
+    TransitionTexture(texture, D3D12_RESOURCE_BARRIER_ALL_SUBRESOURCES,
+                      D3D12_RESOURCE_STATE_ALL_SHADER_RESOURCE);
+  }
+  MarkDirectUse(texture);
+}
+
+void Device::MarkDirectUse(GpuTexture *texture) {
+  texture->set_last_direct_use_frame(CurrentFrame());
+  if (copy_queue_) {
+    copy_queue_->RequireForDirect(cmd_list_done_fence_.get(), CurrentFrame(),
+                                  texture->copy_queue_value());
+  }
+}
+
+ID3D12GraphicsCommandList *Device::BeginCopyUpload(GpuTexture *texture) {
+  if (!copy_queue_ ||
+      texture->current_state() != D3D12_RESOURCE_STATE_COMMON ||
+      texture->last_direct_use_frame() == CurrentFrame()) {
+    return nullptr;
+  }
+  // The batch waits for the frame that last used the texture, which has been
+  // submitted already.
+  uint64_t copy_value;
+  ID3D12GraphicsCommandList *cmd_list =
+      copy_queue_->BeginUpload(texture->last_direct_use_frame(), &copy_value);
+  texture->set_copy_queue_value(copy_value);
+  // The current frame completes only once the batch does.
+  MarkResourceAsUsed(InternalPtr(texture));
+  return cmd_list;
+}
+
+void Device::SubmitCopyUploads() {
+  if (!copy_queue_) return;
+  copy_queue_->Submit(cmd_list_done_fence_.get(), CurrentFrame());
+  copy_queue_->QueueDirectWait(cmd_queue_.get());
+}
+
+const uint32_t *Device::CurrentPaletteColors(uint64_t *generation) const {
+  static constexpr std::array<uint32_t, 256> kBlack = {};
+  auto iter = palettes_.find(current_palette_);
+  if (iter == palettes_.end()) {
+    *generation = 0;
+    return kBlack.data();
+  }
+  *generation = iter->second.generation;
+  return iter->second.colors.data();
+}
+
+void Device::MakeRoomForTexture(uint64_t num_bytes) {
+  for (void *owner : residency_.EvictToFit(num_bytes, CompletedFrame())) {
+    GpuTexture *texture = static_cast<GpuTexture *>(owner);
+    texture->Evict();
+    // Bound textures are made resident again before the next draw.
+    RebindTexture(texture);
+  }
+}
+
+void Device::RebindTexture(GpuTexture *texture) {
+  for (auto &bound_texture : bound_textures_) {
+    if (bound_texture && bound_texture.Get() == texture) {
+      dirty_flags_ |= DIRTY_FLAG_PS_TEXTURES;
+      return;
+    }
+  }
+}
+
+void Device::RetireTexture(ComPtr<ID3D12Resource> resource,
+                           const DescriptorHandle &srv_handle) {
+  retired_textures_.push_back({.resource = std::move(resource),
+                               .srv_handle = srv_handle,
+                               .frame = CurrentFrame()});
+}
+
+void Device::QueuePersistCopy(ID3D12Resource *dest, int64_t dest_offset,
+                              ID3D12Resource *src, int64_t src_offset,
+                              int64_t num_bytes) {
+  pending_persist_copies_.push_back({.dest = dest,
+                                     .dest_offset = dest_offset,
+                                     .src = src,
+                                     .src_offset = src_offset,
+                                     .num_bytes = num_bytes});
+}
+
+void Device::PersistDynamicBuffers() {
+  for (auto buffer : buffers_to_persist_) {
+    buffer->PersistDynamicChanges();
+  }
+  std::vector<PendingPersistCopy> &copies = pending_persist_copies_;
+  if (copies.empty()) {
+    buffers_to_persist_.clear();
+    return;
+  }
+  SortAndMergeCopies(&copies);
+
+  // Dynamic buffers sit in COMMON and are promoted to COPY_DEST by the copy.
+  // Transition each one back once all of its copies are recorded.
+  std::vector<D3D12_RESOURCE_BARRIER> barriers;
+  for (size_t i = 0; i < copies.size(); ++i) {
+    const PendingPersistCopy &copy = copies[i];
+    cmd_list_->CopyBufferRegion(
+        copy.dest, static_cast<UINT64>(copy.dest_offset), copy.src,
+        static_cast<UINT64>(copy.src_offset),
+        static_cast<UINT64>(copy.num_bytes));
+    if (i + 1 == copies.size() || copies[i + 1].dest != copy.dest) {
+      barriers.push_back(CreateBufferTransition(
+          copy.dest, D3D12_RESOURCE_STATE_COPY_DEST,
+          D3D12_RESOURCE_STATE_COMMON));
+    }
+  }
+  cmd_list_->ResourceBarrier(safe_cast<UINT>(barriers.size()),
+                             barriers.data());
+  copies.clear();
+  // Only release the buffers once their copies are recorded.
+  buffers_to_persist_.clear();
 }
 
 void Device::CopyBufferToTexture(
-    GpuTexture *dest, uint32_t dest_subresource, ID3D12Resource *src,
+    GpuTexture *dest, uint32_t dest_subresource, uint32_t dest_x,
+    uint32_t dest_y, ID3D12Resource *src,
     D3D12_PLACED_SUBRESOURCE_FOOTPRINT src_footprint) {
+  // Partial copies need the rest of the texture to be there.
+  dest->MakeResident();
   D3D12_TEXTURE_COPY_LOCATION dest_location{
       .pResource = dest->resource(),
       .Type = D3D12_TEXTURE_COPY_TYPE_SUBRESOURCE_INDEX,
@@ -642,12 +916,15 @@ void Device::CopyBufferToTexture(
       .Type = D3D12_TEXTURE_COPY_TYPE_PLACED_FOOTPRINT,
       .PlacedFootprint = src_footprint};
 
-  TransitionTexture(dest, dest_subresource, D3D12_RESOURCE_STATE_COPY_DEST);
+  // GpuTexture tracks a single state for all of its subresources.
+  TransitionTexture(dest, D3D12_RESOURCE_BARRIER_ALL_SUBRESOURCES,
+                    D3D12_RESOURCE_STATE_COPY_DEST);
 
-  cmd_list_->CopyTextureRegion(&dest_location, 0, 0, 0, &src_location, nullptr);
+  cmd_list_->CopyTextureRegion(&dest_location, dest_x, dest_y, 0,
+                               &src_location, nullptr);
   // TODO: Transition away from copy destination back to whatever state the
   // texture was in, instead of transitioning back to common.
-  TransitionTexture(dest, dest_subresource,
+  TransitionTexture(dest, D3D12_RESOURCE_BARRIER_ALL_SUBRESOURCES,
                     D3D12_RESOURCE_STATE_ALL_SHADER_RESOURCE);
   MarkResourceAsUsed(InternalPtr(dest));
   // TODO: Mark src as used as well.
@@ -657,12 +934,72 @@ void Device::MarkBufferForPersist(Buffer *buffer) {
   buffers_to_persist_.insert(ComWrap(buffer));
 }
 
+void Device::QueueBufferUpload(Buffer *buffer, int64_t dest_offset,
+                               DynamicRingBuffer::Allocation src) {
+  ASSERT(buffer->is_gpu_local());
+  pending_buffer_uploads_.push_back(
+      {.dest = buffer->resource(), .dest_offset = dest_offset, .src = src});
+  // Keeps the destination alive until the copy is done.
+  MarkResourceAsUsed(InternalPtr(buffer));
+}
+
+void Device::FlushPendingBufferUploads() {
+  if (pending_buffer_uploads_.empty()) return;
+  static constexpr D3D12_RESOURCE_STATES kReadState =
+      D3D12_RESOURCE_STATE_VERTEX_AND_CONSTANT_BUFFER |
+      D3D12_RESOURCE_STATE_INDEX_BUFFER;
+  std::vector<D3D12_RESOURCE_BARRIER> barriers;
+  // Buffers still in COMMON are promoted to COPY_DEST implicitly. The ones a
+  // draw has already read from need an explicit transition.
+  for (const PendingBufferUpload &upload : pending_buffer_uploads_) {
+    D3D12_RESOURCE_STATES &state = gpu_buffer_states_[upload.dest];
+    if (state != D3D12_RESOURCE_STATE_COMMON &&
+        state != D3D12_RESOURCE_STATE_COPY_DEST) {
+      barriers.push_back(CreateBufferTransition(
+          upload.dest, state, D3D12_RESOURCE_STATE_COPY_DEST));
+    }
+    state = D3D12_RESOURCE_STATE_COPY_DEST;
+  }
+  if (!barriers.empty()) {
+    cmd_list_->ResourceBarrier(safe_cast<UINT>(barriers.size()),
+                               barriers.data());
+  }
+  for (const PendingBufferUpload &upload : pending_buffer_uploads_) {
+    cmd_list_->CopyBufferRegion(
+        upload.dest, static_cast<UINT64>(upload.dest_offset),
+        dynamic_ring_buffer_->GetBackingResource(upload.src),
+        static_cast<UINT64>(upload.src.offset),
+        static_cast<UINT64>(upload.src.size));
+  }
+  // Then move everything that was written to into a readable state.
+  barriers.clear();
+  for (const PendingBufferUpload &upload : pending_buffer_uploads_) {
+    D3D12_RESOURCE_STATES &state = gpu_buffer_states_[upload.dest];
+    if (state == D3D12_RESOURCE_STATE_COPY_DEST) {
+      barriers.push_back(CreateBufferTransition(
+          upload.dest, D3D12_RESOURCE_STATE_COPY_DEST, kReadState));
+      state = kReadState;
+    }
+  }
+  cmd_list_->ResourceBarrier(safe_cast<UINT>(barriers.size()),
+                             barriers.data());
+  pending_buffer_uploads_.clear();
+}
+
+void Device::MarkBufferRead(Buffer *buffer, D3D12_RESOURCE_STATES state) {
+  if (!buffer->is_gpu_local()) return;
+  D3D12_RESOURCE_STATES &current = gpu_buffer_states_[buffer->resource()];
+  ASSERT(current != D3D12_RESOURCE_STATE_COPY_DEST);
+  current |= state;
+}
+
 HRESULT STDMETHODCALLTYPE Device::CopyRects(
     IDirect3DSurface8 *pSourceSurface, CONST RECT *pSourceRectsArray,
     UINT cRects, IDirect3DSurface8 *pDestinationSurface,
     CONST POINT *pDestPointsArray) {
   TRACE_ENTRY(pSourceSurface, pSourceRectsArray, cRects, pDestinationSurface,
               pDestPointsArray);
+  MaybeFlushCommandList();
   ASSERT(pSourceRectsArray == nullptr);
   ASSERT(pDestPointsArray == nullptr);
 
@@ -672,32 +1009,24 @@ HRESULT STDMETHODCALLTYPE Device::CopyRects(
   ASSERT(static_cast<BaseSurface *>(pDestinationSurface)->kind() ==
          SurfaceKind::Gpu);
   GpuSurface *dest_surface = static_cast<GpuSurface *>(pDestinationSurface);
+  dest_surface->texture()->StopSharing();
+  dest_surface->texture()->StopTranscoding();
+  // Whole-surface copies between the same formats. For block-compressed
+  // formats, the uploader copies rows of blocks. Converted formats are
+  // expanded on the way.
+  D3DSURFACE_DESC source_desc, dest_desc;
+  source_surface->GetDesc(&source_desc);
+  dest_surface->GetDesc(&dest_desc);
+  if (source_desc.Format != dest_desc.Format ||
+      source_desc.Width != dest_desc.Width ||
+      source_desc.Height != dest_desc.Height)
+    return D3DERR_INVALIDCALL;
 
-  // Allocate space in our ring buffer and move the source data.
-  const D3D12_SUBRESOURCE_FOOTPRINT &source_footprint =
-      source_surface->footprint().Footprint;
-  const size_t num_bytes =
-      static_cast<size_t>(source_footprint.RowPitch * source_footprint.Height);
-  DynamicRingBuffer::Allocation ring_alloc =
-      dynamic_ring_buffer()->Allocate(num_bytes);
-  char *source_ring_ptr = dynamic_ring_buffer()->GetCpuPtrFor(ring_alloc);
-  const uint32_t compact_pitch =
-      safe_cast<uint32_t>(source_surface->compact_pitch());
-  if (compact_pitch == source_footprint.RowPitch)
-    memcpy(source_ring_ptr, source_surface->GetPtr(), num_bytes);
-  else {
-    for (uint32_t i = 0; i < source_footprint.Height; ++i) {
-      memcpy(source_ring_ptr + i * source_footprint.RowPitch,
-             source_surface->GetPtr() + i * compact_pitch, compact_pitch);
-    }
-  }
-  D3D12_PLACED_SUBRESOURCE_FOOTPRINT src_placed_footprint = {
-      .Offset = safe_cast<uint64_t>(ring_alloc.offset),
-      .Footprint = source_footprint};
-
-  CopyBufferToTexture(dest_surface->texture(), dest_surface->subresource(),
-                      dynamic_ring_buffer_->GetBackingResource(),
-                      src_placed_footprint);
+  texture_uploader_->Upload(
+      dest_surface->texture(), dest_surface->subresource(),
+      source_surface->footprint().Footprint, source_surface->GetPtr(),
+      source_surface->compact_pitch(),
+      source_surface->texture()->conversion());
 
   MarkResourceAsUsed(InternalPtr(dest_surface));
   return S_OK;
@@ -707,20 +1036,14 @@ HRESULT STDMETHODCALLTYPE
 Device::UpdateTexture(IDirect3DBaseTexture8 *pSourceTexture,
                       IDirect3DBaseTexture8 *pDestinationTexture) {
   TRACE_ENTRY(pSourceTexture, pDestinationTexture);
+  MaybeFlushCommandList();
   BaseTexture *source = dynamic_cast<BaseTexture *>(pSourceTexture);
   ASSERT(source->GetSurfaceDesc(0).Pool == D3DPOOL_SYSTEMMEM);
   BaseTexture *dest = dynamic_cast<BaseTexture *>(pDestinationTexture);
   ASSERT(dest->GetSurfaceDesc(0).Pool != D3DPOOL_SYSTEMMEM);
-  // Transition dest.
-  TransitionTexture(static_cast<GpuTexture *>(dest),
-                    D3D12_RESOURCE_BARRIER_ALL_SUBRESOURCES,
-                    D3D12_RESOURCE_STATE_COPY_DEST);
-  static_cast<CpuTexture *>(source)->CopyToGpuTexture(
+  // Like D3D8, only copy what changed in the source since the last update.
+  static_cast<CpuTexture *>(source)->CopyDirtyRegionsToGpuTexture(
       static_cast<GpuTexture *>(dest));
-  // Transition dest.
-  TransitionTexture(static_cast<GpuTexture *>(dest),
-                    D3D12_RESOURCE_BARRIER_ALL_SUBRESOURCES,
-                    D3D12_RESOURCE_STATE_ALL_SHADER_RESOURCE);
   MarkResourceAsUsed(InternalPtr(source));
   MarkResourceAsUsed(InternalPtr(dest));
   return S_OK;
@@ -859,11 +1182,55 @@ HRESULT STDMETHODCALLTYPE Device::SetTexture(DWORD Stage,
     ASSERT(dynamic_cast<BaseTexture *>(pTexture)->GetSurfaceDesc(0).Pool !=
            D3DPOOL_SYSTEMMEM);
   GpuTexture *texture = dynamic_cast<GpuTexture *>(pTexture);
+  if (texture) texture->MakeResident();
   bound_textures_[Stage] = InternalPtr(texture);
   dirty_flags_ |= DIRTY_FLAG_PS_TEXTURES;
   return S_OK;
 }
 
+HRESULT STDMETHODCALLTYPE Device::SetPaletteEntries(
+    UINT PaletteNumber, CONST PALETTEENTRY *pEntries) {
+  if (pEntries == nullptr) return D3DERR_INVALIDCALL;
+  Palette &palette = palettes_[PaletteNumber];
+  for (int i = 0; i < 256; ++i) {
+    const PALETTEENTRY &entry = pEntries[i];
+    palette.entries[i] = entry;
+    palette.colors[i] = entry.peBlue | (entry.peGreen << 8) |
+                        (entry.peRed << 16) |
+                        (static_cast<uint32_t>(entry.peFlags) << 24);
+  }
+  palette.generation = next_palette_generation_++;
+  // Bound P8 textures get re-expanded before the next draw.
+  if (PaletteNumber == current_palette_) dirty_flags_ |= DIRTY_FLAG_PS_TEXTURES;
+  return S_OK;
+}
+
+HRESULT STDMETHODCALLTYPE Device::GetPaletteEntries(UINT PaletteNumber,
+                                                    PALETTEENTRY *pEntries) {
+  auto iter = palettes_.find(PaletteNumber);
+  if (pEntries == nullptr || iter == palettes_.end())
+    return D3DERR_INVALIDCALL;
+  std::copy(iter->second.entries.begin(), iter->second.entries.end(),
+            pEntries);
+  return S_OK;
+}
+
+HRESULT STDMETHODCALLTYPE Device::SetCurrentTexturePalette(UINT PaletteNumber) {
+  if (!palettes_.contains(PaletteNumber)) return D3DERR_INVALIDCALL;
+  if (PaletteNumber != current_palette_) {
+    current_palette_ = PaletteNumber;
+    dirty_flags_ |= DIRTY_FLAG_PS_TEXTURES;
+  }
+  return S_OK;
+}
+
+HRESULT STDMETHODCALLTYPE
+Device::GetCurrentTexturePalette(UINT *PaletteNumber) {
+  if (PaletteNumber == nullptr) return D3DERR_INVALIDCALL;
+  *PaletteNumber = current_palette_;
+  return S_OK;
+}
+
 HRESULT STDMETHODCALLTYPE Device::SetRenderTarget(
     IDirect3DSurface8 *pRenderTarget, IDirect3DSurface8 *pNewZStencil) {
   if (pRenderTarget) {
@@ -1028,25 +1395,54 @@ HRESULT STDMETHODCALLTYPE Device::SetIndices(IDirect3DIndexBuffer8 *pIndexData,
   return S_OK;
 }
 
-ComPtr<ID3D12PipelineState> Device::CreatePSO(D3DPRIMITIVETYPE d3d8_prim_type) {
+static double SecondsSince(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - start)
+      .count();
+}
+
+PixelShaderState Device::CurrentPixelShaderState() const {
   std::array<bool, kMaxTexStages> stage_has_texture = {};
   for (int i = 0; i < 8; ++i) {
     stage_has_texture[i] = bound_textures_[i];
     if (!stage_has_texture[i]) break;
   }
-  ASSERT(bound_vertex_shader_ != 0);
-  VertexShader *vertex_shader = vertex_shaders_.at(bound_vertex_shader_).Get();
+  return PixelShaderState(render_state_, stage_has_texture.data(),
+                          texture_stage_states_.data());
+}
+
+bool Device::PrepareFFUbershader(const PixelShaderState &state) {
+  if (!ff_ubershader_) return false;
+  const CombinerState combiner = ToCombinerState(state);
+  if (!CanUseUbershader(combiner)) return false;
+  const UbershaderConstants constants = PackUbershaderConstants(combiner);
+  if (!(constants == ff_combiner_)) {
+    ff_combiner_ = constants;
+    dirty_flags_ |= DIRTY_FLAG_PS_CBUFFER;
+  }
+  return true;
+}
+
+ComPtr<ID3D12PipelineState> Device::CreatePSO(D3DPRIMITIVETYPE d3d8_prim_type) {
+  const bool compile_async =
+      kPsoCompileMode != PsoCompileMode::kSynchronous && !kDisablePsoCache;
   // If no pixel shader is bound, generate a fixed-function shader.
   ComPtr<ID3DBlob> pixel_shader;
   if (bound_pixel_shader_ == 0) {
-    // Try to find the fixed-function pixel shader in our cache.
-    PixelShaderState key(render_state_, stage_has_texture.data(),
-                         texture_stage_states_.data());
-    auto iter = ps_cache_.find(key);
-    if (iter != ps_cache_.end()) {
+    // Use the ubershader, or try to find the fixed-function pixel shader in
+    // our cache.
+    const PixelShaderState key = CurrentPixelShaderState();
+    if (kFFPixelShaderMode == FFPixelShaderMode::kUbershader &&
+        PrepareFFUbershader(key)) {
+      pixel_shader = ff_ubershader_;
+    } else if (auto iter = ps_cache_.find(key); iter != ps_cache_.end()) {
       pixel_shader = iter->second;
+    } else if (ps_compiler_) {
+      ps_compiler_->Queue(key,
+                          [key] { return CreatePixelShaderFromState(key); });
     } else {
+      const auto start = std::chrono::steady_clock::now();
       pixel_shader = CreatePixelShaderFromState(key);
+      compile_stall_seconds_ += SecondsSince(start);
       if (!kDisablePixelShaderCache)
         ps_cache_.emplace_hint(iter, key, pixel_shader);
     }
@@ -1056,12 +1452,36 @@ ComPtr<ID3D12PipelineState> Device::CreatePSO(D3DPRIMITIVETYPE d3d8_prim_type) {
     pixel_shader = iter->second->blob;
   }
 
-  // Now that we know our pixel shader, try to look into the PSO cache.
+  if (pixel_shader) {
+    // Now that we know our pixel shader, try to look into the PSO cache.
+    PSOState pso_key = MakePSOState(d3d8_prim_type, pixel_shader.get());
+    if (!compile_async) return GetOrCompilePSO(pso_key);
+    if (ComPtr<ID3D12PipelineState> pso =
+            GetOrQueuePSO(pso_key, pixel_shader)) {
+      return pso;
+    }
+  }
+
+  // Not compiled yet.
+  if (kPsoCompileMode == PsoCompileMode::kAsyncWithFallback) {
+    if (ComPtr<ID3D12PipelineState> pso = GetFallbackPSO(d3d8_prim_type)) {
+      ++num_fallback_draws_;
+      return pso;
+    }
+  }
+  ++num_skipped_draws_;
+  return nullptr;
+}
+
+PSOState Device::MakePSOState(D3DPRIMITIVETYPE d3d8_prim_type,
+                              ID3DBlob *pixel_shader) const {
+  ASSERT(bound_vertex_shader_ != 0);
+  VertexShader *vertex_shader = vertex_shaders_.at(bound_vertex_shader_).Get();
   PSOState pso_key{
       .rs = render_state_,
       .input_elements = vertex_shader->decl.input_elements,
       .vs = vertex_shader->blob.get(),
-      .ps = pixel_shader.get(),
+      .ps = pixel_shader,
       .prim_type = d3d8_prim_type,
       .dsv_format = bound_depth_target_
                         ? bound_depth_target_->resource_desc().Format
@@ -1086,18 +1506,91 @@ ComPtr<ID3D12PipelineState> Device::CreatePSO(D3DPRIMITIVETYPE d3d8_prim_type) {
   // pso_key.rs.color_vertex = 0;
   // pso_key.rs.local_viewer = FALSE;
   // pso_key.rs.normalized_normals = FALSE;
+  return pso_key;
+}
 
-  auto pso_cache_iter = pso_cache_.find(pso_key);
+ComPtr<ID3D12PipelineState> Device::GetOrCompilePSO(const PSOState &key) {
+  auto pso_cache_iter = pso_cache_.find(key);
   if (pso_cache_iter != pso_cache_.end()) {
     return pso_cache_iter->second;
   }
 
   // LOG(INFO) << "Num PSOs: " << std::dec << pso_cache_.size() << "\n";
 
-  ASSERT(render_state_.zbuffer_type <= 1);
+  const auto start = std::chrono::steady_clock::now();
+  ComPtr<ID3D12PipelineState> pso =
+      CompilePSO(key, back_buffers_[0]->resource_desc().Format);
+  compile_stall_seconds_ += SecondsSince(start);
+  if (!kDisablePsoCache) pso_cache_.emplace_hint(pso_cache_iter, key, pso);
+  return pso;
+}
+
+ComPtr<ID3D12PipelineState> Device::GetOrQueuePSO(
+    const PSOState &key, ComPtr<ID3DBlob> pixel_shader) {
+  auto pso_cache_iter = pso_cache_.find(key);
+  if (pso_cache_iter != pso_cache_.end()) {
+    return pso_cache_iter->second;
+  }
+  if (!pso_compiler_->IsPending(key)) {
+    // Holds on to the shaders until the pipeline is compiled.
+    ComPtr<ID3DBlob> vs_blob(key.vs);
+    const DXGI_FORMAT rtv_format = back_buffers_[0]->resource_desc().Format;
+    pso_compiler_->Queue(key, [this, key, vs_blob, pixel_shader, rtv_format] {
+      return CompilePSO(key, rtv_format);
+    });
+  }
+  return nullptr;
+}
+
+ComPtr<ID3D12PipelineState> Device::GetFallbackPSO(
+    D3DPRIMITIVETYPE d3d8_prim_type) {
+  // The ubershader draws fixed-function state exactly. In kUbershader mode it
+  // is what's being compiled, though.
+  if (bound_pixel_shader_ == 0 &&
+      kFFPixelShaderMode == FFPixelShaderMode::kUbershaderFallback &&
+      PrepareFFUbershader(CurrentPixelShaderState())) {
+    return GetOrQueuePSO(MakePSOState(d3d8_prim_type, ff_ubershader_.get()),
+                         ff_ubershader_);
+  }
+  // Otherwise, modulates the diffuse color with the first stage's texture, if
+  // it has a plain 2D one, and keeps the alpha test. The pipeline still
+  // depends on the rest of the render state, the vertex shader and the
+  // targets, so it is compiled in the background like any other.
+  const TextureStageState &stage0 = texture_stage_states_[0];
+  const bool has_texture = bound_textures_[0] &&
+                           stage0.color_op != D3DTOP_DISABLE &&
+                           stage0.texcoord_index < 8;
+  const bool stage_has_texture[kMaxTexStages] = {has_texture};
+  TextureStageState texture_stage_states[kMaxTexStages];
+  if (has_texture) {
+    texture_stage_states[0].color_op = D3DTOP_MODULATE;
+    texture_stage_states[0].alpha_op = D3DTOP_MODULATE;
+    texture_stage_states[0].texcoord_index = stage0.texcoord_index;
+  }
+  const PixelShaderState key(render_state_, stage_has_texture,
+                             texture_stage_states);
+  auto iter = ps_cache_.find(key);
+  if (iter == ps_cache_.end()) {
+    if (ps_compiler_) {
+      ps_compiler_->Queue(key,
+                          [key] { return CreatePixelShaderFromState(key); });
+      return nullptr;
+    }
+    const auto start = std::chrono::steady_clock::now();
+    iter = ps_cache_.emplace_hint(iter, key, CreatePixelShaderFromState(key));
+    compile_stall_seconds_ += SecondsSince(start);
+  }
+  return GetOrQueuePSO(MakePSOState(d3d8_prim_type, iter->second.get()),
+                       iter->second);
+}
+
+ComPtr<ID3D12PipelineState> Device::CompilePSO(const PSOState &key,
+                                               DXGI_FORMAT rtv_format) const {
+  const RenderState &rs = key.rs;
+  ASSERT(rs.zbuffer_type <= 1);
 
   D3D12_PRIMITIVE_TOPOLOGY_TYPE d3d12_prim_type;
-  switch (d3d8_prim_type) {
+  switch (key.prim_type) {
     case D3DPT_POINTLIST:
       d3d12_prim_type = D3D12_PRIMITIVE_TOPOLOGY_TYPE_POINT;
       break;
@@ -1109,66 +1602,64 @@ ComPtr<ID3D12PipelineState> Device::CreatePSO(D3DPRIMITIVETYPE d3d8_prim_type) {
       d3d12_prim_type = D3D12_PRIMITIVE_TOPOLOGY_TYPE_TRIANGLE;
       break;
     default:
-      FAIL("Unimplemented primitive type %d", d3d8_prim_type);
+      FAIL("Unimplemented primitive type %d", key.prim_type);
   }
-  ASSERT(render_state_.src_blend <= D3DBLEND_SRCALPHASAT);
-  ASSERT(render_state_.dest_blend <= D3DBLEND_SRCALPHASAT);
+  ASSERT(rs.src_blend <= D3DBLEND_SRCALPHASAT);
+  ASSERT(rs.dest_blend <= D3DBLEND_SRCALPHASAT);
 
   D3D12_GRAPHICS_PIPELINE_STATE_DESC desc{
       .pRootSignature = main_root_sig_.get(),
-      .VS = {.pShaderBytecode = vertex_shader->blob->GetBufferPointer(),
-             .BytecodeLength = vertex_shader->blob->GetBufferSize()},
-      .PS = {.pShaderBytecode = pixel_shader->GetBufferPointer(),
-             .BytecodeLength = pixel_shader->GetBufferSize()},
+      .VS = {.pShaderBytecode = key.vs->GetBufferPointer(),
+             .BytecodeLength = key.vs->GetBufferSize()},
+      .PS = {.pShaderBytecode = key.ps->GetBufferPointer(),
+             .BytecodeLength = key.ps->GetBufferSize()},
       .BlendState =
           {.RenderTarget = {{
-               .BlendEnable = render_state_.alpha_blend_enable != 0,
-               .SrcBlend = static_cast<D3D12_BLEND>(render_state_.src_blend),
-               .DestBlend = static_cast<D3D12_BLEND>(render_state_.dest_blend),
-               .BlendOp = static_cast<D3D12_BLEND_OP>(render_state_.blend_op),
+               .BlendEnable = rs.alpha_blend_enable != 0,
+               .SrcBlend = static_cast<D3D12_BLEND>(rs.src_blend),
+               .DestBlend = static_cast<D3D12_BLEND>(rs.dest_blend),
+               .BlendOp = static_cast<D3D12_BLEND_OP>(rs.blend_op),
                .SrcBlendAlpha = D3D12_BLEND_ONE,
                .DestBlendAlpha = D3D12_BLEND_ZERO,
                .BlendOpAlpha = D3D12_BLEND_OP_ADD,
                .LogicOp = D3D12_LOGIC_OP_NOOP,
                .RenderTargetWriteMask =
-                   safe_cast<uint8_t>(render_state_.color_write_enable),
+                   safe_cast<uint8_t>(rs.color_write_enable),
            }}},
       .SampleMask = UINT_MAX,
       .RasterizerState =
           {
-              .FillMode = static_cast<D3D12_FILL_MODE>(render_state_.fill_mode),
-              .CullMode = render_state_.cull_mode != D3DCULL_NONE
-                              ? D3D12_CULL_MODE_BACK
-                              : D3D12_CULL_MODE_NONE,
-              .FrontCounterClockwise = render_state_.cull_mode == D3DCULL_CW,
+              .FillMode = static_cast<D3D12_FILL_MODE>(rs.fill_mode),
+              .CullMode = rs.cull_mode != D3DCULL_NONE ? D3D12_CULL_MODE_BACK
+                                                       : D3D12_CULL_MODE_NONE,
+              .FrontCounterClockwise = rs.cull_mode == D3DCULL_CW,
               .DepthBias = 0,         // TODO.
               .DepthBiasClamp = 0.f,  // TODO.
-              .MultisampleEnable = render_state_.multisample_antialias != 0,
-              .AntialiasedLineEnable = render_state_.edge_antialias != 0,
+              .MultisampleEnable = rs.multisample_antialias != 0,
+              .AntialiasedLineEnable = rs.edge_antialias != 0,
           },
       .DepthStencilState =
           {
-              .DepthEnable = render_state_.zbuffer_type && bound_depth_target_,
-              .DepthWriteMask = static_cast<D3D12_DEPTH_WRITE_MASK>(
-                  render_state_.zwrite_enable != 0),
-              .DepthFunc =
-                  static_cast<D3D12_COMPARISON_FUNC>(render_state_.z_func),
+              .DepthEnable =
+                  rs.zbuffer_type && key.dsv_format != DXGI_FORMAT_UNKNOWN,
+              .DepthWriteMask =
+                  static_cast<D3D12_DEPTH_WRITE_MASK>(rs.zwrite_enable != 0),
+              .DepthFunc = static_cast<D3D12_COMPARISON_FUNC>(rs.z_func),
           },
-      .InputLayout = {.pInputElementDescs =
-                          vertex_shader->decl.input_elements.data(),
-                      .NumElements = vertex_shader->decl.input_elements.size()},
+      .InputLayout = {.pInputElementDescs = key.input_elements.data(),
+                      .NumElements = key.input_elements.size()},
       .PrimitiveTopologyType = d3d12_prim_type,
       .NumRenderTargets = 1,
-      .RTVFormats = {back_buffers_[0]->resource_desc().Format},
-      .DSVFormat = bound_depth_target_
-                       ? bound_depth_target_->resource_desc().Format
-                       : DXGI_FORMAT_UNKNOWN,
+      .RTVFormats = {rtv_format},
+      .DSVFormat = key.dsv_format,
       .SampleDesc = {.Count = 1, .Quality = 0}};
   ComPtr<ID3D12PipelineState> pso;
-  ASSERT_HR(d3d12_device_->CreateGraphicsPipelineState(
-      &desc, IID_PPV_ARGS(pso.GetForInit())));
-  if (!kDisablePsoCache)
-    pso_cache_.emplace_hint(pso_cache_iter, std::move(pso_key), pso);
+  if (pipeline_library_) {
+    pso = pipeline_library_->Create(key, desc);
+  } else {
+    ASSERT_HR(d3d12_device_.get()->CreateGraphicsPipelineState(
+        &desc, IID_PPV_ARGS(pso.GetForInit())));
+  }
   return pso;
 }
 
@@ -1262,6 +1753,7 @@ HRESULT Device::PrepareDrawCall(D3DPRIMITIVETYPE PrimitiveType,
   if (dirty_flags_ & DIRTY_FLAG_OM) {
     BeginScene();
   }
+  FlushPendingBufferUploads();
 
   cmd_list_->IASetPrimitiveTopology(
       static_cast<D3D12_PRIMITIVE_TOPOLOGY>(PrimitiveType));
@@ -1290,6 +1782,7 @@ HRESULT Device::PrepareDrawCall(D3DPRIMITIVETYPE PrimitiveType,
                             .StrideInBytes = static_cast<UINT>(stride)};
         if (i > max_index) max_index = i;
         MarkResourceAsUsed(bound_vertex_streams_[i]);
+        MarkBufferRead(buffer, D3D12_RESOURCE_STATE_VERTEX_AND_CONSTANT_BUFFER);
       } else {
         // FAIL("Shader requires bound buffer at slot %d, but none are bound.",
         // i);
@@ -1300,6 +1793,8 @@ HRESULT Device::PrepareDrawCall(D3DPRIMITIVETYPE PrimitiveType,
   cmd_list_->IASetVertexBuffers(0, max_index + 1, vbuffer_views.data());
 
   ComPtr<ID3D12PipelineState> pso = CreatePSO(PrimitiveType);
+  // Skipped until its pipeline is compiled.
+  if (!pso) return S_FALSE;
   cmd_list_->SetPipelineState(pso.get());
   // MarkResourceAsUsed(pso);
   using ::DirectX::SimpleMath::Matrix;
@@ -1370,6 +1865,7 @@ HRESULT Device::PrepareDrawCall(D3DPRIMITIVETYPE PrimitiveType,
     cbuffer->alpha_ref = (render_state_.alpha_ref & 0xFF) / 255.f;
     cbuffer->texture_factor =
         Dx8::Color(render_state_.texture_factor).ToValue();
+    cbuffer->ff_combiner = ff_combiner_;
     ASSERT_HR(ps_cbuffer_->Unlock());
     dirty_flags_ ^= DIRTY_FLAG_PS_CBUFFER;
   }
@@ -1382,10 +1878,16 @@ HRESULT Device::PrepareDrawCall(D3DPRIMITIVETYPE PrimitiveType,
   cmd_list_->SetGraphicsRootConstantBufferView(3,
                                                vs_creg_cbuffer_->GetGpuPtr());
 
+  if (kUseBindlessTextures) {
+    SetBindlessTextures();
+    return S_OK;
+  }
+
   if (dirty_flags_ & DIRTY_FLAG_PS_TEXTURES) {
     // And all the textures.
     for (int i = 0; i < kMaxTexStages; ++i) {
       if (bound_textures_[i]) {
+        PrepareTextureForDraw(bound_textures_[i].Get());
         const auto gpu_handle =
             srv_heap_.GetGPUHandleFor(bound_textures_[i]->srv_handle());
         cmd_list_->SetGraphicsRootDescriptorTable(textures_start_bindslot_ + i,
@@ -1399,24 +1901,67 @@ HRESULT Device::PrepareDrawCall(D3DPRIMITIVETYPE PrimitiveType,
   if (dirty_flags_ & DIRTY_FLAG_PS_SAMPLERS) {
     // Set all the samplers.
     for (int i = 0; i < kMaxTexStages; ++i) {
-      SamplerDesc desc(texture_stage_states_[i]);
-      auto iter = sampler_cache_.find(desc);
-      if (iter == sampler_cache_.end()) {
-        D3D12_CPU_DESCRIPTOR_HANDLE cpu_handle = sampler_heap_.Allocate();
-        d3d12_device_->CreateSampler(&desc, cpu_handle);
-        D3D12_GPU_DESCRIPTOR_HANDLE gpu_handle =
-            sampler_heap_.GetGPUHandleFor(cpu_handle);
-        iter = sampler_cache_.insert(iter, std::pair(desc, gpu_handle));
-      }
-      ASSERT(iter->second.ptr != 0);
       cmd_list_->SetGraphicsRootDescriptorTable(
-          textures_start_bindslot_ + kMaxTexStages + i, iter->second);
+          textures_start_bindslot_ + kMaxTexStages + i, GetSamplerFor(i));
     }
     dirty_flags_ ^= DIRTY_FLAG_PS_SAMPLERS;
   }
   return S_OK;
 }
 
+void Device::SetBindlessTextures() {
+  if (dirty_flags_ & DIRTY_FLAG_PS_TEXTURES) {
+    // Unbound stages point at descriptor 0. Shaders never sample them.
+    std::array<uint32_t, kMaxTexStages> srv_indices = {};
+    for (int i = 0; i < kMaxTexStages; ++i) {
+      if (bound_textures_[i]) {
+        PrepareTextureForDraw(bound_textures_[i].Get());
+        srv_indices[i] =
+            srv_heap_.GetIndexFor(bound_textures_[i]->srv_handle());
+        MarkResourceAsUsed(bound_textures_[i]);
+      }
+    }
+    const D3D12_GPU_DESCRIPTOR_HANDLE srv_start =
+        srv_heap_.GetGPUHandleFor(srv_heap_.GetCPUHandleFor(0));
+    cmd_list_->SetGraphicsRootDescriptorTable(textures_start_bindslot_,
+                                              srv_start);
+    cmd_list_->SetGraphicsRootDescriptorTable(textures_start_bindslot_ + 1,
+                                              srv_start);
+    cmd_list_->SetGraphicsRoot32BitConstants(
+        textures_start_bindslot_ + 3, kMaxTexStages, srv_indices.data(),
+        kBindlessTextureIndicesOffset);
+    dirty_flags_ ^= DIRTY_FLAG_PS_TEXTURES;
+  }
+
+  if (dirty_flags_ & DIRTY_FLAG_PS_SAMPLERS) {
+    std::array<uint32_t, kMaxTexStages> sampler_indices;
+    for (int i = 0; i < kMaxTexStages; ++i) {
+      sampler_indices[i] = sampler_heap_.GetIndexFor(GetSamplerFor(i));
+    }
+    cmd_list_->SetGraphicsRootDescriptorTable(
+        textures_start_bindslot_ + 2,
+        sampler_heap_.GetGPUHandleFor(sampler_heap_.GetCPUHandleFor(0)));
+    cmd_list_->SetGraphicsRoot32BitConstants(
+        textures_start_bindslot_ + 3, kMaxTexStages, sampler_indices.data(),
+        kBindlessSamplerIndicesOffset);
+    dirty_flags_ ^= DIRTY_FLAG_PS_SAMPLERS;
+  }
+}
+
+D3D12_GPU_DESCRIPTOR_HANDLE Device::GetSamplerFor(int stage) {
+  SamplerDesc desc(texture_stage_states_[stage]);
+  auto iter = sampler_cache_.find(desc);
+  if (iter == sampler_cache_.end()) {
+    D3D12_CPU_DESCRIPTOR_HANDLE cpu_handle = sampler_heap_.Allocate().cpu;
+    d3d12_device_->CreateSampler(&desc, cpu_handle);
+    D3D12_GPU_DESCRIPTOR_HANDLE gpu_handle =
+        sampler_heap_.GetGPUHandleFor(cpu_handle);
+    iter = sampler_cache_.insert(iter, std::pair(desc, gpu_handle));
+  }
+  ASSERT(iter->second.ptr != 0);
+  return iter->second;
+}
+
 HRESULT STDMETHODCALLTYPE Device::DrawPrimitive(D3DPRIMITIVETYPE PrimitiveType,
                                                 UINT StartVertex,
                                                 UINT PrimitiveCount) {
@@ -1436,7 +1981,9 @@ HRESULT STDMETHODCALLTYPE Device::DrawPrimitive(D3DPRIMITIVETYPE PrimitiveType,
            PrimitiveType);
       break;
   }
-  HR_OR_RETURN(PrepareDrawCall(PrimitiveType, StartVertex, vertex_count));
+  MaybeFlushCommandList();
+  const HRESULT hr = PrepareDrawCall(PrimitiveType, StartVertex, vertex_count);
+  if (hr != S_OK) return SUCCEEDED(hr) ? S_OK : hr;
   cmd_list_->DrawInstanced(vertex_count, 1, StartVertex, 0);
   return S_OK;
 }
@@ -1488,6 +2035,8 @@ HRESULT STDMETHODCALLTYPE Device::DrawPrimitiveUP(
       break;
   }
 
+  // Flush before allocating ring memory for the vertices.
+  MaybeFlushCommandList();
   // Allocate some ring buffer memory.
   size_t num_bytes = vertex_count * VertexStreamZeroStride;
   DynamicRingBuffer::Allocation alloc =
@@ -1500,7 +2049,8 @@ HRESULT STDMETHODCALLTYPE Device::DrawPrimitiveUP(
       .StrideInBytes = VertexStreamZeroStride};
 
   ASSERT_HR(SetStreamSource(0, nullptr, 0));
-  HR_OR_RETURN(PrepareDrawCall(PrimitiveType, 0, vertex_count));
+  const HRESULT hr = PrepareDrawCall(PrimitiveType, 0, vertex_count);
+  if (hr != S_OK) return SUCCEEDED(hr) ? S_OK : hr;
   // Overwrite whatever vertex buffer the prepare set.
   cmd_list_->IASetVertexBuffers(0, 1, &vbuffer_view);
   cmd_list_->DrawInstanced(vertex_count, 1, 0, 0);
@@ -1526,8 +2076,10 @@ HRESULT STDMETHODCALLTYPE Device::DrawIndexedPrimitive(
       break;
   }
 
-  HR_OR_RETURN(PrepareDrawCall(PrimitiveType, minIndex + bound_base_vertex_,
-                               NumVertices));
+  MaybeFlushCommandList();
+  const HRESULT hr = PrepareDrawCall(
+      PrimitiveType, minIndex + bound_base_vertex_, NumVertices);
+  if (hr != S_OK) return SUCCEEDED(hr) ? S_OK : hr;
 
   D3D12_INDEX_BUFFER_VIEW ib_view{
       .BufferLocation = bound_index_buffer_->GetGpuPtr(),
@@ -1536,6 +2088,7 @@ HRESULT STDMETHODCALLTYPE Device::DrawIndexedPrimitive(
           (startIndex + index_count)),
       .Format = bound_index_buffer_->index_buffer_fmt()};
   MarkResourceAsUsed(bound_index_buffer_);
+  MarkBufferRead(bound_index_buffer_.Get(), D3D12_RESOURCE_STATE_INDEX_BUFFER);
   cmd_list_->IASetIndexBuffer(&ib_view);
 
   cmd_list_->DrawIndexedInstanced(index_count, 1, startIndex,
@@ -1550,6 +2103,16 @@ HRESULT STDMETHODCALLTYPE Device::Present(CONST RECT *pSourceRect,
   TRACE_ENTRY(hDestWindowOverride);
   ASSERT(hDestWindowOverride == nullptr || hDestWindowOverride == window_);
   SubmitAndWait(true);
+  const auto now = std::chrono::steady_clock::now();
+  const uint64_t upload_bytes = texture_uploader_->EndFrame();
+  if (last_present_time_ != std::chrono::steady_clock::time_point()) {
+    frame_times_.AddFrame(
+        std::chrono::duration<double>(now - last_present_time_).count());
+    frame_upload_bytes_total_ += upload_bytes;
+    frame_upload_bytes_max_ = std::max(frame_upload_bytes_max_, upload_bytes);
+  }
+  last_present_time_ = now;
+  LOG(TRACE) << "Uploaded " << upload_bytes << " texture bytes this frame.\n";
   return S_OK;
 }
 
@@ -1564,55 +2127,146 @@ void Device::SubmitAndWait(bool should_present) {
   }
 
   // Persist any dynamic buffers.
-  for (auto buffer : buffers_to_persist_) {
-    buffer->PersistDynamicChanges();
-  }
-  buffers_to_persist_.clear();
+  PersistDynamicBuffers();
+  FlushPendingBufferUploads();
 
   // Close the command list, then execute it.
   ASSERT_HR(cmd_list_->Close());
   dirty_flags_ |= DIRTY_FLAG_CMD_LIST_CLOSED;
+  SubmitCopyUploads();
   ID3D12CommandList *cmd_list = cmd_list_.Get();
   cmd_queue_->ExecuteCommandLists(1, &cmd_list);
+  gpu_buffer_states_.clear();
   // Present!
   if (should_present) {
     ASSERT_HR(swap_chain_->Present(1, 0));
   }
 
   // Grab a new fence value, set it at the end of the command queue execution.
-  fence_values_.at(current_back_buffer_) = next_fence_++;
-  ASSERT_HR(cmd_queue_->Signal(cmd_list_done_fence_.get(),
-                               fence_values_[current_back_buffer_]));
+  const uint64_t fence_value = next_fence_++;
+  ASSERT_HR(cmd_queue_->Signal(cmd_list_done_fence_.get(), fence_value));
 
   // Update our back buffer index.
   current_back_buffer_ = swap_chain_->GetCurrentBackBufferIndex();
 
-  // Wait for it.
-  WaitForFrame(fence_values_[current_back_buffer_]);
+  // Move on to the next frame slot, and wait for the GPU to be done with the
+  // frame that used it last.
+  WaitForFrame(frame_pacer_.EndFrame(fence_value));
+  const int slot = frame_pacer_.current_slot();
+  frame_resources_to_free_[slot].clear();
+  // Don't start the next frame before the swap chain can take it.
+  if (should_present && frame_latency_waitable_) {
+    WaitForSingleObjectEx(frame_latency_waitable_, 1000, TRUE);
+  }
 
   // Reset the command list for the next frame.
-  ASSERT_HR(cmd_allocators_[current_back_buffer_]->Reset());
-  ASSERT_HR(
-      cmd_list_->Reset(cmd_allocators_[current_back_buffer_].get(), nullptr));
+  ASSERT_HR(cmd_allocators_[slot]->Reset());
+  ASSERT_HR(cmd_list_->Reset(cmd_allocators_[slot].get(), nullptr));
   dirty_flags_ ^= DIRTY_FLAG_CMD_LIST_CLOSED;
   dirty_flags_ |= DIRTY_FLAG_ALL_RESOURCES;
+  num_recorded_commands_ = 0;
+  if (texture_deduplicator_) texture_deduplicator_->SwapInFinishedJobs();
+  if (texture_transcoder_) texture_transcoder_->SwapInFinishedJobs();
+  if (ps_compiler_) {
+    ps_compiler_->SwapInFinished(
+        [this](const PixelShaderState &key, ComPtr<ID3DBlob> pixel_shader) {
+          ps_cache_.emplace(key, std::move(pixel_shader));
+        });
+  }
+  if (pso_compiler_) {
+    pso_compiler_->SwapInFinished(
+        [this](const PSOState &key, ComPtr<ID3D12PipelineState> pso) {
+          pso_cache_.emplace(key, std::move(pso));
+        });
+  }
+  texture_uploader_->RecordPendingUploads();
+}
+
+void Device::MaybeFlushCommandList() {
+  static constexpr FlushWatermarks kWatermarks = {
+      .ring_bytes = kFlushRingBytesWatermark,
+      .recorded_commands = kFlushMaxRecordedCommands,
+      .min_free_samplers = kFlushMinFreeSamplers};
+  const FlushReasons reasons = GetFlushReasons(
+      kWatermarks, dynamic_ring_buffer_->stats().frame_bytes,
+      num_recorded_commands_, sampler_heap_.num_free());
+  if (reasons.any()) {
+    LOG(TRACE) << "Flushing command list. Ring: " << reasons.ring
+               << " List: " << reasons.commands
+               << " Samplers: " << reasons.samplers << ".\n";
+    FlushCommandList();
+  }
+  ++num_recorded_commands_;
+}
+
+void Device::FlushCommandList() {
+  ASSERT(!(dirty_flags_ & DIRTY_FLAG_CMD_LIST_CLOSED));
+
+  // Persist any dynamic buffers. Their ring allocations are tied to the current
+  // frame.
+  PersistDynamicBuffers();
+  FlushPendingBufferUploads();
+
+  ASSERT_HR(cmd_list_->Close());
+  SubmitCopyUploads();
+  ID3D12CommandList *cmd_list = cmd_list_.Get();
+  cmd_queue_->ExecuteCommandLists(1, &cmd_list);
+  gpu_buffer_states_.clear();
+  const uint64_t fence_value = next_fence_++;
+  ASSERT_HR(cmd_queue_->Signal(cmd_list_done_fence_.get(), fence_value));
+
+  // The flushed list's allocator can only be reset once the GPU is done with
+  // it. Frame resources stay tied to the frame slot's end-of-frame fence.
+  const int slot = frame_pacer_.current_slot();
+  retired_cmd_allocators_.push_back(
+      {fence_value, std::move(cmd_allocators_[slot])});
+  cmd_allocators_[slot] = AcquireCommandAllocator();
+  ASSERT_HR(cmd_list_->Reset(cmd_allocators_[slot].get(), nullptr));
+
+  // Sampler descriptors are cached forever. If we ran out, wait for the GPU to
+  // stop using them and start over.
+  if (sampler_heap_.num_free() < kFlushMinFreeSamplers) {
+    WaitForFence(fence_value);
+    sampler_cache_.clear();
+    sampler_heap_.FreeAll();
+  }
+
+  dynamic_ring_buffer_->HasCompletedFrame(CompletedFrame());
+  dynamic_ring_buffer_->SetCurrentFrame(CurrentFrame());
+  texture_uploader_->RecordPendingUploads();
+
+  // The new list starts with no state.
+  dirty_flags_ |= DIRTY_FLAG_ALL_RESOURCES;
+  num_recorded_commands_ = 0;
+}
+
+ComPtr<ID3D12CommandAllocator> Device::AcquireCommandAllocator() {
+  ComPtr<ID3D12CommandAllocator> allocator;
+  if (!retired_cmd_allocators_.empty() &&
+      retired_cmd_allocators_.front().first <=
+          cmd_list_done_fence_->GetCompletedValue()) {
+    allocator = std::move(retired_cmd_allocators_.front().second);
+    retired_cmd_allocators_.pop_front();
+    ASSERT_HR(allocator->Reset());
+  } else {
+    ASSERT_HR(d3d12_device_->CreateCommandAllocator(
+        D3D12_COMMAND_LIST_TYPE_DIRECT, IID_PPV_ARGS(allocator.GetForInit())));
+  }
+  return allocator;
 }
 
 void Device::WaitForFrame(uint64_t frame_number) {
   ASSERT(frame_number <= next_fence_);
 
-  if (cmd_list_done_fence_->GetCompletedValue() < frame_number) {
+  if (CompletedFrame() < frame_number) {
     // Is this a frame that we're currently building?
     if (frame_number + 1 == next_fence_ &&
         !(dirty_flags_ & DIRTY_FLAG_CMD_LIST_CLOSED)) {
       // SubmitAndWait will call us again to wait for the frame, but at that
-      // point fence_values_[current_back_buffer_] will have incremented.
+      // point the frame pacer will have moved on to the next slot.
       SubmitAndWait(false);
     } else {
-      LOG(TRACE) << "Waiting for fence " << frame_number << ".\n";
-      ASSERT_HR(cmd_list_done_fence_->SetEventOnCompletion(
-          frame_number, cmd_list_done_event_handle_));
-      WaitForSingleObjectEx(cmd_list_done_event_handle_, 60 * 1000, FALSE);
+      WaitForFence(frame_number);
     }
   }
 
@@ -1620,17 +2274,45 @@ void Device::WaitForFrame(uint64_t frame_number) {
   FreeFrameResources(frame_number);
 }
 
+void Device::WaitForFence(uint64_t fence_value) {
+  if (cmd_list_done_fence_->GetCompletedValue() < fence_value) {
+    LOG(TRACE) << "Waiting for fence " << fence_value << ".\n";
+    ASSERT_HR(cmd_list_done_fence_->SetEventOnCompletion(
+        fence_value, cmd_list_done_event_handle_));
+    WaitForSingleObjectEx(cmd_list_done_event_handle_, 60 * 1000, FALSE);
+  }
+  // So do the copy queue batches submitted up to then.
+  if (copy_queue_) copy_queue_->WaitForFrame(fence_value);
+}
+
 void Device::FreeFrameResources(uint64_t frame_number) {
-  for (size_t i = 0; i < frame_resources_to_free_.size(); ++i) {
-    if (fence_values_[i] <= frame_number) {
+  // The current slot's resources belong to the frame being recorded, whatever
+  // frame used the slot before. SubmitAndWait frees those.
+  for (int i = 0; i < frame_pacer_.frames_in_flight(); ++i) {
+    if (i != frame_pacer_.current_slot() &&
+        frame_pacer_.fence_value(i) <= frame_number) {
       frame_resources_to_free_[i].clear();
     }
   }
 
   dynamic_ring_buffer_->HasCompletedFrame(frame_number);
   dynamic_ring_buffer_->SetCurrentFrame(CurrentFrame());
+
+  const uint64_t completed_frame = CompletedFrame();
+  std::erase_if(retired_textures_, [&](const RetiredTexture &texture) {
+    if (texture.frame > completed_frame) return false;
+    srv_heap_.Free(texture.srv_handle);
+    return true;
+  });
 }
 
 uint64_t Device::CurrentFrame() const { return next_fence_; }
 
+uint64_t Device::CompletedFrame() const {
+  const uint64_t completed_frame =
+      cmd_list_done_fence_.get()->GetCompletedValue();
+  return copy_queue_ ? copy_queue_->CompletedFrame(completed_frame)
+                     : completed_frame;
+}
+
 }  // namespace Dx8to12
\ No newline at end of file
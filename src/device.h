@@ -1,17 +1,27 @@
 #pragma once
 
 #include <array>
+#include <chrono>
+#include <deque>
 #include <memory>
 #include <unordered_map>
 #include <unordered_set>
 
 #include "d3d8.h"
 #include "device_limits.h"
+#include "dynamic_ring_buffer.h"
 #include "pool_heap.h"
 #include "render_state.h"
 #include "shader_parser.h"
 #include "util.h"
+#include "utils/async_compiler.h"
+#include "utils/buffer_copies.h"
 #include "utils/dx_utils.h"
+#include "utils/ff_combiner.h"
+#include "utils/flush_trigger.h"
+#include "utils/frame_pacer.h"
+#include "utils/frame_time_stats.h"
+#include "utils/residency_tracker.h"
 #include "vertex_shader.h"
 
 interface IDXGIFactory2;
@@ -30,8 +40,13 @@ class Allocator;
 
 namespace Dx8to12 {
 class Buffer;
-class DynamicRingBuffer;
+class BufferAllocator;
+class CopyQueue;
 class GpuTexture;
+class PipelineLibrary;
+class TextureDeduplicator;
+class TextureTranscoder;
+class TextureUploader;
 
 class Device : public IDirect3DDevice8, RefCounted {
  public:
@@ -48,31 +63,97 @@ class Device : public IDirect3DDevice8, RefCounted {
   DescriptorPoolHeap &srv_heap() { return srv_heap_; }
   DescriptorPoolHeap *rtv_heap() { return &rtv_heap_; }
   DescriptorPoolHeap *dsv_heap() { return &dsv_heap_; }
+  struct DynamicBufferStats {
+    // Bytes memcpy'd from speculative write caches or into grown ring
+    // allocations.
+    uint64_t bytes_copied = 0;
+    // Bytes that DISCARD locks wrote straight into the ring.
+    uint64_t bytes_avoided = 0;
+  };
+  DynamicBufferStats &dynamic_buffer_stats() { return dynamic_buffer_stats_; }
+
+  struct DynamicTextureStats {
+    // Bytes copied by the GPU out of ring footprints (kRingCopy).
+    uint64_t bytes_copied_on_gpu = 0;
+    // Bytes written by the CPU into per-frame textures (kPerFrameTextures).
+    uint64_t bytes_written_on_cpu = 0;
+    // Number of extra per-frame textures created.
+    int num_extra_textures = 0;
+  };
+  DynamicTextureStats &dynamic_texture_stats() {
+    return dynamic_texture_stats_;
+  }
+
+  BufferAllocator *buffer_allocator() { return buffer_allocator_.get(); }
+  BufferAllocator *gpu_buffer_allocator() {
+    return gpu_buffer_allocator_.get();
+  }
   DynamicRingBuffer *dynamic_ring_buffer() {
     return dynamic_ring_buffer_.get();
   }
+  TextureUploader *texture_uploader() { return texture_uploader_.get(); }
+  // Null unless kTranscodeManagedTextures is set.
+  TextureTranscoder *texture_transcoder() { return texture_transcoder_.get(); }
+  // Null unless kDeduplicateManagedTextures is set.
+  TextureDeduplicator *texture_deduplicator() {
+    return texture_deduplicator_.get();
+  }
   // TODO: Actually put this in GPU mem.
   DynamicRingBuffer *dynamic_gpu_ring_buffer() {
     return dynamic_ring_buffer_.get();
   }
 
   uint64_t CurrentFrame() const;
-  void CopyBuffer(ID3D12Resource *dest, int64_t dest_offset,
-                  ID3D12Resource *src, int64_t src_offset, int64_t num_bytes);
+  // Last frame (i.e. command list fence value) that the GPU has finished.
+  uint64_t CompletedFrame() const;
+  // Queues a copy of a dynamic buffer's ring contents into its backing
+  // resource. Copies are sorted, merged and recorded together when the command
+  // list is submitted.
+  void QueuePersistCopy(ID3D12Resource *dest, int64_t dest_offset,
+                        ID3D12Resource *src, int64_t src_offset,
+                        int64_t num_bytes);
+  // Copies src_footprint to (dest_x, dest_y) of the subresource.
   void CopyBufferToTexture(GpuTexture *dest, uint32_t dest_subresource,
+                           uint32_t dest_x, uint32_t dest_y,
                            ID3D12Resource *src,
                            D3D12_PLACED_SUBRESOURCE_FOOTPRINT src_footprint);
   void TransitionTexture(GpuTexture *texture, uint32_t subresource,
                          D3D12_RESOURCE_STATES state_after);
+  // Returns the copy queue's command list if an upload to texture can be
+  // recorded there instead of on the main command list, or nullptr. Only
+  // textures in COMMON that the command list being recorded has not used yet
+  // qualify. Copies recorded there need no barriers.
+  ID3D12GraphicsCommandList *BeginCopyUpload(GpuTexture *texture);
+  // Called when a texture's SRV changes. Rebinds it if it is bound.
+  void RebindTexture(GpuTexture *texture);
+  // Frees a texture's old resource and SRV once the GPU is done with the
+  // current frame.
+  void RetireTexture(ComPtr<ID3D12Resource> resource,
+                     const DescriptorHandle &srv_handle);
+  // The current texture palette as 256 B8G8R8A8 colors, which P8 textures are
+  // expanded with. generation changes whenever the colors do. All black (with
+  // generation 0) until a palette is set.
+  const uint32_t *CurrentPaletteColors(uint64_t *generation) const;
 
   // Marks a dynamic buffer that needs to be persisted at the end of the frame.
   void MarkBufferForPersist(Buffer *buffer);
+  // Queues a copy from the ring into a GPU-local buffer. Queued copies are
+  // recorded in one batch (with their barriers) before the next draw or
+  // submission.
+  void QueueBufferUpload(Buffer *buffer, int64_t dest_offset,
+                         DynamicRingBuffer::Allocation src);
 
   template <typename T>
   void MarkResourceAsUsed(InternalPtr<T> resource) {
-    frame_resources_to_free_.at(current_back_buffer_)
+    frame_resources_to_free_.at(frame_pacer_.current_slot())
         .push_back(InternalPtr<RefCounted>(resource.Get()));
   }
+  // Also marks managed textures as recently used for eviction.
+  void MarkResourceAsUsed(InternalPtr<GpuTexture> texture);
+
+  ResidencyTracker &residency() { return residency_; }
+  // Evicts managed textures until num_bytes more fit in the texture budget.
+  void MakeRoomForTexture(uint64_t num_bytes);
 
 #ifdef DX8TO12_USE_ALLOCATOR
   D3D12MA::Allocator *allocator() { return allocator_.get(); }
@@ -92,12 +173,9 @@ class Device : public IDirect3DDevice8, RefCounted {
 
   /*** IDirect3DDevice8 methods ***/
   virtual HRESULT STDMETHODCALLTYPE TestCooperativeLevel(THIS) override;
-  virtual UINT STDMETHODCALLTYPE GetAvailableTextureMem(THIS) PURE;
+  virtual UINT STDMETHODCALLTYPE GetAvailableTextureMem(THIS) override;
   virtual HRESULT STDMETHODCALLTYPE
-  ResourceManagerDiscardBytes(DWORD Bytes) override {
-    TRACE_ENTRY(Bytes);
-    return S_OK;
-  }
+  ResourceManagerDiscardBytes(DWORD Bytes) override;
   virtual HRESULT STDMETHODCALLTYPE GetDirect3D(IDirect3D8 **ppD3D8) override {
     *ppD3D8 = direct3d8_.get();
     direct3d8_->AddRef();
@@ -228,19 +306,13 @@ class Device : public IDirect3DDevice8, RefCounted {
   GetInfo(DWORD DevInfoID, void *pDevInfoStruct,
           DWORD DevInfoStructSize) VIRT_NOT_IMPLEMENTED;
   virtual HRESULT STDMETHODCALLTYPE
-  SetPaletteEntries(UINT PaletteNumber, CONST PALETTEENTRY *pEntries) override {
-    return D3DERR_NOTAVAILABLE;
-  }
+  SetPaletteEntries(UINT PaletteNumber, CONST PALETTEENTRY *pEntries) override;
   virtual HRESULT STDMETHODCALLTYPE
-  GetPaletteEntries(UINT PaletteNumber, PALETTEENTRY *pEntries) override {
-    return D3DERR_NOTAVAILABLE;
-  }
+  GetPaletteEntries(UINT PaletteNumber, PALETTEENTRY *pEntries) override;
   virtual HRESULT STDMETHODCALLTYPE
-  SetCurrentTexturePalette(UINT PaletteNumber) override {
-    return D3DERR_NOTAVAILABLE;
-  }
+  SetCurrentTexturePalette(UINT PaletteNumber) override;
   virtual HRESULT STDMETHODCALLTYPE
-  GetCurrentTexturePalette(UINT *PaletteNumber) PURE;
+  GetCurrentTexturePalette(UINT *PaletteNumber) override;
   virtual HRESULT STDMETHODCALLTYPE
   DrawPrimitive(D3DPRIMITIVETYPE PrimitiveType, UINT StartVertex,
                 UINT PrimitiveCount) override;
@@ -305,6 +377,9 @@ class Device : public IDirect3DDevice8, RefCounted {
   // adjust persist any dynamic buffers.
   void SubmitAndWait(bool should_present);
   void WaitForFrame(uint64_t frame_number);
+  // Submits everything recorded so far without presenting, and continues
+  // recording into a fresh command list. Advances the current frame.
+  void FlushCommandList();
 
 #undef PURE
 #define PURE = 0
@@ -319,13 +394,67 @@ class Device : public IDirect3DDevice8, RefCounted {
   HRESULT Init(const D3DPRESENT_PARAMETERS &presentParams);
   void InitRootSignatures();
 
+  // Returns the pipeline state for the next draw, or null if the draw should be
+  // skipped (see kPsoCompileMode).
   ComPtr<ID3D12PipelineState> CreatePSO(D3DPRIMITIVETYPE d3d8_prim_type);
+  // The fixed-function pixel shader state of the next draw.
+  PixelShaderState CurrentPixelShaderState() const;
+  // Returns whether ff_ubershader_ can draw state, and if so, points the pixel
+  // cbuffer at its texture stages.
+  bool PrepareFFUbershader(const PixelShaderState &state);
+  PSOState MakePSOState(D3DPRIMITIVETYPE d3d8_prim_type,
+                        ID3DBlob *pixel_shader) const;
+  // Returns the pipeline state for key from pso_cache_, compiling it on the
+  // spot if needed.
+  ComPtr<ID3D12PipelineState> GetOrCompilePSO(const PSOState &key);
+  // Returns the pipeline state for key from pso_cache_, or queues it on
+  // pso_compiler_ and returns null.
+  ComPtr<ID3D12PipelineState> GetOrQueuePSO(const PSOState &key,
+                                            ComPtr<ID3DBlob> pixel_shader);
+  // Stands in for the pipeline state of the next draw while its pixel shader
+  // or pipeline is compiled in the background. Null if the fallback isn't
+  // compiled yet either.
+  ComPtr<ID3D12PipelineState> GetFallbackPSO(D3DPRIMITIVETYPE d3d8_prim_type);
+  // Thread-safe.
+  ComPtr<ID3D12PipelineState> CompilePSO(const PSOState &key,
+                                         DXGI_FORMAT rtv_format) const;
+  // Returns S_FALSE if the draw should be skipped.
   HRESULT PrepareDrawCall(D3DPRIMITIVETYPE PrimitiveType, int start_vertex,
                           int num_vertices);
+  // PrepareDrawCall's texture and sampler binding when kUseBindlessTextures is
+  // set.
+  void SetBindlessTextures();
+  // Returns the (cached) sampler descriptor for the stage's sampler state.
+  D3D12_GPU_DESCRIPTOR_HANDLE GetSamplerFor(int stage);
 
   // Empties buffers_to_persist_, releases any frame resources, advances current
   // frame.
   void FreeFrameResources(uint64_t frame_number);
+  // Blocks until the command queue has signaled fence_value.
+  void WaitForFence(uint64_t fence_value);
+
+  // Called before recording a draw or copy. Flushes the command list if the
+  // dynamic ring, the sampler heap or the command list itself are running low.
+  void MaybeFlushCommandList();
+  // Returns an allocator that is not in use by the GPU, creating one if needed.
+  ComPtr<ID3D12CommandAllocator> AcquireCommandAllocator();
+
+  // Makes sure a texture is resident and fully uploaded before it is drawn
+  // with.
+  void PrepareTextureForDraw(GpuTexture *texture);
+  // Called whenever the command list being recorded uses a texture. Makes it
+  // wait for the texture's copy queue uploads.
+  void MarkDirectUse(GpuTexture *texture);
+  // Submits the open copy queue batch, and makes the command list that is
+  // about to be executed wait for the batches it uses.
+  void SubmitCopyUploads();
+  // Records all queued buffer uploads.
+  void FlushPendingBufferUploads();
+  // Persists every buffer in buffers_to_persist_ and records the resulting
+  // copies, followed by a single batch of barriers.
+  void PersistDynamicBuffers();
+  // Tracks the implicit promotion of a GPU-local buffer that a draw reads.
+  void MarkBufferRead(Buffer *buffer, D3D12_RESOURCE_STATES state);
 
   D3DMATRIX GetTransform(D3DTRANSFORMSTATETYPE state);
 
@@ -340,17 +469,34 @@ class Device : public IDirect3DDevice8, RefCounted {
   ComPtr<IDXGIOutput> adapter_output_;
   int adapter_index_;
 
+  // Declared early so that they outlive every buffer the device holds on to.
+  std::unique_ptr<BufferAllocator> buffer_allocator_;
+  std::unique_ptr<BufferAllocator> gpu_buffer_allocator_;
+  // Textures budget. Declared early so that it outlives all textures.
+  ResidencyTracker residency_{kTextureMemoryBudget};
+
   ComPtr<ID3D12CommandQueue> cmd_queue_;
-  std::array<ComPtr<ID3D12CommandAllocator>, kNumBackBuffers> cmd_allocators_;
+  // One per frame in flight.
+  std::vector<ComPtr<ID3D12CommandAllocator>> cmd_allocators_;
   ComPtr<ID3D12GraphicsCommandList>
       cmd_list_;  // Main list used for everything.
+  // Allocators that backed flushed command lists, tagged with the fence value
+  // that needs to complete before they can be reused.
+  std::deque<std::pair<uint64_t, ComPtr<ID3D12CommandAllocator>>>
+      retired_cmd_allocators_;
+  // Number of draws and copies recorded since the last submission.
+  int num_recorded_commands_ = 0;
 
   ComPtr<ID3D12Fence> cmd_list_done_fence_;
   HANDLE cmd_list_done_event_handle_ = nullptr;
 
+  // Swap chain buffer that the current frame renders to. Which per-frame
+  // resources it uses is up to frame_pacer_.
   int current_back_buffer_ = 0;
-  std::array<uint64_t, kNumBackBuffers> fence_values_ = {};
+  FramePacer frame_pacer_{kMaxFramesInFlight};
   uint64_t next_fence_ = 1;
+  // Null unless kUseFrameLatencyWaitableObject is set.
+  HANDLE frame_latency_waitable_ = nullptr;
 
   ComPtr<ID3D12Debug5> debug_interface_;
   ComPtr<ID3D12InfoQueue1> info_queue_;
@@ -408,7 +554,29 @@ class Device : public IDirect3DDevice8, RefCounted {
   // Internal rendering resources.
 
   std::unordered_map<PSOState, ComPtr<ID3D12PipelineState>> pso_cache_;
+  // Backs pso_cache_ across runs. Null unless kUsePipelineCache is set.
+  std::unique_ptr<PipelineLibrary> pipeline_library_;
   std::unordered_map<PixelShaderState, ComPtr<ID3DBlob>> ps_cache_;
+  // Null unless kFFPixelShaderMode uses it.
+  ComPtr<ID3DBlob> ff_ubershader_;
+  // The texture stages that the pixel cbuffer holds for ff_ubershader_.
+  UbershaderConstants ff_combiner_ = {};
+  // Fill in ps_cache_ and pso_cache_ in the background. Null when compiling
+  // synchronously, see kPsoCompileMode.
+  std::unique_ptr<AsyncCompiler<PixelShaderState, ComPtr<ID3DBlob>>>
+      ps_compiler_;
+  std::unique_ptr<AsyncCompiler<PSOState, ComPtr<ID3D12PipelineState>>>
+      pso_compiler_;
+  int num_fallback_draws_ = 0;
+  int num_skipped_draws_ = 0;
+  // Time spent compiling pixel shaders and pipelines on the spot.
+  double compile_stall_seconds_ = 0;
+  FrameTimeStats frame_times_;
+  std::chrono::steady_clock::time_point last_present_time_;
+  // Texture bytes uploaded by the frames in frame_times_, and by the frame
+  // that uploaded the most.
+  uint64_t frame_upload_bytes_total_ = 0;
+  uint64_t frame_upload_bytes_max_ = 0;
   std::unordered_map<SamplerDesc, D3D12_GPU_DESCRIPTOR_HANDLE> sampler_cache_;
 
   enum DirtyFlags : uint32_t {
@@ -428,6 +596,11 @@ class Device : public IDirect3DDevice8, RefCounted {
   DirtyFlags dirty_flags_ = DIRTY_FLAG_ALL;
 
   std::unique_ptr<DynamicRingBuffer> dynamic_ring_buffer_;
+  std::unique_ptr<TextureUploader> texture_uploader_;
+  // Null unless kUseCopyQueue is set.
+  std::unique_ptr<CopyQueue> copy_queue_;
+  std::unique_ptr<TextureTranscoder> texture_transcoder_;
+  std::unique_ptr<TextureDeduplicator> texture_deduplicator_;
 
   ComPtr<Buffer> vs_cbuffer_;
   ComPtr<Buffer> lights_cbuffer_;
@@ -446,9 +619,43 @@ class Device : public IDirect3DDevice8, RefCounted {
   DescriptorPoolHeap sampler_heap_;
   DescriptorPoolHeap dsv_heap_;
 
-  std::array<std::vector<InternalPtr<RefCounted>>, kNumBackBuffers>
-      frame_resources_to_free_;
+  // One list per frame in flight.
+  std::vector<std::vector<InternalPtr<RefCounted>>> frame_resources_to_free_;
   std::unordered_set<ComPtr<Buffer>> buffers_to_persist_;
+  DynamicBufferStats dynamic_buffer_stats_;
+  DynamicTextureStats dynamic_texture_stats_;
+
+  struct RetiredTexture {
+    ComPtr<ID3D12Resource> resource;
+    DescriptorHandle srv_handle;
+    uint64_t frame;
+  };
+  std::vector<RetiredTexture> retired_textures_;
+
+  struct Palette {
+    std::array<PALETTEENTRY, 256> entries;
+    // entries as B8G8R8A8, with peFlags as alpha.
+    std::array<uint32_t, 256> colors;
+    uint64_t generation;
+  };
+  std::unordered_map<UINT, Palette> palettes_;
+  UINT current_palette_ = 0;
+  uint64_t next_palette_generation_ = 1;
+
+  using PendingPersistCopy = BufferCopy<ID3D12Resource>;
+  std::vector<PendingPersistCopy> pending_persist_copies_;
+
+  struct PendingBufferUpload {
+    ID3D12Resource *dest;
+    int64_t dest_offset;
+    DynamicRingBuffer::Allocation src;
+  };
+  std::vector<PendingBufferUpload> pending_buffer_uploads_;
+  // State of GPU-local buffer resources within the current command list.
+  // Buffers decay to COMMON when a command list finishes executing, so this is
+  // cleared on every submission. Missing resources are in COMMON.
+  std::unordered_map<ID3D12Resource *, D3D12_RESOURCE_STATES>
+      gpu_buffer_states_;
 
   // TODO: Make macro for this. Or just make dirty_flags_ an int.
   friend DirtyFlags &operator|=(DirtyFlags &, DirtyFlags);
@@ -460,6 +667,11 @@ static constexpr D3D12_HEAP_PROPERTIES kSystemMemHeapProps = {
     .CPUPageProperty = D3D12_CPU_PAGE_PROPERTY_WRITE_BACK,
     .MemoryPoolPreference = D3D12_MEMORY_POOL_L0};
 
+static constexpr D3D12_HEAP_PROPERTIES kGpuLocalHeapProps = {
+    .Type = D3D12_HEAP_TYPE_DEFAULT};
+
 ComPtr<ID3DBlob> CreatePixelShaderFromState(const PixelShaderState &s);
+CombinerState ToCombinerState(const PixelShaderState &s);
+ComPtr<ID3DBlob> CreateFFUbershader();
 
 }  // namespace Dx8to12
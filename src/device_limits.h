@@ -1,7 +1,19 @@
 #pragma once
 
+#include <cstdint>
+
 namespace Dx8to12 {
+// Swap chain buffers. Applications that ask for more back buffers (with
+// D3DPRESENT_PARAMETERS::BackBufferCount) get one more than they asked for.
 static constexpr int kNumBackBuffers = 2;
+static constexpr int kMaxBackBuffers = 4;
+// Frames the CPU may record before it waits for the GPU, each with its own
+// command allocator and resources to free. Independent of kNumBackBuffers.
+static constexpr int kMaxFramesInFlight = 2;
+// Waits on the swap chain's frame latency waitable object before starting each
+// frame, so that Present never queues up more than kMaxFramesInFlight frames.
+// Bounds input latency at the cost of some CPU/GPU overlap.
+static constexpr bool kUseFrameLatencyWaitableObject = false;
 
 static constexpr int kMaxVertexStreams = 16;
 static constexpr int kMaxTexStages = 8;
@@ -12,10 +24,133 @@ static constexpr int kMaxNumSrvs = 1024 + 512;
 static constexpr int kMaxNumRtvs = 32;
 
 static constexpr int kDynamicRingBufferSize = 40 * 1024 * 1024;
+// Number of frames an extra (grown) ring buffer segment can go unused before it
+// is released.
+static constexpr int kDynamicRingBufferSegmentIdleFrames = 120;
+
+// Static buffers up to kBufferAllocatorMaxSize bytes are sub-allocated out of
+// shared kBufferAllocatorBlockSize resources, handed out a page at a time.
+static constexpr int kBufferAllocatorMaxSize = 64 * 1024;
+static constexpr int kBufferAllocatorPageSize = 256 * 1024;
+static constexpr int kBufferAllocatorBlockSize = 4 * 1024 * 1024;
+
+// GPU memory budget for textures. Managed textures are evicted, least recently
+// used first, to stay under it. GetAvailableTextureMem reports what is left.
+static constexpr uint64_t kTextureMemoryBudget = 1024ull * 1024 * 1024;
+
+// Texture uploads are split into row bands of at most kTextureUploadChunkSize
+// bytes. Once kTextureUploadMaxInFlightBytes of uploads are waiting on the GPU,
+// the rest are deferred to later frames (unless the texture gets drawn with).
+static constexpr int kTextureUploadChunkSize = 1024 * 1024;
+static constexpr int kTextureUploadMaxInFlightBytes =
+    kDynamicRingBufferSize / 4;
+// Records texture uploads on a separate copy queue, so that they do not
+// serialize with rendering. The main command list only waits for them before
+// the first draw that uses one of their textures.
+static constexpr bool kUseCopyQueue = true;
+// Managed and system memory textures upload only what was locked (or added with
+// AddDirtyRect) since their last upload, as at most kMaxDirtyRectsPerLevel
+// boxes per level.
+static constexpr int kMaxDirtyRectsPerLevel = 4;
+
+// Compresses managed A8R8G8B8/X8R8G8B8 textures of at least
+// kTranscodeMinTexels texels to BC1 (or BC3 if they have alpha) on a background
+// thread. Only textures that go kTranscodeIdleFrames frames without being
+// locked are compressed. Locking one again reverts it to uncompressed.
+static constexpr bool kTranscodeManagedTextures = false;
+static constexpr int kTranscodeMinTexels = 256 * 256;
+static constexpr int kTranscodeIdleFrames = 60;
+// Managed textures with the same format, size and contents share one GPU copy.
+// Contents are hashed on a background thread the first time a texture is drawn
+// with. Locking one again gives it back a copy of its own.
+static constexpr bool kDeduplicateManagedTextures = false;
+
+// Runs dead code removal, copy propagation and constant folding on vs_1_1 and
+// ps_1_x shaders before turning them into HLSL (see utils/shader_ir.h).
+static constexpr bool kOptimizeShaders = true;
+
+// Compiled shaders are cached in kShaderCachePath (relative to the working
+// directory), so that later runs don't have to compile them again. The least
+// recently used ones are dropped on startup once it grows past
+// kShaderCacheMaxBytes.
+static constexpr bool kUseShaderCache = true;
+static constexpr char kShaderCachePath[] = "dx8to12_shader_cache.bin";
+static constexpr uint64_t kShaderCacheMaxBytes = 64ull * 1024 * 1024;
+
+// The driver's compiled pipeline states are cached in kPipelineCachePath the
+// same way, for the adapter and driver version that compiled them.
+static constexpr bool kUsePipelineCache = true;
+static constexpr char kPipelineCachePath[] = "dx8to12_pipeline_cache.bin";
+static constexpr uint64_t kPipelineCacheMaxBytes = 256ull * 1024 * 1024;
+
+// What a draw does when its pixel shader or pipeline state isn't compiled yet.
+// The asynchronous modes hand the compile to kNumPsoCompileThreads background
+// threads, and the result is swapped in at the start of a later frame. They
+// are ignored when kDisablePsoCache is set.
+enum class PsoCompileMode {
+  // Compiles it on the spot, which stalls the frame.
+  kSynchronous,
+  // Draws with a generic fixed-function pixel shader until it is ready. That
+  // pipeline still depends on the rest of the draw's state, so it is compiled
+  // in the background too, and the draw is skipped until one of the two is
+  // ready.
+  kAsyncWithFallback,
+  // Skips the draw until it is ready.
+  kAsyncSkipDraw,
+};
+static constexpr PsoCompileMode kPsoCompileMode =
+    PsoCompileMode::kAsyncWithFallback;
+static constexpr int kNumPsoCompileThreads = 2;
+
+// How fixed-function pixel shaders are built. The ubershader covers the same
+// texture stage ops as the specialized shaders, reading them from the pixel
+// cbuffer, but not auto-generated texture coordinates; states it can't handle
+// always get a specialized shader.
+enum class FFPixelShaderMode {
+  // Generates and compiles one pixel shader per texture stage setup.
+  kSpecialized,
+  // Uses the ubershader for every state it can handle. Costs more per pixel,
+  // but never compiles a pixel shader after startup.
+  kUbershader,
+  // Uses the ubershader in place of specialized shaders that are still being
+  // compiled (see kPsoCompileMode).
+  kUbershaderFallback,
+};
+static constexpr FFPixelShaderMode kFFPixelShaderMode =
+    FFPixelShaderMode::kUbershaderFallback;
+
+// Watermarks that trigger a mid-frame command list flush.
+static constexpr int kFlushRingBytesWatermark = kDynamicRingBufferSize / 2;
+static constexpr int kFlushMaxRecordedCommands = 8192;
+// A single draw can allocate one sampler per texture stage.
+static constexpr int kFlushMinFreeSamplers = kMaxTexStages;
 
 static constexpr int kNumVsConstRegs = 96;
 static constexpr int kNumPsConstRegs = 8;
 
+// Binds the whole SRV and sampler heaps once per command list and passes
+// per-stage heap indices to pixel shaders as root constants, instead of setting
+// one descriptor table per texture stage and sampler. Requires resource binding
+// tier 2.
+static constexpr bool kUseBindlessTextures = false;
+
+// DISCARD locks on dynamic buffers return ring memory directly instead of
+// caching the write and copying it into the ring when it is first used.
+static constexpr bool kZeroCopyDynamicDiscard = true;
+
+// How the contents of a dynamic texture reach the GPU.
+enum class DynamicTextureStrategy {
+  // Locks write into a ring footprint, which is copied into the texture with
+  // CopyTextureRegion on unlock.
+  kRingCopy,
+  // Textures are CPU-writable and sampled directly. Each unlock writes into a
+  // texture the GPU is done with and points the SRV at it. Only used for
+  // single-level 2D textures, others fall back to kRingCopy.
+  kPerFrameTextures,
+};
+static constexpr DynamicTextureStrategy kDynamicTextureStrategy =
+    DynamicTextureStrategy::kRingCopy;
+
 // Helpful debug controls.
 
 // Will implicitly disable Pso cache.
@@ -23,6 +158,7 @@ static constexpr bool kDisablePixelShaderCache = false;
 static constexpr bool kDisablePsoCache = false;
 
 // Does not bother keeping a CPU copy of managed resources. Frees up memory,
-// helpful when trying to do a GPU capture.
-static constexpr bool kDisableManagedResources = true;
+// helpful when trying to do a GPU capture. Managed textures can not be evicted
+// when set.
+static constexpr bool kDisableManagedResources = false;
 }  // namespace Dx8to12
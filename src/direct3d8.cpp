@@ -205,6 +205,10 @@ STDMETHODCALLTYPE Direct3D8::CheckDeviceFormat(
   D3D12_FEATURE_DATA_FORMAT_SUPPORT support{.Format =
                                                 DXGIFromD3DFormat(CheckFormat)};
   if (support.Format == DXGI_FORMAT_UNKNOWN) return D3DERR_NOTAVAILABLE;
+  // Formats that are expanded on upload can only be sampled.
+  if (GetFormatConversion(CheckFormat) != FormatConversion::kNone &&
+      (Usage & (D3DUSAGE_RENDERTARGET | D3DUSAGE_DEPTHSTENCIL)) != 0)
+    return D3DERR_NOTAVAILABLE;
   HR_OR_RETURN(device->CheckFeatureSupport(D3D12_FEATURE_FORMAT_SUPPORT,
                                            &support, sizeof(support)));
   bool is_valid = true;
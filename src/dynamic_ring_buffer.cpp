@@ -4,6 +4,7 @@
 
 #include "aixlog.hpp"
 #include "device.h"
+#include "device_limits.h"
 
 namespace Dx8to12 {
 
@@ -13,15 +14,28 @@ static constexpr D3D12_HEAP_PROPERTIES kHeapProps = {
     .MemoryPoolPreference = D3D12_MEMORY_POOL_L0};
 
 DynamicRingBuffer::DynamicRingBuffer(ID3D12Device *device, size_t size)
-    : max_size_((size + D3D12_DEFAULT_RESOURCE_PLACEMENT_ALIGNMENT - 1) &
-                ~(D3D12_DEFAULT_RESOURCE_PLACEMENT_ALIGNMENT - 1)),
-      head_(0),
-      tail_(0) {
-  // Align size up to alignment.
+    : device_(device),
+      ring_(size, D3D12_DEFAULT_RESOURCE_PLACEMENT_ALIGNMENT, 256,
+            kDynamicRingBufferSegmentIdleFrames) {
+  CreateSegment(0);
+}
+
+DynamicRingBuffer::~DynamicRingBuffer() {
+  // Unmap the buffers.
+  for (Segment &segment : segments_) {
+    if (segment.buffer) {
+      segment.buffer->Unmap(0, nullptr);
+    }
+  }
+}
+
+void DynamicRingBuffer::CreateSegment(int index) {
+  if (index >= (int)segments_.size()) segments_.resize(index + 1);
+  Segment &segment = segments_[index];
   D3D12_RESOURCE_DESC desc{
       .Dimension = D3D12_RESOURCE_DIMENSION_BUFFER,
       .Alignment = D3D12_DEFAULT_RESOURCE_PLACEMENT_ALIGNMENT,
-      .Width = static_cast<UINT64>(max_size_),
+      .Width = static_cast<UINT64>(ring_.segment_size(index)),
       .Height = 1,
       .DepthOrArraySize = 1,
       .MipLevels = 1,
@@ -29,83 +43,69 @@ DynamicRingBuffer::DynamicRingBuffer(ID3D12Device *device, size_t size)
       .SampleDesc = {.Count = 1, .Quality = 0},
       .Layout = D3D12_TEXTURE_LAYOUT_ROW_MAJOR,
       .Flags = D3D12_RESOURCE_FLAG_NONE};
-  ASSERT_HR(device->CreateCommittedResource(
+  ASSERT_HR(device_->CreateCommittedResource(
       &kHeapProps, D3D12_HEAP_FLAG_CREATE_NOT_ZEROED, &desc,
       D3D12_RESOURCE_STATE_COMMON, nullptr,
-      IID_PPV_ARGS(buffer_.GetForInit())));
-  buffer_->SetName(L"DynamicRingBuffer");
-  gpu_ptr_ = buffer_->GetGPUVirtualAddress();
+      IID_PPV_ARGS(segment.buffer.GetForInit())));
+  segment.buffer->SetName(L"DynamicRingBuffer");
+  segment.gpu_ptr = segment.buffer->GetGPUVirtualAddress();
   // Map the buffer forever.
   D3D12_RANGE no_reads = {};
-  ASSERT_HR(buffer_->Map(0, &no_reads, reinterpret_cast<void **>(&cpu_ptr_)));
+  ASSERT_HR(segment.buffer->Map(
+      0, &no_reads, reinterpret_cast<void **>(&segment.cpu_ptr)));
 }
 
-DynamicRingBuffer::~DynamicRingBuffer() {
-  // Unmap the buffer.
-  buffer_->Unmap(0, nullptr);
+const DynamicRingBuffer::Segment &DynamicRingBuffer::GetSegment(
+    Allocation alloc) const {
+  ASSERT(ring_.is_live(alloc.segment));
+  ASSERT(alloc.offset + alloc.size <= (int)ring_.segment_size(alloc.segment));
+  return segments_[alloc.segment];
 }
 
 DynamicRingBuffer::Allocation DynamicRingBuffer::Allocate(size_t num_bytes,
                                                           uint32_t align) {
-  ASSERT(head_ <= max_size_ && tail_ <= max_size_);
-  ASSERT(IsPow2(align));
-  align = std::max(align, min_align_);
-  // LOG(TRACE) << "Allocating " << std::dec << num_bytes << " bytes. At "
-  //  << std::dec << offset_ / 1024 << "kB.\n";
-  bool is_oom = false;
-  Allocation alloc{.frame = current_frame_, .size = (int)num_bytes};
-  if (tail_ >= head_) {
-    if (AlignUp(tail_, align) + num_bytes <= max_size_) {
-      alloc.offset = AlignUp((int)tail_, align);
-      tail_ = AlignUp((int)tail_, align) + num_bytes;
-    } else if (head_ >= num_bytes) {
-      alloc.offset = 0;
-      tail_ = num_bytes;
-    } else {
-      is_oom = true;
-    }
-  } else if (AlignUp(tail_, align) + num_bytes <= head_) {
-    alloc.offset = AlignUp((int)tail_, align);
-    tail_ = AlignUp((int)tail_, align) + num_bytes;
-  } else {
-    is_oom = true;
+  bool new_segment;
+  const Allocation alloc = ring_.Allocate(num_bytes, align, &new_segment);
+  if (new_segment) {
+    CreateSegment(alloc.segment);
+    const Stats stats = ring_.stats();
+    LOG(INFO) << "Growing dynamic ring buffer by " << std::dec
+              << ring_.segment_size(alloc.segment) / 1024 << "kB to "
+              << stats.total_size / 1024 << "kB. Frame high-water mark is "
+              << stats.high_water_bytes / 1024 << "kB.\n";
   }
-  if (is_oom) {
-    FAIL("OOM: Could not allocate %zu bytes.", num_bytes);
-  }
-  ASSERT(alloc.offset + alloc.size <= (int)max_size_);
   return alloc;
 }
 
 char *DynamicRingBuffer::GetCpuPtrFor(Allocation alloc) {
-  ASSERT(alloc.frame == current_frame_);
-  ASSERT(alloc.offset + alloc.size <= (int)max_size_);
-  return (char *)cpu_ptr_ + alloc.offset;
+  ASSERT(alloc.frame == ring_.current_frame());
+  return GetSegment(alloc).cpu_ptr + alloc.offset;
 }
 
 GpuPtr DynamicRingBuffer::GetGpuPtrFor(Allocation alloc) {
-  ASSERT(alloc.frame == current_frame_);
-  ASSERT(alloc.offset + alloc.size <= (int)max_size_);
-  return gpu_ptr_.WithOffset(alloc.offset);
+  ASSERT(alloc.frame == ring_.current_frame());
+  return GetSegment(alloc).gpu_ptr.WithOffset(alloc.offset);
+}
+
+ID3D12Resource *DynamicRingBuffer::GetBackingResource(Allocation alloc) {
+  ASSERT(ring_.is_live(alloc.segment));
+  return segments_[alloc.segment].buffer.get();
 }
 
 void DynamicRingBuffer::SetCurrentFrame(uint64_t frame) {
-  if (frame > current_frame_) {
-    current_frame_ = frame;
-    frame_heads_.push_back({current_frame_, tail_});
-  }
+  ring_.SetCurrentFrame(frame);
 }
 
 void DynamicRingBuffer::HasCompletedFrame(uint64_t frame) {
-  while (!frame_heads_.empty() && frame_heads_.front().first <= frame) {
-    frame_heads_.pop_front();
-  }
-  if (!frame_heads_.empty()) {
-    head_ = frame_heads_.front().second;
-  } else {
-    head_ = 0;
-    tail_ = 0;
+  retired_segments_.clear();
+  ring_.HasCompletedFrame(frame, &retired_segments_);
+  for (const int index : retired_segments_) {
+    segments_[index].buffer->Unmap(0, nullptr);
+    segments_[index] = {};
+    LOG(INFO) << "Released idle dynamic ring buffer segment. Ring is now "
+              << std::dec << ring_.stats().total_size / 1024 << "kB.\n";
   }
+  segments_.resize(ring_.num_slots());
 }
 
-}  // namespace Dx8to12
\ No newline at end of file
+}  // namespace Dx8to12
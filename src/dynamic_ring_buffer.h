@@ -2,12 +2,12 @@
 
 #include <d3d12.h>
 
-#include <climits>
 #include <cstdint>
-#include <deque>
+#include <vector>
 
 #include "util.h"
 #include "utils/dx_utils.h"
+#include "utils/segmented_ring.h"
 
 interface ID3D12Device;
 interface ID3D12Resource;
@@ -15,14 +15,15 @@ interface ID3D12Resource;
 namespace Dx8to12 {
 class Device;
 
-// Simple ring buffer that needs to be reset each frame.
+// Ring buffer that needs to be told about frame boundaries. Made up of one or
+// more chained segments: when an allocation does not fit in any existing
+// segment, a new one is created instead of failing. Extra segments are released
+// once they have been idle for kDynamicRingBufferSegmentIdleFrames frames. The
+// bookkeeping lives in SegmentedRing; this owns the mapped buffers.
 class DynamicRingBuffer {
  public:
-  struct Allocation {
-    uint64_t frame;
-    int offset;
-    int size;
-  };
+  using Allocation = SegmentedRing::Allocation;
+  using Stats = SegmentedRing::Stats;
 
   // Initializes current_frame to 1.
   DynamicRingBuffer(ID3D12Device* device, size_t size);
@@ -34,23 +35,29 @@ class DynamicRingBuffer {
   Allocation Allocate(
       size_t num_bytes,
       uint32_t alignment = D3D12_CONSTANT_BUFFER_DATA_PLACEMENT_ALIGNMENT);
-  char* GetCpuPtrFor(Allocation offset);
-  GpuPtr GetGpuPtrFor(Allocation offset);
+  char* GetCpuPtrFor(Allocation alloc);
+  GpuPtr GetGpuPtrFor(Allocation alloc);
 
-  ID3D12Resource* GetBackingResource() { return buffer_.get(); }
+  // Returns the resource that backs the segment the allocation lives in.
+  ID3D12Resource* GetBackingResource(Allocation alloc);
 
- private:
-  ComPtr<ID3D12Resource> buffer_;
-  char* cpu_ptr_;
-  GpuPtr gpu_ptr_;
+  Stats stats() const { return ring_.stats(); }
 
-  const size_t max_size_;
-  size_t head_;
-  size_t tail_;
+ private:
+  // The buffer behind a segment, mapped for its whole lifetime.
+  struct Segment {
+    ComPtr<ID3D12Resource> buffer;
+    char* cpu_ptr = nullptr;
+    GpuPtr gpu_ptr;
+  };
 
-  std::deque<std::pair<uint64_t, size_t>> frame_heads_;
-  uint64_t current_frame_ = 0;
+  void CreateSegment(int index);
+  const Segment& GetSegment(Allocation alloc) const;
 
-  const uint32_t min_align_ = 256;
+  ID3D12Device* device_;
+  SegmentedRing ring_;
+  // Indexed like the segments of ring_. Retired segments are left empty.
+  std::vector<Segment> segments_;
+  std::vector<int> retired_segments_;
 };
 }  // namespace Dx8to12
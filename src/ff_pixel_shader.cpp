@@ -5,11 +5,42 @@
 #include "aixlog.hpp"
 #include "device.h"
 #include "render_state.h"
+#include "shader_parser.h"
 #include "utils/dx_utils.h"
 
 namespace Dx8to12 {
 using ::std::endl;
 
+static_assert(Combiner::kNumStages == kMaxTexStages);
+static_assert(Combiner::kOpDisable == D3DTOP_DISABLE);
+static_assert(Combiner::kOpSelectArg1 == D3DTOP_SELECTARG1);
+static_assert(Combiner::kOpSelectArg2 == D3DTOP_SELECTARG2);
+static_assert(Combiner::kOpModulate == D3DTOP_MODULATE);
+static_assert(Combiner::kOpModulate2x == D3DTOP_MODULATE2X);
+static_assert(Combiner::kOpModulate4x == D3DTOP_MODULATE4X);
+static_assert(Combiner::kOpAdd == D3DTOP_ADD);
+static_assert(Combiner::kOpAddSigned == D3DTOP_ADDSIGNED);
+static_assert(Combiner::kOpBlendTextureAlpha == D3DTOP_BLENDTEXTUREALPHA);
+static_assert(Combiner::kOpBlendFactorAlpha == D3DTOP_BLENDFACTORALPHA);
+static_assert(Combiner::kOpBlendCurrentAlpha == D3DTOP_BLENDCURRENTALPHA);
+static_assert(Combiner::kOpDotProduct3 == D3DTOP_DOTPRODUCT3);
+static_assert(Combiner::kArgSelectMask == D3DTA_SELECTMASK);
+static_assert(Combiner::kArgDiffuse == D3DTA_DIFFUSE);
+static_assert(Combiner::kArgCurrent == D3DTA_CURRENT);
+static_assert(Combiner::kArgTexture == D3DTA_TEXTURE);
+static_assert(Combiner::kArgTFactor == D3DTA_TFACTOR);
+static_assert(Combiner::kArgSpecular == D3DTA_SPECULAR);
+static_assert(Combiner::kArgComplement == D3DTA_COMPLEMENT);
+static_assert(Combiner::kArgAlphaReplicate == D3DTA_ALPHAREPLICATE);
+static_assert(Combiner::kCmpNever == D3DCMP_NEVER);
+static_assert(Combiner::kCmpLess == D3DCMP_LESS);
+static_assert(Combiner::kCmpEqual == D3DCMP_EQUAL);
+static_assert(Combiner::kCmpLessEqual == D3DCMP_LESSEQUAL);
+static_assert(Combiner::kCmpGreater == D3DCMP_GREATER);
+static_assert(Combiner::kCmpNotEqual == D3DCMP_NOTEQUAL);
+static_assert(Combiner::kCmpGreaterEqual == D3DCMP_GREATEREQUAL);
+static_assert(Combiner::kCmpAlways == D3DCMP_ALWAYS);
+
 constexpr char kPixelHeader[] = R"(
 #include "ps_common.hlsl"
 )";
@@ -188,28 +219,35 @@ ComPtr<ID3DBlob> CreatePixelShaderFromState(const PixelShaderState &s) {
   ss << "return result_color;" << endl << "}" << endl;
 
   const std::string code = ss.str();
-  auto includer = CreateShaderIncluder();
+  ComPtr<ID3DBlob> result_blob =
+      CompileShader(code, "ff_pixel_shader", GetPixelShaderDefines(), "PSMain",
+                    GetPixelShaderTarget());
+  LOG(TRACE) << "Successfully created pixel shader.\n";
+  return result_blob;
+}
 
-  ComPtr<ID3DBlob> result_blob;
-  ID3DBlob *errorBlob = nullptr;
-  HRESULT hr = D3DCompile(code.c_str(), code.size(), "ff_pixel_shader", nullptr,
-                          includer.get(), "PSMain", "ps_5_0",
-                          D3DCOMPILE_DEBUG | D3DCOMPILE_ENABLE_STRICTNESS |
-                              D3DCOMPILE_WARNINGS_ARE_ERRORS,
-                          0, result_blob.GetForInit(), &errorBlob);
-  if (hr != S_OK) {
-    ASSERT(errorBlob);
-    ASSERT(reinterpret_cast<const char *>(
-               errorBlob->GetBufferPointer())[errorBlob->GetBufferSize() - 1] ==
-           0);
-    LOG_ERROR() << "Error when compiling shader:" << endl
-                << code << endl
-                << (const char *)errorBlob->GetBufferPointer() << "\n";
-    FAIL("Error when compiling shader:\r\n%s\r\n---\r\n%s", code.c_str(),
-         (const char *)errorBlob->GetBufferPointer());
+CombinerState ToCombinerState(const PixelShaderState &s) {
+  CombinerState state = {.alpha_func = static_cast<uint32_t>(s.alpha_func())};
+  for (int i = 0; i < kMaxTexStages; ++i) {
+    const TextureStageState &ts = s.ts[i];
+    state.stages[i] = {.color_op = static_cast<uint32_t>(ts.color_op),
+                       .color_arg1 = ts.color_arg1,
+                       .color_arg2 = ts.color_arg2,
+                       .alpha_op = static_cast<uint32_t>(ts.alpha_op),
+                       .alpha_arg1 = ts.alpha_arg1,
+                       .alpha_arg2 = ts.alpha_arg2,
+                       .texcoord_index = ts.texcoord_index,
+                       .has_texture = s.stage_has_texture(i)};
+    if (ts.color_op == D3DTOP_DISABLE) break;
   }
-  ASSERT(errorBlob == nullptr);
-  LOG(TRACE) << "Successfully created pixel shader.\n";
+  return state;
+}
+
+ComPtr<ID3DBlob> CreateFFUbershader() {
+  ComPtr<ID3DBlob> result_blob = CompileShader(
+      "#include \"ff_ubershader.hlsl\"\n", "ff_ubershader",
+      GetPixelShaderDefines(), "PSMain", GetPixelShaderTarget());
+  LOG(INFO) << "Created the fixed-function pixel ubershader.\n";
   return result_blob;
 }
 
@@ -0,0 +1,128 @@
+#include "pipeline_library.h"
+
+#include <vector>
+
+#include "aixlog.hpp"
+#include "device_limits.h"
+#include "utils/pipeline_digest.h"
+
+namespace Dx8to12 {
+
+static BlobCache *GetPipelineCache() {
+  static BlobCache *cache = [] {
+    // Never destroyed, like the shader cache. Records are flushed as they are
+    // written.
+    auto *result = new BlobCache();
+    if (!result->Open(kPipelineCachePath, kPipelineCacheMaxBytes)) {
+      LOG(WARNING) << "Can't write pipeline cache " << kPipelineCachePath
+                   << ". Compiled pipelines are only kept in memory.\n";
+    }
+    const BlobCache::Stats stats = result->stats();
+    LOG(INFO) << "Pipeline cache has " << stats.num_entries << " pipelines ("
+              << stats.file_bytes / 1024 << " KB).\n";
+    return result;
+  }();
+  return cache;
+}
+
+static std::span<const char> BlobBytes(ID3DBlob *blob) {
+  return {static_cast<const char *>(blob->GetBufferPointer()),
+          blob->GetBufferSize()};
+}
+
+PipelineLibrary::PipelineLibrary(ID3D12Device *device, IDXGIAdapter *adapter,
+                                 ID3DBlob *root_signature)
+    : device_(device) {
+  DXGI_ADAPTER_DESC adapter_desc;
+  ASSERT_HR(adapter->GetDesc(&adapter_desc));
+  // The user-mode driver version. Left at 0 if the adapter won't say, in which
+  // case blobs from an older driver are rejected on load instead.
+  LARGE_INTEGER driver_version = {};
+  if (FAILED(adapter->CheckInterfaceSupport(__uuidof(IDXGIDevice),
+                                            &driver_version))) {
+    driver_version.QuadPart = 0;
+  }
+  const std::span<const char> root_signature_bytes = BlobBytes(root_signature);
+#ifdef DX8TO12_ENABLE_VALIDATION
+  constexpr uint32_t kValidation = 1;
+#else
+  constexpr uint32_t kValidation = 0;
+#endif
+  BlobCache::KeyBuilder id;
+  id.Add(adapter_desc.VendorId)
+      .Add(adapter_desc.DeviceId)
+      .Add(adapter_desc.SubSysId)
+      .Add(adapter_desc.Revision)
+      .Add(static_cast<uint32_t>(driver_version.LowPart))
+      .Add(static_cast<uint32_t>(driver_version.HighPart))
+      .Add(kValidation)
+      .Add(std::string_view(root_signature_bytes.data(),
+                            root_signature_bytes.size()));
+  const BlobCache::Key id_key = id.Finish();
+  device_id_.assign(reinterpret_cast<const char *>(&id_key), sizeof(id_key));
+
+  // Loads the file now rather than on the first draw.
+  GetPipelineCache();
+}
+
+PipelineLibrary::~PipelineLibrary() {
+  const Stats s = stats();
+  LOG(INFO) << "Pipeline cache: " << s.num_hits << " hits, " << s.num_misses
+            << " misses, " << s.num_rejected << " rejected by the driver.\n";
+}
+
+ComPtr<ID3D12PipelineState> PipelineLibrary::Create(
+    const PSOState &state, D3D12_GRAPHICS_PIPELINE_STATE_DESC desc) {
+  BlobCache *cache = GetPipelineCache();
+  const BlobCache::Key key = MakeKey(state, desc.RTVFormats[0]);
+  ComPtr<ID3D12PipelineState> pso;
+  if (std::span<const char> blob = cache->Find(key); !blob.empty()) {
+    desc.CachedPSO = {.pCachedBlob = blob.data(),
+                      .CachedBlobSizeInBytes = blob.size()};
+    if (SUCCEEDED(device_->CreateGraphicsPipelineState(
+            &desc, IID_PPV_ARGS(pso.GetForInit())))) {
+      ++num_hits_;
+      return pso;
+    }
+    LOG(WARNING) << "Driver rejected a cached pipeline, compiling it again.\n";
+    ++num_rejected_;
+    desc.CachedPSO = {};
+  }
+
+  ++num_misses_;
+  ASSERT_HR(device_->CreateGraphicsPipelineState(
+      &desc, IID_PPV_ARGS(pso.GetForInit())));
+  ComPtr<ID3DBlob> blob;
+  if (SUCCEEDED(pso->GetCachedBlob(blob.GetForInit()))) {
+    cache->Insert(key, BlobBytes(blob.get()));
+  }
+  return pso;
+}
+
+BlobCache::Key PipelineLibrary::MakeKey(const PSOState &state,
+                                        DXGI_FORMAT rtv_format) const {
+  std::vector<InputElementFields> input_elements;
+  input_elements.reserve(state.input_elements.size());
+  for (const D3D12_INPUT_ELEMENT_DESC &element : state.input_elements) {
+    input_elements.push_back(
+        {.semantic_name = element.SemanticName,
+         .semantic_index = element.SemanticIndex,
+         .format = static_cast<uint32_t>(element.Format),
+         .input_slot = element.InputSlot,
+         .aligned_byte_offset = element.AlignedByteOffset,
+         .input_slot_class = static_cast<uint32_t>(element.InputSlotClass),
+         .instance_data_step_rate = element.InstanceDataStepRate});
+  }
+  return DigestPipeline(
+      {.device_id = device_id_,
+       .render_state = {reinterpret_cast<const char *>(&state.rs),
+                        sizeof(state.rs)},
+       .input_elements = input_elements,
+       .vs_bytecode = BlobBytes(state.vs),
+       .ps_bytecode = BlobBytes(state.ps),
+       .primitive_type = static_cast<uint32_t>(state.prim_type),
+       .rtv_format = static_cast<uint32_t>(rtv_format),
+       .dsv_format = static_cast<uint32_t>(state.dsv_format)});
+}
+
+}  // namespace Dx8to12
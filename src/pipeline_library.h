@@ -0,0 +1,63 @@
+#pragma once
+
+#include <d3d12.h>
+#include <dxgi.h>
+
+#include <atomic>
+#include <string>
+
+#include "render_state.h"
+#include "util.h"
+#include "utils/blob_cache.h"
+
+namespace Dx8to12 {
+
+// Keeps the driver's compiled pipeline states across runs, in the spirit of
+// ID3D12PipelineLibrary. Pipelines are keyed by a digest of their PSOState,
+// with the shaders' bytecode in place of their blob pointers (see
+// DigestPipeline). Their cached blobs live in one BlobCache file for the whole
+// process, which is loaded when the first device is created. Each newly
+// compiled pipeline is appended to it right away instead of serializing a
+// whole library on exit, so a game that crashes or never shuts down cleanly
+// keeps what it compiled.
+//
+// Blobs are only looked up for the adapter, driver version and root signature
+// they were compiled with. A driver may still reject one, in which case the
+// pipeline is compiled from scratch and its blob replaced.
+//
+// Thread-safe.
+class PipelineLibrary {
+ public:
+  struct Stats {
+    int num_hits;
+    int num_misses;
+    // Cached blobs that the driver refused to load.
+    int num_rejected;
+  };
+
+  PipelineLibrary(ID3D12Device* device, IDXGIAdapter* adapter,
+                  ID3DBlob* root_signature);
+  ~PipelineLibrary();
+
+  // Creates the pipeline state described by desc, which was built from state.
+  ComPtr<ID3D12PipelineState> Create(const PSOState& state,
+                                     D3D12_GRAPHICS_PIPELINE_STATE_DESC desc);
+
+  Stats stats() const {
+    return {.num_hits = num_hits_,
+            .num_misses = num_misses_,
+            .num_rejected = num_rejected_};
+  }
+
+ private:
+  BlobCache::Key MakeKey(const PSOState& state, DXGI_FORMAT rtv_format) const;
+
+  ID3D12Device* device_;
+  // Digest of what cached blobs are tied to, other than the pipeline itself.
+  std::string device_id_;
+  std::atomic<int> num_hits_ = 0;
+  std::atomic<int> num_misses_ = 0;
+  std::atomic<int> num_rejected_ = 0;
+};
+
+}  // namespace Dx8to12
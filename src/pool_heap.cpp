@@ -3,6 +3,7 @@
 #include <cstdint>
 
 namespace Dx8to12 {
+
 DescriptorPoolHeap::DescriptorPoolHeap(ID3D12Device *device,
                                        D3D12_DESCRIPTOR_HEAP_TYPE heap_type,
                                        int num_descriptors) {
@@ -21,42 +22,115 @@ DescriptorPoolHeap::DescriptorPoolHeap(ID3D12Device *device,
   increment_ =
       static_cast<int>(device->GetDescriptorHandleIncrementSize(heap_type));
   num_descriptors_ = num_descriptors;
+  slots_ = DescriptorBitmap(num_descriptors);
+}
+
+DescriptorHandle DescriptorPoolHeap::Allocate() {
+  ASSERT(heap_);
+  const int index = slots_.Allocate();
+  if (index < 0) {
+    FAIL("Descriptor heap is full (%d descriptors).", num_descriptors_);
+  }
+  return {.cpu = GetCPUHandleFor(index),
+          .generation = slots_.generation(index)};
+}
 
-  FreeAll();
+void DescriptorPoolHeap::Free(const DescriptorHandle &handle) {
+  const int index = GetIndexFor(handle.cpu);
+  if (handle.generation != slots_.generation(index)) {
+    FAIL("Freeing stale descriptor %d (generation %u, expected %u).", index,
+         handle.generation, slots_.generation(index));
+  }
+  if (slots_.IsFree(index)) {
+    FAIL("Double free of descriptor %d.", index);
+  }
+  slots_.Free(index);
 }
 
-D3D12_CPU_DESCRIPTOR_HANDLE DescriptorPoolHeap::Allocate() {
+void DescriptorPoolHeap::FreeAll() { slots_.FreeAll(); }
+
+DescriptorRange DescriptorPoolHeap::AllocateRange(int count) {
   ASSERT(heap_);
-  ASSERT(!free_list_.empty());
-  if (free_list_.empty()) return {};
-  int back = free_list_.back();
-  free_list_.pop_back();
-  return {.ptr = static_cast<size_t>(back)};
+  ASSERT(count > 0);
+  const int index = slots_.AllocateRange(count);
+  if (index < 0) {
+    FAIL("No free run of %d descriptors (%d of %d used).", count,
+         slots_.num_used(), num_descriptors_);
+  }
+  return {.cpu = GetCPUHandleFor(index),
+          .index = index,
+          .count = count,
+          .generation = slots_.generation(index)};
 }
 
-void DescriptorPoolHeap::Free(D3D12_CPU_DESCRIPTOR_HANDLE handle) {
-  const ptrdiff_t diff = static_cast<ptrdiff_t>(handle.ptr - cpu_start_.ptr);
+void DescriptorPoolHeap::FreeRange(const DescriptorRange &range) {
+  ASSERT(range.index >= 0 && range.index + range.count <= num_descriptors_);
+  if (range.generation != slots_.generation(range.index)) {
+    FAIL("Freeing stale descriptor range at %d (generation %u, expected %u).",
+         range.index, range.generation, slots_.generation(range.index));
+  }
+  for (int i = range.index; i < range.index + range.count; ++i) {
+    if (slots_.IsFree(i)) {
+      FAIL("Double free of descriptor %d.", i);
+    }
+    slots_.Free(i);
+  }
+}
+
+bool DescriptorPoolHeap::IsValid(const DescriptorRange &range) const {
+  return range.index >= 0 && range.index < num_descriptors_ &&
+         range.generation == slots_.generation(range.index) &&
+         !slots_.IsFree(range.index);
+}
+
+bool DescriptorPoolHeap::IsValid(const DescriptorHandle &handle) const {
+  const int index = GetIndexFor(handle.cpu);
+  return handle.generation == slots_.generation(index) &&
+         !slots_.IsFree(index);
+}
+
+int DescriptorPoolHeap::GetIndexFor(
+    D3D12_CPU_DESCRIPTOR_HANDLE cpu_handle) const {
+  const ptrdiff_t diff = static_cast<ptrdiff_t>(cpu_handle.ptr) -
+                         static_cast<ptrdiff_t>(cpu_start_.ptr);
   ASSERT(diff >= 0 && diff < num_descriptors_ * increment_);
-  free_list_.push_back(handle.ptr);
+  ASSERT((diff % increment_) == 0);
+  return static_cast<int>(diff / increment_);
 }
 
-void DescriptorPoolHeap::FreeAll() {
-  free_list_.clear();
-  for (int i = num_descriptors_ - 1; i >= 0; --i) {
-    free_list_.push_back(cpu_start_.ptr + i * increment_);
+int DescriptorPoolHeap::GetIndexFor(const DescriptorHandle &handle) const {
+  if (!IsValid(handle)) {
+    FAIL("Use of stale descriptor %d.", GetIndexFor(handle.cpu));
   }
+  return GetIndexFor(handle.cpu);
+}
+
+int DescriptorPoolHeap::GetIndexFor(
+    D3D12_GPU_DESCRIPTOR_HANDLE gpu_handle) const {
+  ASSERT(gpu_start_.ptr != 0);
+  const uint64_t diff = gpu_handle.ptr - gpu_start_.ptr;
+  ASSERT(gpu_handle.ptr >= gpu_start_.ptr &&
+         diff < static_cast<uint64_t>(num_descriptors_) * increment_);
+  ASSERT((diff % increment_) == 0);
+  return static_cast<int>(diff / increment_);
+}
+
+D3D12_CPU_DESCRIPTOR_HANDLE DescriptorPoolHeap::GetCPUHandleFor(
+    int index) const {
+  ASSERT(index >= 0 && index < num_descriptors_);
+  return {.ptr = cpu_start_.ptr + static_cast<size_t>(index) * increment_};
 }
 
 D3D12_GPU_DESCRIPTOR_HANDLE DescriptorPoolHeap::GetGPUHandleFor(
     D3D12_CPU_DESCRIPTOR_HANDLE cpu_handle) const {
-  ptrdiff_t diff = static_cast<ptrdiff_t>(cpu_handle.ptr) -
-                   static_cast<ptrdiff_t>(cpu_start_.ptr);
-  ASSERT(diff >= 0);
-  ASSERT((diff % increment_) == 0);
-  int index = static_cast<int>(diff / increment_);
-  // TODO: Just check for < num_descriptors_ * increment_.
-  ASSERT(index < num_descriptors_);
-  return {.ptr = gpu_start_.ptr + index * increment_};
+  const int index = GetIndexFor(cpu_handle);
+  return {.ptr = gpu_start_.ptr + static_cast<uint64_t>(index) * increment_};
 };
 
-}  // namespace Dx8to12
\ No newline at end of file
+D3D12_GPU_DESCRIPTOR_HANDLE DescriptorPoolHeap::GetGPUHandleFor(
+    const DescriptorHandle &handle) const {
+  const int index = GetIndexFor(handle);
+  return {.ptr = gpu_start_.ptr + static_cast<uint64_t>(index) * increment_};
+}
+
+}  // namespace Dx8to12
@@ -3,15 +3,36 @@
 #include <d3d12.h>
 
 #include <cstdint>
-#include <vector>
 
 #include "util.h"
+#include "utils/descriptor_bitmap.h"
 
 namespace Dx8to12 {
 class Device;
 
+// A contiguous run of descriptors handed out by AllocateRange. The generation
+// is bumped every time the first descriptor of the range is freed, which lets
+// stale ranges be detected.
+struct DescriptorRange {
+  D3D12_CPU_DESCRIPTOR_HANDLE cpu = {};
+  int index = -1;
+  int count = 0;
+  uint32_t generation = 0;
+};
+
+// A single descriptor handed out by Allocate. Tagged with its generation like
+// DescriptorRange, so that handles that were already freed are caught.
+struct DescriptorHandle {
+  D3D12_CPU_DESCRIPTOR_HANDLE cpu = {};
+  uint32_t generation = 0;
+};
+
+// Descriptor heap allocator. DescriptorBitmap keeps track of which descriptors
+// are free.
 class DescriptorPoolHeap {
  public:
+  using Stats = DescriptorBitmap::Stats;
+
   // Initializing not really needed since heap_ is null.
   DescriptorPoolHeap()
       : cpu_start_({}), gpu_start_({}), increment_(0), num_descriptors_(0) {}
@@ -19,18 +40,40 @@ class DescriptorPoolHeap {
   DescriptorPoolHeap(ID3D12Device* device, D3D12_DESCRIPTOR_HEAP_TYPE heap_type,
                      int num_descriptors);
 
-  D3D12_CPU_DESCRIPTOR_HANDLE Allocate();
-  void Free(D3D12_CPU_DESCRIPTOR_HANDLE handle);
+  // Fails if the heap is full.
+  DescriptorHandle Allocate();
+  // Fails on double frees and on handles whose generation is stale.
+  void Free(const DescriptorHandle& handle);
   void FreeAll();
 
+  // Allocates count contiguous descriptors, e.g. for a descriptor table. Fails
+  // if there is no free run that is large enough.
+  DescriptorRange AllocateRange(int count);
+  // Fails on double frees and on ranges whose generation is stale.
+  void FreeRange(const DescriptorRange& range);
+  // Return false if the descriptors have been freed since they were
+  // allocated.
+  bool IsValid(const DescriptorRange& range) const;
+  bool IsValid(const DescriptorHandle& handle) const;
+
   D3D12_GPU_DESCRIPTOR_HANDLE GetGPUHandleFor(
       D3D12_CPU_DESCRIPTOR_HANDLE cpu_handle) const;
+  // Fails if the handle is stale.
+  D3D12_GPU_DESCRIPTOR_HANDLE GetGPUHandleFor(
+      const DescriptorHandle& handle) const;
+  D3D12_CPU_DESCRIPTOR_HANDLE GetCPUHandleFor(int index) const;
+  int GetIndexFor(D3D12_CPU_DESCRIPTOR_HANDLE cpu_handle) const;
+  int GetIndexFor(D3D12_GPU_DESCRIPTOR_HANDLE gpu_handle) const;
+  // Fails if the handle is stale.
+  int GetIndexFor(const DescriptorHandle& handle) const;
 
   ID3D12DescriptorHeap* heap() { return heap_.get(); }
+  int num_free() const { return num_descriptors_ - slots_.num_used(); }
+  Stats stats() const { return slots_.stats(); }
 
  private:
   ComPtr<ID3D12DescriptorHeap> heap_;
-  std::vector<intptr_t> free_list_;
+  DescriptorBitmap slots_;
 
   D3D12_CPU_DESCRIPTOR_HANDLE cpu_start_ = {};
   D3D12_GPU_DESCRIPTOR_HANDLE gpu_start_ = {};
@@ -2,6 +2,8 @@
 
 #include <d3dcommon.h>
 
+#include <string>
+
 #include "vertex_shader.h"
 
 namespace Dx8to12 {
@@ -20,4 +22,16 @@ struct ShaderIncluder : public ID3DInclude {
   STDMETHOD(Close)(LPCVOID pData) PURE;
 };
 std::unique_ptr<ShaderIncluder> CreateShaderIncluder();
+
+// Compiles generated HLSL, which may include the embedded shader files. The
+// bytecode is cached on disk (see kUseShaderCache), keyed by everything that
+// goes into it, so that later runs skip the compiler. Fails on compile errors.
+ComPtr<ID3DBlob> CompileShader(const std::string& code, const char* source_name,
+                               const D3D_SHADER_MACRO* defines,
+                               const char* entry_point, const char* target);
+
+// Target profile and defines used by every pixel shader compile. Bindless
+// textures need shader model 5.1 for unbounded resource arrays.
+const char* GetPixelShaderTarget();
+const D3D_SHADER_MACRO* GetPixelShaderDefines();
 }  // namespace Dx8to12
\ No newline at end of file
@@ -21,6 +21,9 @@ cbuffer PixelGlobals : register(b1) {
   float material_power;
   float alpha_ref;
   float4 texture_factor;
+  // Fixed-function texture stages for ff_ubershader.hlsl.
+  uint4 ff_stages[4];
+  uint ff_alpha_func;
 };
 
 struct FFVertexOutput {
@@ -44,8 +47,3 @@ struct FFVertexOutput {
 };
 
 // #define FFVertexOutput VertexOutput
-
-// Some helper functions to make generation of programmable shaders easier.
-float4 mydot4(float4 a, float4 b) { return dot(a, b).xxxx; }
-float4 mydot3(float3 a, float3 b) { return dot(a, b).xxxx; }
-float4 mylerp(float4 s, float4 a, float4 b) { return lerp(a, b, s); }
\ No newline at end of file
@@ -0,0 +1,203 @@
+#include "ps_common.hlsl"
+
+// Fixed-function pixel shader that reads the texture stages from ff_stages
+// instead of having them compiled in. See utils/ff_combiner.h for how they
+// are packed; EvaluateCombiner there is the CPU version of this file and has
+// to be kept in sync with it.
+
+#define D3DTOP_DISABLE 1
+#define D3DTOP_SELECTARG1 2
+#define D3DTOP_SELECTARG2 3
+#define D3DTOP_MODULATE 4
+#define D3DTOP_MODULATE2X 5
+#define D3DTOP_MODULATE4X 6
+#define D3DTOP_ADD 7
+#define D3DTOP_ADDSIGNED 8
+#define D3DTOP_BLENDTEXTUREALPHA 13
+#define D3DTOP_BLENDFACTORALPHA 14
+#define D3DTOP_BLENDCURRENTALPHA 16
+#define D3DTOP_DOTPRODUCT3 24
+
+#define D3DTA_SELECTMASK 0xf
+#define D3DTA_DIFFUSE 0
+#define D3DTA_CURRENT 1
+#define D3DTA_TEXTURE 2
+#define D3DTA_TFACTOR 3
+#define D3DTA_COMPLEMENT 0x10
+
+#define D3DCMP_NEVER 1
+#define D3DCMP_LESS 2
+#define D3DCMP_EQUAL 3
+#define D3DCMP_LESSEQUAL 4
+#define D3DCMP_GREATER 5
+#define D3DCMP_NOTEQUAL 6
+#define D3DCMP_GREATEREQUAL 7
+
+float2 StageTexCoord(FFVertexOutput IN, uint index) {
+  switch (index) {
+    case 0:
+      return IN.oT0.xy;
+    case 1:
+      return IN.oT1.xy;
+    case 2:
+      return IN.oT2.xy;
+    case 3:
+      return IN.oT3.xy;
+    case 4:
+      return IN.oT4.xy;
+    case 5:
+      return IN.oT5.xy;
+    case 6:
+      return IN.oT6.xy;
+    default:
+      return IN.oT7.xy;
+  }
+}
+
+// stage is a constant once the stage loop is unrolled, so this picks a fixed
+// texture. Gradients are passed in because the sample sits in a branch.
+float4 SampleStage(int stage, float2 uv, float2 dx, float2 dy) {
+  switch (stage) {
+    case 0:
+      return g_texture0.SampleGrad(g_sampler0, uv, dx, dy);
+    case 1:
+      return g_texture1.SampleGrad(g_sampler1, uv, dx, dy);
+    case 2:
+      return g_texture2.SampleGrad(g_sampler2, uv, dx, dy);
+    case 3:
+      return g_texture3.SampleGrad(g_sampler3, uv, dx, dy);
+    case 4:
+      return g_texture4.SampleGrad(g_sampler4, uv, dx, dy);
+    case 5:
+      return g_texture5.SampleGrad(g_sampler5, uv, dx, dy);
+    case 6:
+      return g_texture6.SampleGrad(g_sampler6, uv, dx, dy);
+    default:
+      return g_texture7.SampleGrad(g_sampler7, uv, dx, dy);
+  }
+}
+
+float4 SelectArg(uint arg, float4 diffuse, float4 specular, float4 current,
+                 float4 tex) {
+  float4 value;
+  switch (arg & D3DTA_SELECTMASK) {
+    case D3DTA_DIFFUSE:
+      value = diffuse;
+      break;
+    case D3DTA_CURRENT:
+      value = current;
+      break;
+    case D3DTA_TEXTURE:
+      value = tex;
+      break;
+    case D3DTA_TFACTOR:
+      value = texture_factor;
+      break;
+    default:
+      value = specular;
+      break;
+  }
+  return (arg & D3DTA_COMPLEMENT) != 0 ? 1.f - value : value;
+}
+
+// The blend factor of the BLEND*ALPHA ops.
+float BlendAlpha(uint op, float4 current, float4 tex) {
+  switch (op) {
+    case D3DTOP_BLENDTEXTUREALPHA:
+      return tex.a;
+    case D3DTOP_BLENDFACTORALPHA:
+      return texture_factor.a;
+    case D3DTOP_BLENDCURRENTALPHA:
+      return current.a;
+    default:
+      return 0.f;
+  }
+}
+
+float4 ApplyOp(uint op, float4 arg1, float4 arg2, float alpha) {
+  switch (op) {
+    case D3DTOP_SELECTARG2:
+      return arg2;
+    case D3DTOP_MODULATE:
+      return arg1 * arg2;
+    case D3DTOP_MODULATE2X:
+      return arg1 * arg2 * 2.f;
+    case D3DTOP_MODULATE4X:
+      return arg1 * arg2 * 4.f;
+    case D3DTOP_ADD:
+      return arg1 + arg2;
+    case D3DTOP_ADDSIGNED:
+      return arg1 + arg2 - 0.5f;
+    case D3DTOP_BLENDFACTORALPHA:
+      return arg1 * alpha + arg2 * (1.f - alpha);
+    case D3DTOP_BLENDTEXTUREALPHA:
+    case D3DTOP_BLENDCURRENTALPHA:
+      return arg1 + arg2 * (1.f - alpha);
+    case D3DTOP_DOTPRODUCT3:
+      return saturate(dot(arg1 - 0.5f, arg2 - 0.5f)).xxxx;
+    default:
+      return arg1;
+  }
+}
+
+// Applies a packed color or alpha word.
+float4 ApplyWord(uint word, float4 diffuse, float4 specular, float4 current,
+                 float4 tex) {
+  const uint op = word & 0xff;
+  const float4 arg1 =
+      SelectArg((word >> 8) & 0xff, diffuse, specular, current, tex);
+  const float4 arg2 =
+      SelectArg((word >> 16) & 0xff, diffuse, specular, current, tex);
+  return ApplyOp(op, arg1, arg2, BlendAlpha(op, current, tex));
+}
+
+bool AlphaTestPasses(uint func, float alpha) {
+  switch (func) {
+    case D3DCMP_NEVER:
+      return false;
+    case D3DCMP_LESS:
+      return alpha < alpha_ref;
+    case D3DCMP_EQUAL:
+      return alpha == alpha_ref;
+    case D3DCMP_LESSEQUAL:
+      return alpha <= alpha_ref;
+    case D3DCMP_GREATER:
+      return alpha > alpha_ref;
+    case D3DCMP_NOTEQUAL:
+      return alpha != alpha_ref;
+    case D3DCMP_GREATEREQUAL:
+      return alpha >= alpha_ref;
+    default:
+      return true;
+  }
+}
+
+float4 PSMain(FFVertexOutput IN) : SV_Target {
+  const float4 diffuse = IN.oD0;
+  const float4 specular = IN.oD1;
+  float4 current = diffuse;
+  bool done = false;
+
+  [unroll] for (int i = 0; i < 8; ++i) {
+    const uint color_word = ff_stages[i / 2][(i % 2) * 2];
+    const uint alpha_word = ff_stages[i / 2][(i % 2) * 2 + 1];
+    // Unused stages are 0.
+    done = done || (color_word & 0xff) <= D3DTOP_DISABLE;
+
+    // Gradients have to be taken outside of flow control.
+    const float2 uv = StageTexCoord(IN, (color_word >> 24) & 0x7f);
+    const float2 dx = ddx(uv);
+    const float2 dy = ddy(uv);
+
+    [branch] if (!done) {
+      float4 tex = 1.f;
+      if ((color_word >> 31) != 0) tex = SampleStage(i, uv, dx, dy);
+      current.xyz = ApplyWord(color_word, diffuse, specular, current, tex).xyz;
+      if ((alpha_word & 0xff) > D3DTOP_DISABLE) {
+        current.a = ApplyWord(alpha_word, diffuse, specular, current, tex).a;
+      }
+    }
+  }
+  if (!AlphaTestPasses(ff_alpha_func, current.a)) discard;
+  return current;
+}
@@ -1,11 +1,65 @@
 #include "common.hlsl"
 
+#ifdef BINDLESS_TEXTURES
+// The whole SRV and sampler heaps are bound as unbounded tables. Each texture
+// stage gets its heap indices through root constants (see
+// Device::InitRootSignatures).
+cbuffer BindlessIndices : register(b11) {
+  uint4 g_texture_indices[2];
+  uint4 g_sampler_indices[2];
+};
+
+Texture2D<float4> g_textures[] : register(t0, space1);
+TextureCube<float4> g_cube_textures[] : register(t0, space2);
+SamplerState g_samplers[] : register(s0, space1);
+
+#define TEXTURE_INDEX(stage) g_texture_indices[(stage) / 4][(stage) % 4]
+#define SAMPLER_INDEX(stage) g_sampler_indices[(stage) / 4][(stage) % 4]
+
+#define g_texture0 g_textures[TEXTURE_INDEX(0)]
+#define g_texture1 g_textures[TEXTURE_INDEX(1)]
+#define g_texture2 g_textures[TEXTURE_INDEX(2)]
+#define g_texture3 g_textures[TEXTURE_INDEX(3)]
+#define g_texture4 g_textures[TEXTURE_INDEX(4)]
+#define g_texture5 g_textures[TEXTURE_INDEX(5)]
+#define g_texture6 g_textures[TEXTURE_INDEX(6)]
+#define g_texture7 g_textures[TEXTURE_INDEX(7)]
+
+#define g_texCube0 g_cube_textures[TEXTURE_INDEX(0)]
+#define g_texCube1 g_cube_textures[TEXTURE_INDEX(1)]
+#define g_texCube2 g_cube_textures[TEXTURE_INDEX(2)]
+#define g_texCube3 g_cube_textures[TEXTURE_INDEX(3)]
+#define g_texCube4 g_cube_textures[TEXTURE_INDEX(4)]
+#define g_texCube5 g_cube_textures[TEXTURE_INDEX(5)]
+#define g_texCube6 g_cube_textures[TEXTURE_INDEX(6)]
+#define g_texCube7 g_cube_textures[TEXTURE_INDEX(7)]
+
+#define g_sampler0 g_samplers[SAMPLER_INDEX(0)]
+#define g_sampler1 g_samplers[SAMPLER_INDEX(1)]
+#define g_sampler2 g_samplers[SAMPLER_INDEX(2)]
+#define g_sampler3 g_samplers[SAMPLER_INDEX(3)]
+#define g_sampler4 g_samplers[SAMPLER_INDEX(4)]
+#define g_sampler5 g_samplers[SAMPLER_INDEX(5)]
+#define g_sampler6 g_samplers[SAMPLER_INDEX(6)]
+#define g_sampler7 g_samplers[SAMPLER_INDEX(7)]
+#else
 Texture2D<float4> g_texture0 : register(t0);
 SamplerState g_sampler0 : register(s0);
 Texture2D<float4> g_texture1 : register(t1);
 SamplerState g_sampler1 : register(s1);
 Texture2D<float4> g_texture2 : register(t2);
 SamplerState g_sampler2 : register(s2);
+Texture2D<float4> g_texture3 : register(t3);
+SamplerState g_sampler3 : register(s3);
+Texture2D<float4> g_texture4 : register(t4);
+SamplerState g_sampler4 : register(s4);
+Texture2D<float4> g_texture5 : register(t5);
+SamplerState g_sampler5 : register(s5);
+Texture2D<float4> g_texture6 : register(t6);
+SamplerState g_sampler6 : register(s6);
+Texture2D<float4> g_texture7 : register(t7);
+SamplerState g_sampler7 : register(s7);
 
 TextureCube<float4> g_texCube0 : register(t0);
-TextureCube<float4> g_texCube1 : register(t1);
\ No newline at end of file
+TextureCube<float4> g_texCube1 : register(t1);
+#endif
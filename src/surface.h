@@ -82,6 +82,7 @@ class CpuSurface : public BaseSurface {
   }
 
   int compact_pitch() const { return compact_pitch_; }
+  CpuTexture* texture() { return texture_.get(); }
 
  private:
   CpuSurface(CpuTexture* texture, int level,
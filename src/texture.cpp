@@ -2,12 +2,15 @@
 
 #include <d3d12.h>
 
+#include <algorithm>
 #include <bit>
 #include <cstdint>
 
 #include "aixlog.hpp"
 #include "device.h"
 #include "surface.h"
+#include "texture_deduplicator.h"
+#include "texture_uploader.h"
 #include "util.h"
 
 namespace Dx8to12 {
@@ -53,55 +56,74 @@ BaseTexture *BaseTexture::Create(Device *device, TextureKind kind,
     resource_desc.Flags |= D3D12_RESOURCE_FLAG_ALLOW_RENDER_TARGET;
   if (d3d8_usage & D3DUSAGE_DEPTHSTENCIL)
     resource_desc.Flags |= D3D12_RESOURCE_FLAG_ALLOW_DEPTH_STENCIL;
+  // Converted formats are only ever written by the CPU.
+  if (GetFormatConversion(format) != FormatConversion::kNone &&
+      (d3d8_usage & (D3DUSAGE_RENDERTARGET | D3DUSAGE_DEPTHSTENCIL)) != 0)
+    return nullptr;
   if (pool == D3DPOOL_SYSTEMMEM) {
-    return new CpuTexture(device, kind, d3d8_usage, resource_desc);
-  } else {
-    if (HasFlag(d3d8_usage, D3DUSAGE_DYNAMIC)) {
-      FAIL("Dynamic textures are untested.");
-      // return new DynamicTexture(device, kind, d3d8_usage, resource_desc);
-    } else {
-      return new GpuTexture(device, kind, d3d8_usage, pool, resource_desc);
-    }
+    return new CpuTexture(device, kind, d3d8_usage, format, resource_desc);
+  }
+  if (HasFlag(d3d8_usage, D3DUSAGE_DYNAMIC)) {
+    return DynamicTexture::Create(device, kind, d3d8_usage, format,
+                                  resource_desc);
   }
+  return new GpuTexture(device, kind, d3d8_usage, pool, format, resource_desc);
 }
 
 BaseTexture::BaseTexture(Device *device, TextureKind kind, Dx8::Usage usage,
-                         D3DPOOL pool, const D3D12_RESOURCE_DESC &resource_desc)
+                         D3DPOOL pool, D3DFORMAT d3d8_format,
+                         const D3D12_RESOURCE_DESC &resource_desc)
     : device_(device),
       kind_(kind),
       usage_(usage),
       pool_(pool),
-      resource_desc_(resource_desc) {
-  // Grab all copyable footprints.
+      resource_desc_(resource_desc),
+      d3d8_format_(d3d8_format),
+      conversion_(GetFormatConversion(d3d8_format)) {
+  // Grab all copyable footprints. For block-compressed formats, their widths
+  // and heights are rounded up to whole blocks, and their rows are rows of
+  // blocks.
   footprints_.resize(resource_desc_.DepthOrArraySize *
                      resource_desc_.MipLevels);
   gpu_slice_sizes_.resize(footprints_.size());
-  std::unique_ptr<uint64_t[]> gpu_row_strides(new uint64_t[footprints_.size()]);
   device_->device()->GetCopyableFootprints(
       &resource_desc_, 0, footprints_.size(), 0, footprints_.data(),
-      gpu_slice_sizes_.data(), gpu_row_strides.get(), nullptr);
+      gpu_slice_sizes_.data(), nullptr, nullptr);
+  lock_format_ =
+      conversion_ != FormatConversion::kNone
+          ? BlockFormat{.block_dim = 1,
+                        .block_size = static_cast<uint32_t>(
+                            SourceTexelSize(conversion_))}
+          : GetBlockFormat(footprints_[0].Footprint.Format);
   compact_pitches_.resize(footprints_.size());
   compact_offsets_.resize(footprints_.size());
-  const int format_size = DXGIFormatSize(resource_desc_.Format);
   size_t num_bytes = 0;
   for (size_t i = 0; i < footprints_.size(); ++i) {
+    const LevelLayout layout = GetLockLayout(i);
     compact_offsets_[i] = num_bytes;
     // SOME games choose not to respect the row pitch that you give them, and
     // decide to compute their own pitch values.
-    compact_pitches_[i] = footprints_[i].Footprint.Width * format_size;
-    gpu_slice_sizes_[i] *= (uint32_t)gpu_row_strides[i];
+    compact_pitches_[i] = layout.row_pitch;
+    // The footprint's rows, padded to RowPitch.
+    gpu_slice_sizes_[i] *= footprints_[i].Footprint.RowPitch;
 
-    num_bytes += compact_pitches_[i] * footprints_[i].Footprint.Height;
+    num_bytes += layout.size;
   }
   total_compact_size_ = num_bytes;
 }
 
+LevelLayout BaseTexture::GetLockLayout(uint32_t subresource) const {
+  return GetLevelLayout(lock_format_,
+                        static_cast<uint32_t>(resource_desc_.Width),
+                        resource_desc_.Height,
+                        subresource % resource_desc_.MipLevels);
+}
+
 D3DSURFACE_DESC BaseTexture::GetSurfaceDesc(uint32_t subresource) const {
   ASSERT(subresource < footprints_.size());
-  const D3D12_SUBRESOURCE_FOOTPRINT &footprint =
-      footprints_[subresource].Footprint;
+  const LevelLayout layout = GetLockLayout(subresource);
   D3DSURFACE_DESC desc, *pDesc = &desc;
-  pDesc->Format = DXGIToD3DFormat(resource_desc_.Format);
+  pDesc->Format = d3d8_format_;
   pDesc->Type = D3DRTYPE_TEXTURE;
   pDesc->Usage = usage_;
   if (resource_desc_.Flags & D3D12_RESOURCE_FLAG_ALLOW_RENDER_TARGET)
@@ -109,12 +131,13 @@ D3DSURFACE_DESC BaseTexture::GetSurfaceDesc(uint32_t subresource) const {
   if (resource_desc_.Flags & D3D12_RESOURCE_FLAG_ALLOW_DEPTH_STENCIL)
     pDesc->Usage |= D3DUSAGE_DEPTHSTENCIL;
   pDesc->Pool = pool_;
-  // TODO: This isn't technically correct - we should report the real surface
-  // size.
-  pDesc->Size = footprint.RowPitch * footprint.Height;
+  // The size of the level as the application sees it when locking.
+  pDesc->Size = layout.size;
   pDesc->MultiSampleType = D3DMULTISAMPLE_NONE;
-  pDesc->Width = footprint.Width;
-  pDesc->Height = footprint.Height;
+  // Block-compressed footprints are padded to whole blocks. Report the real
+  // size of the level.
+  pDesc->Width = layout.width;
+  pDesc->Height = layout.height;
   return *pDesc;
 }
 
@@ -131,11 +154,16 @@ DWORD STDMETHODCALLTYPE BaseTexture::GetLevelCount() {
 }
 
 CpuTexture::CpuTexture(Device *device, TextureKind kind, Dx8::Usage usage,
+                       D3DFORMAT d3d8_format,
                        const D3D12_RESOURCE_DESC &resource_desc)
-    : BaseTexture(device, kind, usage, D3DPOOL_SYSTEMMEM, resource_desc) {
+    : BaseTexture(device, kind, usage, D3DPOOL_SYSTEMMEM, d3d8_format,
+                  resource_desc),
+      dirty_regions_(footprints_.size(),
+                     DirtyRegion(kMaxDirtyRectsPerLevel)) {
   data_.reset(new char[total_compact_size_]);
   ASSERT(data_);
   memset(data_.get(), 0, total_compact_size_);
+  for (uint32_t i = 0; i < footprints_.size(); ++i) MarkDirty(i, nullptr);
 }
 
 HRESULT STDMETHODCALLTYPE CpuTexture::LockRect(UINT Level,
@@ -144,12 +172,82 @@ HRESULT STDMETHODCALLTYPE CpuTexture::LockRect(UINT Level,
   TRACE_ENTRY(this, resource_desc_.Width, resource_desc_.Height, Level,
               pLockedRect, pRect, Flags);
   if (Level >= footprints_.size()) return D3DERR_INVALIDCALL;
-  ASSERT(pRect == nullptr);
+  char *bits = data_.get() + compact_offsets_[Level];
+  if (pRect != nullptr) {
+    // Rects of block-compressed levels have to start on a block.
+    const D3DSURFACE_DESC desc = GetSurfaceDesc(Level);
+    const LONG block_dim = lock_format_.block_dim;
+    if (pRect->left < 0 || pRect->top < 0 || pRect->left >= pRect->right ||
+        pRect->top >= pRect->bottom ||
+        pRect->right > static_cast<LONG>(desc.Width) ||
+        pRect->bottom > static_cast<LONG>(desc.Height) ||
+        pRect->left % block_dim != 0 || pRect->top % block_dim != 0)
+      return D3DERR_INVALIDCALL;
+    bits += CompactBlockOffset(lock_format_, compact_pitches_[Level],
+                               pRect->left, pRect->top);
+  }
+  if (!HasFlag(Flags, D3DLOCK_READONLY) &&
+      !HasFlag(Flags, D3DLOCK_NO_DIRTY_UPDATE))
+    MarkDirty(Level, pRect);
   *pLockedRect = D3DLOCKED_RECT{.Pitch = compact_pitches_[Level],
-                                .pBits = data_.get() + compact_offsets_[Level]};
+                                .pBits = bits};
+  return S_OK;
+}
+
+HRESULT STDMETHODCALLTYPE CpuTexture::AddDirtyRect(CONST RECT *pDirtyRect) {
+  return AddDirtyRect(D3DCUBEMAP_FACE_POSITIVE_X, pDirtyRect);
+}
+
+HRESULT STDMETHODCALLTYPE CpuTexture::AddDirtyRect(D3DCUBEMAP_FACES FaceType,
+                                                   CONST RECT *pDirtyRect) {
+  if (FaceType >= resource_desc_.DepthOrArraySize) return D3DERR_INVALIDCALL;
+  // Like D3D8, the rect is in level 0, and the same part of every other level
+  // is dirty too.
+  for (uint32_t mip = 0; mip < resource_desc_.MipLevels; ++mip) {
+    const uint32_t subresource =
+        CalcSubresourceIndex(FaceType, mip, resource_desc_.MipLevels);
+    if (pDirtyRect == nullptr) {
+      MarkDirty(subresource, nullptr);
+      continue;
+    }
+    const LONG round_up = (1 << mip) - 1;
+    const RECT scaled = {.left = pDirtyRect->left >> mip,
+                         .top = pDirtyRect->top >> mip,
+                         .right = (pDirtyRect->right + round_up) >> mip,
+                         .bottom = (pDirtyRect->bottom + round_up) >> mip};
+    MarkDirty(subresource, &scaled);
+  }
   return S_OK;
 }
 
+void CpuTexture::MarkDirty(uint32_t subresource, const RECT *rect) {
+  const D3D12_SUBRESOURCE_FOOTPRINT &footprint =
+      footprints_[subresource].Footprint;
+  if (rect == nullptr) {
+    dirty_regions_[subresource].Add({.left = 0,
+                                     .top = 0,
+                                     .right = footprint.Width,
+                                     .bottom = footprint.Height});
+    return;
+  }
+  // Widen the rect to whole blocks. Footprints are already a whole number of
+  // blocks.
+  const int block_dim = DXGIFormatBlockDim(footprint.Format);
+  auto clamp = [](LONG value, uint32_t max) {
+    return std::min(static_cast<uint32_t>(std::max<LONG>(value, 0)), max);
+  };
+  const uint32_t left = clamp(rect->left, footprint.Width);
+  const uint32_t top = clamp(rect->top, footprint.Height);
+  const uint32_t right = clamp(rect->right, footprint.Width);
+  const uint32_t bottom = clamp(rect->bottom, footprint.Height);
+  dirty_regions_[subresource].Add(
+      {.left = left / block_dim * block_dim,
+       .top = top / block_dim * block_dim,
+       .right = safe_cast<uint32_t>(AlignUp(safe_cast<int>(right), block_dim)),
+       .bottom =
+           safe_cast<uint32_t>(AlignUp(safe_cast<int>(bottom), block_dim))});
+}
+
 HRESULT STDMETHODCALLTYPE CpuTexture::UnlockRect(UINT Level) {
   if (Level >= footprints_.size()) return D3DERR_INVALIDCALL;
   // TODO: Check if actually locked.
@@ -163,7 +261,7 @@ HRESULT STDMETHODCALLTYPE CpuTexture::LockRect(D3DCUBEMAP_FACES FaceType,
   if (FaceType > D3DCUBEMAP_FACE_NEGATIVE_Z ||
       Level >= resource_desc_.MipLevels)
     return D3DERR_INVALIDCALL;
-  ASSERT(pRect == nullptr && kind_ == TextureKind::Cube);
+  ASSERT(kind_ == TextureKind::Cube);
   // Hackily use 2D texture's LockRect.
   return LockRect(
       CalcSubresourceIndex(FaceType, Level, resource_desc_.MipLevels),
@@ -206,59 +304,87 @@ STDMETHODIMP CpuTexture::GetCubeMapSurface(
 void CpuTexture::CopyToGpuTexture(GpuTexture *dest) {
   ASSERT(dest->kind() == kind_);
   for (uint32_t i = 0; i < footprints_.size(); ++i) {
-    D3D12_TEXTURE_COPY_LOCATION dst_location{
-        .pResource = dest->resource(),
-        .Type = D3D12_TEXTURE_COPY_TYPE_SUBRESOURCE_INDEX,
-        .SubresourceIndex = i};
-    CopySubresourceToGpuTexture(i, dst_location);
+    CopySubresourceToGpuTexture(i, dest);
   }
 }
 
-void CpuTexture::CopySubresourceToGpuTexture(
-    uint32_t subresource, const D3D12_TEXTURE_COPY_LOCATION &dst_location) {
-  // First, copy over the data from our compact-pitch format to the pitch that
-  // the GPU expects (and also to the upload heap).
-  const D3D12_SUBRESOURCE_FOOTPRINT &footprint =
-      footprints_[subresource].Footprint;
-  const size_t num_bytes =
-      static_cast<size_t>(footprint.RowPitch * footprint.Height);
-  DynamicRingBuffer::Allocation ring_alloc =
-      device_->dynamic_ring_buffer()->Allocate(num_bytes);
-  char *source_ring_ptr =
-      device_->dynamic_ring_buffer()->GetCpuPtrFor(ring_alloc);
-  const uint32_t compact_pitch =
-      safe_cast<uint32_t>(compact_pitches_[subresource]);
-  if (compact_pitch == footprint.RowPitch)
-    memcpy(source_ring_ptr, data_.get() + compact_offsets_[subresource],
-           num_bytes);
-  else {
-    for (uint32_t i = 0; i < footprint.Height; ++i) {
-      memcpy(source_ring_ptr + i * footprint.RowPitch,
-             data_.get() + compact_offsets_[subresource] + i * compact_pitch,
-             compact_pitch);
-    }
+void CpuTexture::CopyDirtyRegionsToGpuTexture(GpuTexture *dest) {
+  ASSERT(dest->kind() == kind_);
+  for (uint32_t i = 0; i < footprints_.size(); ++i) {
+    CopyDirtyRegionsToGpuTexture(i, dest);
   }
-  // Issue the CopyTextureRegion.
-  D3D12_TEXTURE_COPY_LOCATION src_location{
-      .pResource = device_->dynamic_ring_buffer()->GetBackingResource(),
-      .Type = D3D12_TEXTURE_COPY_TYPE_PLACED_FOOTPRINT,
-      .PlacedFootprint = {.Offset = safe_cast<uint64_t>(ring_alloc.offset),
-                          .Footprint = footprint}};
+}
+
+void CpuTexture::CopyDirtyRegionsToGpuTexture(uint32_t subresource,
+                                              GpuTexture *dest) {
+  // An evicted destination re-uploads all of us (and clears every region)
+  // before we look at this one.
+  dest->MakeResident();
+  DirtyRegion &region = dirty_regions_[subresource];
+  if (region.empty()) return;
+  for (const DirtyRect &rect : region.rects()) {
+    device_->texture_uploader()->UploadRegion(
+        dest, subresource, footprints_[subresource].Footprint,
+        data_.get() + compact_offsets_[subresource],
+        compact_pitches_[subresource], conversion_,
+        D3D12_BOX{.left = rect.left,
+                  .top = rect.top,
+                  .front = 0,
+                  .right = rect.right,
+                  .bottom = rect.bottom,
+                  .back = 1});
+  }
+  region.Clear();
+}
 
-  device_->cmd_list()->CopyTextureRegion(&dst_location, 0, 0, 0, &src_location,
-                                         nullptr);
+bool CpuTexture::has_dirty_regions() const {
+  return std::any_of(dirty_regions_.begin(), dirty_regions_.end(),
+                     [](const DirtyRegion &region) { return !region.empty(); });
 }
 
+void CpuTexture::CopySubresourceToGpuTexture(uint32_t subresource,
+                                             GpuTexture *dest) {
+  // The uploader moves our compact-pitch data to the pitch that the GPU
+  // expects, expanding converted formats on the way.
+  device_->texture_uploader()->Upload(
+      dest, subresource, footprints_[subresource].Footprint,
+      data_.get() + compact_offsets_[subresource],
+      compact_pitches_[subresource], conversion_);
+  dirty_regions_[subresource].Clear();
+}
+
+GpuTexture::GpuTexture(Device *device, TextureKind kind, Dx8::Usage usage,
+                       D3DPOOL pool, D3DFORMAT d3d8_format,
+                       const D3D12_RESOURCE_DESC &resource_desc)
+    : GpuTexture(device, kind, usage, pool, d3d8_format, resource_desc,
+                 kGpuLocalHeapProps) {}
+
 GpuTexture::GpuTexture(Device *device, TextureKind kind, Dx8::Usage usage,
-                       D3DPOOL pool, const D3D12_RESOURCE_DESC &resource_desc)
-    : BaseTexture(device, kind, usage, pool, resource_desc) {
+                       D3DPOOL pool, D3DFORMAT d3d8_format,
+                       const D3D12_RESOURCE_DESC &resource_desc,
+                       const D3D12_HEAP_PROPERTIES &heap_props)
+    : BaseTexture(device, kind, usage, pool, d3d8_format, resource_desc) {
   ASSERT(pool_ == D3DPOOL_DEFAULT || pool_ == D3DPOOL_MANAGED);
 
   if (pool_ == D3DPOOL_MANAGED && !kDisableManagedResources) {
-    cpu_tex_ = ComOwn(new CpuTexture(device, kind, usage, resource_desc_));
+    cpu_tex_ = ComOwn(
+        new CpuTexture(device, kind, usage, d3d8_format_, resource_desc_));
+  }
+
+  gpu_size_ = GetAllocationSize(resource_desc_);
+  device_->MakeRoomForTexture(gpu_size_);
+  CreateResource(heap_props);
+  if (cpu_tex_) {
+    residency_handle_ =
+        device_->residency().Add(this, gpu_size_, device_->CurrentFrame());
+  } else {
+    device_->residency().AddPinnedBytes(gpu_size_);
   }
 
-  D3D12_HEAP_PROPERTIES heap_props{.Type = D3D12_HEAP_TYPE_DEFAULT};
+  InitViews();
+}
+
+void GpuTexture::CreateResource(const D3D12_HEAP_PROPERTIES &heap_props) {
   D3D12_HEAP_FLAGS heap_flags = D3D12_HEAP_FLAG_NONE;
   if (HasFlag(usage_, D3DUSAGE_DEPTHSTENCIL))
     current_state_ = D3D12_RESOURCE_STATE_DEPTH_WRITE;
@@ -276,13 +402,12 @@ GpuTexture::GpuTexture(Device *device, TextureKind kind, Dx8::Usage usage,
   ASSERT_HR(device_->device()->CreateCommittedResource(
       &heap_props, heap_flags, &resource_desc_, current_state_, p_clear_value,
       IID_PPV_ARGS(resource_.GetForInit())));
-
-  InitViews();
 }
 
 GpuTexture::GpuTexture(Device *device, ComPtr<ID3D12Resource> resource)
     : BaseTexture(device, TextureKind::Texture2d, D3DUSAGE_RENDERTARGET,
-                  D3DPOOL_DEFAULT, resource->GetDesc()),
+                  D3DPOOL_DEFAULT, DXGIToD3DFormat(resource->GetDesc().Format),
+                  resource->GetDesc()),
       resource_(resource),
       current_state_(D3D12_RESOURCE_STATE_COMMON) {
   InitViews();
@@ -291,18 +416,7 @@ GpuTexture::GpuTexture(Device *device, ComPtr<ID3D12Resource> resource)
 void GpuTexture::InitViews() {
   // Allocate a spot in the SRV heap.
   if (!HasFlag(usage_, D3DUSAGE_DEPTHSTENCIL)) {
-    srv_handle_ = device_->srv_heap().Allocate();
-    D3D12_SHADER_RESOURCE_VIEW_DESC srv_desc{
-        .Format = resource_desc_.Format,
-        .ViewDimension = kTextureKindToSrvDimension[static_cast<int>(kind_)],
-        .Shader4ComponentMapping = D3D12_DEFAULT_SHADER_4_COMPONENT_MAPPING,
-        // Hacky, but TextureCube and Texture2D share the same layout.
-        .TextureCube = {
-            .MostDetailedMip = 0,
-            .MipLevels = resource_desc_.MipLevels,
-        }};
-    device_->device()->CreateShaderResourceView(resource_.get(), &srv_desc,
-                                                srv_handle_);
+    srv_handle_ = CreateSrv(resource_.get());
   }
   // Allocate an RTV.
   if (HasFlag(usage_, D3DUSAGE_RENDERTARGET)) {
@@ -314,7 +428,7 @@ void GpuTexture::InitViews() {
         .Texture2D = {.MipSlice = 0, .PlaneSlice = 0}};
     rtv_handle_ = device_->rtv_heap()->Allocate();
     device_->device()->CreateRenderTargetView(resource_.get(), &rtv_desc,
-                                              rtv_handle_);
+                                              rtv_handle_.cpu);
   }
   // And a DSV.
   if (HasFlag(usage_, D3DUSAGE_DEPTHSTENCIL)) {
@@ -327,13 +441,46 @@ void GpuTexture::InitViews() {
         .Texture2D = {}};
     dsv_handle_ = device_->dsv_heap()->Allocate();
     device_->device()->CreateDepthStencilView(resource_.get(), &dsv_desc,
-                                              dsv_handle_);
+                                              dsv_handle_.cpu);
   }
 }
 
+DescriptorHandle GpuTexture::CreateSrv(ID3D12Resource *resource) {
+  DescriptorHandle srv_handle = device_->srv_heap().Allocate();
+  WriteSrv(resource, srv_handle.cpu);
+  return srv_handle;
+}
+
+void GpuTexture::WriteSrv(ID3D12Resource *resource,
+                          D3D12_CPU_DESCRIPTOR_HANDLE srv_handle) {
+  D3D12_SHADER_RESOURCE_VIEW_DESC srv_desc{
+      // Transcoded textures are viewed with their block-compressed format.
+      .Format = resource->GetDesc().Format,
+      .ViewDimension = kTextureKindToSrvDimension[static_cast<int>(kind_)],
+      .Shader4ComponentMapping = GetSrvComponentMapping(d3d8_format_),
+      // Hacky, but TextureCube and Texture2D share the same layout.
+      .TextureCube = {
+          .MostDetailedMip = 0,
+          .MipLevels = resource_desc_.MipLevels,
+      }};
+  device_->device()->CreateShaderResourceView(resource, &srv_desc, srv_handle);
+}
+
 GpuTexture::~GpuTexture() {
-  if (srv_handle_.ptr != 0) device_->srv_heap().Free(srv_handle_);
-  if (rtv_handle_.ptr != 0) device_->rtv_heap()->Free(rtv_handle_);
+  if (dedup_state_ == DedupState::kShared) {
+    // The SRV belongs to the group of textures that share it.
+    device_->texture_deduplicator()->RemoveFromGroup(this);
+    srv_handle_ = {};
+  } else if (dedup_state_ == DedupState::kHashed) {
+    device_->texture_deduplicator()->Forget(this);
+  }
+  if (is_evictable()) {
+    device_->residency().Remove(residency_handle_);
+  } else {
+    device_->residency().RemovePinnedBytes(gpu_size_);
+  }
+  if (srv_handle_.cpu.ptr != 0) device_->srv_heap().Free(srv_handle_);
+  if (rtv_handle_.cpu.ptr != 0) device_->rtv_heap()->Free(rtv_handle_);
   srv_handle_ = {};
 }
 
@@ -345,6 +492,156 @@ void GpuTexture::SetName(const std::string &name) {
 #endif
 }
 
+void GpuTexture::Evict() {
+  ASSERT(is_evictable() && !is_evicted());
+  // Shared copies stay with the other textures. Either way, the texture gets
+  // hashed again once it is back.
+  if (dedup_state_ == DedupState::kShared) {
+    LeaveSharedResource();
+    dedup_state_ = DedupState::kNone;
+    return;
+  }
+  if (dedup_state_ == DedupState::kHashed) {
+    device_->texture_deduplicator()->Forget(this);
+    dedup_state_ = DedupState::kNone;
+  }
+  // Keep the SRV slot. MakeResident points it at the new resource.
+  resource_.Reset();
+  // It comes back uncompressed.
+  if (transcode_state_ == TranscodeState::kDone) {
+    transcode_state_ = TranscodeState::kNone;
+    gpu_size_ = GetAllocationSize(resource_desc_);
+    device_->residency().Resize(residency_handle_, gpu_size_);
+  }
+}
+
+void GpuTexture::MakeResident() {
+  if (!is_evicted()) return;
+  LOG(TRACE) << "Making texture " << std::hex << this << " resident.\n";
+  device_->MakeRoomForTexture(gpu_size_);
+  CreateResource(kGpuLocalHeapProps);
+  WriteSrv(resource_.get(), srv_handle_.cpu);
+  device_->residency().MakeResident(residency_handle_, device_->CurrentFrame());
+  // Re-upload everything from the CPU copy.
+  cpu_tex_->CopyToGpuTexture(this);
+}
+
+bool GpuTexture::CanTranscode() const {
+  return is_evictable() && kind_ == TextureKind::Texture2d &&
+         conversion_ == FormatConversion::kNone &&
+         (resource_desc_.Format == DXGI_FORMAT_B8G8R8A8_UNORM ||
+          resource_desc_.Format == DXGI_FORMAT_B8G8R8X8_UNORM) &&
+         resource_desc_.Width % 4 == 0 && resource_desc_.Height % 4 == 0 &&
+         resource_desc_.Width * resource_desc_.Height >= kTranscodeMinTexels;
+}
+
+void GpuTexture::SwapInTranscoded(
+    DXGI_FORMAT format, const std::vector<std::vector<uint8_t>> &levels) {
+  ASSERT(transcode_state_ == TranscodeState::kQueued && !is_evicted());
+  ASSERT(levels.size() == footprints_.size());
+  D3D12_RESOURCE_DESC desc = resource_desc_;
+  desc.Format = format;
+  std::vector<D3D12_PLACED_SUBRESOURCE_FOOTPRINT> footprints(levels.size());
+  device_->device()->GetCopyableFootprints(
+      &desc, 0, safe_cast<UINT>(footprints.size()), 0, footprints.data(),
+      nullptr, nullptr, nullptr);
+  ReplaceResource(desc);
+  transcode_state_ = TranscodeState::kDone;
+  for (uint32_t i = 0; i < footprints.size(); ++i) {
+    const D3D12_SUBRESOURCE_FOOTPRINT &footprint = footprints[i].Footprint;
+    device_->texture_uploader()->Upload(
+        this, i, footprint, reinterpret_cast<const char *>(levels[i].data()),
+        safe_cast<int>(CompactRowPitch(format, footprint.Width)),
+        FormatConversion::kNone);
+  }
+}
+
+void GpuTexture::StopTranscoding() {
+  if (transcode_state_ == TranscodeState::kNone) return;
+  if (transcode_state_ == TranscodeState::kDone) {
+    ReplaceResource(resource_desc_);
+    cpu_tex_->CopyToGpuTexture(this);
+  }
+  transcode_state_ = TranscodeState::kNever;
+}
+
+bool GpuTexture::CanDeduplicate() const {
+  return is_evictable() && cpu_tex_ &&
+         conversion_ != FormatConversion::kP8ToB8G8R8A8 &&
+         (transcode_state_ == TranscodeState::kNone ||
+          transcode_state_ == TranscodeState::kNever);
+}
+
+void GpuTexture::ShareResourceOf(GpuTexture *source) {
+  ASSERT(!is_evicted() && !source->is_evicted());
+  device_->RetireTexture(std::move(resource_), srv_handle_);
+  resource_ = source->resource_;
+  srv_handle_ = source->srv_handle_;
+  current_state_ = source->current_state_;
+  copy_queue_value_ = source->copy_queue_value_;
+  set_gpu_size(0);
+  dedup_state_ = DedupState::kShared;
+  device_->RebindTexture(this);
+}
+
+void GpuTexture::StopSharing() {
+  const DedupWrite write = DedupStateForWrite(dedup_state_);
+  if (write.leave_group) {
+    LOG(TRACE) << "Unsharing texture " << std::hex << this << ".\n";
+    LeaveSharedResource();
+    // Growing may go over the budget until the next MakeRoomForTexture.
+    CreateResource(kGpuLocalHeapProps);
+    WriteSrv(resource_.get(), srv_handle_.cpu);
+    cpu_tex_->CopyToGpuTexture(this);
+  }
+  if (write.forget_hash) device_->texture_deduplicator()->Forget(this);
+  if (write.cancel_job) ++dedup_generation_;
+  dedup_state_ = write.next_state;
+}
+
+void GpuTexture::set_gpu_size(uint64_t num_bytes) {
+  gpu_size_ = num_bytes;
+  device_->residency().Resize(residency_handle_, gpu_size_);
+}
+
+void GpuTexture::LeaveSharedResource() {
+  ASSERT(dedup_state_ == DedupState::kShared);
+  // The group keeps the shared copy alive for draws that were already
+  // recorded.
+  device_->texture_deduplicator()->RemoveFromGroup(this);
+  resource_.Reset();
+  srv_handle_ = device_->srv_heap().Allocate();
+  set_gpu_size(GetAllocationSize(resource_desc_));
+  device_->RebindTexture(this);
+}
+
+void GpuTexture::RefreshPalette() {
+  if (conversion_ != FormatConversion::kP8ToB8G8R8A8 || !cpu_tex_) return;
+  uint64_t generation;
+  device_->CurrentPaletteColors(&generation);
+  if (generation == palette_generation_) return;
+  LOG(TRACE) << "Re-expanding P8 texture " << std::hex << this << ".\n";
+  cpu_tex_->CopyToGpuTexture(this);
+}
+
+void GpuTexture::ReplaceResource(const D3D12_RESOURCE_DESC &desc) {
+  ASSERT(!is_evicted());
+  device_->RetireTexture(std::move(resource_), srv_handle_);
+  current_state_ = D3D12_RESOURCE_STATE_COMMON;
+  ASSERT_HR(device_->device()->CreateCommittedResource(
+      &kGpuLocalHeapProps, D3D12_HEAP_FLAG_NONE, &desc, current_state_,
+      nullptr, IID_PPV_ARGS(resource_.GetForInit())));
+  srv_handle_ = CreateSrv(resource_.get());
+  // Growing may go over the budget until the next MakeRoomForTexture.
+  gpu_size_ = GetAllocationSize(desc);
+  device_->residency().Resize(residency_handle_, gpu_size_);
+  device_->RebindTexture(this);
+}
+
+uint64_t GpuTexture::GetAllocationSize(const D3D12_RESOURCE_DESC &desc) const {
+  return device_->device()->GetResourceAllocationInfo(0, 1, &desc).SizeInBytes;
+}
+
 GpuTexture *GpuTexture::InitFromResource(Device *device,
                                          ComPtr<ID3D12Resource> resource) {
   return new GpuTexture(device, resource);
@@ -358,11 +655,15 @@ HRESULT STDMETHODCALLTYPE GpuTexture::LockRect(UINT Level,
   if (pool_ != D3DPOOL_MANAGED || Level >= footprints_.size()) {
     return D3DERR_INVALIDCALL;
   }
-  ASSERT(pRect == nullptr);
+  if (!HasFlag(Flags, D3DLOCK_READONLY)) {
+    StopSharing();
+    StopTranscoding();
+  }
   if (kDisableManagedResources) {
     // Allocate the CPU texture now.
     if (!cpu_tex_)
-      cpu_tex_ = ComOwn(new CpuTexture(device_, kind_, usage_, resource_desc_));
+      cpu_tex_ = ComOwn(new CpuTexture(device_, kind_, usage_, d3d8_format_,
+                                       resource_desc_));
     else
       cpu_tex_->AddRef();
   }
@@ -374,16 +675,14 @@ HRESULT STDMETHODCALLTYPE GpuTexture::UnlockRect(UINT Level) {
   if (Level >= footprints_.size()) return D3DERR_INVALIDCALL;
   ASSERT(cpu_tex_);
   cpu_tex_->UnlockRect(Level);
-  // Copy over the CPU data to our resource.
-  D3D12_TEXTURE_COPY_LOCATION dst_location{
-      .pResource = resource_.get(),
-      .Type = D3D12_TEXTURE_COPY_TYPE_SUBRESOURCE_INDEX,
-      .SubresourceIndex = Level};
-  device_->TransitionTexture(this, Level, D3D12_RESOURCE_STATE_COPY_DEST);
-  cpu_tex_->CopySubresourceToGpuTexture(Level, dst_location);
-  // Issue a barrier (because CopySubresourceToGpuTexture does not).
-  device_->TransitionTexture(this, Level,
-                             D3D12_RESOURCE_STATE_ALL_SHADER_RESOURCE);
+  last_update_frame_ = device_->CurrentFrame();
+  if (is_evicted()) {
+    // The CPU copy is up to date, upload all of it.
+    MakeResident();
+    return S_OK;
+  }
+  // Copy over the parts of the CPU data that were locked.
+  cpu_tex_->CopyDirtyRegionsToGpuTexture(Level, this);
   device_->MarkResourceAsUsed(InternalPtr(this));
   if (kDisableManagedResources) {
     // Free the cpu texture.
@@ -392,6 +691,24 @@ HRESULT STDMETHODCALLTYPE GpuTexture::UnlockRect(UINT Level) {
   return S_OK;
 }
 
+HRESULT STDMETHODCALLTYPE GpuTexture::AddDirtyRect(CONST RECT *pDirtyRect) {
+  return AddDirtyRect(D3DCUBEMAP_FACE_POSITIVE_X, pDirtyRect);
+}
+
+HRESULT STDMETHODCALLTYPE GpuTexture::AddDirtyRect(D3DCUBEMAP_FACES FaceType,
+                                                   CONST RECT *pDirtyRect) {
+  if (pool_ != D3DPOOL_MANAGED) return D3DERR_INVALIDCALL;
+  // Without a CPU copy there is nothing to upload from.
+  if (!cpu_tex_) return S_OK;
+  StopSharing();
+  return cpu_tex_->AddDirtyRect(FaceType, pDirtyRect);
+}
+
+void GpuTexture::UploadDirtyRegions() {
+  if (!cpu_tex_ || is_evicted() || !cpu_tex_->has_dirty_regions()) return;
+  cpu_tex_->CopyDirtyRegionsToGpuTexture(this);
+}
+
 HRESULT STDMETHODCALLTYPE GpuTexture::LockRect(D3DCUBEMAP_FACES FaceType,
                                                UINT Level,
                                                D3DLOCKED_RECT *pLockedRect,
@@ -399,7 +716,7 @@ HRESULT STDMETHODCALLTYPE GpuTexture::LockRect(D3DCUBEMAP_FACES FaceType,
   if (FaceType > D3DCUBEMAP_FACE_NEGATIVE_Z ||
       Level >= resource_desc_.MipLevels)
     return D3DERR_INVALIDCALL;
-  ASSERT(pRect == nullptr && kind_ == TextureKind::Cube);
+  ASSERT(kind_ == TextureKind::Cube);
   // Hackily use 2D texture's LockRect.
   return LockRect(
       CalcSubresourceIndex(FaceType, Level, resource_desc_.MipLevels),
@@ -438,47 +755,184 @@ STDMETHODIMP GpuTexture::GetCubeMapSurface(
   return S_OK;
 }
 
-// WARNING: Dynamic textures are untested.
+DynamicTexture *DynamicTexture::Create(
+    Device *device, TextureKind kind, Dx8::Usage usage, D3DFORMAT d3d8_format,
+    const D3D12_RESOURCE_DESC &resource_desc) {
+  // Converted formats have to go through the uploader.
+  const bool use_per_frame_textures =
+      kDynamicTextureStrategy == DynamicTextureStrategy::kPerFrameTextures &&
+      kind == TextureKind::Texture2d && resource_desc.MipLevels == 1 &&
+      GetFormatConversion(d3d8_format) == FormatConversion::kNone;
+  return new DynamicTexture(device, kind, usage, d3d8_format, resource_desc,
+                            use_per_frame_textures);
+}
+
 DynamicTexture::DynamicTexture(Device *device, TextureKind kind,
-                               Dx8::Usage usage,
-                               const D3D12_RESOURCE_DESC &resource_desc)
-    : GpuTexture(device, kind, usage, D3DPOOL_DEFAULT, resource_desc) {}
+                               Dx8::Usage usage, D3DFORMAT d3d8_format,
+                               const D3D12_RESOURCE_DESC &resource_desc,
+                               bool use_per_frame_textures)
+    : GpuTexture(device, kind, usage, D3DPOOL_DEFAULT, d3d8_format,
+                 resource_desc,
+                 use_per_frame_textures ? kSystemMemHeapProps
+                                        : kGpuLocalHeapProps),
+      use_per_frame_textures_(use_per_frame_textures) {}
+
+DynamicTexture::~DynamicTexture() {
+  for (const RetiredTexture &texture : retired_textures_) {
+    device_->srv_heap().Free(texture.srv_handle);
+  }
+}
 
 HRESULT STDMETHODCALLTYPE DynamicTexture::LockRect(UINT Level,
                                                    D3DLOCKED_RECT *pLockedRect,
                                                    CONST RECT *pRect,
                                                    DWORD Flags) {
+  TRACE_ENTRY(this, resource_desc_.Width, resource_desc_.Height, Level,
+              pLockedRect, pRect, Flags);
   if (Level >= footprints_.size() ||
       (Level != 0 && HasFlag(Flags, D3DLOCK_DISCARD)))
     return D3DERR_INVALIDCALL;
-  ASSERT(HasFlag(Flags, D3DLOCK_DISCARD));
-  ASSERT(Level == 0);
   ASSERT(!is_locked_);
-  ASSERT(pRect == nullptr);
+  if (!GetLockRect(Level, pRect, &lock_rect_)) return D3DERR_INVALIDCALL;
   is_locked_ = true;
-  return cpu_tex_->LockRect(Level, pLockedRect, pRect, 0);
+  if (use_per_frame_textures_ || conversion_ != FormatConversion::kNone) {
+    // The staging copy keeps the rest of the level. Converted formats are
+    // written in the application's own layout, and expanded on unlock.
+    staging_.resize(total_compact_size_);
+    *pLockedRect = D3DLOCKED_RECT{
+        .Pitch = compact_pitches_[Level],
+        .pBits = staging_.data() + CompactOffset(Level, lock_rect_)};
+    return S_OK;
+  }
+  // Hand out a copyable footprint of the rect in the ring. The texture is
+  // updated with a single copy on unlock.
+  lock_footprint_ = footprints_[Level].Footprint;
+  lock_footprint_.Width = lock_rect_.right - lock_rect_.left;
+  lock_footprint_.Height = lock_rect_.bottom - lock_rect_.top;
+  lock_footprint_.RowPitch =
+      FootprintRowPitch(lock_footprint_.Format, lock_footprint_.Width);
+  DynamicRingBuffer *ring = device_->dynamic_ring_buffer();
+  lock_alloc_ = ring->Allocate(
+      static_cast<size_t>(lock_footprint_.RowPitch) *
+          NumBlockRows(lock_footprint_.Format, lock_footprint_.Height),
+      D3D12_TEXTURE_DATA_PLACEMENT_ALIGNMENT);
+  *pLockedRect =
+      D3DLOCKED_RECT{.Pitch = safe_cast<INT>(lock_footprint_.RowPitch),
+                     .pBits = ring->GetCpuPtrFor(lock_alloc_)};
+  return S_OK;
+}
+
+bool DynamicTexture::GetLockRect(UINT Level, const RECT *pRect,
+                                 RECT *rect) const {
+  const D3D12_SUBRESOURCE_FOOTPRINT &footprint = footprints_[Level].Footprint;
+  if (pRect == nullptr) {
+    *rect = {.left = 0,
+             .top = 0,
+             .right = safe_cast<LONG>(footprint.Width),
+             .bottom = safe_cast<LONG>(footprint.Height)};
+    return true;
+  }
+  // Like CpuTexture, rects of block-compressed levels have to start on a
+  // block.
+  const D3DSURFACE_DESC desc = GetSurfaceDesc(Level);
+  const int block_dim = lock_format_.block_dim;
+  if (pRect->left < 0 || pRect->top < 0 || pRect->left >= pRect->right ||
+      pRect->top >= pRect->bottom ||
+      pRect->right > static_cast<LONG>(desc.Width) ||
+      pRect->bottom > static_cast<LONG>(desc.Height) ||
+      pRect->left % block_dim != 0 || pRect->top % block_dim != 0)
+    return false;
+  // Footprints are a whole number of blocks, so this stays inside.
+  *rect = {.left = pRect->left,
+           .top = pRect->top,
+           .right = AlignUp(safe_cast<int>(pRect->right), block_dim),
+           .bottom = AlignUp(safe_cast<int>(pRect->bottom), block_dim)};
+  return true;
+}
+
+size_t DynamicTexture::CompactOffset(UINT Level, const RECT &rect) const {
+  return compact_offsets_[Level] +
+         CompactBlockOffset(lock_format_, compact_pitches_[Level], rect.left,
+                            rect.top);
 }
 
 HRESULT STDMETHODCALLTYPE DynamicTexture::UnlockRect(UINT Level) {
   if (Level >= footprints_.size()) return D3DERR_INVALIDCALL;
-  ASSERT(Level == 0);
   ASSERT(is_locked_);
-  // Allocate a texture in GPU ring buffer memory.
-  D3D12_PLACED_SUBRESOURCE_FOOTPRINT footprint = footprints_[Level];
-  DynamicRingBuffer::Allocation alloc =
-      device_->dynamic_gpu_ring_buffer()->Allocate(
-          gpu_slice_sizes_[Level], D3D12_DEFAULT_RESOURCE_PLACEMENT_ALIGNMENT);
-  footprint.Offset = safe_cast<UINT64>(alloc.offset);
-
-  // Copy the CPU buffer to our new GPU ring texture location.
-  D3D12_TEXTURE_COPY_LOCATION ring_location{
-      .pResource = device_->dynamic_gpu_ring_buffer()->GetBackingResource(),
-      .Type = D3D12_TEXTURE_COPY_TYPE_PLACED_FOOTPRINT,
-      .PlacedFootprint = footprint};
-  cpu_tex_->CopySubresourceToGpuTexture(Level, ring_location);
-
-  cpu_tex_->UnlockRect(Level);
   is_locked_ = false;
+  if (use_per_frame_textures_) {
+    UnlockPerFrameTexture();
+  } else {
+    UnlockRingCopy(Level);
+  }
   return S_OK;
 }
-}  // namespace Dx8to12
\ No newline at end of file
+
+void DynamicTexture::UnlockRingCopy(UINT Level) {
+  if (conversion_ != FormatConversion::kNone) {
+    device_->dynamic_texture_stats().bytes_copied_on_gpu +=
+        gpu_slice_sizes_[Level];
+    device_->texture_uploader()->UploadRegion(
+        this, Level, footprints_[Level].Footprint,
+        staging_.data() + compact_offsets_[Level], compact_pitches_[Level],
+        conversion_,
+        D3D12_BOX{.left = safe_cast<UINT>(lock_rect_.left),
+                  .top = safe_cast<UINT>(lock_rect_.top),
+                  .front = 0,
+                  .right = safe_cast<UINT>(lock_rect_.right),
+                  .bottom = safe_cast<UINT>(lock_rect_.bottom),
+                  .back = 1});
+    return;
+  }
+  device_->dynamic_texture_stats().bytes_copied_on_gpu += lock_alloc_.size;
+  DynamicRingBuffer *ring = device_->dynamic_ring_buffer();
+  const D3D12_PLACED_SUBRESOURCE_FOOTPRINT footprint = {
+      .Offset = safe_cast<UINT64>(lock_alloc_.offset),
+      .Footprint = lock_footprint_};
+  // Draws recorded before this point still see the previous contents.
+  device_->CopyBufferToTexture(
+      this, Level, safe_cast<uint32_t>(lock_rect_.left),
+      safe_cast<uint32_t>(lock_rect_.top),
+      ring->GetBackingResource(lock_alloc_), footprint);
+  lock_alloc_ = {};
+}
+
+void DynamicTexture::UnlockPerFrameTexture() {
+  RetiredTexture texture = AcquireFreeTexture();
+  ASSERT_HR(texture.resource->Map(0, nullptr, nullptr));
+  ASSERT_HR(texture.resource->WriteToSubresource(
+      0, nullptr, staging_.data(), safe_cast<UINT>(compact_pitches_[0]),
+      safe_cast<UINT>(total_compact_size_)));
+  texture.resource->Unmap(0, nullptr);
+  device_->dynamic_texture_stats().bytes_written_on_cpu += total_compact_size_;
+
+  // Draws recorded before this point keep sampling the previous texture through
+  // its own SRV. Retire it until the GPU is done with the current frame.
+  retired_textures_.push_back({.resource = std::move(resource_),
+                               .srv_handle = srv_handle_,
+                               .frame = device_->CurrentFrame()});
+  resource_ = std::move(texture.resource);
+  srv_handle_ = texture.srv_handle;
+  device_->RebindTexture(this);
+}
+
+DynamicTexture::RetiredTexture DynamicTexture::AcquireFreeTexture() {
+  const uint64_t completed_frame = device_->CompletedFrame();
+  for (auto iter = retired_textures_.begin(); iter != retired_textures_.end();
+       ++iter) {
+    if (iter->frame <= completed_frame) {
+      RetiredTexture texture = std::move(*iter);
+      retired_textures_.erase(iter);
+      return texture;
+    }
+  }
+  RetiredTexture texture = {};
+  ASSERT_HR(device_->device()->CreateCommittedResource(
+      &kSystemMemHeapProps, D3D12_HEAP_FLAG_NONE, &resource_desc_,
+      D3D12_RESOURCE_STATE_COMMON, nullptr,
+      IID_PPV_ARGS(texture.resource.GetForInit())));
+  texture.srv_handle = CreateSrv(texture.resource.get());
+  ++device_->dynamic_texture_stats().num_extra_textures;
+  return texture;
+}
+}  // namespace Dx8to12
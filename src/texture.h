@@ -8,7 +8,10 @@
 
 #include "d3d8.h"
 #include "dynamic_ring_buffer.h"
+#include "pool_heap.h"
 #include "util.h"
+#include "utils/dedup_state.h"
+#include "utils/dirty_region.h"
 #include "utils/dx_utils.h"
 
 namespace Dx8to12 {
@@ -35,10 +38,16 @@ class BaseTexture : public IDirect3DTexture8,
   D3DSURFACE_DESC GetSurfaceDesc(uint32_t subresource) const;
 
   TextureKind kind() const { return kind_; }
+  uint32_t num_subresources() const {
+    return static_cast<uint32_t>(footprints_.size());
+  }
+  FormatConversion conversion() const { return conversion_; }
+  // Size of all subresources at their compact pitches.
+  size_t total_compact_size() const { return total_compact_size_; }
 
  protected:
   BaseTexture(Device* device, TextureKind kind, Dx8::Usage usage, D3DPOOL pool,
-              const D3D12_RESOURCE_DESC& resource_desc);
+              D3DFORMAT d3d8_format, const D3D12_RESOURCE_DESC& resource_desc);
 
  public:
   /*** IUnknown methods ***/
@@ -88,6 +97,9 @@ class BaseTexture : public IDirect3DTexture8,
       D3DCUBEMAP_FACES FaceType, CONST RECT* pDirtyRect) VIRT_NOT_IMPLEMENTED;
 
  protected:
+  // Size and compact pitch of a subresource, as the application locks it.
+  LevelLayout GetLockLayout(uint32_t subresource) const;
+
   Device* device_;
   TextureKind kind_;
   Dx8::Usage usage_;
@@ -97,19 +109,42 @@ class BaseTexture : public IDirect3DTexture8,
   // One footprint per level.
   std::vector<D3D12_PLACED_SUBRESOURCE_FOOTPRINT> footprints_;
 
+  // The format the application created the texture with. DXGI formats don't
+  // round trip: DXT2 and DXT3 are both BC2, for example.
+  D3DFORMAT d3d8_format_;
+  // How locked texels are expanded to resource_desc_.Format on upload.
+  FormatConversion conversion_;
+  // Blocks of locked levels. For converted formats, these are texels of the
+  // D3D8 format.
+  BlockFormat lock_format_;
+
   // Some games expect the pitch to be width*Bpp. So we give it that pitch, and
-  // copy to the DX12 minimum pitch later.
+  // copy to the DX12 minimum pitch later. For block-compressed formats, this is
+  // the size of a row of blocks. For converted formats, Bpp is that of the D3D8
+  // format.
   std::vector<int> compact_pitches_;
   std::vector<int> compact_offsets_;
   size_t total_compact_size_;
 
-  // Actually per-slice offets when the texture is placed in its native tiling
-  // mode.
+  // Size of each subresource's copyable footprint, i.e. RowPitch times its
+  // number of rows (of blocks).
   std::vector<uint32_t> gpu_slice_sizes_;
 };
 
 class GpuTexture : public BaseTexture {
  public:
+  // Where a managed texture is in being swapped for a block-compressed copy by
+  // the device's TextureTranscoder.
+  enum class TranscodeState {
+    kNone,
+    kQueued,
+    // The GPU copy is block-compressed.
+    kDone,
+    // Not eligible, or locked again after being queued.
+    kNever,
+  };
+  using DedupState = ::Dx8to12::DedupState;
+
   ~GpuTexture() override;
 
   // Creates a texture from an existing resource. This is only used with the
@@ -118,17 +153,17 @@ class GpuTexture : public BaseTexture {
                                       ComPtr<ID3D12Resource> resource);
 
   ID3D12Resource* resource() { return resource_.get(); }
-  D3D12_CPU_DESCRIPTOR_HANDLE srv_handle() const {
-    ASSERT(srv_handle_.ptr != 0);
+  const DescriptorHandle& srv_handle() const {
+    ASSERT(srv_handle_.cpu.ptr != 0);
     return srv_handle_;
   }
   D3D12_CPU_DESCRIPTOR_HANDLE rtv_handle() const {
-    ASSERT(rtv_handle_.ptr != 0);
-    return rtv_handle_;
+    ASSERT(rtv_handle_.cpu.ptr != 0);
+    return rtv_handle_.cpu;
   }
   D3D12_CPU_DESCRIPTOR_HANDLE dsv_handle() const {
-    ASSERT(dsv_handle_.ptr != 0);
-    return dsv_handle_;
+    ASSERT(dsv_handle_.cpu.ptr != 0);
+    return dsv_handle_.cpu;
   }
 
   const D3D12_RESOURCE_DESC& resource_desc() const { return resource_desc_; }
@@ -140,6 +175,69 @@ class GpuTexture : public BaseTexture {
 
   void SetName(const std::string& name);
 
+  // Managed textures with a CPU copy can have their GPU copy evicted to stay
+  // within the device's texture budget. They are re-uploaded by MakeResident.
+  bool is_evictable() const { return residency_handle_ >= 0; }
+  bool is_evicted() const { return resource_.get() == nullptr; }
+  int residency_handle() const { return residency_handle_; }
+  // Only called by the device, once the GPU is done with the texture.
+  void Evict();
+  // Does nothing if the texture is resident.
+  void MakeResident();
+
+  // Managed 32-bit textures with sizes that are a multiple of 4.
+  bool CanTranscode() const;
+  TranscodeState transcode_state() const { return transcode_state_; }
+  void set_transcode_state(TranscodeState state) { transcode_state_ = state; }
+  // Replaces the GPU copy with block-compressed data, one compact level per
+  // subresource.
+  void SwapInTranscoded(DXGI_FORMAT format,
+                        const std::vector<std::vector<uint8_t>>& levels);
+  // Called before the contents change. Goes back to an uncompressed GPU copy,
+  // and makes sure the texture never gets transcoded again.
+  void StopTranscoding();
+  CpuTexture* cpu_texture() { return cpu_tex_.get(); }
+  // Frame of the last lock. Only textures that stay untouched get transcoded.
+  uint64_t last_update_frame() const { return last_update_frame_; }
+
+  // Managed textures with a CPU copy that is not expanded with a palette, and
+  // that are not being transcoded.
+  bool CanDeduplicate() const;
+  DedupState dedup_state() const { return dedup_state_; }
+  void set_dedup_state(DedupState state) { dedup_state_ = state; }
+  // Bumped whenever a queued hashing job goes stale.
+  uint32_t dedup_generation() const { return dedup_generation_; }
+  // Switches to source's GPU copy and SRV, which hold the same contents. The
+  // texture's own are retired.
+  void ShareResourceOf(GpuTexture* source);
+  // Called before the contents change. Gets the texture a GPU copy of its own
+  // back, and makes sure it never gets deduplicated again once it has been
+  // hashed (see DedupStateForWrite).
+  void StopSharing();
+  // How much of the texture budget the texture counts against. Shared GPU
+  // copies only count against one of the textures that share them.
+  uint64_t gpu_size() const { return gpu_size_; }
+  void set_gpu_size(uint64_t num_bytes);
+
+  // P8 textures are expanded with the texture palette that is current when
+  // they are uploaded. Re-expands the CPU copy if the palette has changed
+  // since. Textures without a CPU copy keep the colors they were uploaded with.
+  void RefreshPalette();
+  void set_palette_generation(uint64_t generation) {
+    palette_generation_ = generation;
+  }
+  // Uploads whatever AddDirtyRect marked since the last upload.
+  void UploadDirtyRegions();
+
+  // Last frame whose direct command list used the texture, and the copy queue
+  // batch that last uploaded to it (0 if none). See Device::BeginCopyUpload.
+  uint64_t last_direct_use_frame() const { return last_direct_use_frame_; }
+  void set_last_direct_use_frame(uint64_t frame) {
+    last_direct_use_frame_ = frame;
+  }
+  uint64_t copy_queue_value() const { return copy_queue_value_; }
+  void set_copy_queue_value(uint64_t value) { copy_queue_value_ = value; }
+
  public:
   ULONG STDMETHODCALLTYPE AddRef() override { return RefCounted::AddRef(); }
   ULONG STDMETHODCALLTYPE Release(THIS) override {
@@ -152,8 +250,8 @@ class GpuTexture : public BaseTexture {
                                              CONST RECT* pRect,
                                              DWORD Flags) override;
   virtual HRESULT STDMETHODCALLTYPE UnlockRect(UINT Level) override;
-  virtual HRESULT STDMETHODCALLTYPE AddDirtyRect(CONST RECT* pDirtyRect)
-      VIRT_NOT_IMPLEMENTED;
+  virtual HRESULT STDMETHODCALLTYPE
+  AddDirtyRect(CONST RECT* pDirtyRect) override;
 
   /*** IDirect3DCubeTexture8 methods ***/
   HRESULT STDMETHODCALLTYPE LockRect(D3DCUBEMAP_FACES FaceType, UINT Level,
@@ -163,6 +261,8 @@ class GpuTexture : public BaseTexture {
                                        UINT Level) override;
   STDMETHODIMP GetCubeMapSurface(D3DCUBEMAP_FACES FaceType, UINT Level,
                                  IDirect3DSurface8** ppCubeMapSurface) override;
+  HRESULT STDMETHODCALLTYPE AddDirtyRect(D3DCUBEMAP_FACES FaceType,
+                                         CONST RECT* pDirtyRect) override;
   using IDirect3DCubeTexture8::AddDirtyRect;
   using IDirect3DCubeTexture8::LockRect;
   using IDirect3DCubeTexture8::UnlockRect;
@@ -170,12 +270,20 @@ class GpuTexture : public BaseTexture {
  protected:
   GpuTexture(Device* device, ComPtr<ID3D12Resource> resource);
   GpuTexture(Device* device, TextureKind kind, Dx8::Usage usage, D3DPOOL pool,
-             const D3D12_RESOURCE_DESC& resource_desc);
+             D3DFORMAT d3d8_format, const D3D12_RESOURCE_DESC& resource_desc);
+  GpuTexture(Device* device, TextureKind kind, Dx8::Usage usage, D3DPOOL pool,
+             D3DFORMAT d3d8_format, const D3D12_RESOURCE_DESC& resource_desc,
+             const D3D12_HEAP_PROPERTIES& heap_props);
+
+  // Allocates an SRV for resource, which must match resource_desc_.
+  DescriptorHandle CreateSrv(ID3D12Resource* resource);
+  void WriteSrv(ID3D12Resource* resource,
+                D3D12_CPU_DESCRIPTOR_HANDLE srv_handle);
 
   ComPtr<ID3D12Resource> resource_;
-  D3D12_CPU_DESCRIPTOR_HANDLE srv_handle_ = {};
-  D3D12_CPU_DESCRIPTOR_HANDLE rtv_handle_ = {};
-  D3D12_CPU_DESCRIPTOR_HANDLE dsv_handle_ = {};
+  DescriptorHandle srv_handle_ = {};
+  DescriptorHandle rtv_handle_ = {};
+  DescriptorHandle dsv_handle_ = {};
 
   D3D12_RESOURCE_STATES current_state_;
 
@@ -183,7 +291,27 @@ class GpuTexture : public BaseTexture {
   uint64_t last_update_frame_ = 0;
 
  private:
+  void CreateResource(const D3D12_HEAP_PROPERTIES& heap_props);
   void InitViews();
+  // Switches to a new GPU-local resource for desc, with its own SRV. Draws that
+  // were already recorded keep the old ones until the GPU is done with them.
+  void ReplaceResource(const D3D12_RESOURCE_DESC& desc);
+  // Stops pointing at a shared GPU copy. Leaves the texture without a
+  // resource, like an evicted one.
+  void LeaveSharedResource();
+  uint64_t GetAllocationSize(const D3D12_RESOURCE_DESC& desc) const;
+
+  // Size of the GPU allocation, which counts against the texture budget.
+  uint64_t gpu_size_ = 0;
+  // Handle in the device's ResidencyTracker, or -1 if not evictable.
+  int residency_handle_ = -1;
+  TranscodeState transcode_state_ = TranscodeState::kNone;
+  DedupState dedup_state_ = DedupState::kNone;
+  uint32_t dedup_generation_ = 0;
+  // Generation of the palette that a P8 texture was last expanded with.
+  uint64_t palette_generation_ = 0;
+  uint64_t last_direct_use_frame_ = 0;
+  uint64_t copy_queue_value_ = 0;
 
   friend BaseTexture* BaseTexture::Create(Device* device, TextureKind kind,
                                           uint32_t width, uint32_t height,
@@ -195,11 +323,22 @@ class GpuTexture : public BaseTexture {
 class CpuTexture : public BaseTexture {
  public:
   CpuTexture(Device* device, TextureKind kind, Dx8::Usage usage,
-             const D3D12_RESOURCE_DESC& resource_desc);
+             D3DFORMAT d3d8_format, const D3D12_RESOURCE_DESC& resource_desc);
 
+  // Uploads through the device's TextureUploader, which takes care of the
+  // destination's barriers. Either everything, or only the dirty regions.
+  // Both leave the uploaded subresources clean.
   void CopyToGpuTexture(GpuTexture* dest);
-  void CopySubresourceToGpuTexture(
-      uint32_t subresource, const D3D12_TEXTURE_COPY_LOCATION& dst_location);
+  void CopyDirtyRegionsToGpuTexture(GpuTexture* dest);
+  void CopyDirtyRegionsToGpuTexture(uint32_t subresource, GpuTexture* dest);
+  bool has_dirty_regions() const;
+
+  const char* subresource_data(uint32_t subresource) const {
+    return data_.get() + compact_offsets_[subresource];
+  }
+  int compact_pitch(uint32_t subresource) const {
+    return compact_pitches_[subresource];
+  }
 
   ULONG STDMETHODCALLTYPE Release(THIS) override {
     return RefCounted::Release();
@@ -212,8 +351,7 @@ class CpuTexture : public BaseTexture {
 
   HRESULT STDMETHODCALLTYPE
   GetSurfaceLevel(UINT Level, IDirect3DSurface8** ppSurfaceLevel) override;
-  HRESULT STDMETHODCALLTYPE AddDirtyRect(CONST RECT* pDirtyRect)
-      VIRT_NOT_IMPLEMENTED;
+  HRESULT STDMETHODCALLTYPE AddDirtyRect(CONST RECT* pDirtyRect) override;
 
   /*** IDirect3DCubeTexture8 methods ***/
   HRESULT STDMETHODCALLTYPE LockRect(D3DCUBEMAP_FACES FaceType, UINT Level,
@@ -223,19 +361,33 @@ class CpuTexture : public BaseTexture {
                                        UINT Level) override;
   STDMETHODIMP GetCubeMapSurface(D3DCUBEMAP_FACES FaceType, UINT Level,
                                  IDirect3DSurface8** ppCubeMapSurface) override;
+  HRESULT STDMETHODCALLTYPE AddDirtyRect(D3DCUBEMAP_FACES FaceType,
+                                         CONST RECT* pDirtyRect) override;
   using IDirect3DCubeTexture8::AddDirtyRect;
 
  private:
+  void CopySubresourceToGpuTexture(uint32_t subresource, GpuTexture* dest);
+  // Marks rect (or all of it, if null) of a subresource as dirty. Rects are
+  // widened to whole blocks.
+  void MarkDirty(uint32_t subresource, const RECT* rect);
+
   // The most up-to-date texture contents.
   std::unique_ptr<char[]> data_;
+  // What changed since the last upload, per subresource. Everything starts out
+  // dirty.
+  std::vector<DirtyRegion> dirty_regions_;
 };
 
 // A little twist on GpuTexture to allow dynamic mapping. Not as complicated as
-// dynamic buffers (because it only allows discard writes).
+// dynamic buffers: the previous contents are never read back, so every lock
+// behaves like a discard of the locked rect (the whole level by default).
+// kDynamicTextureStrategy decides how the new contents reach the GPU.
 class DynamicTexture : public GpuTexture {
  public:
-  DynamicTexture(Device* device, TextureKind kind, Dx8::Usage usage,
-                 const D3D12_RESOURCE_DESC& resource_desc);
+  static DynamicTexture* Create(Device* device, TextureKind kind,
+                                Dx8::Usage usage, D3DFORMAT d3d8_format,
+                                const D3D12_RESOURCE_DESC& resource_desc);
+  ~DynamicTexture() override;
 
   virtual HRESULT STDMETHODCALLTYPE LockRect(UINT Level,
                                              D3DLOCKED_RECT* pLockedRect,
@@ -244,7 +396,38 @@ class DynamicTexture : public GpuTexture {
   virtual HRESULT STDMETHODCALLTYPE UnlockRect(UINT Level) override;
 
  private:
+  // A texture that used to be current, and the frame it was retired in.
+  struct RetiredTexture {
+    ComPtr<ID3D12Resource> resource;
+    DescriptorHandle srv_handle;
+    uint64_t frame;
+  };
+
+  DynamicTexture(Device* device, TextureKind kind, Dx8::Usage usage,
+                 D3DFORMAT d3d8_format,
+                 const D3D12_RESOURCE_DESC& resource_desc,
+                 bool use_per_frame_textures);
+
+  // Checks pRect and widens it to whole blocks. A null pRect is the whole
+  // level.
+  bool GetLockRect(UINT Level, const RECT* pRect, RECT* rect) const;
+  // Offset of rect's top-left corner in the compact copy of the level.
+  size_t CompactOffset(UINT Level, const RECT& rect) const;
+  void UnlockRingCopy(UINT Level);
+  void UnlockPerFrameTexture();
+  // Returns a retired texture the GPU is done with, or a new one.
+  RetiredTexture AcquireFreeTexture();
+
+  const bool use_per_frame_textures_;
   bool is_locked_ = false;
+  // Where the current lock writes to. Ring memory for kRingCopy, a CPU copy for
+  // kPerFrameTextures and for converted formats.
+  DynamicRingBuffer::Allocation lock_alloc_ = {};
+  // The locked part of the level, and its footprint in lock_alloc_.
+  RECT lock_rect_ = {};
+  D3D12_SUBRESOURCE_FOOTPRINT lock_footprint_ = {};
+  std::vector<char> staging_;
+  std::vector<RetiredTexture> retired_textures_;
 };
 
 }  // namespace Dx8to12
\ No newline at end of file
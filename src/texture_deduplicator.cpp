@@ -0,0 +1,227 @@
+#include "texture_deduplicator.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <utility>
+
+#include "aixlog.hpp"
+#include "device.h"
+#include "texture.h"
+#include "texture_uploader.h"
+
+namespace Dx8to12 {
+
+TextureDeduplicator::TextureDeduplicator(Device *device)
+    : device_(device), worker_(&TextureDeduplicator::WorkerMain, this) {}
+
+TextureDeduplicator::~TextureDeduplicator() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    should_stop_ = true;
+  }
+  has_work_.notify_one();
+  worker_.join();
+  const Stats s = stats();
+  LOG(INFO) << "Texture deduplication: " << s.num_shared
+            << " textures share " << s.num_groups << " GPU copies, saving "
+            << s.bytes_saved / (1024.0 * 1024.0) << " MB. Hashed "
+            << s.bytes_hashed / (1024.0 * 1024.0) << " MB at "
+            << (s.hash_seconds > 0
+                    ? s.bytes_hashed / (1024.0 * 1024.0) / s.hash_seconds
+                    : 0.0)
+            << " MB/s.\n";
+}
+
+void TextureDeduplicator::MaybeDeduplicate(GpuTexture *texture) {
+  using DedupState = GpuTexture::DedupState;
+  if (!ShouldQueueForDedup(texture->dedup_state())) return;
+  if (!texture->CanDeduplicate()) {
+    texture->set_dedup_state(DedupState::kNever);
+    return;
+  }
+
+  auto job = std::make_unique<Job>();
+  job->texture = InternalPtr(texture);
+  // Subresources are stored back to back at their compact pitches.
+  const char *data = texture->cpu_texture()->subresource_data(0);
+  job->data.assign(data, data + texture->total_compact_size());
+  job->generation = texture->dedup_generation();
+  texture->set_dedup_state(DedupState::kQueued);
+  ++num_queued_;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    queued_jobs_.push_back(std::move(job));
+  }
+  has_work_.notify_one();
+}
+
+void TextureDeduplicator::SwapInFinishedJobs() {
+  using DedupState = GpuTexture::DedupState;
+  using TranscodeState = GpuTexture::TranscodeState;
+  std::vector<std::unique_ptr<Job>> jobs;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    jobs.swap(finished_jobs_);
+  }
+  for (std::unique_ptr<Job> &job : jobs) {
+    GpuTexture *texture = job->texture.Get();
+    // Locked again since it was queued. It may have been queued again too,
+    // in which case the newer job has the hash of its current contents.
+    if (texture->dedup_state() != DedupState::kQueued ||
+        job->generation != texture->dedup_generation()) {
+      continue;
+    }
+    if (texture->is_evicted()) {
+      // Try again once it is back.
+      texture->set_dedup_state(DedupState::kNone);
+      continue;
+    }
+    const Key key = MakeKey(texture, job->hash);
+
+    if (auto it = groups_.find(key); it != groups_.end()) {
+      if (HaveSameContents(texture, it->second->members[0])) {
+        AddToGroup(*it->second, key, texture);
+      } else {
+        texture->set_dedup_state(DedupState::kNever);
+      }
+      continue;
+    }
+
+    auto [it, is_new] = candidates_.try_emplace(key, texture);
+    if (is_new) {
+      texture->set_dedup_state(DedupState::kHashed);
+      keys_[texture] = key;
+      continue;
+    }
+    GpuTexture *candidate = it->second;
+    if (!HaveSameContents(texture, candidate)) {
+      texture->set_dedup_state(DedupState::kNever);
+      continue;
+    }
+    // The candidate may have started transcoding since it was hashed, and
+    // its GPU copy is about to be swapped out. Keep the newer one instead.
+    if (candidate->transcode_state() != TranscodeState::kNone &&
+        candidate->transcode_state() != TranscodeState::kNever) {
+      candidate->set_dedup_state(DedupState::kNever);
+      keys_.erase(candidate);
+      it->second = texture;
+      texture->set_dedup_state(DedupState::kHashed);
+      keys_[texture] = key;
+      continue;
+    }
+
+    candidates_.erase(it);
+    // Shared copies are never written again, so they stay readable by shaders
+    // and need no more barriers.
+    device_->texture_uploader()->FlushUploadsFor(candidate);
+    device_->TransitionTexture(candidate,
+                               D3D12_RESOURCE_BARRIER_ALL_SUBRESOURCES,
+                               D3D12_RESOURCE_STATE_ALL_SHADER_RESOURCE);
+    auto group = std::make_unique<Group>();
+    group->resource = ComPtr<ID3D12Resource>(candidate->resource());
+    group->srv_handle = candidate->srv_handle();
+    group->num_bytes = candidate->gpu_size();
+    group->members.push_back(candidate);
+    candidate->set_dedup_state(DedupState::kShared);
+    candidate->set_transcode_state(TranscodeState::kNever);
+    AddToGroup(*group, key, texture);
+    groups_.emplace(key, std::move(group));
+  }
+}
+
+void TextureDeduplicator::AddToGroup(Group &group, const Key &key,
+                                     GpuTexture *texture) {
+  LOG(TRACE) << "Sharing texture " << std::hex << texture << " with "
+             << group.members[0] << ".\n";
+  device_->texture_uploader()->FlushUploadsFor(texture);
+  texture->ShareResourceOf(group.members[0]);
+  texture->set_transcode_state(GpuTexture::TranscodeState::kNever);
+  group.members.push_back(texture);
+  keys_[texture] = key;
+}
+
+void TextureDeduplicator::Forget(GpuTexture *texture) {
+  auto it = keys_.find(texture);
+  if (it == keys_.end()) return;
+  candidates_.erase(it->second);
+  keys_.erase(it);
+}
+
+void TextureDeduplicator::RemoveFromGroup(GpuTexture *texture) {
+  auto key_it = keys_.find(texture);
+  ASSERT(key_it != keys_.end());
+  auto group_it = groups_.find(key_it->second);
+  keys_.erase(key_it);
+  ASSERT(group_it != groups_.end());
+  Group &group = *group_it->second;
+  auto member_it = std::find(group.members.begin(), group.members.end(),
+                             texture);
+  ASSERT(member_it != group.members.end());
+  const bool was_first = member_it == group.members.begin();
+  group.members.erase(member_it);
+  if (group.members.empty()) {
+    // Only the group held on to the copy and its SRV by now.
+    device_->RetireTexture(std::move(group.resource), group.srv_handle);
+    groups_.erase(group_it);
+    return;
+  }
+  if (was_first) group.members[0]->set_gpu_size(group.num_bytes);
+}
+
+TextureDeduplicator::Stats TextureDeduplicator::stats() const {
+  Stats s = {.num_queued = num_queued_};
+  for (const auto &[key, group] : groups_) {
+    s.num_shared += static_cast<int>(group->members.size());
+    ++s.num_groups;
+    s.bytes_saved += (group->members.size() - 1) * group->num_bytes;
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  s.bytes_hashed = bytes_hashed_;
+  s.hash_seconds = hash_seconds_;
+  return s;
+}
+
+TextureDeduplicator::Key TextureDeduplicator::MakeKey(GpuTexture *texture,
+                                                      uint32_t hash) {
+  const D3D12_RESOURCE_DESC &desc = texture->resource_desc();
+  return {.hash = hash,
+          .d3d8_format =
+              static_cast<uint32_t>(texture->GetSurfaceDesc(0).Format),
+          .kind = static_cast<uint32_t>(texture->kind()),
+          .width = static_cast<uint32_t>(desc.Width),
+          .height = desc.Height,
+          .depth = desc.DepthOrArraySize,
+          .mip_levels = desc.MipLevels};
+}
+
+bool TextureDeduplicator::HaveSameContents(GpuTexture *a, GpuTexture *b) {
+  // Same key, so same size.
+  return std::memcmp(a->cpu_texture()->subresource_data(0),
+                     b->cpu_texture()->subresource_data(0),
+                     a->total_compact_size()) == 0;
+}
+
+void TextureDeduplicator::WorkerMain() {
+  while (true) {
+    std::unique_ptr<Job> job;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      has_work_.wait(lock,
+                     [this] { return should_stop_ || !queued_jobs_.empty(); });
+      if (should_stop_) return;
+      job = std::move(queued_jobs_.front());
+      queued_jobs_.pop_front();
+    }
+    const auto start = std::chrono::steady_clock::now();
+    job->hash = MurmurHashTo32(job->data.data(), job->data.size());
+    const std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+    std::lock_guard<std::mutex> lock(mutex_);
+    bytes_hashed_ += job->data.size();
+    hash_seconds_ += elapsed.count();
+    finished_jobs_.push_back(std::move(job));
+  }
+}
+
+}  // namespace Dx8to12
@@ -0,0 +1,126 @@
+#pragma once
+
+#include <d3d12.h>
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "pool_heap.h"
+#include "util.h"
+#include "utils/murmur_hash.h"
+
+namespace Dx8to12 {
+class Device;
+class GpuTexture;
+
+// Shares one GPU copy (and SRV) between managed textures with the same
+// contents, which games tend to load many times over. Textures are queued the
+// first time they are drawn with, by which point all of their levels have been
+// written. Their CPU copy is snapshotted and hashed on a background thread.
+// Hashed textures are matched at the start of the next frame, and only share
+// once their CPU copies compare equal. Sharing is copy-on-write: a texture that
+// is locked again gets its own GPU copy back for good (see
+// GpuTexture::StopSharing).
+class TextureDeduplicator {
+ public:
+  struct Stats {
+    int num_queued;
+    // Textures that share a GPU copy, and the number of copies they share.
+    int num_shared;
+    int num_groups;
+    // GPU memory that sharing currently saves.
+    uint64_t bytes_saved;
+    // Work done by the background thread, to measure hashing throughput.
+    uint64_t bytes_hashed;
+    double hash_seconds;
+  };
+
+  explicit TextureDeduplicator(Device* device);
+  ~TextureDeduplicator();
+
+  // Called whenever texture is about to be drawn with.
+  void MaybeDeduplicate(GpuTexture* texture);
+  // Shares the GPU copies of textures that have finished hashing. Called once
+  // per frame.
+  void SwapInFinishedJobs();
+  // Called when a hashed texture that still has its own GPU copy changes or
+  // goes away.
+  void Forget(GpuTexture* texture);
+  // Called when a texture stops sharing its GPU copy. The copy is retired once
+  // the last texture in its group leaves.
+  void RemoveFromGroup(GpuTexture* texture);
+
+  Stats stats() const;
+
+ private:
+  // Everything that has to match for two textures to share a GPU copy, other
+  // than their contents. All 32-bit, so that there is no padding to hash.
+  struct Key {
+    uint32_t hash;
+    uint32_t d3d8_format;
+    uint32_t kind;
+    uint32_t width;
+    uint32_t height;
+    uint32_t depth;
+    uint32_t mip_levels;
+
+    bool operator==(const Key&) const = default;
+  };
+  struct KeyHash {
+    size_t operator()(const Key& key) const {
+      return MurmurHashTo32(&key, sizeof(key));
+    }
+  };
+  struct Group {
+    ComPtr<ID3D12Resource> resource;
+    DescriptorHandle srv_handle;
+    uint64_t num_bytes;
+    // The first texture counts the copy against the texture budget.
+    std::vector<GpuTexture*> members;
+  };
+  struct Job {
+    // Only touched on the device's thread.
+    InternalPtr<GpuTexture> texture;
+    // Snapshot of the CPU copy.
+    std::vector<char> data;
+    // GpuTexture::dedup_generation when the job was queued.
+    uint32_t generation = 0;
+
+    // Filled in by the worker.
+    uint32_t hash = 0;
+  };
+
+  static Key MakeKey(GpuTexture* texture, uint32_t hash);
+  // Compares the CPU copies of two textures with the same key.
+  static bool HaveSameContents(GpuTexture* a, GpuTexture* b);
+  void AddToGroup(Group& group, const Key& key, GpuTexture* texture);
+  void WorkerMain();
+
+  Device* device_;
+  int num_queued_ = 0;
+
+  // Hashed textures that still have their own GPU copy.
+  std::unordered_map<Key, GpuTexture*, KeyHash> candidates_;
+  std::unordered_map<Key, std::unique_ptr<Group>, KeyHash> groups_;
+  // Keys of the textures in candidates_ and groups_.
+  std::unordered_map<GpuTexture*, Key> keys_;
+
+  // Guards everything below.
+  mutable std::mutex mutex_;
+  std::condition_variable has_work_;
+  std::deque<std::unique_ptr<Job>> queued_jobs_;
+  std::vector<std::unique_ptr<Job>> finished_jobs_;
+  uint64_t bytes_hashed_ = 0;
+  double hash_seconds_ = 0;
+  bool should_stop_ = false;
+  // Declared last, so that it starts after everything else is initialized.
+  std::thread worker_;
+};
+
+}  // namespace Dx8to12
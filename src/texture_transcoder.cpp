@@ -0,0 +1,133 @@
+#include "texture_transcoder.h"
+
+#include <utility>
+
+#include "aixlog.hpp"
+#include "device.h"
+#include "texture.h"
+#include "utils/bc_encoder.h"
+#include "utils/dx_utils.h"
+
+namespace Dx8to12 {
+
+TextureTranscoder::TextureTranscoder(Device *device)
+    : device_(device), worker_(&TextureTranscoder::WorkerMain, this) {}
+
+TextureTranscoder::~TextureTranscoder() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    should_stop_ = true;
+  }
+  has_work_.notify_one();
+  worker_.join();
+}
+
+void TextureTranscoder::MaybeTranscode(GpuTexture *texture) {
+  using TranscodeState = GpuTexture::TranscodeState;
+  if (texture->transcode_state() != TranscodeState::kNone) return;
+  // Wait for it to be hashed first. Textures that end up sharing a GPU copy
+  // are never transcoded.
+  if (texture->dedup_state() == GpuTexture::DedupState::kQueued) return;
+  if (!texture->CanTranscode()) {
+    texture->set_transcode_state(TranscodeState::kNever);
+    return;
+  }
+  if (device_->CurrentFrame() <
+      texture->last_update_frame() + kTranscodeIdleFrames)
+    return;
+
+  auto job = std::make_unique<Job>();
+  job->texture = InternalPtr(texture);
+  job->has_alpha =
+      texture->resource_desc().Format == DXGI_FORMAT_B8G8R8A8_UNORM;
+  const CpuTexture *cpu_tex = texture->cpu_texture();
+  for (uint32_t i = 0; i < texture->num_subresources(); ++i) {
+    const D3DSURFACE_DESC desc = texture->GetSurfaceDesc(i);
+    const int pitch = cpu_tex->compact_pitch(i);
+    const size_t num_bytes = static_cast<size_t>(pitch) * desc.Height;
+    const char *data = cpu_tex->subresource_data(i);
+    job->levels.push_back({.width = desc.Width,
+                           .height = desc.Height,
+                           .offset = job->data.size(),
+                           .pitch = pitch});
+    job->data.insert(job->data.end(), data, data + num_bytes);
+  }
+  texture->set_transcode_state(TranscodeState::kQueued);
+  ++stats_.num_queued;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    queued_jobs_.push_back(std::move(job));
+  }
+  has_work_.notify_one();
+}
+
+void TextureTranscoder::SwapInFinishedJobs() {
+  using TranscodeState = GpuTexture::TranscodeState;
+  std::vector<std::unique_ptr<Job>> jobs;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    jobs.swap(finished_jobs_);
+  }
+  for (std::unique_ptr<Job> &job : jobs) {
+    GpuTexture *texture = job->texture.Get();
+    // Locked again since it was queued.
+    if (texture->transcode_state() != TranscodeState::kQueued) continue;
+    if (texture->is_evicted()) {
+      // Try again once it is back.
+      texture->set_transcode_state(TranscodeState::kNone);
+      continue;
+    }
+    LOG(TRACE) << "Swapping in transcoded texture " << std::hex << texture
+               << ".\n";
+    uint64_t encoded_size = 0;
+    for (const std::vector<uint8_t> &level : job->encoded_levels) {
+      encoded_size += level.size();
+    }
+    stats_.bytes_saved += job->data.size() - encoded_size;
+    ++stats_.num_transcoded;
+    texture->SwapInTranscoded(job->format, job->encoded_levels);
+  }
+}
+
+void TextureTranscoder::WorkerMain() {
+  while (true) {
+    std::unique_ptr<Job> job;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      has_work_.wait(lock,
+                     [this] { return should_stop_ || !queued_jobs_.empty(); });
+      if (should_stop_) return;
+      job = std::move(queued_jobs_.front());
+      queued_jobs_.pop_front();
+    }
+    Encode(*job);
+    std::lock_guard<std::mutex> lock(mutex_);
+    finished_jobs_.push_back(std::move(job));
+  }
+}
+
+void TextureTranscoder::Encode(Job &job) {
+  const auto *data = reinterpret_cast<const uint8_t *>(job.data.data());
+  bool is_opaque = true;
+  if (job.has_alpha) {
+    for (const Level &level : job.levels) {
+      is_opaque &= IsOpaque(data + level.offset, level.pitch, level.width,
+                            level.height);
+      if (!is_opaque) break;
+    }
+  }
+  const BcFormat bc_format = is_opaque ? BcFormat::kBc1 : BcFormat::kBc3;
+  job.format = is_opaque ? DXGI_FORMAT_BC1_UNORM : DXGI_FORMAT_BC3_UNORM;
+  job.encoded_levels.resize(job.levels.size());
+  for (size_t i = 0; i < job.levels.size(); ++i) {
+    const Level &level = job.levels[i];
+    const uint32_t pitch = CompactRowPitch(job.format, level.width);
+    std::vector<uint8_t> &encoded = job.encoded_levels[i];
+    encoded.resize(static_cast<size_t>(pitch) *
+                   NumBlockRows(job.format, level.height));
+    EncodeBcImage(bc_format, data + level.offset, level.pitch, level.width,
+                  level.height, encoded.data(), pitch);
+  }
+}
+
+}  // namespace Dx8to12
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <d3d12.h>
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "util.h"
+
+namespace Dx8to12 {
+class Device;
+class GpuTexture;
+
+// Compresses managed 32-bit textures to BC1 (or BC3, if they have alpha) on a
+// background thread, to save GPU memory and bandwidth. Textures are queued the
+// first time they are drawn with after going kTranscodeIdleFrames without a
+// lock. Their CPU copy is snapshotted, so that the worker never races with the
+// application. Finished textures are swapped in at the start of the next frame.
+// Textures that are locked again go back to uncompressed for good (see
+// GpuTexture::StopTranscoding).
+class TextureTranscoder {
+ public:
+  struct Stats {
+    int num_queued;
+    int num_transcoded;
+    // Uncompressed minus compressed size of all transcoded textures.
+    uint64_t bytes_saved;
+  };
+
+  explicit TextureTranscoder(Device* device);
+  ~TextureTranscoder();
+
+  // Called whenever texture is about to be drawn with.
+  void MaybeTranscode(GpuTexture* texture);
+  // Swaps in the textures that have finished encoding. Called once per frame.
+  void SwapInFinishedJobs();
+
+  Stats stats() const { return stats_; }
+
+ private:
+  struct Level {
+    uint32_t width;
+    uint32_t height;
+    size_t offset;
+    int pitch;
+  };
+  struct Job {
+    // Only touched on the device's thread.
+    InternalPtr<GpuTexture> texture;
+    // Snapshot of the CPU copy, and where its levels are.
+    std::vector<char> data;
+    std::vector<Level> levels;
+    bool has_alpha;
+
+    // Filled in by the worker.
+    DXGI_FORMAT format = DXGI_FORMAT_UNKNOWN;
+    std::vector<std::vector<uint8_t>> encoded_levels;
+  };
+
+  void WorkerMain();
+  static void Encode(Job& job);
+
+  Device* device_;
+  Stats stats_ = {};
+
+  std::mutex mutex_;
+  std::condition_variable has_work_;
+  std::deque<std::unique_ptr<Job>> queued_jobs_;
+  std::vector<std::unique_ptr<Job>> finished_jobs_;
+  bool should_stop_ = false;
+  // Declared last, so that it starts after everything else is initialized.
+  std::thread worker_;
+};
+
+}  // namespace Dx8to12
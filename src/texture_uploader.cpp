@@ -0,0 +1,242 @@
+#include "texture_uploader.h"
+
+#include <utility>
+
+#include "aixlog.hpp"
+#include "device.h"
+#include "dynamic_ring_buffer.h"
+#include "texture.h"
+#include "utils/dx_utils.h"
+#include "utils/pitch_repack.h"
+
+namespace Dx8to12 {
+
+// Rows of a footprint are rows of blocks for block-compressed formats.
+static uint32_t NumRows(const D3D12_SUBRESOURCE_FOOTPRINT &footprint) {
+  return NumBlockRows(footprint.Format, footprint.Height);
+}
+
+void TextureUploader::Upload(GpuTexture *dest, uint32_t subresource,
+                             const D3D12_SUBRESOURCE_FOOTPRINT &footprint,
+                             const char *src, int src_pitch,
+                             FormatConversion conversion) {
+  UploadRegion(dest, subresource, footprint, src, src_pitch, conversion,
+               D3D12_BOX{.left = 0,
+                         .top = 0,
+                         .front = 0,
+                         .right = footprint.Width,
+                         .bottom = footprint.Height,
+                         .back = 1});
+}
+
+void TextureUploader::UploadRegion(
+    GpuTexture *dest, uint32_t subresource,
+    const D3D12_SUBRESOURCE_FOOTPRINT &footprint, const char *src,
+    int src_pitch, FormatConversion conversion, const D3D12_BOX &box) {
+  const uint32_t block_dim = DXGIFormatBlockDim(footprint.Format);
+  ASSERT(src_pitch > 0 && footprint.Height % block_dim == 0);
+  ASSERT(box.left < box.right && box.top < box.bottom &&
+         box.right <= footprint.Width && box.bottom <= footprint.Height);
+  ASSERT((box.left | box.top | box.right | box.bottom) % block_dim == 0);
+  // Evicted textures are re-uploaded in full first, so that partial contents
+  // are never lost.
+  dest->MakeResident();
+  const bool is_whole_subresource =
+      box.left == 0 && box.top == 0 && box.right == footprint.Width &&
+      box.bottom == footprint.Height;
+  for (auto iter = pending_uploads_.begin(); iter != pending_uploads_.end();) {
+    if (iter->dest.Get() != dest || iter->subresource != subresource) {
+      ++iter;
+      continue;
+    }
+    // The new contents replace anything that is still waiting. Smaller
+    // regions have to land after it.
+    if (!is_whole_subresource) RecordPendingUpload(*iter, /*force=*/true);
+    iter = pending_uploads_.erase(iter);
+  }
+  RetireCompletedUploads();
+  const uint32_t *palette = nullptr;
+  if (conversion == FormatConversion::kP8ToB8G8R8A8) {
+    uint64_t generation;
+    palette = device_->CurrentPaletteColors(&generation);
+    dest->set_palette_generation(generation);
+  }
+
+  // The box becomes a footprint of its own, placed at (left, top).
+  D3D12_SUBRESOURCE_FOOTPRINT region = footprint;
+  region.Width = box.right - box.left;
+  region.Height = box.bottom - box.top;
+  region.RowPitch = FootprintRowPitch(region.Format, region.Width);
+  const int src_block_size = conversion != FormatConversion::kNone
+                                 ? SourceTexelSize(conversion)
+                                 : DXGIFormatSize(footprint.Format);
+  src += static_cast<size_t>(box.top / block_dim) * src_pitch +
+         static_cast<size_t>(box.left / block_dim) * src_block_size;
+
+  const uint32_t next_row =
+      RecordRows(dest, subresource, region, box.left, box.top, src, src_pitch,
+                 conversion, palette, 0, /*force=*/false);
+  const uint32_t num_rows = NumRows(region);
+  if (next_row == num_rows) return;
+
+  LOG(TRACE) << "Deferring " << num_rows - next_row << " rows of "
+             << std::hex << dest << ".\n";
+  const char *rest = src + static_cast<size_t>(next_row) * src_pitch;
+  const size_t row_bytes =
+      static_cast<size_t>(region.Width / block_dim) * src_block_size;
+  PendingUpload upload = {.dest = InternalPtr(dest),
+                          .subresource = subresource,
+                          .footprint = region,
+                          .dest_x = box.left,
+                          .dest_y = box.top,
+                          .pitch = safe_cast<int>(row_bytes),
+                          .data_first_row = next_row,
+                          .next_row = next_row};
+  if (conversion == FormatConversion::kNone) {
+    upload.data.resize(static_cast<size_t>(num_rows - next_row) * row_bytes);
+    RepackRows(upload.data.data(), row_bytes, rest, src_pitch, row_bytes,
+               num_rows - next_row);
+  } else {
+    // Converted now, so that the rest is expanded with the same palette.
+    upload.pitch = safe_cast<int>(region.Width * DestTexelSize(conversion));
+    upload.data.resize(static_cast<size_t>(num_rows - next_row) *
+                       upload.pitch);
+    ConvertRows(conversion, upload.data.data(), upload.pitch, rest, src_pitch,
+                region.Width, num_rows - next_row, palette);
+  }
+  pending_uploads_.push_back(std::move(upload));
+  // Bound textures have to be flushed before the next draw.
+  device_->RebindTexture(dest);
+}
+
+void TextureUploader::FlushUploadsFor(GpuTexture *texture) {
+  for (auto iter = pending_uploads_.begin(); iter != pending_uploads_.end();) {
+    if (iter->dest.Get() == texture) {
+      RecordPendingUpload(*iter, /*force=*/true);
+      iter = pending_uploads_.erase(iter);
+    } else {
+      ++iter;
+    }
+  }
+}
+
+void TextureUploader::RecordPendingUploads() {
+  RetireCompletedUploads();
+  // Oldest first, so that uploads finish in the order they were started.
+  for (auto iter = pending_uploads_.begin(); iter != pending_uploads_.end();) {
+    if (!RecordPendingUpload(*iter, /*force=*/false)) break;
+    iter = pending_uploads_.erase(iter);
+  }
+}
+
+bool TextureUploader::RecordPendingUpload(PendingUpload &upload, bool force) {
+  // Evicted textures get a full upload when they are made resident again.
+  if (upload.dest->is_evicted()) return true;
+  const char *src =
+      upload.data.data() +
+      static_cast<size_t>(upload.next_row - upload.data_first_row) *
+          upload.pitch;
+  upload.next_row = RecordRows(
+      upload.dest.Get(), upload.subresource, upload.footprint, upload.dest_x,
+      upload.dest_y, src, upload.pitch, FormatConversion::kNone,
+      /*palette=*/nullptr, upload.next_row, force);
+  return upload.next_row == NumRows(upload.footprint);
+}
+
+uint32_t TextureUploader::RecordRows(
+    GpuTexture *dest, uint32_t subresource,
+    const D3D12_SUBRESOURCE_FOOTPRINT &footprint, uint32_t dest_x,
+    uint32_t dest_y, const char *src, int src_pitch,
+    FormatConversion conversion, const uint32_t *palette, uint32_t first_row,
+    bool force) {
+  DynamicRingBuffer *ring = device_->dynamic_ring_buffer();
+  const uint32_t row_pitch = footprint.RowPitch;
+  const uint32_t total_rows = NumRows(footprint);
+  const uint32_t block_dim = DXGIFormatBlockDim(footprint.Format);
+  const size_t row_bytes = CompactRowPitch(footprint.Format, footprint.Width);
+  const uint64_t frame = device_->CurrentFrame();
+  // Either the copy queue's command list, which needs no barriers, or the main
+  // one.
+  ID3D12GraphicsCommandList *cmd_list = nullptr;
+  bool on_copy_queue = false;
+
+  uint32_t row = first_row;
+  while (row < total_rows) {
+    const uint32_t num_rows =
+        budget_.NextChunkRows(total_rows - row, row_pitch, force);
+    if (num_rows == 0) break;
+    if (row == first_row) {
+      cmd_list = device_->BeginCopyUpload(dest);
+      on_copy_queue = cmd_list != nullptr;
+      if (!on_copy_queue) {
+        cmd_list = device_->cmd_list();
+        // GpuTexture tracks a single state for all of its subresources.
+        device_->TransitionTexture(dest,
+                                   D3D12_RESOURCE_BARRIER_ALL_SUBRESOURCES,
+                                   D3D12_RESOURCE_STATE_COPY_DEST);
+      }
+    }
+
+    // Fill a band of the source footprint in the ring.
+    const size_t num_bytes = static_cast<size_t>(num_rows) * row_pitch;
+    DynamicRingBuffer::Allocation alloc =
+        ring->Allocate(num_bytes, D3D12_TEXTURE_DATA_PLACEMENT_ALIGNMENT);
+    char *ring_ptr = ring->GetCpuPtrFor(alloc);
+    const char *src_rows =
+        src + static_cast<size_t>(row - first_row) * src_pitch;
+    if (conversion == FormatConversion::kNone) {
+      RepackRows(ring_ptr, row_pitch, src_rows, src_pitch, row_bytes,
+                 num_rows);
+    } else {
+      ConvertRows(conversion, ring_ptr, row_pitch, src_rows, src_pitch,
+                  footprint.Width, num_rows, palette);
+    }
+
+    // And copy it to its rows in the destination. Bands of blocks stay aligned
+    // to whole blocks.
+    D3D12_SUBRESOURCE_FOOTPRINT band = footprint;
+    band.Height = num_rows * block_dim;
+    D3D12_TEXTURE_COPY_LOCATION src_location{
+        .pResource = ring->GetBackingResource(alloc),
+        .Type = D3D12_TEXTURE_COPY_TYPE_PLACED_FOOTPRINT,
+        .PlacedFootprint = {.Offset = safe_cast<uint64_t>(alloc.offset),
+                            .Footprint = band}};
+    D3D12_TEXTURE_COPY_LOCATION dest_location{
+        .pResource = dest->resource(),
+        .Type = D3D12_TEXTURE_COPY_TYPE_SUBRESOURCE_INDEX,
+        .SubresourceIndex = subresource};
+    cmd_list->CopyTextureRegion(&dest_location, dest_x,
+                                dest_y + row * block_dim, 0, &src_location,
+                                nullptr);
+
+    budget_.Record(frame, num_bytes);
+    row += num_rows;
+  }
+  if (row != first_row && !on_copy_queue) {
+    device_->TransitionTexture(dest, D3D12_RESOURCE_BARRIER_ALL_SUBRESOURCES,
+                               D3D12_RESOURCE_STATE_ALL_SHADER_RESOURCE);
+  }
+  return row;
+}
+
+void TextureUploader::RetireCompletedUploads() {
+  budget_.Retire(device_->CompletedFrame());
+}
+
+TextureUploader::Stats TextureUploader::stats() const {
+  uint64_t pending_bytes = 0;
+  for (const PendingUpload &upload : pending_uploads_) {
+    pending_bytes +=
+        static_cast<uint64_t>(NumRows(upload.footprint) - upload.next_row) *
+        upload.pitch;
+  }
+  const UploadBudget::Stats budget_stats = budget_.stats();
+  return {.bytes_uploaded = budget_stats.bytes_uploaded,
+          .frame_bytes = budget_stats.frame_bytes,
+          .num_chunks = budget_stats.num_chunks,
+          .in_flight_bytes = budget_stats.in_flight_bytes,
+          .pending_bytes = pending_bytes,
+          .num_pending_uploads = static_cast<int>(pending_uploads_.size())};
+}
+
+}  // namespace Dx8to12
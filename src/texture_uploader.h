@@ -0,0 +1,107 @@
+#pragma once
+
+#include <d3d12.h>
+
+#include <cstdint>
+#include <vector>
+
+#include "device_limits.h"
+#include "util.h"
+#include "utils/format_conversion.h"
+#include "utils/upload_budget.h"
+
+namespace Dx8to12 {
+class Device;
+class GpuTexture;
+
+// Streams CPU texture data into GPU textures through the dynamic ring buffer.
+// Subresources are split into row bands of at most kTextureUploadChunkSize
+// bytes, so that a large texture never needs one huge ring allocation. Chunks
+// stop being recorded once kTextureUploadMaxInFlightBytes are waiting on the
+// GPU. The rest of the upload is copied aside and recorded in later frames, as
+// earlier chunks complete, or as soon as the texture is about to be drawn with.
+// For block-compressed formats, a row is a row of 4x4 blocks. D3D8 formats that
+// have no DXGI equivalent are expanded as they are written to the ring. Copies
+// are recorded on the device's copy queue whenever the destination allows it,
+// and on the main command list otherwise.
+class TextureUploader {
+ public:
+  struct Stats {
+    uint64_t bytes_uploaded;
+    // Bytes recorded since the last EndFrame.
+    uint64_t frame_bytes;
+    uint64_t num_chunks;
+    // Recorded bytes whose frame has not completed yet.
+    uint64_t in_flight_bytes;
+    // Bytes that are waiting for a later frame.
+    uint64_t pending_bytes;
+    int num_pending_uploads;
+  };
+
+  explicit TextureUploader(Device* device) : device_(device) {}
+
+  // Uploads a whole subresource. src holds the footprint's rows, src_pitch
+  // bytes apart, in the source layout of conversion. It only needs to live for
+  // the duration of the call. Replaces any pending upload of the same
+  // subresource. P8 data is expanded with the device's current palette.
+  void Upload(GpuTexture* dest, uint32_t subresource,
+              const D3D12_SUBRESOURCE_FOOTPRINT& footprint, const char* src,
+              int src_pitch, FormatConversion conversion);
+  // Uploads the box of a subresource, in texels, aligned to whole blocks. src
+  // and src_pitch describe the whole subresource, like with Upload. Pending
+  // uploads of the same subresource are recorded first.
+  void UploadRegion(GpuTexture* dest, uint32_t subresource,
+                    const D3D12_SUBRESOURCE_FOOTPRINT& footprint,
+                    const char* src, int src_pitch,
+                    FormatConversion conversion, const D3D12_BOX& box);
+  // Records all pending uploads to texture, ignoring the in-flight limit.
+  void FlushUploadsFor(GpuTexture* texture);
+  // Records pending uploads, as far as the in-flight limit allows. Called
+  // whenever a new command list starts.
+  void RecordPendingUploads();
+
+  // Returns the bytes recorded since the last call, and starts counting the
+  // next frame. Called on present.
+  uint64_t EndFrame() { return budget_.EndFrame(); }
+
+  Stats stats() const;
+
+ private:
+  struct PendingUpload {
+    InternalPtr<GpuTexture> dest;
+    uint32_t subresource;
+    // Footprint of the uploaded region, and where it goes.
+    D3D12_SUBRESOURCE_FOOTPRINT footprint;
+    uint32_t dest_x;
+    uint32_t dest_y;
+    // Compact copy of the rows from data_first_row on. Already converted.
+    std::vector<char> data;
+    int pitch;
+    uint32_t data_first_row;
+    // First row that has not been recorded yet.
+    uint32_t next_row;
+  };
+
+  // Records whatever the in-flight limit allows (or everything, if force is
+  // set). Returns true once the whole upload is recorded.
+  bool RecordPendingUpload(PendingUpload& upload, bool force);
+
+  // Records the rows of footprint from first_row on, where src points at
+  // first_row. The footprint's top-left corner goes to (dest_x, dest_y).
+  // Stops early when the in-flight limit is hit, unless force is set. Returns
+  // the first row that was not recorded.
+  uint32_t RecordRows(GpuTexture* dest, uint32_t subresource,
+                      const D3D12_SUBRESOURCE_FOOTPRINT& footprint,
+                      uint32_t dest_x, uint32_t dest_y, const char* src,
+                      int src_pitch, FormatConversion conversion,
+                      const uint32_t* palette, uint32_t first_row, bool force);
+  // Forgets about uploads whose frame has completed.
+  void RetireCompletedUploads();
+
+  Device* device_;
+  std::vector<PendingUpload> pending_uploads_;
+  UploadBudget budget_{kTextureUploadChunkSize,
+                       kTextureUploadMaxInFlightBytes};
+};
+
+}  // namespace Dx8to12
@@ -1,12 +1,20 @@
 #include "asserts.h"
 
+#ifdef _WIN32
 #include <windows.h>
 
+#include "aixlog.hpp"
+#endif
+
 #include <cstdarg>
 #include <cstdio>
 #include <memory>
 
 namespace Dx8to12 {
+#ifdef _WIN32
+static_assert(kMessageBoxAbortRetryIgnore == MB_ABORTRETRYIGNORE);
+#endif
+
 void MessageBoxFmt(unsigned int flags, const char *fmt, ...) {
   va_list args;
   va_start(args, fmt);
@@ -16,6 +24,7 @@ void MessageBoxFmt(unsigned int flags, const char *fmt, ...) {
   vsnprintf(msg.get(), kMsgSize, fmt, args);
   va_end(args);
 
+#ifdef _WIN32
   LOG(AixLog::Severity::error) << msg << "\n";
 
   int clicked = MessageBoxA(nullptr, msg.get(), nullptr, MB_TASKMODAL | flags);
@@ -29,5 +38,11 @@ void MessageBoxFmt(unsigned int flags, const char *fmt, ...) {
     default:
       break;
   }
+#else
+  // Only the utils are built off Windows, for the tests. Any failure there is
+  // fatal.
+  fprintf(stderr, "%s\n", msg.get());
+  abort();
+#endif
 }
-}  // namespace Dx8to12
\ No newline at end of file
+}  // namespace Dx8to12
@@ -1,6 +1,13 @@
 #pragma once
 
+#include <cstdlib>
+#include <ostream>
+
 namespace Dx8to12 {
+// MB_ABORTRETRYIGNORE, spelled out so that this header doesn't need
+// windows.h. asserts.cpp checks that it matches.
+constexpr unsigned int kMessageBoxAbortRetryIgnore = 0x2;
+
 #ifdef __clang__
 __attribute__((__format__(__printf__, 2, 0)))
 #endif
@@ -8,7 +15,7 @@ void MessageBoxFmt(unsigned int flags, const char* fmt, ...);
 
 #define FAIL(fmt, ...)                                                    \
   do {                                                                    \
-    ::Dx8to12::MessageBoxFmt(MB_ABORTRETRYIGNORE,                         \
+    ::Dx8to12::MessageBoxFmt(::Dx8to12::kMessageBoxAbortRetryIgnore,      \
                              "Fatal error on %s:%d in function %s: " fmt, \
                              __FILE__, __LINE__, __func__, __VA_ARGS__);  \
     abort();                                                              \
@@ -20,7 +27,7 @@ void MessageBoxFmt(unsigned int flags, const char* fmt, ...);
 #define ASSERT(expr)                                                    \
   do {                                                                  \
     if (!(expr)) {                                                      \
-      ::Dx8to12::MessageBoxFmt(MB_ABORTRETRYIGNORE,                     \
+      ::Dx8to12::MessageBoxFmt(::Dx8to12::kMessageBoxAbortRetryIgnore,  \
                                "Assertion %s:%d failed:\n%s", __FILE__, \
                                __LINE__, #expr);                        \
     }                                                                   \
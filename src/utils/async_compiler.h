@@ -0,0 +1,126 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+namespace Dx8to12 {
+
+// Runs compile jobs on background threads, so that the thread that needs their
+// results can carry on with a stand-in instead of stalling on them. Knows
+// nothing about what is compiled: a job is a key and a function that produces
+// its result. A key is only queued once until its result is swapped in.
+//
+// Results are handed over in SwapInFinished, on the calling thread and at a
+// point of its choosing (e.g. between frames). So a result shows up all at
+// once, and never while the caller is in the middle of using the old state.
+// Everything but the compile functions runs on the calling thread.
+template <typename Key, typename Result, typename Hash = std::hash<Key>>
+class AsyncCompiler {
+ public:
+  using CompileFn = std::function<Result()>;
+
+  struct Stats {
+    int num_queued;
+    int num_swapped_in;
+    // Time spent compiling, summed over all threads.
+    double compile_seconds;
+  };
+
+  explicit AsyncCompiler(int num_threads) {
+    for (int i = 0; i < num_threads; ++i) {
+      workers_.emplace_back(&AsyncCompiler::WorkerMain, this);
+    }
+  }
+  // Drops the jobs that haven't started, and waits for the running ones.
+  ~AsyncCompiler() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      should_stop_ = true;
+    }
+    has_work_.notify_all();
+    for (std::thread& worker : workers_) worker.join();
+  }
+  AsyncCompiler(const AsyncCompiler&) = delete;
+  AsyncCompiler& operator=(const AsyncCompiler&) = delete;
+
+  // Whether key was queued and its result has not been swapped in yet.
+  bool IsPending(const Key& key) const { return pending_.contains(key); }
+
+  // Queues compile for key, unless key is already pending.
+  void Queue(const Key& key, CompileFn compile) {
+    if (!pending_.insert(key).second) return;
+    ++stats_.num_queued;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      queued_jobs_.push_back({key, std::move(compile)});
+    }
+    has_work_.notify_one();
+  }
+
+  // Calls on_finished(key, result) for every job that is done.
+  template <typename OnFinished>
+  void SwapInFinished(OnFinished&& on_finished) {
+    std::vector<std::pair<Key, Result>> finished;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      finished.swap(finished_);
+      stats_.compile_seconds = compile_seconds_;
+    }
+    for (auto& [key, result] : finished) {
+      pending_.erase(key);
+      ++stats_.num_swapped_in;
+      on_finished(key, std::move(result));
+    }
+  }
+
+  int num_pending() const { return static_cast<int>(pending_.size()); }
+  // As of the last SwapInFinished.
+  Stats stats() const { return stats_; }
+
+ private:
+  struct Job {
+    Key key;
+    CompileFn compile;
+  };
+
+  void WorkerMain() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+      has_work_.wait(lock,
+                     [this] { return should_stop_ || !queued_jobs_.empty(); });
+      if (should_stop_) return;
+      Job job = std::move(queued_jobs_.front());
+      queued_jobs_.pop_front();
+      lock.unlock();
+      const auto start = std::chrono::steady_clock::now();
+      Result result = job.compile();
+      const std::chrono::duration<double> elapsed =
+          std::chrono::steady_clock::now() - start;
+      lock.lock();
+      compile_seconds_ += elapsed.count();
+      finished_.emplace_back(std::move(job.key), std::move(result));
+    }
+  }
+
+  std::unordered_set<Key, Hash> pending_;
+  Stats stats_ = {};
+
+  // Guards everything below.
+  std::mutex mutex_;
+  std::condition_variable has_work_;
+  std::deque<Job> queued_jobs_;
+  std::vector<std::pair<Key, Result>> finished_;
+  double compile_seconds_ = 0;
+  bool should_stop_ = false;
+  // Declared last, so that they start after everything else is initialized.
+  std::vector<std::thread> workers_;
+};
+
+}  // namespace Dx8to12
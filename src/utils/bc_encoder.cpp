@@ -0,0 +1,224 @@
+#include "bc_encoder.h"
+
+#include <algorithm>
+#include <cstring>
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || \
+    defined(__x86_64__)
+#define DX8TO12_BC_SSE2
+#include <emmintrin.h>
+#endif
+
+namespace Dx8to12 {
+namespace {
+
+// Block indices, in order of texels along the line from the second endpoint to
+// the first one.
+constexpr uint32_t kColorIndexFromLinear[4] = {1, 3, 2, 0};
+constexpr uint64_t kAlphaIndexFromLinear[8] = {1, 7, 6, 5, 4, 3, 2, 0};
+
+// Rounds to the closest 565 color.
+uint16_t To565(const uint8_t *bgr) {
+  const int b = (bgr[0] * 31 + 127) / 255, g = (bgr[1] * 63 + 127) / 255,
+            r = (bgr[2] * 31 + 127) / 255;
+  return static_cast<uint16_t>((r << 11) | (g << 5) | b);
+}
+
+// What the GPU decodes a 565 color to, as BGR.
+void From565(uint16_t color, int *bgr) {
+  const int b = color & 31, g = (color >> 5) & 63, r = color >> 11;
+  bgr[0] = (b << 3) | (b >> 2);
+  bgr[1] = (g << 2) | (g >> 4);
+  bgr[2] = (r << 3) | (r >> 2);
+}
+
+void GetBoundingBox(const uint8_t *bgra, size_t pitch, uint8_t *min,
+                    uint8_t *max) {
+#ifdef DX8TO12_BC_SSE2
+  __m128i rows[4];
+  for (int i = 0; i < 4; ++i) {
+    rows[i] =
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(bgra + i * pitch));
+  }
+  __m128i lo = _mm_min_epu8(_mm_min_epu8(rows[0], rows[1]),
+                            _mm_min_epu8(rows[2], rows[3]));
+  __m128i hi = _mm_max_epu8(_mm_max_epu8(rows[0], rows[1]),
+                            _mm_max_epu8(rows[2], rows[3]));
+  lo = _mm_min_epu8(lo, _mm_srli_si128(lo, 8));
+  lo = _mm_min_epu8(lo, _mm_srli_si128(lo, 4));
+  hi = _mm_max_epu8(hi, _mm_srli_si128(hi, 8));
+  hi = _mm_max_epu8(hi, _mm_srli_si128(hi, 4));
+  const int min_bits = _mm_cvtsi128_si32(lo), max_bits = _mm_cvtsi128_si32(hi);
+  memcpy(min, &min_bits, 4);
+  memcpy(max, &max_bits, 4);
+#else
+  memset(min, 255, 4);
+  memset(max, 0, 4);
+  for (int y = 0; y < 4; ++y) {
+    for (int i = 0; i < 16; ++i) {
+      min[i % 4] = std::min(min[i % 4], bgra[y * pitch + i]);
+      max[i % 4] = std::max(max[i % 4], bgra[y * pitch + i]);
+    }
+  }
+#endif
+}
+
+// Projects every texel on the line from c1 to c0, and picks the closest of the
+// four palette entries on that line.
+uint32_t GetColorIndices(const uint8_t *bgra, size_t pitch, const int *c0,
+                         const int *c1) {
+  const int axis[3] = {c0[0] - c1[0], c0[1] - c1[1], c0[2] - c1[2]};
+  const int length_sq =
+      axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2];
+  const float max_t = static_cast<float>(length_sq);
+  const float scale = 3.f / max_t;
+  int linear[16];
+#ifdef DX8TO12_BC_SSE2
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i axis_v = _mm_setr_epi16(
+      static_cast<int16_t>(axis[0]), static_cast<int16_t>(axis[1]),
+      static_cast<int16_t>(axis[2]), 0, static_cast<int16_t>(axis[0]),
+      static_cast<int16_t>(axis[1]), static_cast<int16_t>(axis[2]), 0);
+  const __m128i base_v = _mm_setr_epi16(
+      static_cast<int16_t>(c1[0]), static_cast<int16_t>(c1[1]),
+      static_cast<int16_t>(c1[2]), 0, static_cast<int16_t>(c1[0]),
+      static_cast<int16_t>(c1[1]), static_cast<int16_t>(c1[2]), 0);
+  for (int y = 0; y < 4; ++y) {
+    const __m128i texels =
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(bgra + y * pitch));
+    // Two texels per register, one channel per 16-bit lane. Alpha is
+    // multiplied by 0.
+    __m128i lo = _mm_sub_epi16(_mm_unpacklo_epi8(texels, zero), base_v);
+    __m128i hi = _mm_sub_epi16(_mm_unpackhi_epi8(texels, zero), base_v);
+    lo = _mm_madd_epi16(lo, axis_v);
+    hi = _mm_madd_epi16(hi, axis_v);
+    // Sum up the two halves of each texel's dot product into its low lane.
+    lo = _mm_add_epi32(lo, _mm_srli_epi64(lo, 32));
+    hi = _mm_add_epi32(hi, _mm_srli_epi64(hi, 32));
+    const __m128i dots = _mm_castps_si128(
+        _mm_shuffle_ps(_mm_castsi128_ps(lo), _mm_castsi128_ps(hi),
+                       _MM_SHUFFLE(2, 0, 2, 0)));
+    __m128 t = _mm_cvtepi32_ps(dots);
+    t = _mm_min_ps(_mm_max_ps(t, _mm_setzero_ps()), _mm_set1_ps(max_t));
+    t = _mm_add_ps(_mm_mul_ps(t, _mm_set1_ps(scale)), _mm_set1_ps(0.5f));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(linear + y * 4),
+                     _mm_cvttps_epi32(t));
+  }
+#else
+  for (int i = 0; i < 16; ++i) {
+    const uint8_t *texel = bgra + (i / 4) * pitch + (i % 4) * 4;
+    const int dot = (texel[0] - c1[0]) * axis[0] +
+                    (texel[1] - c1[1]) * axis[1] + (texel[2] - c1[2]) * axis[2];
+    const float t = std::clamp(static_cast<float>(dot), 0.f, max_t);
+    linear[i] = static_cast<int>(t * scale + 0.5f);
+  }
+#endif
+  uint32_t indices = 0;
+  for (int i = 0; i < 16; ++i) {
+    indices |= kColorIndexFromLinear[linear[i]] << (2 * i);
+  }
+  return indices;
+}
+
+void EncodeColorBlock(const uint8_t *bgra, size_t pitch, const uint8_t *min,
+                      const uint8_t *max, uint8_t *out) {
+  uint8_t lo[3], hi[3];
+  for (int i = 0; i < 3; ++i) {
+    // Inset the bounding box, which makes its corners closer to the texels.
+    const int inset = (max[i] - min[i]) >> 4;
+    lo[i] = static_cast<uint8_t>(min[i] + inset);
+    hi[i] = static_cast<uint8_t>(max[i] - inset);
+  }
+  uint16_t color0 = To565(hi), color1 = To565(lo);
+  // color0 > color1 selects the four color mode.
+  if (color0 < color1) std::swap(color0, color1);
+  uint32_t indices = 0;
+  if (color0 != color1) {
+    int c0[3], c1[3];
+    From565(color0, c0);
+    From565(color1, c1);
+    indices = GetColorIndices(bgra, pitch, c0, c1);
+  }
+  out[0] = static_cast<uint8_t>(color0);
+  out[1] = static_cast<uint8_t>(color0 >> 8);
+  out[2] = static_cast<uint8_t>(color1);
+  out[3] = static_cast<uint8_t>(color1 >> 8);
+  memcpy(out + 4, &indices, 4);
+}
+
+void EncodeAlphaBlock(const uint8_t *bgra, size_t pitch, uint8_t alpha0,
+                      uint8_t alpha1, uint8_t *out) {
+  // alpha0 > alpha1 selects the eight alpha mode. Equal values are a constant
+  // block.
+  uint64_t indices = 0;
+  const int range = alpha0 - alpha1;
+  if (range > 0) {
+    for (int i = 0; i < 16; ++i) {
+      const int alpha = bgra[(i / 4) * pitch + (i % 4) * 4 + 3];
+      const int linear = ((alpha - alpha1) * 14 + range) / (2 * range);
+      indices |= kAlphaIndexFromLinear[linear] << (3 * i);
+    }
+  }
+  out[0] = alpha0;
+  out[1] = alpha1;
+  for (int i = 0; i < 6; ++i) {
+    out[2 + i] = static_cast<uint8_t>(indices >> (8 * i));
+  }
+}
+
+}  // namespace
+
+void EncodeBc1Block(const uint8_t *bgra, size_t pitch, uint8_t *out) {
+  uint8_t min[4], max[4];
+  GetBoundingBox(bgra, pitch, min, max);
+  EncodeColorBlock(bgra, pitch, min, max, out);
+}
+
+void EncodeBc3Block(const uint8_t *bgra, size_t pitch, uint8_t *out) {
+  uint8_t min[4], max[4];
+  GetBoundingBox(bgra, pitch, min, max);
+  EncodeAlphaBlock(bgra, pitch, max[3], min[3], out);
+  EncodeColorBlock(bgra, pitch, min, max, out + 8);
+}
+
+void EncodeBcImage(BcFormat format, const uint8_t *bgra, size_t pitch,
+                   uint32_t width, uint32_t height, uint8_t *dst,
+                   size_t dst_pitch) {
+  const int block_size = BcBlockSize(format);
+  for (uint32_t y = 0; y < height; y += 4) {
+    uint8_t *out = dst + (y / 4) * dst_pitch;
+    for (uint32_t x = 0; x < width; x += 4, out += block_size) {
+      const uint8_t *block = bgra + y * pitch + x * 4;
+      size_t block_pitch = pitch;
+      uint8_t edge_block[64];
+      if (x + 4 > width || y + 4 > height) {
+        // Repeat the last row and column.
+        for (uint32_t i = 0; i < 16; ++i) {
+          const uint32_t src_x = std::min(x + i % 4, width - 1);
+          const uint32_t src_y = std::min(y + i / 4, height - 1);
+          memcpy(edge_block + i * 4, bgra + src_y * pitch + src_x * 4, 4);
+        }
+        block = edge_block;
+        block_pitch = 16;
+      }
+      if (format == BcFormat::kBc1) {
+        EncodeBc1Block(block, block_pitch, out);
+      } else {
+        EncodeBc3Block(block, block_pitch, out);
+      }
+    }
+  }
+}
+
+bool IsOpaque(const uint8_t *bgra, size_t pitch, uint32_t width,
+              uint32_t height) {
+  for (uint32_t y = 0; y < height; ++y) {
+    const uint8_t *row = bgra + y * pitch;
+    uint8_t alpha = 255;
+    for (uint32_t x = 0; x < width; ++x) alpha &= row[x * 4 + 3];
+    if (alpha != 255) return false;
+  }
+  return true;
+}
+
+}  // namespace Dx8to12
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace Dx8to12 {
+
+enum class BcFormat {
+  // Opaque colors, 8 bytes per 4x4 block.
+  kBc1,
+  // Colors plus interpolated alpha, 16 bytes per 4x4 block.
+  kBc3,
+};
+
+constexpr int BcBlockSize(BcFormat format) {
+  return format == BcFormat::kBc1 ? 8 : 16;
+}
+
+// Fast, single-pass block compression of 32-bit BGRA (i.e. D3DFMT_A8R8G8B8)
+// images. Endpoints are the corners of the block's color bounding box, inset
+// by 1/16th of its size, and every texel is projected onto the line between
+// them. This is a lot worse than a proper cluster fit, but fast enough to run
+// on textures as they are loaded. Uses SSE2 where available.
+
+// Encodes one block of 4x4 texels, pitch bytes apart.
+void EncodeBc1Block(const uint8_t* bgra, size_t pitch, uint8_t* out);
+void EncodeBc3Block(const uint8_t* bgra, size_t pitch, uint8_t* out);
+
+// Encodes a width x height image. Edge blocks of images that are not a multiple
+// of 4 in size repeat the last row and column. Rows of blocks are written
+// dst_pitch bytes apart.
+void EncodeBcImage(BcFormat format, const uint8_t* bgra, size_t pitch,
+                   uint32_t width, uint32_t height, uint8_t* dst,
+                   size_t dst_pitch);
+
+// True if every texel of the image has an alpha of 255.
+bool IsOpaque(const uint8_t* bgra, size_t pitch, uint32_t width,
+              uint32_t height);
+
+}  // namespace Dx8to12
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace Dx8to12 {
+
+// Root constants of the bindless pixel shaders (kUseBindlessTextures): the SRV
+// heap index of each texture stage, followed by the sampler heap index of each
+// stage. This is the BindlessIndices cbuffer of ps_common.hlsl, which reads
+// stage s's index as component s % 4 of vector s / 4 of its uint4 arrays.
+struct BindlessIndices {
+  static constexpr int kNumStages = 8;
+
+  uint32_t texture_indices[kNumStages];
+  uint32_t sampler_indices[kNumStages];
+};
+
+// Where each half starts, and the size of the whole, in 32-bit root constants.
+inline constexpr uint32_t kBindlessTextureIndicesOffset =
+    offsetof(BindlessIndices, texture_indices) / sizeof(uint32_t);
+inline constexpr uint32_t kBindlessSamplerIndicesOffset =
+    offsetof(BindlessIndices, sampler_indices) / sizeof(uint32_t);
+inline constexpr uint32_t kNumBindlessIndices =
+    sizeof(BindlessIndices) / sizeof(uint32_t);
+
+}  // namespace Dx8to12
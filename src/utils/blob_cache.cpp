@@ -0,0 +1,302 @@
+#include "blob_cache.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <filesystem>
+#include <utility>
+
+#include "murmur_hash.h"
+
+namespace Dx8to12 {
+namespace {
+
+constexpr char kFileMagic[8] = {'D', 'X', '8', 'S', 'H', 'C', 'C', 'H'};
+constexpr uint32_t kFileVersion = 1;
+constexpr uint32_t kRecordMagic = 0x43424853;  // "SHBC"
+constexpr uint32_t kRecordBlob = 1;
+constexpr uint32_t kRecordUse = 2;
+// Blobs are padded, so that record headers stay aligned.
+constexpr size_t kRecordAlignment = 8;
+
+struct FileHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t reserved;
+};
+
+struct RecordHeader {
+  uint32_t magic;
+  uint32_t type;
+  BlobCache::Key key;
+  // 0 for kRecordUse.
+  uint32_t size;
+  uint32_t checksum;
+  uint32_t reserved;
+  // Of everything above.
+  uint32_t header_checksum;
+};
+static_assert(sizeof(RecordHeader) == 40);
+
+uint32_t HeaderChecksum(const RecordHeader &header) {
+  return MurmurHashTo32(&header, offsetof(RecordHeader, header_checksum));
+}
+
+size_t PaddedSize(size_t size) {
+  return (size + kRecordAlignment - 1) & ~(kRecordAlignment - 1);
+}
+
+size_t RecordSize(size_t blob_size) {
+  return sizeof(RecordHeader) + PaddedSize(blob_size);
+}
+
+uint64_t Fnv1a64(std::string_view data) {
+  uint64_t hash = 0xcbf29ce484222325ull;
+  for (char c : data) {
+    hash ^= static_cast<uint8_t>(c);
+    hash *= 0x100000001b3ull;
+  }
+  return hash;
+}
+
+}  // namespace
+
+BlobCache::KeyBuilder &BlobCache::KeyBuilder::Add(std::string_view part) {
+  Add(static_cast<uint32_t>(part.size()));
+  material_.append(part);
+  return *this;
+}
+
+BlobCache::KeyBuilder &BlobCache::KeyBuilder::Add(uint32_t value) {
+  material_.append(reinterpret_cast<const char *>(&value), sizeof(value));
+  return *this;
+}
+
+BlobCache::Key BlobCache::KeyBuilder::Finish() const {
+  return {.fnv_hash = Fnv1a64(material_),
+          .murmur_hash = MurmurHashTo32(material_.data(), material_.size()),
+          .size = static_cast<uint32_t>(material_.size())};
+}
+
+BlobCache::~BlobCache() {
+  if (file_ != nullptr) std::fclose(file_);
+}
+
+bool BlobCache::Open(const std::string &path, uint64_t max_bytes) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (file_ != nullptr) std::fclose(file_);
+  file_ = nullptr;
+  path_ = path;
+  entries_.clear();
+  next_use_ = 0;
+  size_t valid_bytes = 0;
+  if (mapped_.Open(path_)) valid_bytes = LoadIndex();
+  // Start over if the file is new or damaged, and compact it if it got too
+  // big.
+  if (valid_bytes == 0 || valid_bytes != mapped_.size() ||
+      mapped_.size() > max_bytes) {
+    const uint64_t target =
+        mapped_.size() > max_bytes ? max_bytes / 4 * 3 : max_bytes;
+    if (!Rewrite(target)) return false;
+  }
+  return OpenForAppend();
+}
+
+size_t BlobCache::LoadIndex() {
+  const char *data = mapped_.data();
+  const size_t size = mapped_.size();
+  FileHeader file_header;
+  if (size < sizeof(file_header)) return 0;
+  std::memcpy(&file_header, data, sizeof(file_header));
+  if (std::memcmp(file_header.magic, kFileMagic, sizeof(kFileMagic)) != 0 ||
+      file_header.version != kFileVersion) {
+    return 0;
+  }
+  size_t offset = sizeof(file_header);
+  while (size - offset >= sizeof(RecordHeader)) {
+    RecordHeader header;
+    std::memcpy(&header, data + offset, sizeof(header));
+    if (header.magic != kRecordMagic ||
+        header.header_checksum != HeaderChecksum(header) ||
+        size - offset < RecordSize(header.size)) {
+      break;
+    }
+    if (header.type == kRecordBlob) {
+      // Later records for the same key win.
+      entries_[header.key] = {.blob = data + offset + sizeof(header),
+                              .size = header.size,
+                              .checksum = header.checksum,
+                              .last_use = next_use_++,
+                              .verified = false,
+                              .used = false,
+                              .data = {}};
+    } else if (header.type == kRecordUse) {
+      if (auto it = entries_.find(header.key); it != entries_.end()) {
+        it->second.last_use = next_use_++;
+      }
+    } else {
+      break;
+    }
+    offset += RecordSize(header.size);
+  }
+  return offset;
+}
+
+bool BlobCache::Rewrite(uint64_t max_bytes) {
+  // Most recently used first.
+  std::vector<std::pair<Key, const Entry *>> kept;
+  for (const auto &[key, entry] : entries_) kept.emplace_back(key, &entry);
+  std::sort(kept.begin(), kept.end(), [](const auto &a, const auto &b) {
+    return a.second->last_use > b.second->last_use;
+  });
+  uint64_t num_bytes = sizeof(FileHeader);
+  size_t num_kept = 0;
+  for (; num_kept < kept.size(); ++num_kept) {
+    const uint64_t record_size = RecordSize(kept[num_kept].second->size);
+    if (num_bytes + record_size > max_bytes) break;
+    num_bytes += record_size;
+  }
+  kept.resize(num_kept);
+
+  // Written oldest first, to keep their order of use.
+  const std::string temp_path = path_ + ".tmp";
+  std::FILE *file = std::fopen(temp_path.c_str(), "wb");
+  if (file == nullptr) {
+    mapped_.Close();
+    entries_.clear();
+    return false;
+  }
+  FileHeader file_header = {
+      .magic = {}, .version = kFileVersion, .reserved = 0};
+  std::memcpy(file_header.magic, kFileMagic, sizeof(kFileMagic));
+  bool ok = std::fwrite(&file_header, sizeof(file_header), 1, file) == 1;
+  std::FILE *previous_file = file_;
+  file_ = file;
+  for (auto it = kept.rbegin(); it != kept.rend() && ok; ++it) {
+    AppendRecord(kRecordBlob, it->first,
+                 {it->second->blob, it->second->size});
+  }
+  ok &= std::ferror(file) == 0;
+  file_ = previous_file;
+  ok &= std::fclose(file) == 0;
+
+  // The old file can only be replaced once it is no longer mapped.
+  mapped_.Close();
+  entries_.clear();
+  next_use_ = 0;
+  std::error_code error;
+  if (ok) std::filesystem::rename(temp_path, path_, error);
+  if (!ok || error) {
+    std::filesystem::remove(temp_path, error);
+    return false;
+  }
+  if (mapped_.Open(path_)) LoadIndex();
+  return true;
+}
+
+bool BlobCache::OpenForAppend() {
+  file_ = std::fopen(path_.c_str(), "ab");
+  if (file_ == nullptr) return false;
+  file_bytes_ = mapped_.size();
+  return true;
+}
+
+std::span<const char> BlobCache::Find(const Key &key) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return FindLocked(key);
+}
+
+std::span<const char> BlobCache::FindLocked(const Key &key) {
+  auto it = entries_.find(key);
+  if (it == entries_.end()) return {};
+  Entry &entry = it->second;
+  if (!entry.verified) {
+    if (MurmurHashTo32(entry.blob, entry.size) != entry.checksum) {
+      ++stats_.num_corrupt;
+      entries_.erase(it);
+      return {};
+    }
+    entry.verified = true;
+  }
+  if (!entry.used) {
+    // Entries that get used are kept the next time the file is compacted.
+    entry.used = true;
+    entry.last_use = next_use_++;
+    AppendRecord(kRecordUse, key, {});
+  }
+  return {entry.blob, entry.size};
+}
+
+void BlobCache::Insert(const Key &key, std::span<const char> blob) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  InsertLocked(key, blob);
+}
+
+void BlobCache::InsertLocked(const Key &key, std::span<const char> blob) {
+  Entry &entry = entries_[key];
+  if (!entry.data.empty()) replaced_blobs_.push_back(std::move(entry.data));
+  entry.data.assign(blob.begin(), blob.end());
+  entry.blob = entry.data.data();
+  entry.size = static_cast<uint32_t>(blob.size());
+  entry.checksum = MurmurHashTo32(blob.data(), blob.size());
+  entry.last_use = next_use_++;
+  entry.verified = true;
+  entry.used = true;
+  AppendRecord(kRecordBlob, key, blob);
+}
+
+std::span<const char> BlobCache::GetOrCompile(const Key &key,
+                                              const CompileFn &compile) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (std::span<const char> blob = FindLocked(key); !blob.empty()) {
+      ++stats_.num_hits;
+      return blob;
+    }
+    ++stats_.num_misses;
+  }
+  // Compile without holding the lock. Two threads may end up compiling the
+  // same blob, in which case the first one wins.
+  std::vector<char> blob;
+  if (!compile(&blob) || blob.empty()) return {};
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (std::span<const char> found = FindLocked(key); !found.empty()) {
+    return found;
+  }
+  InsertLocked(key, blob);
+  return FindLocked(key);
+}
+
+BlobCache::Stats BlobCache::stats() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  Stats stats = stats_;
+  stats.num_entries = static_cast<int>(entries_.size());
+  stats.file_bytes = file_bytes_;
+  return stats;
+}
+
+void BlobCache::AppendRecord(uint32_t type, const Key &key,
+                             std::span<const char> blob) {
+  if (file_ == nullptr) return;
+  RecordHeader header = {
+      .magic = kRecordMagic,
+      .type = type,
+      .key = key,
+      .size = static_cast<uint32_t>(blob.size()),
+      .checksum = MurmurHashTo32(blob.data(), blob.size()),
+      .reserved = 0,
+      .header_checksum = 0};
+  header.header_checksum = HeaderChecksum(header);
+  static constexpr char kPadding[kRecordAlignment] = {};
+  const size_t padding = PaddedSize(blob.size()) - blob.size();
+  std::fwrite(&header, sizeof(header), 1, file_);
+  if (!blob.empty()) {
+    std::fwrite(blob.data(), 1, blob.size(), file_);
+    std::fwrite(kPadding, 1, padding, file_);
+  }
+  // So that a crash loses as little as possible.
+  std::fflush(file_);
+  file_bytes_ += RecordSize(blob.size());
+}
+
+}  // namespace Dx8to12
@@ -0,0 +1,131 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <mutex>
+#include <span>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "mapped_file.h"
+
+namespace Dx8to12 {
+
+// Content-addressed store of compiled blobs (shader bytecode, driver pipeline
+// states) that persists across runs, so that they only have to be compiled the
+// first time they are ever used. Knows nothing about compilers: callers hash
+// whatever determines a blob into a Key, and compile on a miss.
+//
+// The file is an append-only log of records behind a small header. Each record
+// holds a key and its blob, or just marks a key as used during a run. On open,
+// the file is memory-mapped and scanned into an index, so cached blobs are
+// read straight out of the mapping. Every record header carries a checksum.
+// Scanning stops at the first bad one, e.g. a write that was torn by a crash,
+// and blob checksums are verified on first use. Recency of use is the order
+// of records in the log. If the file is over its size cap (or damaged) on
+// open, the most recently used entries are rewritten into a fresh file, down
+// to 3/4 of the cap.
+//
+// Thread-safe.
+class BlobCache {
+ public:
+  struct Key {
+    uint64_t fnv_hash;
+    uint32_t murmur_hash;
+    // Size of what was hashed.
+    uint32_t size;
+
+    bool operator==(const Key&) const = default;
+  };
+  // Hashes the parts of a key. Parts are length-prefixed, so that moving bytes
+  // from one part to the next changes the key.
+  class KeyBuilder {
+   public:
+    KeyBuilder& Add(std::string_view part);
+    KeyBuilder& Add(uint32_t value);
+    Key Finish() const;
+
+   private:
+    std::string material_;
+  };
+  // Fills in blob and returns true, or returns false if compiling failed.
+  using CompileFn = std::function<bool(std::vector<char>* blob)>;
+
+  struct Stats {
+    int num_entries;
+    int num_hits;
+    int num_misses;
+    // Entries dropped because their blob failed its checksum.
+    int num_corrupt;
+    uint64_t file_bytes;
+  };
+
+  BlobCache() = default;
+  ~BlobCache();
+  BlobCache(const BlobCache&) = delete;
+  BlobCache& operator=(const BlobCache&) = delete;
+
+  // Loads the cache at path, creating it if needed. Returns false if the file
+  // can't be written, in which case the cache only lives in memory.
+  bool Open(const std::string& path, uint64_t max_bytes);
+
+  // Returns the blob for key, or an empty span. Stays valid for as long as the
+  // cache does, or until the next Open.
+  std::span<const char> Find(const Key& key);
+  // Adds or replaces the blob for key. A replaced blob stays in memory, for
+  // the spans that still point at it.
+  void Insert(const Key& key, std::span<const char> blob);
+  // Returns the blob for key, calling compile and inserting its result on a
+  // miss. Empty if compiling failed. If two threads compile the same key, the
+  // first blob to be inserted wins.
+  std::span<const char> GetOrCompile(const Key& key, const CompileFn& compile);
+
+  Stats stats() const;
+
+ private:
+  struct KeyHash {
+    size_t operator()(const Key& key) const {
+      return static_cast<size_t>(key.fnv_hash);
+    }
+  };
+  struct Entry {
+    // Points into the mapping, or into data if it was added during this run.
+    const char* blob;
+    uint32_t size;
+    uint32_t checksum;
+    // Position of the entry's last record in the log.
+    uint64_t last_use;
+    bool verified;
+    // Whether this run has recorded a use yet.
+    bool used;
+    std::vector<char> data;
+  };
+
+  // Scans the mapped file into entries_. Returns the size of its valid part,
+  // or 0 if its header is bad.
+  size_t LoadIndex();
+  // Rewrites the file with the most recently used entries that fit in
+  // max_bytes.
+  bool Rewrite(uint64_t max_bytes);
+  bool OpenForAppend();
+  std::span<const char> FindLocked(const Key& key);
+  void InsertLocked(const Key& key, std::span<const char> blob);
+  void AppendRecord(uint32_t type, const Key& key, std::span<const char> blob);
+
+  mutable std::mutex mutex_;
+  std::string path_;
+  MappedFile mapped_;
+  std::FILE* file_ = nullptr;
+  uint64_t file_bytes_ = 0;
+  uint64_t next_use_ = 0;
+  std::unordered_map<Key, Entry, KeyHash> entries_;
+  // Blobs of entries that were replaced during this run. Moving a vector
+  // keeps its storage where it is.
+  std::vector<std::vector<char>> replaced_blobs_;
+  Stats stats_ = {};
+};
+
+}  // namespace Dx8to12
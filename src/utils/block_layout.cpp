@@ -0,0 +1,37 @@
+#include "block_layout.h"
+
+#include <algorithm>
+
+namespace Dx8to12 {
+
+uint32_t NumBlockRows(BlockFormat format, uint32_t height) {
+  return (height + format.block_dim - 1) / format.block_dim;
+}
+
+uint32_t CompactRowPitch(BlockFormat format, uint32_t width) {
+  return (width + format.block_dim - 1) / format.block_dim * format.block_size;
+}
+
+uint32_t FootprintRowPitch(BlockFormat format, uint32_t width) {
+  const uint32_t align = kFootprintPitchAlignment;
+  return (CompactRowPitch(format, width) + align - 1) / align * align;
+}
+
+size_t CompactBlockOffset(BlockFormat format, uint32_t row_pitch, uint32_t x,
+                          uint32_t y) {
+  return static_cast<size_t>(y / format.block_dim) * row_pitch +
+         static_cast<size_t>(x / format.block_dim) * format.block_size;
+}
+
+LevelLayout GetLevelLayout(BlockFormat format, uint32_t width, uint32_t height,
+                           uint32_t mip) {
+  LevelLayout layout;
+  layout.width = std::max<uint32_t>(1, width >> mip);
+  layout.height = std::max<uint32_t>(1, height >> mip);
+  layout.row_pitch = CompactRowPitch(format, layout.width);
+  layout.num_rows = NumBlockRows(format, layout.height);
+  layout.size = layout.row_pitch * layout.num_rows;
+  return layout;
+}
+
+}  // namespace Dx8to12
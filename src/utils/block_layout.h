@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace Dx8to12 {
+
+// How texels are laid out in memory: in blocks of block_dim x block_dim
+// texels, block_size bytes each. Uncompressed formats have 1x1 blocks of one
+// texel. dx_utils maps DXGI formats to these; the math below doesn't need D3D.
+struct BlockFormat {
+  uint32_t block_dim;
+  uint32_t block_size;
+};
+
+// Number of rows of blocks needed for height texels. This is the number of
+// rows in a locked level, and in its copyable footprint.
+uint32_t NumBlockRows(BlockFormat format, uint32_t height);
+// Size of a tightly packed row of blocks covering width texels. This is the
+// pitch that D3D8 applications expect.
+uint32_t CompactRowPitch(BlockFormat format, uint32_t width);
+// Row pitch of a copyable footprint covering width texels: CompactRowPitch
+// aligned to kFootprintPitchAlignment, like D3D12 wants it.
+inline constexpr uint32_t kFootprintPitchAlignment = 256;
+uint32_t FootprintRowPitch(BlockFormat format, uint32_t width);
+// Offset of the block holding texel (x, y), in rows of row_pitch bytes.
+size_t CompactBlockOffset(BlockFormat format, uint32_t row_pitch, uint32_t x,
+                          uint32_t y);
+
+// A mip level as D3D8 applications lock it.
+struct LevelLayout {
+  // Size of the level in texels, at least 1 even for block-compressed formats.
+  // This is what GetLevelDesc reports.
+  uint32_t width;
+  uint32_t height;
+  uint32_t row_pitch;
+  uint32_t num_rows;
+  // row_pitch * num_rows, which GetLevelDesc reports as Size.
+  uint32_t size;
+
+  bool operator==(const LevelLayout&) const = default;
+};
+
+// Layout of level mip of a width x height texture.
+LevelLayout GetLevelLayout(BlockFormat format, uint32_t width, uint32_t height,
+                           uint32_t mip);
+
+}  // namespace Dx8to12
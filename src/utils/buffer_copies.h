@@ -0,0 +1,52 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+namespace Dx8to12 {
+
+// A copy of num_bytes from src to dest. Resource is only compared, never
+// dereferenced, so this works with any resource type (and with fake ones in
+// tests).
+template <typename Resource>
+struct BufferCopy {
+  Resource *dest;
+  int64_t dest_offset;
+  Resource *src;
+  int64_t src_offset;
+  int64_t num_bytes;
+};
+
+// Sorts copies by destination and destination offset, then merges copies
+// that are contiguous in both the destination and the source. Copies to the
+// same destination end up next to each other, so the caller can transition
+// each destination once, after its last copy.
+template <typename Resource>
+void SortAndMergeCopies(std::vector<BufferCopy<Resource>> *copies) {
+  using Copy = BufferCopy<Resource>;
+  std::sort(copies->begin(), copies->end(),
+            [](const Copy &a, const Copy &b) {
+              if (a.dest != b.dest) {
+                return std::less<Resource *>()(a.dest, b.dest);
+              }
+              return a.dest_offset < b.dest_offset;
+            });
+  size_t num_merged = 0;
+  for (const Copy &copy : *copies) {
+    if (num_merged > 0) {
+      Copy &prev = (*copies)[num_merged - 1];
+      if (prev.dest == copy.dest && prev.src == copy.src &&
+          prev.dest_offset + prev.num_bytes == copy.dest_offset &&
+          prev.src_offset + prev.num_bytes == copy.src_offset) {
+        prev.num_bytes += copy.num_bytes;
+        continue;
+      }
+    }
+    (*copies)[num_merged++] = copy;
+  }
+  copies->resize(num_merged);
+}
+
+}  // namespace Dx8to12
@@ -0,0 +1,65 @@
+#include "copy_queue_sync.h"
+
+#include <algorithm>
+
+#include "utils/asserts.h"
+
+namespace Dx8to12 {
+
+uint64_t CopyQueueSync::AddUpload(uint64_t last_used_frame) {
+  has_open_batch_ = true;
+  open_batch_wait_ = std::max(open_batch_wait_, last_used_frame);
+  return next_value_;
+}
+
+CopyQueueSync::Batch CopyQueueSync::SubmitBatch(uint64_t frame) {
+  ASSERT(has_open_batch_);
+  Batch batch = {.signal_value = next_value_++,
+                 .direct_wait_value = open_batch_wait_};
+  has_open_batch_ = false;
+  open_batch_wait_ = 0;
+  in_flight_.emplace_back(frame, batch.signal_value);
+  return batch;
+}
+
+void CopyQueueSync::RequireForDirect(uint64_t copy_value) {
+  direct_required_ = std::max(direct_required_, copy_value);
+}
+
+uint64_t CopyQueueSync::TakeDirectWait(uint64_t completed_copy_value) {
+  ASSERT(!IsOpen(direct_required_));
+  const uint64_t required = direct_required_;
+  direct_required_ = 0;
+  if (required <= direct_waited_ || required <= completed_copy_value) return 0;
+  direct_waited_ = required;
+  return required;
+}
+
+uint64_t CopyQueueSync::CompletedFrame(uint64_t completed_frame,
+                                       uint64_t completed_copy_value) const {
+  // Batches complete in order, so the first one that is still running holds
+  // back its frame and every frame after it.
+  for (const auto &[frame, copy_value] : in_flight_) {
+    if (copy_value <= completed_copy_value) continue;
+    return std::min(completed_frame, frame - 1);
+  }
+  return completed_frame;
+}
+
+uint64_t CopyQueueSync::CopyValueFor(uint64_t frame) const {
+  uint64_t copy_value = 0;
+  for (const auto &[batch_frame, batch_value] : in_flight_) {
+    if (batch_frame > frame) break;
+    copy_value = batch_value;
+  }
+  return copy_value;
+}
+
+void CopyQueueSync::Retire(uint64_t completed_copy_value) {
+  while (!in_flight_.empty() &&
+         in_flight_.front().second <= completed_copy_value) {
+    in_flight_.pop_front();
+  }
+}
+
+}  // namespace Dx8to12
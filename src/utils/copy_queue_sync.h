@@ -0,0 +1,72 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <utility>
+
+namespace Dx8to12 {
+
+// Fence bookkeeping between the direct queue, whose fence values are frames,
+// and a copy queue that uploads textures next to it. Knows nothing about the
+// queues themselves: the caller records and submits, and asks what to wait
+// for. Copy fence values start at 1 and go up by one per batch.
+//
+// - A copy batch waits for the last frame that used any of its textures on the
+//   direct queue, so that an upload never overwrites texels a draw still reads.
+// - A direct command list waits for the batches of the textures it uses, and
+//   only if it uses any.
+// - A frame only counts as complete once the batches submitted during it are,
+//   so that the ring memory and frame resources they use outlive them.
+class CopyQueueSync {
+ public:
+  struct Batch {
+    // Copy fence value that the batch signals once it is done.
+    uint64_t signal_value;
+    // Direct fence value to wait for before executing the batch, 0 if none.
+    uint64_t direct_wait_value;
+  };
+
+  // Adds an upload to the open batch, of a texture last used on the direct
+  // queue in last_used_frame (0 if never). That frame has to have been
+  // submitted. Returns the batch's copy fence value.
+  uint64_t AddUpload(uint64_t last_used_frame);
+  bool has_open_batch() const { return has_open_batch_; }
+  // Whether copy_value belongs to the open batch, i.e. has not been submitted.
+  bool IsOpen(uint64_t copy_value) const {
+    return has_open_batch_ && copy_value == next_value_;
+  }
+  // Closes the open batch, which is being submitted during frame.
+  Batch SubmitBatch(uint64_t frame);
+
+  // Called when the direct command list being recorded uses a texture that
+  // was uploaded by copy_value (0 for none). Its batch has to be submitted
+  // before the list is.
+  void RequireForDirect(uint64_t copy_value);
+  // Called right before the direct command list is executed. Returns the copy
+  // fence value the direct queue has to wait for first, 0 if none.
+  uint64_t TakeDirectWait(uint64_t completed_copy_value);
+
+  // Last frame that is done on both queues, given the last completed frame and
+  // copy fence value.
+  uint64_t CompletedFrame(uint64_t completed_frame,
+                          uint64_t completed_copy_value) const;
+  // Copy fence value that has to be reached for frame to be complete, 0 if
+  // none.
+  uint64_t CopyValueFor(uint64_t frame) const;
+  // Forgets about batches that are done.
+  void Retire(uint64_t completed_copy_value);
+
+ private:
+  uint64_t next_value_ = 1;
+  bool has_open_batch_ = false;
+  uint64_t open_batch_wait_ = 0;
+  // Submitted batches that may still be running, as (frame, copy value),
+  // oldest first.
+  std::deque<std::pair<uint64_t, uint64_t>> in_flight_;
+  // Largest copy value the direct list being recorded needs, and the largest
+  // one the direct queue has already waited for.
+  uint64_t direct_required_ = 0;
+  uint64_t direct_waited_ = 0;
+};
+
+}  // namespace Dx8to12
@@ -0,0 +1,73 @@
+#include "cpu_features.h"
+
+#include <cstdint>
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || \
+    defined(__x86_64__)
+#define DX8TO12_CPUID_X86
+#ifdef _MSC_VER
+#include <immintrin.h>
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+namespace Dx8to12 {
+namespace {
+
+#ifdef DX8TO12_CPUID_X86
+void Cpuid(int leaf, int regs[4]) {
+#ifdef _MSC_VER
+  __cpuidex(regs, leaf, 0);
+#else
+  unsigned int a, b, c, d;
+  __cpuid_count(leaf, 0, a, b, c, d);
+  regs[0] = static_cast<int>(a);
+  regs[1] = static_cast<int>(b);
+  regs[2] = static_cast<int>(c);
+  regs[3] = static_cast<int>(d);
+#endif
+}
+
+// Which register states the OS saves on context switches.
+uint64_t GetEnabledXcrFeatures() {
+#if defined(_MSC_VER) && !defined(__clang__)
+  return _xgetbv(0);
+#else
+  uint32_t eax, edx;
+  __asm__ volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+  return (static_cast<uint64_t>(edx) << 32) | eax;
+#endif
+}
+
+CpuFeatures DetectFeatures() {
+  CpuFeatures features = {};
+  int regs[4];
+  Cpuid(0, regs);
+  const int max_leaf = regs[0];
+  Cpuid(1, regs);
+  features.sse2 = regs[3] & (1 << 26);
+  features.ssse3 = regs[2] & (1 << 9);
+  // AVX needs OS support for saving YMM registers.
+  const bool has_osxsave = regs[2] & (1 << 27);
+  const bool has_avx = regs[2] & (1 << 28);
+  if (has_osxsave && has_avx && (GetEnabledXcrFeatures() & 6) == 6 &&
+      max_leaf >= 7) {
+    Cpuid(7, regs);
+    features.avx2 = regs[1] & (1 << 5);
+  }
+  return features;
+}
+#else
+CpuFeatures DetectFeatures() { return {}; }
+#endif
+
+}  // namespace
+
+const CpuFeatures& GetCpuFeatures() {
+  static const CpuFeatures features = DetectFeatures();
+  return features;
+}
+
+}  // namespace Dx8to12
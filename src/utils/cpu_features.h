@@ -0,0 +1,17 @@
+#pragma once
+
+namespace Dx8to12 {
+
+// Instruction set extensions that the CPU (and OS, for AVX) supports. Used to
+// pick the vector kernels of the texture helpers at runtime. All false on
+// non-x86 builds.
+struct CpuFeatures {
+  bool sse2;
+  bool ssse3;
+  bool avx2;
+};
+
+// Detected once, on first use.
+const CpuFeatures& GetCpuFeatures();
+
+}  // namespace Dx8to12
@@ -0,0 +1,35 @@
+#include "dedup_state.h"
+
+namespace Dx8to12 {
+
+DedupWrite DedupStateForWrite(DedupState state) {
+  switch (state) {
+    case DedupState::kNone:
+    case DedupState::kNever:
+      return {.next_state = state,
+              .cancel_job = false,
+              .forget_hash = false,
+              .leave_group = false};
+    case DedupState::kQueued:
+      return {.next_state = DedupState::kNone,
+              .cancel_job = true,
+              .forget_hash = false,
+              .leave_group = false};
+    case DedupState::kHashed:
+      return {.next_state = DedupState::kNever,
+              .cancel_job = false,
+              .forget_hash = true,
+              .leave_group = false};
+    case DedupState::kShared:
+      return {.next_state = DedupState::kNever,
+              .cancel_job = false,
+              .forget_hash = false,
+              .leave_group = true};
+  }
+  return {.next_state = state,
+          .cancel_job = false,
+          .forget_hash = false,
+          .leave_group = false};
+}
+
+}  // namespace Dx8to12
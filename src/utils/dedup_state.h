@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cstdint>
+
+namespace Dx8to12 {
+
+// Where a managed texture is in being deduplicated by the device's
+// TextureDeduplicator.
+enum class DedupState {
+  kNone,
+  kQueued,
+  // Hashed, and still has a GPU copy of its own.
+  kHashed,
+  // Shares its GPU copy with textures that have the same contents.
+  kShared,
+  // Not eligible, or written to after it was hashed.
+  kNever,
+};
+
+// What happens to a texture whose contents are about to change (see
+// GpuTexture::StopSharing).
+struct DedupWrite {
+  DedupState next_state;
+  // The queued hash is of the old contents, and has to be dropped.
+  bool cancel_job;
+  // Drop the texture from the deduplicator's candidates.
+  bool forget_hash;
+  // Leave the group, and get a GPU copy of its own back.
+  bool leave_group;
+};
+
+// Textures are filled by locks before they are first drawn with, so writes
+// only count against textures that were hashed already. Those stay away from
+// sharing for good, since they are likely to change again. Textures that are
+// still queued go back to kNone, and get hashed again on their next draw.
+DedupWrite DedupStateForWrite(DedupState state);
+
+// Whether a texture that is about to be drawn with gets queued for hashing.
+inline bool ShouldQueueForDedup(DedupState state) {
+  return state == DedupState::kNone;
+}
+
+}  // namespace Dx8to12
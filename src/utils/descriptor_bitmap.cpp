@@ -0,0 +1,132 @@
+#include "descriptor_bitmap.h"
+
+#include <algorithm>
+#include <bit>
+
+#include "utils/asserts.h"
+
+namespace Dx8to12 {
+
+DescriptorBitmap::DescriptorBitmap(int size) : size_(size) {
+  const int num_words = (size + kBitsPerWord - 1) / kBitsPerWord;
+  free_bits_.resize(num_words);
+  free_summary_.resize((num_words + kBitsPerWord - 1) / kBitsPerWord);
+  generations_.resize(size, 0);
+  FreeAll();
+}
+
+void DescriptorBitmap::MarkFree(int index) {
+  const int word = index / kBitsPerWord;
+  free_bits_[word] |= uint64_t{1} << (index % kBitsPerWord);
+  free_summary_[word / kBitsPerWord] |= uint64_t{1} << (word % kBitsPerWord);
+}
+
+void DescriptorBitmap::MarkUsed(int index) {
+  const int word = index / kBitsPerWord;
+  free_bits_[word] &= ~(uint64_t{1} << (index % kBitsPerWord));
+  if (free_bits_[word] == 0) {
+    free_summary_[word / kBitsPerWord] &=
+        ~(uint64_t{1} << (word % kBitsPerWord));
+  }
+}
+
+int DescriptorBitmap::FindFirstFree() const {
+  for (size_t i = 0; i < free_summary_.size(); ++i) {
+    if (free_summary_[i] == 0) continue;
+    const int word =
+        static_cast<int>(i) * kBitsPerWord + std::countr_zero(free_summary_[i]);
+    return word * kBitsPerWord + std::countr_zero(free_bits_[word]);
+  }
+  return -1;
+}
+
+int DescriptorBitmap::FindFreeRun(int count) const {
+  if (count == 1) return FindFirstFree();
+  int run_start = -1;
+  int run_length = 0;
+  const int num_words = static_cast<int>(free_bits_.size());
+  for (int word = 0; word < num_words; ++word) {
+    // Skip 64 fully used words at a time.
+    if (word % kBitsPerWord == 0 && free_summary_[word / kBitsPerWord] == 0) {
+      run_length = 0;
+      word += kBitsPerWord - 1;
+      continue;
+    }
+    const uint64_t bits = free_bits_[word];
+    if (bits == 0) {
+      run_length = 0;
+    } else if (bits == ~uint64_t{0}) {
+      if (run_length == 0) run_start = word * kBitsPerWord;
+      run_length += kBitsPerWord;
+      if (run_length >= count) return run_start;
+    } else {
+      for (int bit = 0; bit < kBitsPerWord; ++bit) {
+        if ((bits >> bit) & 1) {
+          if (run_length == 0) run_start = word * kBitsPerWord + bit;
+          if (++run_length >= count) return run_start;
+        } else {
+          run_length = 0;
+        }
+      }
+    }
+  }
+  return -1;
+}
+
+int DescriptorBitmap::Allocate() {
+  const int index = FindFirstFree();
+  if (index < 0) return -1;
+  MarkUsed(index);
+  ++num_used_;
+  peak_used_ = std::max(peak_used_, num_used_);
+  return index;
+}
+
+int DescriptorBitmap::AllocateRange(int count) {
+  ASSERT(count > 0);
+  const int index = FindFreeRun(count);
+  if (index < 0) return -1;
+  for (int i = index; i < index + count; ++i) {
+    MarkUsed(i);
+  }
+  num_used_ += count;
+  peak_used_ = std::max(peak_used_, num_used_);
+  return index;
+}
+
+void DescriptorBitmap::Free(int index) {
+  ASSERT(index >= 0 && index < size_ && !IsFree(index));
+  MarkFree(index);
+  ++generations_[index];
+  --num_used_;
+}
+
+void DescriptorBitmap::FreeAll() {
+  std::fill(free_bits_.begin(), free_bits_.end(), 0);
+  std::fill(free_summary_.begin(), free_summary_.end(), 0);
+  for (int i = 0; i < size_; ++i) {
+    ++generations_[i];
+    MarkFree(i);
+  }
+  num_used_ = 0;
+}
+
+DescriptorBitmap::Stats DescriptorBitmap::stats() const {
+  int largest_run = 0;
+  int run = 0;
+  for (int i = 0; i < size_; ++i) {
+    run = IsFree(i) ? run + 1 : 0;
+    largest_run = std::max(largest_run, run);
+  }
+  const int num_free = size_ - num_used_;
+  return {.num_used = num_used_,
+          .num_free = num_free,
+          .peak_used = peak_used_,
+          .largest_free_range = largest_run,
+          .fragmentation =
+              num_free == 0 ? 0.0f
+                            : 1.0f - static_cast<float>(largest_run) /
+                                         static_cast<float>(num_free)};
+}
+
+}  // namespace Dx8to12
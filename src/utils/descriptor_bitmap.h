@@ -0,0 +1,65 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+namespace Dx8to12 {
+
+// Bookkeeping for DescriptorPoolHeap: which of size descriptors are free, in
+// a two-level bitmap. The summary level has one bit per bitmap word that still
+// has a free descriptor, so finding a free descriptor is a couple of
+// count-trailing-zeros away. Each descriptor also has a generation, bumped
+// every time it is freed, which lets stale handles be detected. Knows nothing
+// about the heap itself.
+class DescriptorBitmap {
+ public:
+  struct Stats {
+    int num_used;
+    int num_free;
+    int peak_used;
+    int largest_free_range;
+    // 0 when all free descriptors are contiguous, approaching 1 as free space
+    // gets split into smaller runs.
+    float fragmentation;
+  };
+
+  DescriptorBitmap() = default;
+  explicit DescriptorBitmap(int size);
+
+  // Returns the lowest free index, or -1 if every descriptor is used.
+  int Allocate();
+  // Returns the first index of the lowest run of count free descriptors, or
+  // -1 if there is none.
+  int AllocateRange(int count);
+  // The descriptor must be in use.
+  void Free(int index);
+  void FreeAll();
+
+  bool IsFree(int index) const {
+    return (free_bits_[index / kBitsPerWord] >> (index % kBitsPerWord)) & 1;
+  }
+  uint32_t generation(int index) const { return generations_[index]; }
+  int size() const { return size_; }
+  int num_used() const { return num_used_; }
+  Stats stats() const;
+
+ private:
+  static constexpr int kBitsPerWord = 64;
+
+  void MarkFree(int index);
+  void MarkUsed(int index);
+  int FindFirstFree() const;
+  // Returns the first index of a free run of count descriptors, or -1.
+  int FindFreeRun(int count) const;
+
+  int size_ = 0;
+  // One bit per descriptor, set when free. Bits past size_ are always clear.
+  std::vector<uint64_t> free_bits_;
+  // One bit per free_bits_ word, set when the word is non-zero.
+  std::vector<uint64_t> free_summary_;
+  std::vector<uint32_t> generations_;
+  int num_used_ = 0;
+  int peak_used_ = 0;
+};
+
+}  // namespace Dx8to12
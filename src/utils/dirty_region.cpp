@@ -0,0 +1,69 @@
+#include "dirty_region.h"
+
+#include <algorithm>
+
+namespace Dx8to12 {
+namespace {
+
+DirtyRect Union(const DirtyRect &a, const DirtyRect &b) {
+  return {.left = std::min(a.left, b.left),
+          .top = std::min(a.top, b.top),
+          .right = std::max(a.right, b.right),
+          .bottom = std::max(a.bottom, b.bottom)};
+}
+
+bool Contains(const DirtyRect &outer, const DirtyRect &inner) {
+  return outer.left <= inner.left && outer.top <= inner.top &&
+         outer.right >= inner.right && outer.bottom >= inner.bottom;
+}
+
+// Texels that merging a and b would upload for nothing. Negative if they
+// overlap enough that their union is cheaper than both.
+int64_t MergeWaste(const DirtyRect &a, const DirtyRect &b) {
+  return static_cast<int64_t>(Union(a, b).area()) -
+         static_cast<int64_t>(a.area() + b.area());
+}
+
+}  // namespace
+
+void DirtyRegion::Add(const DirtyRect &rect) {
+  if (rect.left >= rect.right || rect.top >= rect.bottom) return;
+  for (const DirtyRect &existing : rects_) {
+    if (Contains(existing, rect)) return;
+  }
+  std::erase_if(rects_, [&](const DirtyRect &existing) {
+    return Contains(rect, existing);
+  });
+  rects_.push_back(rect);
+  MergeRects();
+}
+
+void DirtyRegion::MergeRects() {
+  while (rects_.size() > 1) {
+    size_t best_i = 0, best_j = 1;
+    int64_t best_waste = MergeWaste(rects_[0], rects_[1]);
+    for (size_t i = 0; i < rects_.size(); ++i) {
+      for (size_t j = i + 1; j < rects_.size(); ++j) {
+        const int64_t waste = MergeWaste(rects_[i], rects_[j]);
+        if (waste < best_waste) {
+          best_waste = waste;
+          best_i = i;
+          best_j = j;
+        }
+      }
+    }
+    if (best_waste > 0 && rects_.size() <= static_cast<size_t>(max_rects_)) {
+      return;
+    }
+    const DirtyRect merged = Union(rects_[best_i], rects_[best_j]);
+    // best_j > best_i, so erase it first. The union may cover others too.
+    rects_.erase(rects_.begin() + best_j);
+    rects_.erase(rects_.begin() + best_i);
+    std::erase_if(rects_, [&](const DirtyRect &other) {
+      return Contains(merged, other);
+    });
+    rects_.push_back(merged);
+  }
+}
+
+}  // namespace Dx8to12
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+namespace Dx8to12 {
+
+// Half-open rectangle of texels, [left, right) x [top, bottom).
+struct DirtyRect {
+  uint32_t left;
+  uint32_t top;
+  uint32_t right;
+  uint32_t bottom;
+
+  uint64_t area() const {
+    return static_cast<uint64_t>(right - left) * (bottom - top);
+  }
+};
+
+// The parts of a texture level that changed since it was last uploaded, as a
+// few (possibly overlapping) rectangles. Rectangles are merged whenever their
+// bounding box is no bigger than the two of them combined, and the pair that
+// wastes the fewest texels is merged whenever there are more than max_rects.
+// So a region never costs more than max_rects copies, and repeated locks of
+// the same tile don't add up.
+class DirtyRegion {
+ public:
+  explicit DirtyRegion(int max_rects) : max_rects_(max_rects) {}
+
+  // Empty rectangles are ignored.
+  void Add(const DirtyRect& rect);
+  void Clear() { rects_.clear(); }
+
+  bool empty() const { return rects_.empty(); }
+  const std::vector<DirtyRect>& rects() const { return rects_; }
+
+ private:
+  void MergeRects();
+
+  int max_rects_;
+  std::vector<DirtyRect> rects_;
+};
+
+}  // namespace Dx8to12
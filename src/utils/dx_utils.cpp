@@ -70,14 +70,24 @@ D3DFORMAT DXGIToD3DFormat(DXGI_FORMAT dxgi_format) {
       return D3DFMT_A4R4G4B4;
     case DXGI_FORMAT_B5G5R5A1_UNORM:
       return D3DFMT_A1R5G5B5;
-    case DXGI_FORMAT_R32G32_FLOAT:
-      return D3DFMT_R3G3B2;
     case DXGI_FORMAT_D32_FLOAT:
       return D3DFMT_D32;
     case DXGI_FORMAT_D16_UNORM:
       return D3DFMT_D16;
     case DXGI_FORMAT_A8_UNORM:
       return D3DFMT_A8;
+    case DXGI_FORMAT_R8_UNORM:
+      return D3DFMT_L8;
+    case DXGI_FORMAT_R8G8_UNORM:
+      return D3DFMT_A8L8;
+    // The premultiplied DXT2 and DXT4 share their DXGI format with DXT3 and
+    // DXT5. Textures remember which one they were created with.
+    case DXGI_FORMAT_BC1_UNORM:
+      return D3DFMT_DXT1;
+    case DXGI_FORMAT_BC2_UNORM:
+      return D3DFMT_DXT3;
+    case DXGI_FORMAT_BC3_UNORM:
+      return D3DFMT_DXT5;
     default:
       FAIL("Unimplemented DXGI_FORMAT %d\n", dxgi_format);
   }
@@ -92,12 +102,11 @@ DXGI_FORMAT DXGIFromD3DFormat(D3DFORMAT d3d_format) {
     case D3DFMT_R5G6B5:
       return DXGI_FORMAT_B5G6R5_UNORM;
     case D3DFMT_A4R4G4B4:
+    case D3DFMT_X4R4G4B4:
       return DXGI_FORMAT_B4G4R4A4_UNORM;
     case D3DFMT_X1R5G5B5:
     case D3DFMT_A1R5G5B5:
       return DXGI_FORMAT_B5G5R5A1_UNORM;
-    case D3DFMT_R3G3B2:
-      return DXGI_FORMAT_R32G32_FLOAT;
     case D3DFMT_A8:
       return DXGI_FORMAT_A8_UNORM;
     case D3DFMT_D32:
@@ -112,12 +121,20 @@ DXGI_FORMAT DXGIFromD3DFormat(D3DFORMAT d3d_format) {
       return DXGI_FORMAT_R8G8B8A8_SNORM;
     case D3DFMT_V16U16:
       return DXGI_FORMAT_R16G16_SNORM;
-    case D3DFMT_P8:
+    // Luminance is read from red (see GetSrvComponentMapping).
     case D3DFMT_L8:
+      return DXGI_FORMAT_R8_UNORM;
     case D3DFMT_A8L8:
     case D3DFMT_A4L4:
+      return DXGI_FORMAT_R8G8_UNORM;
+    // Expanded on upload (see GetFormatConversion).
+    case D3DFMT_R8G8B8:
+    case D3DFMT_R3G3B2:
+      return DXGI_FORMAT_B8G8R8X8_UNORM;
     case D3DFMT_A8R3G3B2:
-    case D3DFMT_X4R4G4B4:
+    case D3DFMT_P8:
+      return DXGI_FORMAT_B8G8R8A8_UNORM;
+
     case D3DFMT_A8P8:
     case D3DFMT_L6V5U5:
     case D3DFMT_X8L8V8U8:
@@ -127,20 +144,21 @@ DXGI_FORMAT DXGIFromD3DFormat(D3DFORMAT d3d_format) {
     case D3DFMT_YUY2:
       return DXGI_FORMAT_UNKNOWN;
 
+    // Premultiplied alpha only changes how the application blends. The blocks
+    // decode the same way.
     case D3DFMT_DXT1:
+      return DXGI_FORMAT_BC1_UNORM;
     case D3DFMT_DXT2:
     case D3DFMT_DXT3:
+      return DXGI_FORMAT_BC2_UNORM;
     case D3DFMT_DXT4:
     case D3DFMT_DXT5:
-      return DXGI_FORMAT_UNKNOWN;
+      return DXGI_FORMAT_BC3_UNORM;
 
     case D3DFMT_D24S8:
     case D3DFMT_D24X8:
     case D3DFMT_D24X4S4:
       return DXGI_FORMAT_UNKNOWN;
-
-    case D3DFMT_R8G8B8:
-      return DXGI_FORMAT_UNKNOWN;
     default:
       FAIL("Unimplemented D3DFORMAT %d\n", d3d_format);
   }
@@ -151,6 +169,7 @@ int DXGIFormatSize(DXGI_FORMAT format) {
     case DXGI_FORMAT_R32_SINT:
     case DXGI_FORMAT_R32_UINT:
     case DXGI_FORMAT_B8G8R8A8_UNORM:
+    case DXGI_FORMAT_B8G8R8X8_UNORM:
     case DXGI_FORMAT_D32_FLOAT:
       return 4;
     case DXGI_FORMAT_R16_SINT:
@@ -159,16 +178,87 @@ int DXGIFormatSize(DXGI_FORMAT format) {
     case DXGI_FORMAT_B4G4R4A4_UNORM:
     case DXGI_FORMAT_B5G6R5_UNORM:
     case DXGI_FORMAT_B5G5R5A1_UNORM:
+    case DXGI_FORMAT_R8G8_UNORM:
       return 2;
-    case DXGI_FORMAT_B8G8R8X8_UNORM:
-      // This is tricky. We need to make sure DX8 can never lock R8G8B8
-      // textures.
-      return 4;
+    case DXGI_FORMAT_R8_UNORM:
+    case DXGI_FORMAT_A8_UNORM:
+      return 1;
+    case DXGI_FORMAT_BC1_UNORM:
+      return 8;
+    case DXGI_FORMAT_BC2_UNORM:
+    case DXGI_FORMAT_BC3_UNORM:
+      return 16;
     default:
       FAIL("Unexpected format %d", format);
   }
 }
 
+bool IsBlockCompressed(DXGI_FORMAT format) {
+  return format == DXGI_FORMAT_BC1_UNORM || format == DXGI_FORMAT_BC2_UNORM ||
+         format == DXGI_FORMAT_BC3_UNORM;
+}
+
+uint32_t DXGIFormatBlockDim(DXGI_FORMAT format) {
+  return IsBlockCompressed(format) ? 4 : 1;
+}
+
+BlockFormat GetBlockFormat(DXGI_FORMAT format) {
+  return {.block_dim = DXGIFormatBlockDim(format),
+          .block_size = static_cast<uint32_t>(DXGIFormatSize(format))};
+}
+
+uint32_t NumBlockRows(DXGI_FORMAT format, uint32_t height) {
+  return NumBlockRows(GetBlockFormat(format), height);
+}
+
+uint32_t CompactRowPitch(DXGI_FORMAT format, uint32_t width) {
+  return CompactRowPitch(GetBlockFormat(format), width);
+}
+
+static_assert(kFootprintPitchAlignment == D3D12_TEXTURE_DATA_PITCH_ALIGNMENT);
+
+uint32_t FootprintRowPitch(DXGI_FORMAT format, uint32_t width) {
+  return FootprintRowPitch(GetBlockFormat(format), width);
+}
+
+FormatConversion GetFormatConversion(D3DFORMAT d3d_format) {
+  switch (d3d_format) {
+    case D3DFMT_R8G8B8:
+      return FormatConversion::kR8G8B8ToB8G8R8X8;
+    case D3DFMT_A4L4:
+      return FormatConversion::kA4L4ToR8G8;
+    case D3DFMT_R3G3B2:
+      return FormatConversion::kR3G3B2ToB8G8R8X8;
+    case D3DFMT_A8R3G3B2:
+      return FormatConversion::kA8R3G3B2ToB8G8R8A8;
+    case D3DFMT_P8:
+      return FormatConversion::kP8ToB8G8R8A8;
+    default:
+      return FormatConversion::kNone;
+  }
+}
+
+UINT GetSrvComponentMapping(D3DFORMAT d3d_format) {
+  constexpr UINT kRed = D3D12_SHADER_COMPONENT_MAPPING_FROM_MEMORY_COMPONENT_0;
+  constexpr UINT kGreen =
+      D3D12_SHADER_COMPONENT_MAPPING_FROM_MEMORY_COMPONENT_1;
+  constexpr UINT kBlue = D3D12_SHADER_COMPONENT_MAPPING_FROM_MEMORY_COMPONENT_2;
+  constexpr UINT kOne = D3D12_SHADER_COMPONENT_MAPPING_FORCE_VALUE_1;
+  switch (d3d_format) {
+    case D3DFMT_L8:
+      return D3D12_ENCODE_SHADER_4_COMPONENT_MAPPING(kRed, kRed, kRed, kOne);
+    case D3DFMT_A8L8:
+    case D3DFMT_A4L4:
+      return D3D12_ENCODE_SHADER_4_COMPONENT_MAPPING(kRed, kRed, kRed, kGreen);
+    // The X bits hold garbage.
+    case D3DFMT_X4R4G4B4:
+    case D3DFMT_X1R5G5B5:
+      return D3D12_ENCODE_SHADER_4_COMPONENT_MAPPING(kRed, kGreen, kBlue, kOne);
+    default:
+      return D3D12_DEFAULT_SHADER_4_COMPONENT_MAPPING;
+  }
+}
+
 ScopedGpuMarker::ScopedGpuMarker(ID3D12GraphicsCommandList *cmd_list,
                                  const char *annotation)
     : cmd_list_(cmd_list) {
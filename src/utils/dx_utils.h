@@ -9,6 +9,8 @@
 #include "SimpleMath.h"
 #include "d3d8.h"
 #include "util.h"
+#include "utils/block_layout.h"
+#include "utils/format_conversion.h"
 #include "utils/murmur_hash.h"
 
 namespace Dx8to12 {
@@ -16,7 +18,26 @@ struct TextureStageState;
 
 D3DFORMAT DXGIToD3DFormat(DXGI_FORMAT dxgi_format);
 DXGI_FORMAT DXGIFromD3DFormat(D3DFORMAT d3d_format);
+// Size of a texel, or of a block for block-compressed formats.
 int DXGIFormatSize(DXGI_FORMAT format);
+// BC1-3 (DXT1-5) store 4x4 blocks of texels.
+bool IsBlockCompressed(DXGI_FORMAT format);
+// Width and height of a block in texels. 1 for uncompressed formats.
+uint32_t DXGIFormatBlockDim(DXGI_FORMAT format);
+BlockFormat GetBlockFormat(DXGI_FORMAT format);
+// Number of rows of blocks needed for height texels. This is the number of
+// rows in a locked level, and in its copyable footprint.
+uint32_t NumBlockRows(DXGI_FORMAT format, uint32_t height);
+// Size of a tightly packed row of blocks covering width texels. This is the
+// pitch that D3D8 applications expect.
+uint32_t CompactRowPitch(DXGI_FORMAT format, uint32_t width);
+// Row pitch of a copyable footprint covering width texels.
+uint32_t FootprintRowPitch(DXGI_FORMAT format, uint32_t width);
+// How texels of d3d_format are expanded to its DXGI format on upload.
+FormatConversion GetFormatConversion(D3DFORMAT d3d_format);
+// Swizzle for SRVs of d3d_format, e.g. to replicate luminance, or to ignore
+// the X bits of X4R4G4B4.
+UINT GetSrvComponentMapping(D3DFORMAT d3d_format);
 
 struct GpuPtr {
  public:
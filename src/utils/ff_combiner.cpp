@@ -0,0 +1,216 @@
+#include "ff_combiner.h"
+
+#include <algorithm>
+
+namespace Dx8to12 {
+namespace {
+
+using namespace Combiner;
+
+bool IsSupportedOp(uint32_t op) {
+  switch (op) {
+    case kOpSelectArg1:
+    case kOpSelectArg2:
+    case kOpModulate:
+    case kOpModulate2x:
+    case kOpModulate4x:
+    case kOpAdd:
+    case kOpAddSigned:
+    case kOpBlendTextureAlpha:
+    case kOpBlendFactorAlpha:
+    case kOpBlendCurrentAlpha:
+    case kOpDotProduct3:
+      return true;
+    default:
+      return false;
+  }
+}
+
+bool IsSupportedArg(uint32_t arg) {
+  if ((arg & ~(kArgSelectMask | kArgComplement)) != 0) return false;
+  return (arg & kArgSelectMask) <= kArgSpecular;
+}
+
+uint32_t PackWord(uint32_t op, uint32_t arg1, uint32_t arg2) {
+  return op | arg1 << 8 | arg2 << 16;
+}
+
+Float4 Splat(float value) { return {value, value, value, value}; }
+
+Float4 SelectArg(uint32_t arg, const CombinerInputs& inputs,
+                 const Float4& current, const Float4& texture) {
+  Float4 value;
+  switch (arg & kArgSelectMask) {
+    case kArgDiffuse:
+      value = inputs.diffuse;
+      break;
+    case kArgCurrent:
+      value = current;
+      break;
+    case kArgTexture:
+      value = texture;
+      break;
+    case kArgTFactor:
+      value = inputs.texture_factor;
+      break;
+    default:
+      value = inputs.specular;
+      break;
+  }
+  if (arg & kArgComplement) {
+    for (float& c : value) c = 1.f - c;
+  }
+  return value;
+}
+
+// The blend factor of the BLEND*ALPHA ops.
+float BlendAlpha(uint32_t op, const CombinerInputs& inputs,
+                 const Float4& current, const Float4& texture) {
+  switch (op) {
+    case kOpBlendTextureAlpha:
+      return texture[3];
+    case kOpBlendFactorAlpha:
+      return inputs.texture_factor[3];
+    case kOpBlendCurrentAlpha:
+      return current[3];
+    default:
+      return 0.f;
+  }
+}
+
+Float4 ApplyOp(uint32_t op, const Float4& arg1, const Float4& arg2,
+               float alpha) {
+  if (op == kOpDotProduct3) {
+    float dot = 0.f;
+    for (int i = 0; i < 4; ++i) dot += (arg1[i] - 0.5f) * (arg2[i] - 0.5f);
+    return Splat(std::clamp(dot, 0.f, 1.f));
+  }
+  Float4 result;
+  for (int i = 0; i < 4; ++i) {
+    const float a = arg1[i];
+    const float b = arg2[i];
+    switch (op) {
+      case kOpSelectArg2:
+        result[i] = b;
+        break;
+      case kOpModulate:
+        result[i] = a * b;
+        break;
+      case kOpModulate2x:
+        result[i] = a * b * 2.f;
+        break;
+      case kOpModulate4x:
+        result[i] = a * b * 4.f;
+        break;
+      case kOpAdd:
+        result[i] = a + b;
+        break;
+      case kOpAddSigned:
+        result[i] = a + b - 0.5f;
+        break;
+      case kOpBlendFactorAlpha:
+        result[i] = a * alpha + b * (1.f - alpha);
+        break;
+      case kOpBlendTextureAlpha:
+      case kOpBlendCurrentAlpha:
+        result[i] = a + b * (1.f - alpha);
+        break;
+      default:
+        result[i] = a;
+        break;
+    }
+  }
+  return result;
+}
+
+// Applies a packed color or alpha word.
+Float4 ApplyWord(uint32_t word, const CombinerInputs& inputs,
+                 const Float4& current, const Float4& texture) {
+  const uint32_t op = word & 0xff;
+  const Float4 arg1 = SelectArg((word >> 8) & 0xff, inputs, current, texture);
+  const Float4 arg2 = SelectArg((word >> 16) & 0xff, inputs, current, texture);
+  return ApplyOp(op, arg1, arg2, BlendAlpha(op, inputs, current, texture));
+}
+
+bool AlphaTestPasses(uint32_t func, float alpha, float ref) {
+  switch (func) {
+    case kCmpNever:
+      return false;
+    case kCmpLess:
+      return alpha < ref;
+    case kCmpEqual:
+      return alpha == ref;
+    case kCmpLessEqual:
+      return alpha <= ref;
+    case kCmpGreater:
+      return alpha > ref;
+    case kCmpNotEqual:
+      return alpha != ref;
+    case kCmpGreaterEqual:
+      return alpha >= ref;
+    default:
+      return true;
+  }
+}
+
+}  // namespace
+
+bool CanUseUbershader(const CombinerState& state) {
+  if (state.alpha_func < kCmpNever || state.alpha_func > kCmpAlways) {
+    return false;
+  }
+  for (const CombinerStage& stage : state.stages) {
+    if (stage.color_op == kOpDisable) break;
+    if (!IsSupportedOp(stage.color_op) || !IsSupportedArg(stage.color_arg1) ||
+        !IsSupportedArg(stage.color_arg2)) {
+      return false;
+    }
+    if (stage.alpha_op != kOpDisable &&
+        (!IsSupportedOp(stage.alpha_op) || !IsSupportedArg(stage.alpha_arg1) ||
+         !IsSupportedArg(stage.alpha_arg2))) {
+      return false;
+    }
+    if (stage.texcoord_index >= kNumStages) return false;
+  }
+  return true;
+}
+
+UbershaderConstants PackUbershaderConstants(const CombinerState& state) {
+  UbershaderConstants constants = {};
+  constants.alpha_func = state.alpha_func;
+  for (int i = 0; i < kNumStages; ++i) {
+    const CombinerStage& stage = state.stages[i];
+    if (stage.color_op == kOpDisable) break;
+    constants.stages[2 * i] =
+        PackWord(stage.color_op, stage.color_arg1, stage.color_arg2) |
+        stage.texcoord_index << 24 | uint32_t{stage.has_texture} << 31;
+    if (stage.alpha_op != kOpDisable) {
+      constants.stages[2 * i + 1] =
+          PackWord(stage.alpha_op, stage.alpha_arg1, stage.alpha_arg2);
+    }
+  }
+  return constants;
+}
+
+CombinerOutput EvaluateCombiner(const UbershaderConstants& constants,
+                                const CombinerInputs& inputs) {
+  Float4 current = inputs.diffuse;
+  for (int i = 0; i < kNumStages; ++i) {
+    const uint32_t color_word = constants.stages[2 * i];
+    const uint32_t alpha_word = constants.stages[2 * i + 1];
+    // Unused stages are 0.
+    if ((color_word & 0xff) <= kOpDisable) break;
+    const Float4 texture =
+        (color_word >> 31) != 0 ? inputs.textures[i] : Splat(1.f);
+    const Float4 color = ApplyWord(color_word, inputs, current, texture);
+    for (int c = 0; c < 3; ++c) current[c] = color[c];
+    if ((alpha_word & 0xff) > kOpDisable) {
+      current[3] = ApplyWord(alpha_word, inputs, current, texture)[3];
+    }
+  }
+  return {.color = current,
+          .discarded = !AlphaTestPasses(constants.alpha_func, current[3],
+                                        inputs.alpha_ref)};
+}
+
+}  // namespace Dx8to12
@@ -0,0 +1,112 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+
+namespace Dx8to12 {
+
+// The fixed-function texture stage combiner as plain data, for the pixel
+// ubershader (shaders/ff_ubershader.hlsl) that reads it from constants
+// instead of having it compiled in. Ops, args and the alpha func hold
+// D3DTEXTUREOP, D3DTA_* and D3DCMPFUNC values; ff_pixel_shader.cpp checks
+// that the constants below match them.
+//
+// Semantics follow CreatePixelShaderFromState: stages run until the first one
+// whose color op is disabled, results are not clamped between stages, and a
+// disabled alpha op leaves alpha alone.
+namespace Combiner {
+constexpr int kNumStages = 8;
+
+constexpr uint32_t kOpDisable = 1;
+constexpr uint32_t kOpSelectArg1 = 2;
+constexpr uint32_t kOpSelectArg2 = 3;
+constexpr uint32_t kOpModulate = 4;
+constexpr uint32_t kOpModulate2x = 5;
+constexpr uint32_t kOpModulate4x = 6;
+constexpr uint32_t kOpAdd = 7;
+constexpr uint32_t kOpAddSigned = 8;
+constexpr uint32_t kOpBlendTextureAlpha = 13;
+constexpr uint32_t kOpBlendFactorAlpha = 14;
+constexpr uint32_t kOpBlendCurrentAlpha = 16;
+constexpr uint32_t kOpDotProduct3 = 24;
+
+constexpr uint32_t kArgSelectMask = 0xf;
+constexpr uint32_t kArgDiffuse = 0;
+constexpr uint32_t kArgCurrent = 1;
+constexpr uint32_t kArgTexture = 2;
+constexpr uint32_t kArgTFactor = 3;
+constexpr uint32_t kArgSpecular = 4;
+constexpr uint32_t kArgComplement = 0x10;
+constexpr uint32_t kArgAlphaReplicate = 0x20;
+
+constexpr uint32_t kCmpNever = 1;
+constexpr uint32_t kCmpLess = 2;
+constexpr uint32_t kCmpEqual = 3;
+constexpr uint32_t kCmpLessEqual = 4;
+constexpr uint32_t kCmpGreater = 5;
+constexpr uint32_t kCmpNotEqual = 6;
+constexpr uint32_t kCmpGreaterEqual = 7;
+constexpr uint32_t kCmpAlways = 8;
+}  // namespace Combiner
+
+struct CombinerStage {
+  uint32_t color_op;
+  uint32_t color_arg1;
+  uint32_t color_arg2;
+  uint32_t alpha_op;
+  uint32_t alpha_arg1;
+  uint32_t alpha_arg2;
+  uint32_t texcoord_index;
+  bool has_texture;
+};
+
+struct CombinerState {
+  std::array<CombinerStage, Combiner::kNumStages> stages;
+  uint32_t alpha_func;
+};
+
+// The combiner as the ubershader reads it, at the end of the pixel cbuffer.
+// Each stage takes two words:
+//   color: op | arg1 << 8 | arg2 << 16 | texcoord index << 24 | texture << 31
+//   alpha: op | arg1 << 8 | arg2 << 16
+// Stages after the last active one are zero.
+struct UbershaderConstants {
+  uint32_t stages[2 * Combiner::kNumStages];
+  uint32_t alpha_func;
+  uint32_t pad[3];
+
+  bool operator==(const UbershaderConstants&) const = default;
+};
+static_assert(sizeof(UbershaderConstants) == 80);
+
+// Whether the ubershader implements everything state uses. It covers the same
+// ops and args as CreatePixelShaderFromState, but only texture coordinates
+// that come from the vertex (no auto-generated ones, which need cube maps).
+bool CanUseUbershader(const CombinerState& state);
+UbershaderConstants PackUbershaderConstants(const CombinerState& state);
+
+using Float4 = std::array<float, 4>;
+
+// What the ubershader reads besides its constants.
+struct CombinerInputs {
+  Float4 diffuse;
+  Float4 specular;
+  Float4 texture_factor;
+  float alpha_ref;
+  // What each stage's texture sampled to. Ignored for stages that have no
+  // texture, which read as opaque white instead.
+  std::array<Float4, Combiner::kNumStages> textures;
+};
+
+struct CombinerOutput {
+  Float4 color;
+  bool discarded;
+};
+
+// CPU reference for the ubershader. Evaluates the packed constants line by
+// line the way ff_ubershader.hlsl does, so that both can be checked against
+// the combiner's semantics without a GPU.
+CombinerOutput EvaluateCombiner(const UbershaderConstants& constants,
+                                const CombinerInputs& inputs);
+
+}  // namespace Dx8to12
@@ -0,0 +1,13 @@
+#include "flush_trigger.h"
+
+namespace Dx8to12 {
+
+FlushReasons GetFlushReasons(const FlushWatermarks &watermarks,
+                             size_t ring_bytes, int num_recorded_commands,
+                             int num_free_samplers) {
+  return {.ring = ring_bytes >= watermarks.ring_bytes,
+          .commands = num_recorded_commands >= watermarks.recorded_commands,
+          .samplers = num_free_samplers < watermarks.min_free_samplers};
+}
+
+}  // namespace Dx8to12
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstddef>
+
+namespace Dx8to12 {
+
+// How much a command list may use before it is flushed mid-frame.
+struct FlushWatermarks {
+  // Dynamic ring bytes allocated since the last submission.
+  size_t ring_bytes;
+  // Draws and copies recorded since the last submission.
+  int recorded_commands;
+  // Sampler descriptors that have to be free for the next draw.
+  int min_free_samplers;
+};
+
+// Which watermarks the command list being recorded has hit.
+struct FlushReasons {
+  bool ring;
+  bool commands;
+  bool samplers;
+
+  bool any() const { return ring || commands || samplers; }
+};
+
+// Checks the command list being recorded against watermarks, before the next
+// draw or copy is recorded.
+FlushReasons GetFlushReasons(const FlushWatermarks &watermarks,
+                             size_t ring_bytes, int num_recorded_commands,
+                             int num_free_samplers);
+
+}  // namespace Dx8to12
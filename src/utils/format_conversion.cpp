@@ -0,0 +1,291 @@
+#include "format_conversion.h"
+
+#include "cpu_features.h"
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || \
+    defined(__x86_64__)
+#define DX8TO12_CONVERT_X86
+#include <immintrin.h>
+#endif
+
+#if defined(__clang__) || defined(__GNUC__)
+#define DX8TO12_TARGET(isa) __attribute__((target(isa)))
+#else
+#define DX8TO12_TARGET(isa)
+#endif
+
+namespace Dx8to12 {
+namespace {
+
+constexpr uint32_t kOpaqueAlpha = 0xFF000000;
+
+// Bit replication to 8 bits.
+constexpr uint32_t Expand3(uint32_t x) {
+  return (x << 5) | (x << 2) | (x >> 1);
+}
+constexpr uint32_t Expand2(uint32_t x) { return x * 0x55; }
+constexpr uint32_t Expand4(uint32_t x) { return x * 0x11; }
+
+// R3G3B2 to B8G8R8 in the low 24 bits.
+constexpr uint32_t ExpandRgb332(uint32_t rgb) {
+  return Expand2(rgb & 3) | (Expand3((rgb >> 2) & 7) << 8) |
+         (Expand3(rgb >> 5) << 16);
+}
+
+// Per-texel loops, one per conversion. Each converts texels [begin, end) of a
+// row, so that the vector kernels can use them for their tails.
+void ConvertR8G8B8Scalar(uint32_t *dst, const uint8_t *src, uint32_t begin,
+                         uint32_t end) {
+  for (uint32_t i = begin; i < end; ++i) {
+    const uint8_t *texel = src + i * 3;
+    dst[i] = texel[0] | (texel[1] << 8) | (texel[2] << 16) | kOpaqueAlpha;
+  }
+}
+
+void ConvertA4L4Scalar(uint8_t *dst, const uint8_t *src, uint32_t begin,
+                       uint32_t end) {
+  for (uint32_t i = begin; i < end; ++i) {
+    dst[i * 2] = static_cast<uint8_t>(Expand4(src[i] & 15));
+    dst[i * 2 + 1] = static_cast<uint8_t>(Expand4(src[i] >> 4));
+  }
+}
+
+void ConvertR3G3B2Scalar(uint32_t *dst, const uint8_t *src, uint32_t begin,
+                         uint32_t end) {
+  for (uint32_t i = begin; i < end; ++i) {
+    dst[i] = ExpandRgb332(src[i]) | kOpaqueAlpha;
+  }
+}
+
+void ConvertA8R3G3B2Scalar(uint32_t *dst, const uint16_t *src, uint32_t begin,
+                           uint32_t end) {
+  for (uint32_t i = begin; i < end; ++i) {
+    dst[i] = ExpandRgb332(src[i] & 0xFF) | ((src[i] >> 8) << 24);
+  }
+}
+
+// A table lookup per texel, which no x86 vector extension does faster.
+void ConvertP8(uint32_t *dst, const uint8_t *src, uint32_t width,
+               const uint32_t *palette) {
+  uint32_t i = 0;
+  for (; i + 4 <= width; i += 4) {
+    dst[i] = palette[src[i]];
+    dst[i + 1] = palette[src[i + 1]];
+    dst[i + 2] = palette[src[i + 2]];
+    dst[i + 3] = palette[src[i + 3]];
+  }
+  for (; i < width; ++i) dst[i] = palette[src[i]];
+}
+
+void ConvertRowScalar(FormatConversion conversion, void *dst, const void *src,
+                      uint32_t width, const uint32_t *palette) {
+  auto *d32 = static_cast<uint32_t *>(dst);
+  const auto *s8 = static_cast<const uint8_t *>(src);
+  switch (conversion) {
+    case FormatConversion::kR8G8B8ToB8G8R8X8:
+      return ConvertR8G8B8Scalar(d32, s8, 0, width);
+    case FormatConversion::kA4L4ToR8G8:
+      return ConvertA4L4Scalar(static_cast<uint8_t *>(dst), s8, 0, width);
+    case FormatConversion::kR3G3B2ToB8G8R8X8:
+      return ConvertR3G3B2Scalar(d32, s8, 0, width);
+    case FormatConversion::kA8R3G3B2ToB8G8R8A8:
+      return ConvertA8R3G3B2Scalar(d32, static_cast<const uint16_t *>(src), 0,
+                                   width);
+    case FormatConversion::kP8ToB8G8R8A8:
+      return ConvertP8(d32, s8, width, palette);
+    case FormatConversion::kNone:
+      break;
+  }
+}
+
+#ifdef DX8TO12_CONVERT_X86
+// Expands 8 R3G3B2 texels, one per 16-bit lane, and stores them as B8G8R8A8
+// with the alpha in the low byte of the matching lane of alpha.
+DX8TO12_TARGET("sse2")
+void StoreRgb332(uint32_t *dst, __m128i rgb, __m128i alpha) {
+  const __m128i r = _mm_srli_epi16(rgb, 5);
+  const __m128i g = _mm_and_si128(_mm_srli_epi16(rgb, 2), _mm_set1_epi16(7));
+  const __m128i b = _mm_and_si128(rgb, _mm_set1_epi16(3));
+  const __m128i r8 =
+      _mm_or_si128(_mm_or_si128(_mm_slli_epi16(r, 5), _mm_slli_epi16(r, 2)),
+                   _mm_srli_epi16(r, 1));
+  const __m128i g8 =
+      _mm_or_si128(_mm_or_si128(_mm_slli_epi16(g, 5), _mm_slli_epi16(g, 2)),
+                   _mm_srli_epi16(g, 1));
+  const __m128i b8 = _mm_mullo_epi16(b, _mm_set1_epi16(0x55));
+  const __m128i bg = _mm_or_si128(b8, _mm_slli_epi16(g8, 8));
+  const __m128i ra = _mm_or_si128(r8, _mm_slli_epi16(alpha, 8));
+  _mm_storeu_si128(reinterpret_cast<__m128i *>(dst),
+                   _mm_unpacklo_epi16(bg, ra));
+  _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + 4),
+                   _mm_unpackhi_epi16(bg, ra));
+}
+
+DX8TO12_TARGET("sse2")
+void ConvertA4L4Sse2(uint8_t *dst, const uint8_t *src, uint32_t width) {
+  const __m128i low_nibbles = _mm_set1_epi8(15);
+  uint32_t i = 0;
+  for (; i + 16 <= width; i += 16) {
+    const __m128i v =
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+    // Nibbles never carry into the neighboring byte, so 16-bit shifts work.
+    const __m128i l = _mm_and_si128(v, low_nibbles);
+    const __m128i a = _mm_and_si128(_mm_srli_epi16(v, 4), low_nibbles);
+    const __m128i l8 = _mm_or_si128(l, _mm_slli_epi16(l, 4));
+    const __m128i a8 = _mm_or_si128(a, _mm_slli_epi16(a, 4));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i * 2),
+                     _mm_unpacklo_epi8(l8, a8));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i * 2 + 16),
+                     _mm_unpackhi_epi8(l8, a8));
+  }
+  ConvertA4L4Scalar(dst, src, i, width);
+}
+
+DX8TO12_TARGET("sse2")
+void ConvertR3G3B2Sse2(uint32_t *dst, const uint8_t *src, uint32_t width) {
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i opaque = _mm_set1_epi16(0xFF);
+  uint32_t i = 0;
+  for (; i + 16 <= width; i += 16) {
+    const __m128i v =
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+    StoreRgb332(dst + i, _mm_unpacklo_epi8(v, zero), opaque);
+    StoreRgb332(dst + i + 8, _mm_unpackhi_epi8(v, zero), opaque);
+  }
+  ConvertR3G3B2Scalar(dst, src, i, width);
+}
+
+DX8TO12_TARGET("sse2")
+void ConvertA8R3G3B2Sse2(uint32_t *dst, const uint16_t *src, uint32_t width) {
+  const __m128i low_bytes = _mm_set1_epi16(0xFF);
+  uint32_t i = 0;
+  for (; i + 8 <= width; i += 8) {
+    const __m128i v =
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+    StoreRgb332(dst + i, _mm_and_si128(v, low_bytes), _mm_srli_epi16(v, 8));
+  }
+  ConvertA8R3G3B2Scalar(dst, src, i, width);
+}
+
+// 16 texels (48 bytes) per iteration, realigned to four groups of four texels
+// so that no load reads past the end of the row.
+DX8TO12_TARGET("ssse3")
+void ConvertR8G8B8Ssse3(uint32_t *dst, const uint8_t *src, uint32_t width) {
+  const __m128i shuffle =
+      _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+  const __m128i opaque = _mm_set1_epi32(static_cast<int>(kOpaqueAlpha));
+  uint32_t i = 0;
+  for (; i + 16 <= width; i += 16) {
+    const uint8_t *s = src + i * 3;
+    const __m128i v0 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(s));
+    const __m128i v1 =
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(s + 16));
+    const __m128i v2 =
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(s + 32));
+    const __m128i groups[4] = {v0, _mm_alignr_epi8(v1, v0, 12),
+                               _mm_alignr_epi8(v2, v1, 8),
+                               _mm_srli_si128(v2, 4)};
+    for (int g = 0; g < 4; ++g) {
+      _mm_storeu_si128(
+          reinterpret_cast<__m128i *>(dst + i + g * 4),
+          _mm_or_si128(_mm_shuffle_epi8(groups[g], shuffle), opaque));
+    }
+  }
+  ConvertR8G8B8Scalar(dst, src, i, width);
+}
+
+void ConvertRowSimd(ConversionKernel kernel, FormatConversion conversion,
+                    void *dst, const void *src, uint32_t width,
+                    const uint32_t *palette) {
+  auto *d32 = static_cast<uint32_t *>(dst);
+  const auto *s8 = static_cast<const uint8_t *>(src);
+  switch (conversion) {
+    case FormatConversion::kR8G8B8ToB8G8R8X8:
+      if (kernel == ConversionKernel::kSsse3) {
+        return ConvertR8G8B8Ssse3(d32, s8, width);
+      }
+      return ConvertR8G8B8Scalar(d32, s8, 0, width);
+    case FormatConversion::kA4L4ToR8G8:
+      return ConvertA4L4Sse2(static_cast<uint8_t *>(dst), s8, width);
+    case FormatConversion::kR3G3B2ToB8G8R8X8:
+      return ConvertR3G3B2Sse2(d32, s8, width);
+    case FormatConversion::kA8R3G3B2ToB8G8R8A8:
+      return ConvertA8R3G3B2Sse2(d32, static_cast<const uint16_t *>(src),
+                                 width);
+    default:
+      return ConvertRowScalar(conversion, dst, src, width, palette);
+  }
+}
+#endif
+
+ConversionKernel DetectKernel() {
+  const CpuFeatures &features = GetCpuFeatures();
+  if (features.ssse3) return ConversionKernel::kSsse3;
+  return features.sse2 ? ConversionKernel::kSse2 : ConversionKernel::kScalar;
+}
+
+}  // namespace
+
+int SourceTexelSize(FormatConversion conversion) {
+  switch (conversion) {
+    case FormatConversion::kR8G8B8ToB8G8R8X8:
+      return 3;
+    case FormatConversion::kA8R3G3B2ToB8G8R8A8:
+      return 2;
+    case FormatConversion::kA4L4ToR8G8:
+    case FormatConversion::kR3G3B2ToB8G8R8X8:
+    case FormatConversion::kP8ToB8G8R8A8:
+      return 1;
+    case FormatConversion::kNone:
+      break;
+  }
+  return 0;
+}
+
+int DestTexelSize(FormatConversion conversion) {
+  switch (conversion) {
+    case FormatConversion::kA4L4ToR8G8:
+      return 2;
+    case FormatConversion::kR8G8B8ToB8G8R8X8:
+    case FormatConversion::kR3G3B2ToB8G8R8X8:
+    case FormatConversion::kA8R3G3B2ToB8G8R8A8:
+    case FormatConversion::kP8ToB8G8R8A8:
+      return 4;
+    case FormatConversion::kNone:
+      break;
+  }
+  return 0;
+}
+
+void ConvertRowsWith(ConversionKernel kernel, FormatConversion conversion,
+                     void *dst, size_t dst_pitch, const void *src,
+                     size_t src_pitch, uint32_t width, uint32_t num_rows,
+                     const uint32_t *palette) {
+  char *d = static_cast<char *>(dst);
+  const char *s = static_cast<const char *>(src);
+  for (uint32_t i = 0; i < num_rows; ++i) {
+#ifdef DX8TO12_CONVERT_X86
+    if (kernel != ConversionKernel::kScalar) {
+      ConvertRowSimd(kernel, conversion, d + i * dst_pitch, s + i * src_pitch,
+                     width, palette);
+      continue;
+    }
+#endif
+    ConvertRowScalar(conversion, d + i * dst_pitch, s + i * src_pitch, width,
+                     palette);
+  }
+}
+
+void ConvertRows(FormatConversion conversion, void *dst, size_t dst_pitch,
+                 const void *src, size_t src_pitch, uint32_t width,
+                 uint32_t num_rows, const uint32_t *palette) {
+  ConvertRowsWith(BestConversionKernel(), conversion, dst, dst_pitch, src,
+                  src_pitch, width, num_rows, palette);
+}
+
+ConversionKernel BestConversionKernel() {
+  static const ConversionKernel kernel = DetectKernel();
+  return kernel;
+}
+
+}  // namespace Dx8to12
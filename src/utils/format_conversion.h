@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace Dx8to12 {
+
+// D3D8 formats that have no DXGI equivalent are stored in a wider DXGI format.
+// Applications still lock them in their D3D8 layout, and their texels are
+// expanded as they are uploaded. Formats that only differ in how channels are
+// read (e.g. L8 as R8, X4R4G4B4 as B4G4R4A4) need no conversion; their SRVs
+// swizzle instead.
+enum class FormatConversion {
+  kNone,
+  // 24-bit R8G8B8 to 32-bit B8G8R8X8.
+  kR8G8B8ToB8G8R8X8,
+  // 4-bit alpha and luminance to 8-bit R8G8, with luminance in red.
+  kA4L4ToR8G8,
+  kR3G3B2ToB8G8R8X8,
+  kA8R3G3B2ToB8G8R8A8,
+  // Palette indices to the B8G8R8A8 colors of a 256-entry palette.
+  kP8ToB8G8R8A8,
+};
+
+enum class ConversionKernel {
+  // Plain per-texel loops. The reference implementation.
+  kScalar,
+  kSse2,
+  // SSE2 plus a byte shuffle for R8G8B8.
+  kSsse3,
+};
+
+// Bytes per texel in the D3D8 (locked) layout.
+int SourceTexelSize(FormatConversion conversion);
+// Bytes per texel in the DXGI (uploaded) layout.
+int DestTexelSize(FormatConversion conversion);
+
+// Converts num_rows rows of width texels each. Rows are src_pitch and
+// dst_pitch bytes apart. palette holds 256 B8G8R8A8 colors, and is only read by
+// kP8ToB8G8R8A8. Low channel bits are filled by bit replication, so that e.g.
+// a 3-bit 7 becomes 255. Every kernel produces exactly the same output.
+void ConvertRows(FormatConversion conversion, void *dst, size_t dst_pitch,
+                 const void *src, size_t src_pitch, uint32_t width,
+                 uint32_t num_rows, const uint32_t *palette);
+
+// Same as ConvertRows, with a specific kernel. The kernel must be supported.
+void ConvertRowsWith(ConversionKernel kernel, FormatConversion conversion,
+                     void *dst, size_t dst_pitch, const void *src,
+                     size_t src_pitch, uint32_t width, uint32_t num_rows,
+                     const uint32_t *palette);
+
+// Fastest kernel that the CPU supports. Used by ConvertRows.
+ConversionKernel BestConversionKernel();
+
+}  // namespace Dx8to12
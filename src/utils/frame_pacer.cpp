@@ -0,0 +1,19 @@
+#include "frame_pacer.h"
+
+#include "utils/asserts.h"
+
+namespace Dx8to12 {
+
+FramePacer::FramePacer(int frames_in_flight)
+    : fence_values_(frames_in_flight, 0) {
+  ASSERT(frames_in_flight >= 1);
+}
+
+uint64_t FramePacer::EndFrame(uint64_t fence_value) {
+  ASSERT(fence_value > fence_values_[current_slot_]);
+  fence_values_[current_slot_] = fence_value;
+  current_slot_ = (current_slot_ + 1) % frames_in_flight();
+  return fence_values_[current_slot_];
+}
+
+}  // namespace Dx8to12
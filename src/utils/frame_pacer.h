@@ -0,0 +1,38 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+namespace Dx8to12 {
+
+// Decides how far the CPU may run ahead of the GPU. Frames are recorded into a
+// fixed number of slots, each with its own set of per-frame resources, and a
+// slot can only be reused once the GPU is done with the last frame recorded
+// into it. Knows nothing about fences or swap chains: the caller reports the
+// fence value each frame ends with, and waits for what it is told to. This is
+// independent of the number of swap chain buffers.
+class FramePacer {
+ public:
+  // Lets the CPU record up to frames_in_flight frames before it has to wait for
+  // the GPU. At least 1.
+  explicit FramePacer(int frames_in_flight);
+
+  int frames_in_flight() const {
+    return static_cast<int>(fence_values_.size());
+  }
+  // Slot the current frame is recorded into.
+  int current_slot() const { return current_slot_; }
+  // Fence value of the last frame recorded into slot, 0 if none.
+  uint64_t fence_value(int slot) const { return fence_values_.at(slot); }
+
+  // Ends the current frame, whose work completes at fence_value, and moves on
+  // to the next slot. Returns the fence value to wait for before the next slot
+  // can be reused, 0 if none.
+  uint64_t EndFrame(uint64_t fence_value);
+
+ private:
+  std::vector<uint64_t> fence_values_;
+  int current_slot_ = 0;
+};
+
+}  // namespace Dx8to12
@@ -0,0 +1,56 @@
+#include "frame_time_stats.h"
+
+#include <algorithm>
+
+namespace Dx8to12 {
+namespace {
+
+constexpr double kBucketMs = 0.1;
+constexpr int kNumBuckets = 10000;
+
+int BucketOf(double ms) {
+  return std::min(static_cast<int>(ms / kBucketMs), kNumBuckets - 1);
+}
+
+}  // namespace
+
+FrameTimeStats::FrameTimeStats() : buckets_(kNumBuckets, 0) {}
+
+void FrameTimeStats::AddFrame(double seconds) {
+  const double ms = seconds * 1000.0;
+  ++buckets_[BucketOf(ms)];
+  ++num_frames_;
+  total_ms_ += ms;
+  max_ms_ = std::max(max_ms_, ms);
+}
+
+double FrameTimeStats::Quantile(double q) const {
+  const double rank = q * num_frames_;
+  uint64_t seen = 0;
+  for (int i = 0; i < kNumBuckets; ++i) {
+    seen += buckets_[i];
+    if (seen >= rank && seen > 0) {
+      return std::min((i + 1) * kBucketMs, max_ms_);
+    }
+  }
+  return max_ms_;
+}
+
+FrameTimeStats::Summary FrameTimeStats::Summarize() const {
+  if (num_frames_ == 0) return {};
+  Summary summary = {.num_frames = num_frames_,
+                     .mean_ms = total_ms_ / num_frames_,
+                     .median_ms = Quantile(0.5),
+                     .p99_ms = Quantile(0.99),
+                     .max_ms = max_ms_,
+                     .num_spikes = 0};
+  // Counts whole buckets, so frames within a bucket of the threshold may be
+  // off by one.
+  for (int i = BucketOf(summary.median_ms * kSpikeFactor) + 1; i < kNumBuckets;
+       ++i) {
+    summary.num_spikes += static_cast<int>(buckets_[i]);
+  }
+  return summary;
+}
+
+}  // namespace Dx8to12
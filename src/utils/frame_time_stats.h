@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+namespace Dx8to12 {
+
+// Summarizes how smooth a run was. Frame times go into a histogram of 0.1 ms
+// buckets, so that a long run takes no more memory than a short one. A spike
+// is a frame that took more than kSpikeFactor times the median, e.g. one that
+// stalled on compiling a pipeline.
+class FrameTimeStats {
+ public:
+  static constexpr double kSpikeFactor = 2.0;
+
+  struct Summary {
+    int num_frames;
+    double mean_ms;
+    double median_ms;
+    double p99_ms;
+    double max_ms;
+    int num_spikes;
+  };
+
+  FrameTimeStats();
+
+  void AddFrame(double seconds);
+  Summary Summarize() const;
+
+ private:
+  // Upper bound of the bucket that the frame at quantile q falls into.
+  double Quantile(double q) const;
+
+  // The last bucket holds everything from 1 s on.
+  std::vector<uint32_t> buckets_;
+  int num_frames_ = 0;
+  double total_ms_ = 0;
+  double max_ms_ = 0;
+};
+
+}  // namespace Dx8to12
@@ -6,7 +6,7 @@ namespace Dx8to12 {
 #ifdef _MSC_VER
 #define FORCE_INLINE __forceinline
 #else
-#define FORCE_INLINE __attribute__((always_inline))
+#define FORCE_INLINE inline __attribute__((always_inline))
 #endif
 
 inline uint32_t rotl32(uint32_t x, int8_t r) {
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <cstddef>
+
 namespace Dx8to12 {
 unsigned int MurmurHashTo32(const void *value, size_t size);
 
@@ -0,0 +1,35 @@
+#include "pipeline_digest.h"
+
+namespace Dx8to12 {
+namespace {
+
+std::string_view AsStringView(std::span<const char> bytes) {
+  return {bytes.data(), bytes.size()};
+}
+
+}  // namespace
+
+BlobCache::Key DigestPipeline(const PipelineFields &fields) {
+  BlobCache::KeyBuilder key;
+  key.Add(kPipelineDigestVersion)
+      .Add(fields.device_id)
+      .Add(AsStringView(fields.render_state))
+      .Add(static_cast<uint32_t>(fields.input_elements.size()));
+  for (const InputElementFields &element : fields.input_elements) {
+    key.Add(element.semantic_name)
+        .Add(element.semantic_index)
+        .Add(element.format)
+        .Add(element.input_slot)
+        .Add(element.aligned_byte_offset)
+        .Add(element.input_slot_class)
+        .Add(element.instance_data_step_rate);
+  }
+  return key.Add(AsStringView(fields.vs_bytecode))
+      .Add(AsStringView(fields.ps_bytecode))
+      .Add(fields.primitive_type)
+      .Add(fields.rtv_format)
+      .Add(fields.dsv_format)
+      .Finish();
+}
+
+}  // namespace Dx8to12
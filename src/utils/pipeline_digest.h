@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstdint>
+#include <span>
+#include <string_view>
+
+#include "blob_cache.h"
+
+namespace Dx8to12 {
+
+// Mirrors D3D12_INPUT_ELEMENT_DESC, with enums as plain integers.
+struct InputElementFields {
+  std::string_view semantic_name;
+  uint32_t semantic_index;
+  uint32_t format;
+  uint32_t input_slot;
+  uint32_t aligned_byte_offset;
+  uint32_t input_slot_class;
+  uint32_t instance_data_step_rate;
+};
+
+// Everything a graphics pipeline state is built from, by value. Unlike the
+// in-memory PSO cache key, nothing here is a pointer, so the same state digests
+// to the same key in every run.
+struct PipelineFields {
+  // Identifies the driver and root signature that the pipeline is compiled
+  // for. Cached pipelines don't load anywhere else.
+  std::string_view device_id;
+  // Raw bytes of the render states that the pipeline depends on.
+  std::span<const char> render_state;
+  std::span<const InputElementFields> input_elements;
+  std::span<const char> vs_bytecode;
+  std::span<const char> ps_bytecode;
+  uint32_t primitive_type;
+  uint32_t rtv_format;
+  uint32_t dsv_format;
+};
+
+// Bumped whenever what goes into a pipeline changes in a way the fields above
+// don't capture, so that stale cached pipelines are no longer found.
+inline constexpr uint32_t kPipelineDigestVersion = 1;
+
+BlobCache::Key DigestPipeline(const PipelineFields& fields);
+
+}  // namespace Dx8to12
@@ -0,0 +1,164 @@
+#include "pitch_repack.h"
+
+#include <cstring>
+
+#include "cpu_features.h"
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || \
+    defined(__x86_64__)
+#define DX8TO12_REPACK_X86
+#include <immintrin.h>
+#endif
+
+#if defined(__clang__) || defined(__GNUC__)
+#define DX8TO12_TARGET(isa) __attribute__((target(isa)))
+#else
+#define DX8TO12_TARGET(isa)
+#endif
+
+namespace Dx8to12 {
+namespace {
+
+void RepackScalar(char *dst, size_t dst_pitch, const char *src,
+                  size_t src_pitch, size_t row_bytes, uint32_t num_rows) {
+  for (uint32_t i = 0; i < num_rows; ++i) {
+    memcpy(dst + i * dst_pitch, src + i * src_pitch, row_bytes);
+  }
+}
+
+template <size_t kRowBytes>
+void RepackNarrow(char *dst, size_t dst_pitch, const char *src,
+                  size_t src_pitch, uint32_t num_rows) {
+  for (uint32_t i = 0; i < num_rows; ++i) {
+    memcpy(dst + i * dst_pitch, src + i * src_pitch, kRowBytes);
+  }
+}
+
+// Rows narrower than a vector: the last few mips of a texture. Common widths
+// get a fixed-size copy.
+void RepackNarrowRows(char *dst, size_t dst_pitch, const char *src,
+                      size_t src_pitch, size_t row_bytes, uint32_t num_rows) {
+  switch (row_bytes) {
+    case 1:
+      return RepackNarrow<1>(dst, dst_pitch, src, src_pitch, num_rows);
+    case 2:
+      return RepackNarrow<2>(dst, dst_pitch, src, src_pitch, num_rows);
+    case 4:
+      return RepackNarrow<4>(dst, dst_pitch, src, src_pitch, num_rows);
+    case 8:
+      return RepackNarrow<8>(dst, dst_pitch, src, src_pitch, num_rows);
+    case 12:
+      return RepackNarrow<12>(dst, dst_pitch, src, src_pitch, num_rows);
+    default:
+      return RepackScalar(dst, dst_pitch, src, src_pitch, row_bytes, num_rows);
+  }
+}
+
+#ifdef DX8TO12_REPACK_X86
+// Both vector kernels need rows that are at least one vector wide. The part of
+// a row past the last full vector is written with one unaligned store that
+// overlaps the previous vector.
+DX8TO12_TARGET("sse2")
+void RepackSse2(char *dst, size_t dst_pitch, const char *src,
+                size_t src_pitch, size_t row_bytes, uint32_t num_rows) {
+  const bool is_aligned =
+      (reinterpret_cast<uintptr_t>(dst) | dst_pitch) % 16 == 0;
+  const size_t num_vectors = row_bytes / 16;
+  for (uint32_t i = 0; i < num_rows; ++i) {
+    const char *s = src + i * src_pitch;
+    char *d = dst + i * dst_pitch;
+    for (size_t v = 0; v < num_vectors; ++v) {
+      const __m128i value =
+          _mm_loadu_si128(reinterpret_cast<const __m128i *>(s + v * 16));
+      if (is_aligned) {
+        _mm_stream_si128(reinterpret_cast<__m128i *>(d + v * 16), value);
+      } else {
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(d + v * 16), value);
+      }
+    }
+    if (row_bytes % 16 != 0) {
+      _mm_storeu_si128(
+          reinterpret_cast<__m128i *>(d + row_bytes - 16),
+          _mm_loadu_si128(
+              reinterpret_cast<const __m128i *>(s + row_bytes - 16)));
+    }
+  }
+  _mm_sfence();
+}
+
+DX8TO12_TARGET("avx2")
+void RepackAvx2(char *dst, size_t dst_pitch, const char *src,
+                size_t src_pitch, size_t row_bytes, uint32_t num_rows) {
+  const bool is_aligned =
+      (reinterpret_cast<uintptr_t>(dst) | dst_pitch) % 32 == 0;
+  const size_t num_vectors = row_bytes / 32;
+  for (uint32_t i = 0; i < num_rows; ++i) {
+    const char *s = src + i * src_pitch;
+    char *d = dst + i * dst_pitch;
+    for (size_t v = 0; v < num_vectors; ++v) {
+      const __m256i value =
+          _mm256_loadu_si256(reinterpret_cast<const __m256i *>(s + v * 32));
+      if (is_aligned) {
+        _mm256_stream_si256(reinterpret_cast<__m256i *>(d + v * 32), value);
+      } else {
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(d + v * 32), value);
+      }
+    }
+    if (row_bytes % 32 != 0) {
+      _mm256_storeu_si256(
+          reinterpret_cast<__m256i *>(d + row_bytes - 32),
+          _mm256_loadu_si256(
+              reinterpret_cast<const __m256i *>(s + row_bytes - 32)));
+    }
+  }
+  _mm_sfence();
+}
+#endif
+
+RepackKernel DetectKernel() {
+  const CpuFeatures &features = GetCpuFeatures();
+  if (features.avx2) return RepackKernel::kAvx2;
+  return features.sse2 ? RepackKernel::kSse2 : RepackKernel::kScalar;
+}
+
+}  // namespace
+
+void RepackRowsWith(RepackKernel kernel, void *dst, size_t dst_pitch,
+                    const void *src, size_t src_pitch, size_t row_bytes,
+                    uint32_t num_rows) {
+  if (row_bytes == 0 || num_rows == 0) return;
+  char *d = static_cast<char *>(dst);
+  const char *s = static_cast<const char *>(src);
+  // Contiguous rows are one big row.
+  if (dst_pitch == row_bytes && src_pitch == row_bytes) {
+    row_bytes *= num_rows;
+    num_rows = 1;
+  }
+  if (kernel == RepackKernel::kScalar) {
+    return RepackScalar(d, dst_pitch, s, src_pitch, row_bytes, num_rows);
+  }
+  if (row_bytes < 16) {
+    return RepackNarrowRows(d, dst_pitch, s, src_pitch, row_bytes, num_rows);
+  }
+#ifdef DX8TO12_REPACK_X86
+  if (kernel == RepackKernel::kAvx2 && row_bytes >= 32) {
+    return RepackAvx2(d, dst_pitch, s, src_pitch, row_bytes, num_rows);
+  }
+  return RepackSse2(d, dst_pitch, s, src_pitch, row_bytes, num_rows);
+#else
+  return RepackScalar(d, dst_pitch, s, src_pitch, row_bytes, num_rows);
+#endif
+}
+
+void RepackRows(void *dst, size_t dst_pitch, const void *src, size_t src_pitch,
+                size_t row_bytes, uint32_t num_rows) {
+  RepackRowsWith(BestRepackKernel(), dst, dst_pitch, src, src_pitch, row_bytes,
+                 num_rows);
+}
+
+RepackKernel BestRepackKernel() {
+  static const RepackKernel kernel = DetectKernel();
+  return kernel;
+}
+
+}  // namespace Dx8to12
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace Dx8to12 {
+
+enum class RepackKernel {
+  // Plain memcpy per row. The reference implementation.
+  kScalar,
+  kSse2,
+  kAvx2,
+};
+
+// Copies num_rows rows of row_bytes bytes each between two buffers with
+// different row pitches, e.g. from a compact CPU copy into a 256-byte aligned
+// upload footprint. Rows that are at least one vector wide are written with
+// non-temporal stores, which keeps upload memory out of the CPU caches. Narrow
+// rows (i.e. small mip levels) are copied with fixed-size moves instead of
+// calls to memcpy.
+//
+// The vector kernels want dst and dst_pitch 16-byte aligned (32 for AVX2),
+// which D3D12 footprints always are. They fall back to unaligned stores if
+// not.
+void RepackRows(void *dst, size_t dst_pitch, const void *src, size_t src_pitch,
+                size_t row_bytes, uint32_t num_rows);
+
+// Same as RepackRows, with a specific kernel. The kernel must be supported.
+void RepackRowsWith(RepackKernel kernel, void *dst, size_t dst_pitch,
+                    const void *src, size_t src_pitch, size_t row_bytes,
+                    uint32_t num_rows);
+
+// Fastest kernel that the CPU supports. Used by RepackRows.
+RepackKernel BestRepackKernel();
+
+}  // namespace Dx8to12
@@ -1,12 +1,19 @@
 #pragma once
 
-#include <vector>
-
-#include "util.h"
+#include <algorithm>
+#include <cstddef>
+#include <iterator>
+#include <map>
 
 namespace Dx8to12 {
 
-// A collection of ranges that automatically coalesces consecutive ranges.
+// A set of disjoint integer ranges, kept sorted by offset. Inserting a range
+// merges it with every range it overlaps or touches, so the set always holds
+// the fewest ranges that cover the inserted bytes. Erasing a range trims or
+// splits the ranges it covers.
+//
+// With n ranges in the set, insert and erase are O(log n + k), where k is the
+// number of ranges that get merged or removed. Iteration is in offset order.
 class RangeSet {
  public:
   struct Range {
@@ -16,31 +23,108 @@ class RangeSet {
     bool operator==(const Range &rhs) const = default;
   };
 
+  class const_iterator {
+   public:
+    using iterator_category = std::bidirectional_iterator_tag;
+    using value_type = Range;
+    using difference_type = std::ptrdiff_t;
+    using pointer = void;
+    using reference = Range;
+
+    const_iterator() = default;
+    explicit const_iterator(std::map<int, int>::const_iterator iter)
+        : iter_(iter) {}
+
+    Range operator*() const {
+      return {.offset = iter_->first, .size = iter_->second - iter_->first};
+    }
+    const_iterator &operator++() {
+      ++iter_;
+      return *this;
+    }
+    const_iterator operator++(int) { return const_iterator(iter_++); }
+    const_iterator &operator--() {
+      --iter_;
+      return *this;
+    }
+    const_iterator operator--(int) { return const_iterator(iter_--); }
+    bool operator==(const const_iterator &rhs) const = default;
+
+   private:
+    std::map<int, int>::const_iterator iter_;
+  };
+
   void insert(Range range) {
-    auto iter = std::lower_bound(ranges.begin(), ranges.end(), range);
-    if (iter != ranges.begin()) {
-      if (auto prev = std::prev(iter);
-          prev->offset + prev->size >= range.offset) {
-        ASSERT(prev->offset + prev->size == range.offset);
-        prev->size += range.size;
-        // TODO: Handle case where we can coalesce with next element. Never
-        // happens in practice.
-        return;
+    if (range.size <= 0) return;
+    int begin = range.offset;
+    int end = range.offset + range.size;
+    auto iter = ends_.upper_bound(begin);
+    // The previous range starts at or before us. Merge if it reaches us.
+    if (iter != ends_.begin()) {
+      if (auto prev = std::prev(iter); prev->second >= begin) iter = prev;
+    }
+    while (iter != ends_.end() && iter->first <= end) {
+      begin = std::min(begin, iter->first);
+      end = std::max(end, iter->second);
+      iter = ends_.erase(iter);
+    }
+    ends_.emplace_hint(iter, begin, end);
+  }
+
+  void erase(Range range) {
+    if (range.size <= 0) return;
+    const int begin = range.offset;
+    const int end = range.offset + range.size;
+    auto iter = ends_.upper_bound(begin);
+    // Trim (or split) a range that straddles our beginning.
+    if (iter != ends_.begin()) {
+      if (auto prev = std::prev(iter); prev->second > begin) {
+        const int prev_end = prev->second;
+        if (prev->first == begin) {
+          ends_.erase(prev);
+        } else {
+          prev->second = begin;
+        }
+        if (prev_end > end) {
+          ends_.emplace_hint(iter, end, prev_end);
+          return;
+        }
       }
     }
-    if (iter != ranges.end() && range.offset + range.size >= iter->offset) {
-      // Are these the same range?
-      if (*iter == range) return;
-      ASSERT(range.offset + range.size == iter->offset);
-      // Warning: Untested path.
-      iter->offset = range.offset;
-      iter->size += range.size;
-    } else {
-      ranges.insert(iter, range);
+    // Remove everything we fully cover, then trim a range that straddles our
+    // end.
+    while (iter != ends_.end() && iter->first < end) {
+      if (iter->second > end) {
+        const int iter_end = iter->second;
+        iter = ends_.erase(iter);
+        ends_.emplace_hint(iter, end, iter_end);
+        return;
+      }
+      iter = ends_.erase(iter);
     }
   }
 
-  std::vector<Range> ranges;
+  // Removes every range in other. O(m (log n + k)) for m ranges in other.
+  void subtract(const RangeSet &other) {
+    for (Range range : other) erase(range);
+  }
+
+  bool contains(int offset) const {
+    auto iter = ends_.upper_bound(offset);
+    return iter != ends_.begin() && std::prev(iter)->second > offset;
+  }
+
+  void clear() { ends_.clear(); }
+  bool empty() const { return ends_.empty(); }
+  // Number of disjoint ranges.
+  size_t size() const { return ends_.size(); }
+
+  const_iterator begin() const { return const_iterator(ends_.begin()); }
+  const_iterator end() const { return const_iterator(ends_.end()); }
+
+ private:
+  // Maps the offset of each range to its end.
+  std::map<int, int> ends_;
 };
 
-}  // namespace Dx8to12
\ No newline at end of file
+}  // namespace Dx8to12
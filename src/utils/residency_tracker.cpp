@@ -0,0 +1,114 @@
+#include "residency_tracker.h"
+
+#include "utils/asserts.h"
+
+namespace Dx8to12 {
+
+int ResidencyTracker::Add(void *owner, uint64_t num_bytes, uint64_t frame) {
+  int handle;
+  if (free_handles_.empty()) {
+    handle = static_cast<int>(entries_.size());
+    entries_.emplace_back();
+  } else {
+    handle = free_handles_.back();
+    free_handles_.pop_back();
+  }
+  Entry &entry = entries_[handle];
+  entry = {.owner = owner,
+           .num_bytes = num_bytes,
+           .last_used_frame = frame,
+           .resident = true,
+           .lru_iter = lru_.insert(lru_.end(), handle)};
+  resident_bytes_ += num_bytes;
+  return handle;
+}
+
+void ResidencyTracker::Remove(int handle) {
+  Entry &entry = entries_.at(handle);
+  ASSERT(entry.owner != nullptr);
+  if (entry.resident) {
+    lru_.erase(entry.lru_iter);
+    resident_bytes_ -= entry.num_bytes;
+  } else {
+    evicted_bytes_ -= entry.num_bytes;
+    --num_evicted_;
+  }
+  entry = {};
+  free_handles_.push_back(handle);
+}
+
+void ResidencyTracker::MarkUsed(int handle, uint64_t frame) {
+  Entry &entry = entries_.at(handle);
+  ASSERT(entry.resident);
+  ASSERT(frame >= entry.last_used_frame);
+  entry.last_used_frame = frame;
+  lru_.splice(lru_.end(), lru_, entry.lru_iter);
+}
+
+void ResidencyTracker::MakeResident(int handle, uint64_t frame) {
+  Entry &entry = entries_.at(handle);
+  ASSERT(!entry.resident);
+  entry.resident = true;
+  entry.last_used_frame = frame;
+  entry.lru_iter = lru_.insert(lru_.end(), handle);
+  resident_bytes_ += entry.num_bytes;
+  evicted_bytes_ -= entry.num_bytes;
+  --num_evicted_;
+}
+
+void ResidencyTracker::Resize(int handle, uint64_t num_bytes) {
+  Entry &entry = entries_.at(handle);
+  ASSERT(entry.owner != nullptr);
+  uint64_t &total = entry.resident ? resident_bytes_ : evicted_bytes_;
+  total = total - entry.num_bytes + num_bytes;
+  entry.num_bytes = num_bytes;
+}
+
+void ResidencyTracker::RemovePinnedBytes(uint64_t num_bytes) {
+  ASSERT(num_bytes <= pinned_bytes_);
+  pinned_bytes_ -= num_bytes;
+}
+
+std::vector<void *> ResidencyTracker::EvictToFit(uint64_t num_bytes,
+                                                 uint64_t completed_frame) {
+  const uint64_t used_bytes = resident_bytes_ + pinned_bytes_ + num_bytes;
+  if (used_bytes <= budget_) return {};
+  return Evict(used_bytes - budget_, completed_frame);
+}
+
+std::vector<void *> ResidencyTracker::Evict(uint64_t num_bytes,
+                                            uint64_t completed_frame) {
+  std::vector<void *> evicted;
+  uint64_t num_evicted_bytes = 0;
+  while (!lru_.empty() && (num_bytes == 0 || num_evicted_bytes < num_bytes)) {
+    Entry &entry = entries_[lru_.front()];
+    // Everything after this was used more recently.
+    if (entry.last_used_frame > completed_frame) break;
+    lru_.pop_front();
+    entry.resident = false;
+    resident_bytes_ -= entry.num_bytes;
+    evicted_bytes_ += entry.num_bytes;
+    num_evicted_bytes += entry.num_bytes;
+    ++num_evicted_;
+    ++num_evictions_;
+    evicted.push_back(entry.owner);
+  }
+  return evicted;
+}
+
+uint64_t ResidencyTracker::available_bytes() const {
+  const uint64_t used_bytes = resident_bytes_ + pinned_bytes_;
+  return used_bytes >= budget_ ? 0 : budget_ - used_bytes;
+}
+
+ResidencyTracker::Stats ResidencyTracker::stats() const {
+  return {.budget = budget_,
+          .resident_bytes = resident_bytes_,
+          .pinned_bytes = pinned_bytes_,
+          .evicted_bytes = evicted_bytes_,
+          .num_resident = static_cast<int>(lru_.size()),
+          .num_evicted = num_evicted_,
+          .num_evictions = num_evictions_};
+}
+
+}  // namespace Dx8to12
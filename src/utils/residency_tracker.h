@@ -0,0 +1,84 @@
+#pragma once
+
+#include <cstdint>
+#include <list>
+#include <vector>
+
+namespace Dx8to12 {
+
+// Least-recently-used bookkeeping for evictable GPU allocations that share a
+// memory budget. Knows nothing about the allocations themselves, only their
+// size, whether they are resident, and the frame they were last used in. Frames
+// are fence values: an allocation last used in frame F may only be evicted once
+// F has completed.
+class ResidencyTracker {
+ public:
+  struct Stats {
+    uint64_t budget;
+    // Bytes of resident evictable allocations.
+    uint64_t resident_bytes;
+    // Bytes that count against the budget but can never be evicted.
+    uint64_t pinned_bytes;
+    uint64_t evicted_bytes;
+    int num_resident;
+    int num_evicted;
+    // Total number of evictions so far.
+    uint64_t num_evictions;
+  };
+
+  explicit ResidencyTracker(uint64_t budget) : budget_(budget) {}
+
+  // Registers a resident allocation used in frame. owner is handed back when
+  // the allocation gets evicted.
+  int Add(void* owner, uint64_t num_bytes, uint64_t frame);
+  void Remove(int handle);
+  void MarkUsed(int handle, uint64_t frame);
+  // Marks an evicted allocation as resident again.
+  void MakeResident(int handle, uint64_t frame);
+  bool IsResident(int handle) const { return entries_.at(handle).resident; }
+  // Changes the size of an allocation, resident or not. Does not evict
+  // anything if it grows.
+  void Resize(int handle, uint64_t num_bytes);
+
+  void AddPinnedBytes(uint64_t num_bytes) { pinned_bytes_ += num_bytes; }
+  void RemovePinnedBytes(uint64_t num_bytes);
+
+  // Evicts least recently used allocations until num_bytes more fit in the
+  // budget. Returns the owners of the evicted allocations. Only allocations
+  // last used at or before completed_frame are evicted, so this may not make
+  // enough room.
+  std::vector<void*> EvictToFit(uint64_t num_bytes, uint64_t completed_frame);
+  // Evicts at least num_bytes worth of allocations (or all of them if
+  // num_bytes is 0), with the same rules as EvictToFit.
+  std::vector<void*> Evict(uint64_t num_bytes, uint64_t completed_frame);
+
+  // Budget left after all resident and pinned bytes. Never negative.
+  uint64_t available_bytes() const;
+  uint64_t budget() const { return budget_; }
+  Stats stats() const;
+
+ private:
+  struct Entry {
+    void* owner = nullptr;
+    uint64_t num_bytes = 0;
+    uint64_t last_used_frame = 0;
+    bool resident = false;
+    // Position in lru_ while resident.
+    std::list<int>::iterator lru_iter;
+  };
+
+  const uint64_t budget_;
+  std::vector<Entry> entries_;
+  std::vector<int> free_handles_;
+  // Resident handles, least recently used first. Frames only go up, so this is
+  // also sorted by last_used_frame.
+  std::list<int> lru_;
+
+  uint64_t resident_bytes_ = 0;
+  uint64_t pinned_bytes_ = 0;
+  uint64_t evicted_bytes_ = 0;
+  int num_evicted_ = 0;
+  uint64_t num_evictions_ = 0;
+};
+
+}  // namespace Dx8to12
@@ -0,0 +1,162 @@
+#include "segmented_ring.h"
+
+#include <algorithm>
+#include <bit>
+
+#include "utils/asserts.h"
+
+namespace Dx8to12 {
+
+SegmentedRing::SegmentedRing(size_t base_size, size_t segment_alignment,
+                             uint32_t min_alignment, uint64_t idle_frames)
+    : segment_alignment_(segment_alignment),
+      base_size_((base_size + segment_alignment - 1) /
+                 segment_alignment * segment_alignment),
+      min_alignment_(min_alignment),
+      idle_frames_(idle_frames) {
+  ASSERT(std::has_single_bit(segment_alignment) &&
+         std::has_single_bit(min_alignment));
+  AddSegment(base_size_);
+}
+
+size_t SegmentedRing::AlignToSegment(size_t size) const {
+  return (size + segment_alignment_ - 1) & ~(segment_alignment_ - 1);
+}
+
+int SegmentedRing::AddSegment(size_t size) {
+  int slot = 0;
+  while (slot < num_slots() && segments_[slot].has_value()) ++slot;
+  if (slot == num_slots()) segments_.emplace_back();
+  Segment& segment = segments_[slot].emplace();
+  segment.size = size;
+  // Segments added mid-frame still need to know where the frame started.
+  if (current_frame_ > 0) {
+    segment.frame_heads.push_back({current_frame_, 0});
+  }
+  return slot;
+}
+
+// head == tail always means the segment is empty, which is why the checks that
+// could make tail catch up to head are strict.
+bool SegmentedRing::Segment::TryAllocate(size_t num_bytes, uint32_t align,
+                                         int* offset) {
+  ASSERT(head <= size && tail <= size);
+  const size_t aligned_tail = (tail + align - 1) & ~size_t{align - 1};
+  if (tail >= head) {
+    if (aligned_tail + num_bytes <= size) {
+      *offset = static_cast<int>(aligned_tail);
+      tail = aligned_tail + num_bytes;
+      return true;
+    }
+    if (num_bytes < head) {
+      *offset = 0;
+      tail = num_bytes;
+      return true;
+    }
+  } else if (aligned_tail + num_bytes < head) {
+    *offset = static_cast<int>(aligned_tail);
+    tail = aligned_tail + num_bytes;
+    return true;
+  }
+  return false;
+}
+
+void SegmentedRing::Segment::HasCompletedFrame(uint64_t frame) {
+  while (!frame_heads.empty() && frame_heads.front().first <= frame) {
+    frame_heads.pop_front();
+  }
+  if (!frame_heads.empty()) {
+    head = frame_heads.front().second;
+  } else {
+    head = 0;
+    tail = 0;
+  }
+}
+
+SegmentedRing::Allocation SegmentedRing::Allocate(size_t num_bytes,
+                                                  uint32_t align,
+                                                  bool* new_segment) {
+  ASSERT(std::has_single_bit(align));
+  align = std::max(align, min_alignment_);
+  *new_segment = false;
+  Allocation alloc{.frame = current_frame_,
+                   .segment = 0,
+                   .offset = 0,
+                   .size = static_cast<int>(num_bytes)};
+  frame_bytes_ += num_bytes;
+  // First-fit across the segments. Under sustained pressure this keeps every
+  // segment busy each frame, so only segments that are truly unneeded go idle.
+  for (int i = 0; i < num_slots(); ++i) {
+    std::optional<Segment>& segment = segments_[i];
+    if (segment.has_value() &&
+        segment->TryAllocate(num_bytes, align, &alloc.offset)) {
+      segment->last_used_frame = current_frame_;
+      alloc.segment = i;
+      return alloc;
+    }
+  }
+  // Grow the ring. Reuse a retired slot if there is one.
+  alloc.segment =
+      AddSegment(std::max(base_size_, AlignToSegment(num_bytes + align)));
+  *new_segment = true;
+  Segment& segment = *segments_[alloc.segment];
+  if (!segment.TryAllocate(num_bytes, align, &alloc.offset)) {
+    FAIL("OOM: Could not allocate %zu bytes.", num_bytes);
+  }
+  segment.last_used_frame = current_frame_;
+  return alloc;
+}
+
+SegmentedRing::Stats SegmentedRing::stats() const {
+  Stats stats{.frame_bytes = frame_bytes_,
+              .high_water_bytes = std::max(high_water_bytes_, frame_bytes_),
+              .total_size = 0,
+              .num_segments = 0};
+  for (const std::optional<Segment>& segment : segments_) {
+    if (segment.has_value()) {
+      stats.total_size += segment->size;
+      ++stats.num_segments;
+    }
+  }
+  return stats;
+}
+
+void SegmentedRing::SetCurrentFrame(uint64_t frame) {
+  if (frame > current_frame_) {
+    current_frame_ = frame;
+    high_water_bytes_ = std::max(high_water_bytes_, frame_bytes_);
+    frame_bytes_ = 0;
+    for (std::optional<Segment>& segment : segments_) {
+      if (segment.has_value()) {
+        segment->frame_heads.push_back({current_frame_, segment->tail});
+      }
+    }
+  }
+}
+
+void SegmentedRing::HasCompletedFrame(uint64_t frame,
+                                      std::vector<int>* retired_segments) {
+  for (std::optional<Segment>& segment : segments_) {
+    if (segment.has_value()) segment->HasCompletedFrame(frame);
+  }
+  RetireIdleSegments(frame, retired_segments);
+}
+
+void SegmentedRing::RetireIdleSegments(uint64_t completed_frame,
+                                       std::vector<int>* retired_segments) {
+  // The first segment is never retired.
+  for (int i = 1; i < num_slots(); ++i) {
+    const std::optional<Segment>& segment = segments_[i];
+    if (!segment.has_value() || segment->last_used_frame > completed_frame ||
+        current_frame_ - segment->last_used_frame < idle_frames_) {
+      continue;
+    }
+    segments_[i].reset();
+    retired_segments->push_back(i);
+  }
+  while (segments_.size() > 1 && !segments_.back().has_value()) {
+    segments_.pop_back();
+  }
+}
+
+}  // namespace Dx8to12
@@ -0,0 +1,97 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <optional>
+#include <utility>
+#include <vector>
+
+namespace Dx8to12 {
+
+// Bookkeeping for a ring buffer that needs to be told about frame boundaries.
+// It is made up of one or more chained segments: when an allocation does not
+// fit in any existing segment, a new one is added instead of failing. Segments
+// other than the first are retired once they have been idle for idle_frames
+// frames. Knows nothing about the memory it manages: the owner is told through
+// Allocate's and HasCompletedFrame's arguments when a segment is added or
+// retired.
+class SegmentedRing {
+ public:
+  struct Allocation {
+    uint64_t frame;
+    int segment;
+    int offset;
+    int size;
+  };
+
+  struct Stats {
+    // Bytes allocated since the last call to SetCurrentFrame (i.e. since the
+    // last submission).
+    size_t frame_bytes;
+    // Largest number of bytes allocated by any single frame.
+    size_t high_water_bytes;
+    // Sum of the sizes of all live segments.
+    size_t total_size;
+    int num_segments;
+  };
+
+  // Segment sizes are multiples of segment_alignment. Starts out with one
+  // segment of (at least) base_size bytes, at index 0.
+  SegmentedRing(size_t base_size, size_t segment_alignment,
+                uint32_t min_alignment, uint64_t idle_frames);
+
+  void SetCurrentFrame(uint64_t frame);
+  // Appends the segments that were retired to retired_segments. Their indices
+  // may be reused by later segments.
+  void HasCompletedFrame(uint64_t frame, std::vector<int>* retired_segments);
+
+  // Sets new_segment if a segment was added for the allocation, which is then
+  // alloc.segment. alignment is a power of two.
+  Allocation Allocate(size_t num_bytes, uint32_t alignment, bool* new_segment);
+
+  // Retired segments leave a gap, so that segment indices of in-flight
+  // allocations stay valid.
+  int num_slots() const { return static_cast<int>(segments_.size()); }
+  bool is_live(int segment) const {
+    return segment < num_slots() && segments_[segment].has_value();
+  }
+  size_t segment_size(int segment) const { return segments_[segment]->size; }
+  uint64_t current_frame() const { return current_frame_; }
+
+  Stats stats() const;
+
+ private:
+  // A single fixed-size ring. head is the oldest byte still in use by the GPU,
+  // tail is where the next allocation goes.
+  struct Segment {
+    size_t size;
+    size_t head = 0;
+    size_t tail = 0;
+
+    std::deque<std::pair<uint64_t, size_t>> frame_heads;
+    // Last frame that allocated from this segment.
+    uint64_t last_used_frame = 0;
+
+    bool TryAllocate(size_t num_bytes, uint32_t align, int* offset);
+    void HasCompletedFrame(uint64_t frame);
+  };
+
+  size_t AlignToSegment(size_t size) const;
+  // Adds a segment in the first free slot, and returns its index.
+  int AddSegment(size_t size);
+  void RetireIdleSegments(uint64_t completed_frame,
+                          std::vector<int>* retired_segments);
+
+  const size_t segment_alignment_;
+  const size_t base_size_;
+  const uint32_t min_alignment_;
+  const uint64_t idle_frames_;
+  std::vector<std::optional<Segment>> segments_;
+
+  uint64_t current_frame_ = 0;
+  size_t frame_bytes_ = 0;
+  size_t high_water_bytes_ = 0;
+};
+
+}  // namespace Dx8to12
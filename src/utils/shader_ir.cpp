@@ -0,0 +1,650 @@
+#include "shader_ir.h"
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <cstring>
+#include <iomanip>
+#include <limits>
+#include <map>
+#include <sstream>
+#include <utility>
+
+#include "utils/asserts.h"
+
+namespace Dx8to12 {
+namespace {
+
+using namespace ShaderToken;
+
+constexpr int kMaxNumTempRegs = 12;
+constexpr int kMaxNumConstRegs = 96;
+constexpr char kComponents[] = "xyzw";
+
+int NumSources(uint32_t opcode) {
+  switch (opcode) {
+    case kOpTex:
+      return 0;
+    case kOpMov:
+    case kOpRcp:
+    case kOpRsq:
+      return 1;
+    case kOpAdd:
+    case kOpSub:
+    case kOpMul:
+    case kOpSge:
+    case kOpDp3:
+    case kOpDp4:
+    case kOpMin:
+    case kOpMax:
+      return 2;
+    case kOpMad:
+    case kOpLrp:
+      return 3;
+    default:
+      FAIL("TODO: Implement instruction %d.", opcode);
+  }
+}
+
+// The components of each source that an instruction reads.
+uint32_t ReadMask(const ShaderInstruction& inst) {
+  switch (inst.opcode) {
+    case kOpDp3:
+      return 0x7;
+    case kOpDp4:
+      return 0xf;
+    case kOpTex:
+      return 0;
+    default:
+      return inst.write_mask;
+  }
+}
+
+ShaderRegister DecodeRegister(uint32_t token) {
+  return {.type = (token & kRegTypeMask) >> kRegTypeShift,
+          .number = static_cast<int>(token & kRegNumMask)};
+}
+
+void DecodeDest(bool is_pixel_shader, uint32_t token, ShaderInstruction* inst) {
+  ASSERT(token & 0x80000000);
+  ASSERT((token & kAddrModeRelative) == 0);
+  const ShaderRegister reg = DecodeRegister(token);
+  switch (reg.type) {
+    case kRegTemp:
+      ASSERT(reg.number < kMaxNumTempRegs);
+      break;
+    case kRegAddr:
+      if (!is_pixel_shader) ASSERT(reg.number == 0);
+      break;
+    case kRegRastOut:
+      if (reg.number != kRastOutPosition && reg.number != kRastOutFog) {
+        FAIL("TODO: Support rast output %d in vertex shader.", reg.number);
+      }
+      break;
+    case kRegAttrOut:
+      ASSERT(reg.number < 2);
+      break;
+    case kRegTexCoordOut:
+      ASSERT(reg.number < 8);
+      break;
+    default:
+      FAIL("Unexpected reg type for destination param %d", reg.type);
+  }
+  inst->dest = reg;
+  inst->write_mask = (token & kWriteMaskAll) >> kWriteMaskShift;
+  inst->saturate = (token & kDstModMask) == kDstModSaturate;
+}
+
+ShaderSource DecodeSource(uint32_t token,
+                          const std::map<int, std::array<float, 4>>& defs) {
+  ShaderSource src = {.reg = DecodeRegister(token),
+                      .relative = (token & kAddrModeRelative) != 0};
+  switch (src.reg.type) {
+    case kRegTemp:
+      ASSERT(src.reg.number < kMaxNumTempRegs);
+      break;
+    case kRegInput:
+      ASSERT(src.reg.number < 16);
+      break;
+    case kRegConst:
+      ASSERT(src.reg.number < kMaxNumConstRegs);
+      break;
+    case kRegAddr:
+      if (src.relative) FAIL("TODO: Use address reg as source? %d", 0);
+      break;
+    case kRegRastOut:
+      if (src.reg.number != kRastOutPosition &&
+          src.reg.number != kRastOutFog) {
+        FAIL("Unexpected rast output offset %d", src.reg.number);
+      }
+      break;
+    case kRegAttrOut:
+      ASSERT(src.reg.number < 2);
+      break;
+    case kRegTexCoordOut:
+      ASSERT(src.reg.number < 8);
+      break;
+    default:
+      FAIL("Unexpected reg type for source param %d", src.reg.type);
+  }
+  ASSERT(!src.relative || src.reg.type == kRegConst);
+  const uint32_t swizzle = (token & kSwizzleMask) >> kSwizzleShift;
+  for (int c = 0; c < 4; ++c) src.swizzle[c] = (swizzle >> (2 * c)) & 0x3;
+  switch (token & kSrcModMask) {
+    case kSrcModNone:
+      break;
+    case kSrcModNeg:
+      src.negate = true;
+      break;
+    default:
+      FAIL("Unexpected modification %d", (token & kSrcModMask) >> 24);
+  }
+
+  // def constants can't be changed from outside the shader.
+  const auto def = defs.find(src.reg.number);
+  if (src.reg.type == kRegConst && !src.relative && def != defs.end()) {
+    src.is_literal = true;
+    for (int c = 0; c < 4; ++c) {
+      const float value = def->second[src.swizzle[c]];
+      src.literal[c] = src.negate ? -value : value;
+    }
+  }
+  return src;
+}
+
+// Which instruction last wrote each component of each register written so
+// far, keyed by register type and number.
+using DefTable = std::map<std::pair<uint32_t, int>, std::array<int, 4>>;
+
+std::array<int, 4> CurrentDefs(const DefTable& table,
+                               const ShaderRegister& reg) {
+  const auto iter = table.find({reg.type, reg.number});
+  if (iter == table.end()) {
+    return {ShaderSource::kInputValue, ShaderSource::kInputValue,
+            ShaderSource::kInputValue, ShaderSource::kInputValue};
+  }
+  return iter->second;
+}
+
+void Define(const ShaderInstruction& inst, int index, DefTable* table) {
+  if (inst.opcode == kOpNop) return;
+  auto [iter, inserted] = table->try_emplace(
+      {inst.dest.type, inst.dest.number}, CurrentDefs(*table, inst.dest));
+  for (int c = 0; c < 4; ++c) {
+    if (inst.write_mask & (1 << c)) iter->second[c] = index;
+  }
+}
+
+void LinkDefinitions(ShaderProgram* program) {
+  DefTable table;
+  for (int i = 0; i < static_cast<int>(program->instructions.size()); ++i) {
+    ShaderInstruction& inst = program->instructions[i];
+    for (int s = 0; s < inst.num_sources; ++s) {
+      ShaderSource& src = inst.sources[s];
+      src.defs.fill(ShaderSource::kInputValue);
+      src.addr_def = ShaderSource::kInputValue;
+      if (src.is_literal) continue;
+      const std::array<int, 4> reg_defs = CurrentDefs(table, src.reg);
+      for (int c = 0; c < 4; ++c) src.defs[c] = reg_defs[src.swizzle[c]];
+      if (src.relative) {
+        src.addr_def = CurrentDefs(table, {.type = kRegAddr, .number = 0})[0];
+      }
+    }
+    Define(inst, i, &table);
+  }
+}
+
+// Rewrites src to read what the mov that defined it read, if that still
+// holds the same value.
+void PropagateCopy(const std::vector<ShaderInstruction>& instructions,
+                   const DefTable& table, uint32_t read_mask,
+                   ShaderSource* src) {
+  if (src->is_literal || read_mask == 0) return;
+  const int def = src->defs[std::countr_zero(read_mask)];
+  if (def == ShaderSource::kInputValue) return;
+  for (int c = 0; c < 4; ++c) {
+    if ((read_mask & (1 << c)) && src->defs[c] != def) return;
+  }
+  const ShaderInstruction& copy = instructions[def];
+  if (copy.opcode != kOpMov || copy.saturate) return;
+  const ShaderSource& from = copy.sources[0];
+  if (from.relative) return;
+
+  ShaderSource result = from;
+  result.negate = src->negate != from.negate;
+  const std::array<int, 4> current = CurrentDefs(table, from.reg);
+  for (int c = 0; c < 4; ++c) {
+    if ((read_mask & (1 << c)) == 0) continue;
+    // The component of the mov's result that is read here.
+    const int k = src->swizzle[c];
+    if (from.is_literal) {
+      result.literal[c] = src->negate ? -from.literal[k] : from.literal[k];
+      continue;
+    }
+    if (current[from.swizzle[k]] != from.defs[k]) return;
+    result.swizzle[c] = from.swizzle[k];
+    result.defs[c] = from.defs[k];
+  }
+  if (from.is_literal) result.negate = false;
+  *src = result;
+}
+
+// Turns src into a literal if all the components it reads are known.
+void MakeLiteralIfKnown(const std::vector<std::array<float, 4>>& values,
+                        const std::vector<uint32_t>& known,
+                        uint32_t read_mask, ShaderSource* src) {
+  if (src->is_literal || src->relative) return;
+  std::array<float, 4> literal = {};
+  for (int c = 0; c < 4; ++c) {
+    if ((read_mask & (1 << c)) == 0) continue;
+    const int def = src->defs[c];
+    const int k = src->swizzle[c];
+    if (def == ShaderSource::kInputValue || (known[def] & (1 << k)) == 0) {
+      return;
+    }
+    literal[c] = src->negate ? -values[def][k] : values[def][k];
+  }
+  src->is_literal = true;
+  src->literal = literal;
+  src->negate = false;
+}
+
+bool IsFoldable(uint32_t opcode) {
+  switch (opcode) {
+    case kOpRcp:
+    case kOpRsq:
+    case kOpTex:
+      return false;
+    default:
+      return true;
+  }
+}
+
+// Evaluates an instruction whose sources are all literals.
+std::array<float, 4> Evaluate(const ShaderInstruction& inst) {
+  const std::array<float, 4>& a = inst.sources[0].literal;
+  const std::array<float, 4>& b = inst.sources[1].literal;
+  const std::array<float, 4>& d = inst.sources[2].literal;
+  std::array<float, 4> result = {};
+  if (inst.opcode == kOpDp3 || inst.opcode == kOpDp4) {
+    float dot = 0.f;
+    const int size = inst.opcode == kOpDp3 ? 3 : 4;
+    for (int c = 0; c < size; ++c) dot += a[c] * b[c];
+    result.fill(dot);
+  } else {
+    for (int c = 0; c < 4; ++c) {
+      switch (inst.opcode) {
+        case kOpMov:
+          result[c] = a[c];
+          break;
+        case kOpAdd:
+          result[c] = a[c] + b[c];
+          break;
+        case kOpSub:
+          result[c] = a[c] - b[c];
+          break;
+        case kOpMul:
+          result[c] = a[c] * b[c];
+          break;
+        case kOpMad:
+          result[c] = a[c] * b[c] + d[c];
+          break;
+        case kOpMin:
+          result[c] = std::min(a[c], b[c]);
+          break;
+        case kOpMax:
+          result[c] = std::max(a[c], b[c]);
+          break;
+        case kOpSge:
+          result[c] = a[c] >= b[c] ? 1.f : 0.f;
+          break;
+        case kOpLrp:
+          result[c] = a[c] * b[c] + (1.f - a[c]) * d[c];
+          break;
+        default:
+          FAIL("Unexpected instruction %d", inst.opcode);
+      }
+    }
+  }
+  if (inst.saturate) {
+    for (float& value : result) value = std::clamp(value, 0.f, 1.f);
+  }
+  return result;
+}
+
+uint32_t LiveOutputMask(bool is_pixel_shader, const ShaderRegister& reg,
+                        const LiveOutputs& outputs) {
+  if (is_pixel_shader) {
+    return reg == ShaderRegister{.type = kRegTemp, .number = 0} ? 0xf : 0;
+  }
+  switch (reg.type) {
+    case kRegRastOut:
+      return reg.number == kRastOutPosition ? outputs.position : outputs.fog;
+    case kRegAttrOut:
+      return outputs.colors[reg.number];
+    case kRegTexCoordOut:
+      return outputs.texcoords[reg.number];
+    default:
+      return 0;
+  }
+}
+
+void EmitMask(uint32_t mask, std::ostream& os) {
+  for (int c = 0; c < 4; ++c) {
+    if (mask & (1 << c)) os << kComponents[c];
+  }
+}
+
+void EmitRegister(bool is_pixel_shader, const ShaderRegister& reg,
+                  bool relative, std::ostream& os) {
+  switch (reg.type) {
+    case kRegTemp:
+      os << "temp_reg[" << reg.number << "]";
+      break;
+    case kRegInput:
+      os << "IN.input_reg" << reg.number;
+      break;
+    case kRegConst:
+      if (relative) {
+        os << "c[addr_reg.x + " << reg.number << "]";
+      } else {
+        os << "c[" << reg.number << "]";
+      }
+      break;
+    case kRegAddr:
+      if (is_pixel_shader) {
+        os << "t" << reg.number;
+      } else {
+        os << "addr_reg";
+      }
+      break;
+    case kRegRastOut:
+      os << (reg.number == kRastOutPosition ? "OUT.oPos" : "OUT.oFog");
+      break;
+    case kRegAttrOut:
+      os << "OUT.oD" << reg.number;
+      break;
+    case kRegTexCoordOut:
+      os << "OUT.oT" << reg.number;
+      break;
+    default:
+      FAIL("Unexpected reg type %d", reg.type);
+  }
+}
+
+// Emits the components of src in read_mask.
+void EmitSource(bool is_pixel_shader, const ShaderSource& src,
+                uint32_t read_mask, std::ostream& os) {
+  if (src.is_literal) {
+    const int size = std::popcount(read_mask);
+    os << "float";
+    if (size > 1) os << size;
+    os << "(";
+    const char* separator = "";
+    for (int c = 0; c < 4; ++c) {
+      if ((read_mask & (1 << c)) == 0) continue;
+      os << separator << src.literal[c];
+      separator = ", ";
+    }
+    os << ")";
+    return;
+  }
+  if (src.negate) os << "-";
+  EmitRegister(is_pixel_shader, src.reg, src.relative, os);
+  os << ".";
+  for (int c = 0; c < 4; ++c) {
+    if (read_mask & (1 << c)) os << kComponents[src.swizzle[c]];
+  }
+}
+
+void EmitInstruction(bool is_pixel_shader, const ShaderInstruction& inst,
+                     std::ostream& os) {
+  const uint32_t read_mask = ReadMask(inst);
+  auto source = [&](int index) {
+    EmitSource(is_pixel_shader, inst.sources[index], read_mask, os);
+  };
+
+  EmitRegister(is_pixel_shader, inst.dest, false, os);
+  if (inst.write_mask != 0xf) {
+    os << ".";
+    EmitMask(inst.write_mask, os);
+  }
+  os << " = ";
+  if (inst.saturate) os << "saturate(";
+  switch (inst.opcode) {
+    case kOpMov:
+      source(0);
+      break;
+    case kOpRcp:
+    case kOpRsq:
+      os << (inst.opcode == kOpRcp ? "rcp(" : "rsqrt(");
+      source(0);
+      os << ")";
+      break;
+    case kOpAdd:
+    case kOpSub:
+    case kOpMul:
+      source(0);
+      os << (inst.opcode == kOpAdd   ? " + "
+             : inst.opcode == kOpSub ? " - "
+                                     : " * ");
+      source(1);
+      break;
+    case kOpSge:
+      os << "(";
+      source(0);
+      os << " >= ";
+      source(1);
+      os << ")";
+      break;
+    case kOpMad:
+      source(0);
+      os << " * ";
+      source(1);
+      os << " + ";
+      source(2);
+      break;
+    case kOpDp3:
+    case kOpDp4:
+    case kOpMin:
+    case kOpMax:
+      os << (inst.opcode == kOpMin   ? "min("
+             : inst.opcode == kOpMax ? "max("
+                                     : "dot(");
+      source(0);
+      os << ", ";
+      source(1);
+      os << ")";
+      break;
+    case kOpLrp:
+      // src0 * src1 + (1 - src0) * src2.
+      os << "lerp(";
+      source(2);
+      os << ", ";
+      source(1);
+      os << ", ";
+      source(0);
+      os << ")";
+      break;
+    case kOpTex:
+      os << "g_texture" << inst.dest.number << ".Sample(g_sampler"
+         << inst.dest.number << ", IN.oT" << inst.dest.number << ".xy)";
+      if (inst.write_mask != 0xf) {
+        os << ".";
+        EmitMask(inst.write_mask, os);
+      }
+      break;
+    default:
+      FAIL("Unexpected instruction %d", inst.opcode);
+  }
+  if (inst.saturate) os << ")";
+  os << ";\n";
+}
+
+}  // namespace
+
+int ShaderProgram::CountInstructions() const {
+  int count = 0;
+  for (const ShaderInstruction& inst : instructions) {
+    if (inst.opcode != kOpNop) ++count;
+  }
+  return count;
+}
+
+ShaderProgram DecodeShader(const uint32_t* tokens) {
+  ASSERT(tokens != nullptr);
+  // First token is always the version token.
+  const uint32_t version = *tokens++;
+  ShaderProgram program = {.is_pixel_shader = (version >> 16) == 0xffff};
+  ASSERT(((version >> 8) & 0xff) == 1);
+  if (program.is_pixel_shader) {
+    ASSERT_TODO((version & 0xff) <= 3, "Pixel shader 1_4.");
+  }
+
+  std::map<int, std::array<float, 4>> defs;
+  for (;;) {
+    const uint32_t token = *tokens++;
+    const uint32_t opcode = token & kOpcodeMask;
+    if (opcode == kOpEnd) break;
+    if (opcode == kOpNop) continue;
+    if (opcode == kOpComment) {
+      tokens += (token & kCommentSizeMask) >> kCommentSizeShift;
+      continue;
+    }
+    if (opcode == kOpDef) {
+      const ShaderRegister reg = DecodeRegister(*tokens++);
+      ASSERT(reg.type == kRegConst);
+      std::memcpy(defs[reg.number].data(), tokens, sizeof(float[4]));
+      tokens += 4;
+      continue;
+    }
+    ShaderInstruction inst = {.opcode = opcode,
+                              .num_sources = NumSources(opcode)};
+    DecodeDest(program.is_pixel_shader, *tokens++, &inst);
+    for (int s = 0; s < inst.num_sources; ++s) {
+      inst.sources[s] = DecodeSource(*tokens++, defs);
+    }
+    program.instructions.push_back(inst);
+  }
+  LinkDefinitions(&program);
+  return program;
+}
+
+void PropagateCopies(ShaderProgram* program) {
+  LinkDefinitions(program);
+  std::vector<ShaderInstruction>& instructions = program->instructions;
+  DefTable table;
+  for (int i = 0; i < static_cast<int>(instructions.size()); ++i) {
+    ShaderInstruction& inst = instructions[i];
+    const uint32_t read_mask = ReadMask(inst);
+    for (int s = 0; s < inst.num_sources; ++s) {
+      PropagateCopy(instructions, table, read_mask, &inst.sources[s]);
+    }
+    Define(inst, i, &table);
+  }
+}
+
+void FoldConstants(ShaderProgram* program) {
+  LinkDefinitions(program);
+  std::vector<ShaderInstruction>& instructions = program->instructions;
+  // The components of each instruction's result that are known, and their
+  // values.
+  std::vector<uint32_t> known(instructions.size(), 0);
+  std::vector<std::array<float, 4>> values(instructions.size());
+  for (size_t i = 0; i < instructions.size(); ++i) {
+    ShaderInstruction& inst = instructions[i];
+    if (inst.opcode == kOpNop) continue;
+    const uint32_t read_mask = ReadMask(inst);
+    bool all_literal = inst.num_sources > 0;
+    for (int s = 0; s < inst.num_sources; ++s) {
+      MakeLiteralIfKnown(values, known, read_mask, &inst.sources[s]);
+      all_literal = all_literal && inst.sources[s].is_literal;
+    }
+    if (!all_literal || !IsFoldable(inst.opcode)) continue;
+
+    const std::array<float, 4> result = Evaluate(inst);
+    bool finite = true;
+    for (int c = 0; c < 4; ++c) {
+      if (inst.write_mask & (1 << c)) {
+        finite = finite && std::isfinite(result[c]);
+      }
+    }
+    // There are no literals for these in HLSL.
+    if (!finite) continue;
+    inst.opcode = kOpMov;
+    inst.saturate = false;
+    inst.num_sources = 1;
+    inst.sources[0] = {.is_literal = true, .literal = result};
+    known[i] = inst.write_mask;
+    values[i] = result;
+  }
+  LinkDefinitions(program);
+}
+
+void RemoveDeadCode(ShaderProgram* program, const LiveOutputs& outputs) {
+  LinkDefinitions(program);
+  std::vector<ShaderInstruction>& instructions = program->instructions;
+  // The components of each instruction's result that are read.
+  std::vector<uint32_t> live(instructions.size(), 0);
+  DefTable final_defs;
+  for (int i = 0; i < static_cast<int>(instructions.size()); ++i) {
+    Define(instructions[i], i, &final_defs);
+  }
+  for (const auto& [key, defs] : final_defs) {
+    const uint32_t mask = LiveOutputMask(
+        program->is_pixel_shader, {.type = key.first, .number = key.second},
+        outputs);
+    for (int c = 0; c < 4; ++c) {
+      if ((mask & (1 << c)) && defs[c] != ShaderSource::kInputValue) {
+        live[defs[c]] |= 1 << c;
+      }
+    }
+  }
+
+  for (int i = static_cast<int>(instructions.size()) - 1; i >= 0; --i) {
+    ShaderInstruction& inst = instructions[i];
+    if (inst.opcode == kOpNop) continue;
+    inst.write_mask &= live[i];
+    if (inst.write_mask == 0) {
+      inst.opcode = kOpNop;
+      inst.num_sources = 0;
+      continue;
+    }
+    const uint32_t read_mask = ReadMask(inst);
+    for (int s = 0; s < inst.num_sources; ++s) {
+      const ShaderSource& src = inst.sources[s];
+      if (src.is_literal) continue;
+      for (int c = 0; c < 4; ++c) {
+        const int def = src.defs[c];
+        if ((read_mask & (1 << c)) && def != ShaderSource::kInputValue) {
+          live[def] |= 1 << src.swizzle[c];
+        }
+      }
+      if (src.relative && src.addr_def != ShaderSource::kInputValue) {
+        live[src.addr_def] |= 1;
+      }
+    }
+  }
+  LinkDefinitions(program);
+}
+
+void OptimizeShader(ShaderProgram* program, const LiveOutputs& outputs) {
+  // Narrowing masks first lets more sources read from a single mov.
+  RemoveDeadCode(program, outputs);
+  PropagateCopies(program);
+  FoldConstants(program);
+  RemoveDeadCode(program, outputs);
+}
+
+std::string EmitShaderHlsl(const ShaderProgram& program) {
+  std::stringstream ss;
+  ss << std::dec << std::setprecision(std::numeric_limits<float>::max_digits10);
+  for (const ShaderInstruction& inst : program.instructions) {
+    if (inst.opcode != kOpNop) {
+      EmitInstruction(program.is_pixel_shader, inst, ss);
+    }
+  }
+  return ss.str();
+}
+
+}  // namespace Dx8to12
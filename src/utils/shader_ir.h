@@ -0,0 +1,150 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace Dx8to12 {
+
+// vs_1_1 and ps_1_0 to ps_1_3 shaders as a list of instructions decoded from
+// their D3D8 token stream, so that they can be cleaned up before being turned
+// into HLSL.
+//
+// These shader models have no flow control, so a shader is a single basic
+// block and needs no phis to be in SSA form: every instruction defines a new
+// value for the components it writes, and each component a source reads is
+// linked to the instruction that defined it (ShaderSource::defs).
+namespace ShaderToken {
+// Values from d3d8types.h; shader_parser.cpp checks that they match.
+constexpr uint32_t kOpNop = 0;
+constexpr uint32_t kOpMov = 1;
+constexpr uint32_t kOpAdd = 2;
+constexpr uint32_t kOpSub = 3;
+constexpr uint32_t kOpMad = 4;
+constexpr uint32_t kOpMul = 5;
+constexpr uint32_t kOpRcp = 6;
+constexpr uint32_t kOpRsq = 7;
+constexpr uint32_t kOpDp3 = 8;
+constexpr uint32_t kOpDp4 = 9;
+constexpr uint32_t kOpMin = 10;
+constexpr uint32_t kOpMax = 11;
+constexpr uint32_t kOpSge = 13;
+constexpr uint32_t kOpLrp = 18;
+constexpr uint32_t kOpTex = 66;
+constexpr uint32_t kOpDef = 81;
+constexpr uint32_t kOpComment = 0xfffe;
+constexpr uint32_t kOpEnd = 0xffff;
+constexpr uint32_t kOpcodeMask = 0xffff;
+constexpr uint32_t kCommentSizeMask = 0x7fff0000;
+constexpr uint32_t kCommentSizeShift = 16;
+
+constexpr uint32_t kRegNumMask = 0x1fff;
+constexpr uint32_t kRegTypeMask = 0x70000000;
+constexpr uint32_t kRegTypeShift = 28;
+constexpr uint32_t kRegTemp = 0;
+constexpr uint32_t kRegInput = 1;
+constexpr uint32_t kRegConst = 2;
+// The address register in vertex shaders, texture registers in pixel shaders.
+constexpr uint32_t kRegAddr = 3;
+constexpr uint32_t kRegRastOut = 4;
+constexpr uint32_t kRegAttrOut = 5;
+constexpr uint32_t kRegTexCoordOut = 6;
+constexpr int kRastOutPosition = 0;
+constexpr int kRastOutFog = 1;
+
+constexpr uint32_t kAddrModeRelative = 1 << 13;
+constexpr uint32_t kWriteMaskShift = 16;
+constexpr uint32_t kWriteMaskAll = 0xf << kWriteMaskShift;
+constexpr uint32_t kDstModShift = 20;
+constexpr uint32_t kDstModMask = 0xf << kDstModShift;
+constexpr uint32_t kDstModSaturate = 1 << kDstModShift;
+constexpr uint32_t kSwizzleShift = 16;
+constexpr uint32_t kSwizzleMask = 0xff << kSwizzleShift;
+constexpr uint32_t kSrcModMask = 0xf << 24;
+constexpr uint32_t kSrcModNone = 0;
+constexpr uint32_t kSrcModNeg = 1 << 24;
+}  // namespace ShaderToken
+
+struct ShaderRegister {
+  uint32_t type = 0;  // ShaderToken::kReg*
+  int number = 0;
+
+  bool operator==(const ShaderRegister&) const = default;
+};
+
+struct ShaderSource {
+  // Marks a component that comes from outside the shader.
+  static constexpr int kInputValue = -1;
+
+  ShaderRegister reg = {};
+  // Reads c[a0.x + reg.number].
+  bool relative = false;
+  // The component read for each of x, y, z and w.
+  std::array<uint8_t, 4> swizzle = {0, 1, 2, 3};
+  bool negate = false;
+  // Set once the value is known, e.g. from a def. The literal is already
+  // swizzled and negated, and reg is unused.
+  bool is_literal = false;
+  std::array<float, 4> literal = {};
+  // The instruction that defined the component read for each of x, y, z and
+  // w, and the one that defined a0.x for relative reads.
+  std::array<int, 4> defs = {kInputValue, kInputValue, kInputValue,
+                             kInputValue};
+  int addr_def = kInputValue;
+};
+
+struct ShaderInstruction {
+  // ShaderToken::kOp*, never kOpDef or kOpComment.
+  uint32_t opcode = ShaderToken::kOpNop;
+  ShaderRegister dest = {};
+  // x in bit 0.
+  uint32_t write_mask = 0;
+  bool saturate = false;
+  int num_sources = 0;
+  std::array<ShaderSource, 3> sources = {};
+};
+
+struct ShaderProgram {
+  bool is_pixel_shader = false;
+  // Instructions that passes remove become kOpNop, so that defs stay valid.
+  std::vector<ShaderInstruction> instructions = {};
+
+  int CountInstructions() const;
+};
+
+// The components of each vertex shader output that are read after it runs,
+// with x in bit 0. Writes to any others are removed. Pixel shaders always
+// output r0.
+struct LiveOutputs {
+  uint32_t position = 0xf;
+  uint32_t fog = 0x1;
+  std::array<uint32_t, 2> colors = {0xf, 0xf};
+  std::array<uint32_t, 8> texcoords = {0xf, 0xf, 0xf, 0xf,
+                                       0xf, 0xf, 0xf, 0xf};
+};
+
+// Decodes a token stream, starting at its version token. def instructions
+// don't make it into the program; reads of the constants they define become
+// literals. Fails on instructions that the HLSL emitter doesn't support.
+ShaderProgram DecodeShader(const uint32_t* tokens);
+
+// Replaces sources that read the result of a plain mov with the mov's own
+// source, composing their swizzles, as long as it still holds the same value.
+void PropagateCopies(ShaderProgram* program);
+// Turns sources whose components are all known into literals, and evaluates
+// instructions whose sources are all literals at compile time. Leaves rcp,
+// rsq and tex alone, whose results the GPU only approximates.
+void FoldConstants(ShaderProgram* program);
+// Narrows write masks to the components that are read later or are live
+// outputs, and removes instructions left with nothing to write.
+void RemoveDeadCode(ShaderProgram* program, const LiveOutputs& outputs);
+// Runs all of the above.
+void OptimizeShader(ShaderProgram* program, const LiveOutputs& outputs);
+
+// The HLSL statements for the shader's instructions, which go into the body
+// of VSMain (programmable_vs.hlsl) or PSMain (programmable_ps.hlsl). Sources
+// of per-component instructions only read the components that are written.
+std::string EmitShaderHlsl(const ShaderProgram& program);
+
+}  // namespace Dx8to12
@@ -0,0 +1,92 @@
+#include "size_class_allocator.h"
+
+#include <bit>
+
+#include "utils/asserts.h"
+
+namespace Dx8to12 {
+
+SizeClassAllocator::SizeClassAllocator(int min_size, int max_size,
+                                       int page_size, int block_size)
+    : min_size_(min_size),
+      max_size_(max_size),
+      page_size_(page_size),
+      block_size_(block_size) {
+  ASSERT(std::has_single_bit(static_cast<unsigned>(min_size)) &&
+         std::has_single_bit(static_cast<unsigned>(max_size)) &&
+         std::has_single_bit(static_cast<unsigned>(page_size)));
+  ASSERT(min_size <= max_size && max_size <= page_size);
+  ASSERT(block_size % page_size == 0);
+  free_slots_.resize(SizeClassFor(max_size) + 1);
+  // Start out with a full last block so the first page creates one.
+  next_page_offset_ = block_size_;
+}
+
+int SizeClassAllocator::SizeClassFor(int size) const {
+  if (size <= min_size_) return 0;
+  return std::bit_width(static_cast<unsigned>(size - 1)) -
+         std::bit_width(static_cast<unsigned>(min_size_ - 1));
+}
+
+void SizeClassAllocator::AddPage(int size_class, bool *new_block) {
+  if (next_page_offset_ + page_size_ > block_size_) {
+    ++num_blocks_;
+    next_page_offset_ = 0;
+    *new_block = true;
+  }
+  const int block = num_blocks_ - 1;
+  const int slot_size = ClassSize(size_class);
+  // Push in reverse so that lower offsets get handed out first.
+  std::vector<Slot> &slots = free_slots_[size_class];
+  for (int offset = next_page_offset_ + page_size_ - slot_size;
+       offset >= next_page_offset_; offset -= slot_size) {
+    slots.push_back({.block = block, .offset = offset});
+  }
+  next_page_offset_ += page_size_;
+}
+
+SizeClassAllocator::Allocation SizeClassAllocator::Allocate(int size,
+                                                            bool *new_block) {
+  ASSERT(CanAllocate(size));
+  *new_block = false;
+  const int size_class = SizeClassFor(size);
+  if (free_slots_[size_class].empty()) {
+    AddPage(size_class, new_block);
+  }
+  const Slot slot = free_slots_[size_class].back();
+  free_slots_[size_class].pop_back();
+
+  bytes_requested_ += size;
+  bytes_allocated_ += ClassSize(size_class);
+  ++num_allocations_;
+  return {.block = slot.block,
+          .offset = slot.offset,
+          .size_class = size_class,
+          .size = size};
+}
+
+void SizeClassAllocator::Free(const Allocation &alloc) {
+  ASSERT(alloc.block >= 0 && alloc.block < num_blocks_);
+  ASSERT(alloc.size_class < (int)free_slots_.size());
+  ASSERT(alloc.offset % ClassSize(alloc.size_class) == 0);
+  free_slots_[alloc.size_class].push_back(
+      {.block = alloc.block, .offset = alloc.offset});
+  bytes_requested_ -= alloc.size;
+  bytes_allocated_ -= ClassSize(alloc.size_class);
+  --num_allocations_;
+}
+
+SizeClassAllocator::Stats SizeClassAllocator::stats() const {
+  return {.bytes_requested = bytes_requested_,
+          .bytes_allocated = bytes_allocated_,
+          .bytes_reserved = static_cast<size_t>(num_blocks_) * block_size_,
+          .num_allocations = num_allocations_,
+          .num_blocks = num_blocks_,
+          .internal_fragmentation =
+              bytes_allocated_ == 0
+                  ? 0.0f
+                  : 1.0f - static_cast<float>(bytes_requested_) /
+                               static_cast<float>(bytes_allocated_)};
+}
+
+}  // namespace Dx8to12
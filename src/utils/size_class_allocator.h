@@ -0,0 +1,74 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace Dx8to12 {
+
+// Bookkeeping for a slab allocator with power-of-two size classes. Address
+// space is made of equally sized blocks, which are split into pages on demand.
+// Each page serves a single size class. Offsets are aligned to their size
+// class. Knows nothing about the memory it manages, the owner is told through
+// Allocate's return value when a new block is needed.
+class SizeClassAllocator {
+ public:
+  struct Allocation {
+    int block = -1;
+    int offset = 0;
+    int size_class = 0;
+    // Size that was asked for. The slot itself is ClassSize(size_class).
+    int size = 0;
+  };
+
+  struct Stats {
+    size_t bytes_requested;
+    // Sum of the slot sizes of all live allocations.
+    size_t bytes_allocated;
+    // Total size of all blocks.
+    size_t bytes_reserved;
+    int num_allocations;
+    int num_blocks;
+    // Fraction of allocated slot bytes that are lost to size class rounding.
+    float internal_fragmentation;
+  };
+
+  SizeClassAllocator(int min_size, int max_size, int page_size,
+                     int block_size);
+
+  bool CanAllocate(int size) const { return size > 0 && size <= max_size_; }
+  // Sets new_block if the allocation needed a new block, which is always the
+  // last one (num_blocks() - 1).
+  Allocation Allocate(int size, bool* new_block);
+  void Free(const Allocation& alloc);
+
+  int ClassSize(int size_class) const { return min_size_ << size_class; }
+  int num_blocks() const { return num_blocks_; }
+  Stats stats() const;
+
+ private:
+  struct Slot {
+    int block;
+    int offset;
+  };
+
+  int SizeClassFor(int size) const;
+  // Carves a page out of the current block (or a new one) for size_class.
+  void AddPage(int size_class, bool* new_block);
+
+  const int min_size_;
+  const int max_size_;
+  const int page_size_;
+  const int block_size_;
+
+  std::vector<std::vector<Slot>> free_slots_;
+  int num_blocks_ = 0;
+  // Next unused page offset in the last block.
+  int next_page_offset_ = 0;
+
+  size_t bytes_requested_ = 0;
+  size_t bytes_allocated_ = 0;
+  int num_allocations_ = 0;
+};
+
+}  // namespace Dx8to12
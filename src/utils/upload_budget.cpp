@@ -0,0 +1,46 @@
+#include "upload_budget.h"
+
+#include <algorithm>
+
+namespace Dx8to12 {
+
+uint32_t UploadBudget::NextChunkRows(uint32_t rows_left, uint32_t row_pitch,
+                                     bool force) const {
+  const uint64_t rows_per_chunk =
+      std::max<uint64_t>(1, chunk_size_ / row_pitch);
+  uint64_t num_rows = std::min<uint64_t>(rows_per_chunk, rows_left);
+  if (!force) {
+    const uint64_t room = in_flight_bytes_ >= max_in_flight_bytes_
+                              ? 0
+                              : max_in_flight_bytes_ - in_flight_bytes_;
+    num_rows = std::min(num_rows, room / row_pitch);
+  }
+  return static_cast<uint32_t>(num_rows);
+}
+
+void UploadBudget::Record(uint64_t frame, uint64_t num_bytes) {
+  if (in_flight_.empty() || in_flight_.back().first != frame) {
+    in_flight_.emplace_back(frame, 0);
+  }
+  in_flight_.back().second += num_bytes;
+  in_flight_bytes_ += num_bytes;
+  bytes_uploaded_ += num_bytes;
+  frame_bytes_ += num_bytes;
+  ++num_chunks_;
+}
+
+void UploadBudget::Retire(uint64_t completed_frame) {
+  while (!in_flight_.empty() && in_flight_.front().first <= completed_frame) {
+    in_flight_bytes_ -= in_flight_.front().second;
+    in_flight_.pop_front();
+  }
+}
+
+UploadBudget::Stats UploadBudget::stats() const {
+  return {.bytes_uploaded = bytes_uploaded_,
+          .frame_bytes = frame_bytes_,
+          .num_chunks = num_chunks_,
+          .in_flight_bytes = in_flight_bytes_};
+}
+
+}  // namespace Dx8to12
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <utility>
+
+namespace Dx8to12 {
+
+// Chunk sizing and in-flight accounting for uploads that are streamed through
+// a ring buffer in row bands. Bands hold at most chunk_size bytes (but at
+// least one row), and stop being handed out once max_in_flight_bytes are
+// waiting on the GPU. Frames are fence values: bytes recorded in frame F are
+// in flight until F has completed. Knows nothing about what is uploaded.
+class UploadBudget {
+ public:
+  struct Stats {
+    uint64_t bytes_uploaded;
+    // Bytes recorded since the last EndFrame.
+    uint64_t frame_bytes;
+    uint64_t num_chunks;
+    // Recorded bytes whose frame has not completed yet.
+    uint64_t in_flight_bytes;
+  };
+
+  UploadBudget(uint64_t chunk_size, uint64_t max_in_flight_bytes)
+      : chunk_size_(chunk_size), max_in_flight_bytes_(max_in_flight_bytes) {}
+
+  // Number of rows of row_pitch bytes that go in the next band, out of
+  // rows_left. 0 means the in-flight limit is hit, which force ignores.
+  uint32_t NextChunkRows(uint32_t rows_left, uint32_t row_pitch,
+                         bool force) const;
+  // Accounts for a band of num_bytes recorded in frame.
+  void Record(uint64_t frame, uint64_t num_bytes);
+  // Forgets about bands whose frame is at or before completed_frame.
+  void Retire(uint64_t completed_frame);
+
+  // Returns the bytes recorded since the last call, and starts counting the
+  // next frame.
+  uint64_t EndFrame() { return std::exchange(frame_bytes_, 0); }
+
+  uint64_t in_flight_bytes() const { return in_flight_bytes_; }
+  Stats stats() const;
+
+ private:
+  uint64_t chunk_size_;
+  uint64_t max_in_flight_bytes_;
+  // Bytes recorded per frame, oldest first.
+  std::deque<std::pair<uint64_t, uint64_t>> in_flight_;
+  uint64_t in_flight_bytes_ = 0;
+  uint64_t bytes_uploaded_ = 0;
+  uint64_t frame_bytes_ = 0;
+  uint64_t num_chunks_ = 0;
+};
+
+}  // namespace Dx8to12
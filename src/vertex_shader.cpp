@@ -280,25 +280,8 @@ VertexShader CreateFixedFunctionVertexShader(
   s << "#include \"ff_vertex_shader.hlsl\"\n";
 
   const std::string code = s.str();
-  auto includer = CreateShaderIncluder();
-
-  ID3DBlob* errorBlob = nullptr;
-  HRESULT hr = D3DCompile(code.c_str(), code.size(), nullptr, defines.data(),
-                          includer.get(), "VSMain", "vs_5_0",
-                          D3DCOMPILE_DEBUG | D3DCOMPILE_ENABLE_STRICTNESS |
-                              D3DCOMPILE_WARNINGS_ARE_ERRORS,
-                          0, result.blob.GetForInit(), &errorBlob);
-  if (hr != S_OK) {
-    ASSERT(errorBlob);
-    ASSERT(reinterpret_cast<const char*>(
-               errorBlob->GetBufferPointer())[errorBlob->GetBufferSize() - 1] ==
-           0);
-    LOG_ERROR() << "Error when compiling shader: "
-                << (const char*)errorBlob->GetBufferPointer() << "\n";
-    FAIL("Error when compiling shader:\r\n%s\r\n---\r\n%s", code.c_str(),
-         (const char*)errorBlob->GetBufferPointer());
-  }
-  ASSERT(errorBlob == nullptr);
+  result.blob =
+      CompileShader(code, nullptr, defines.data(), "VSMain", "vs_5_0");
   LOG(TRACE) << "Successfully created shader.\n";
 
   // TODO: Pass declaration by value.
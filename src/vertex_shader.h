@@ -3,6 +3,7 @@
 #include <d3d12.h>
 
 #include <array>
+#include <cstddef>
 #include <cstdint>
 #include <iosfwd>
 #include <map>
@@ -12,6 +13,7 @@
 #include "d3d8.h"
 #include "util.h"
 #include "utils/dx_utils.h"
+#include "utils/ff_combiner.h"
 
 namespace Dx8to12 {
 
@@ -76,7 +78,11 @@ struct PixelCBuffer {
   float alpha_ref;
   float pad[2];
   D3DCOLORVALUE texture_factor;
+  // Only read by the fixed-function ubershader.
+  UbershaderConstants ff_combiner;
 };
+static_assert(offsetof(PixelCBuffer, ff_combiner) == 96,
+              "Must match PixelGlobals in common.hlsl.");
 
 struct ConstantRegData {
   uint32_t data[4];
@@ -0,0 +1,110 @@
+#include "utils/async_compiler.h"
+
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <string>
+#include <thread>
+
+#include "test.h"
+
+namespace Dx8to12 {
+namespace {
+
+using namespace std::chrono_literals;
+using Compiler = AsyncCompiler<int, std::string>;
+
+// Stands in for a compile that takes latency, e.g. CreateGraphicsPipelineState.
+std::string FakeCompile(int key, std::chrono::milliseconds latency) {
+  std::this_thread::sleep_for(latency);
+  return "result " + std::to_string(key);
+}
+
+// Swaps in finished jobs until num_expected results have arrived, or a
+// generous timeout passes.
+std::map<int, std::string> SwapInAll(Compiler* compiler, int num_expected) {
+  std::map<int, std::string> results;
+  const auto deadline = std::chrono::steady_clock::now() + 10s;
+  while (static_cast<int>(results.size()) < num_expected &&
+         std::chrono::steady_clock::now() < deadline) {
+    compiler->SwapInFinished([&](int key, std::string result) {
+      EXPECT(!results.contains(key));
+      results[key] = std::move(result);
+    });
+    std::this_thread::sleep_for(1ms);
+  }
+  return results;
+}
+
+TEST(PendingKeysAreOnlyQueuedOnce) {
+  std::atomic<int> num_compiles = 0;
+  Compiler compiler(2);
+  for (int i = 0; i < 10; ++i) {
+    compiler.Queue(7, [&] {
+      ++num_compiles;
+      return FakeCompile(7, 20ms);
+    });
+  }
+  EXPECT(compiler.IsPending(7));
+  EXPECT(compiler.num_pending() == 1);
+  const std::map<int, std::string> results = SwapInAll(&compiler, 1);
+  EXPECT(results.size() == 1 && results.at(7) == "result 7");
+  EXPECT(num_compiles == 1);
+  EXPECT(!compiler.IsPending(7));
+  EXPECT(compiler.stats().num_queued == 1);
+  EXPECT(compiler.stats().num_swapped_in == 1);
+}
+
+TEST(KeysCanBeQueuedAgainOnceSwappedIn) {
+  Compiler compiler(1);
+  compiler.Queue(1, [] { return FakeCompile(1, 0ms); });
+  SwapInAll(&compiler, 1);
+  compiler.Queue(1, [] { return FakeCompile(1, 0ms); });
+  EXPECT(compiler.IsPending(1));
+  EXPECT(SwapInAll(&compiler, 1).size() == 1);
+  EXPECT(compiler.stats().num_queued == 2);
+}
+
+TEST(ResultsOnlyShowUpInSwapInFinished) {
+  Compiler compiler(4);
+  for (int key = 0; key < 16; ++key) {
+    compiler.Queue(key, [key] { return FakeCompile(key, 5ms); });
+  }
+  // Every job is done by now, but still pending until swapped in.
+  std::this_thread::sleep_for(200ms);
+  EXPECT(compiler.num_pending() == 16);
+  const std::map<int, std::string> results = SwapInAll(&compiler, 16);
+  EXPECT(results.size() == 16);
+  for (const auto& [key, result] : results) {
+    EXPECT(result == "result " + std::to_string(key));
+  }
+  EXPECT(compiler.num_pending() == 0);
+  EXPECT(compiler.stats().compile_seconds > 0.0);
+}
+
+TEST(ShutdownDropsQueuedJobsAndWaitsForRunningOnes) {
+  std::atomic<bool> started = false;
+  std::atomic<bool> finished = false;
+  std::atomic<int> num_compiles = 0;
+  {
+    Compiler compiler(1);
+    compiler.Queue(0, [&] {
+      started = true;
+      std::string result = FakeCompile(0, 50ms);
+      finished = true;
+      return result;
+    });
+    for (int key = 1; key < 8; ++key) {
+      compiler.Queue(key, [&, key] {
+        ++num_compiles;
+        return FakeCompile(key, 50ms);
+      });
+    }
+    while (!started) std::this_thread::yield();
+  }
+  EXPECT(finished);
+  EXPECT(num_compiles == 0);
+}
+
+}  // namespace
+}  // namespace Dx8to12
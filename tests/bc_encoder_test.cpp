@@ -0,0 +1,283 @@
+#include "utils/bc_encoder.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+#include "bench.h"
+#include "test.h"
+
+namespace Dx8to12 {
+namespace {
+
+using Testing::SecondsPerRun;
+
+struct Image {
+  uint32_t width;
+  uint32_t height;
+  std::vector<uint8_t> bgra;
+
+  size_t pitch() const { return width * 4; }
+  uint8_t* texel(uint32_t x, uint32_t y) { return &bgra[y * pitch() + x * 4]; }
+};
+
+Image MakeImage(uint32_t width, uint32_t height) {
+  return {width, height, std::vector<uint8_t>(width * height * 4, 255)};
+}
+
+// Smooth color ramps, which are what block compression does best on.
+Image Gradient(uint32_t size) {
+  Image image = MakeImage(size, size);
+  const uint32_t max = std::max(size - 1, 1u);
+  for (uint32_t y = 0; y < size; ++y) {
+    for (uint32_t x = 0; x < size; ++x) {
+      uint8_t* texel = image.texel(x, y);
+      texel[0] = static_cast<uint8_t>(x * 255 / max);
+      texel[1] = static_cast<uint8_t>(y * 255 / max);
+      texel[2] = static_cast<uint8_t>((x + y) * 255 / (2 * max));
+    }
+  }
+  return image;
+}
+
+// A gradient with +-16 of noise per channel, like a photo.
+Image Noisy(uint32_t size, std::mt19937& rng) {
+  Image image = Gradient(size);
+  for (size_t i = 0; i < image.bgra.size(); ++i) {
+    if (i % 4 == 3) continue;
+    const int value = image.bgra[i] + static_cast<int>(rng() % 33) - 16;
+    image.bgra[i] = static_cast<uint8_t>(std::clamp(value, 0, 255));
+  }
+  return image;
+}
+
+// A gradient with an alpha ramp across it.
+Image AlphaRamp(uint32_t size) {
+  Image image = Gradient(size);
+  for (uint32_t y = 0; y < size; ++y) {
+    for (uint32_t x = 0; x < size; ++x) {
+      image.texel(x, y)[3] = static_cast<uint8_t>((x + y) * 255 / (2 * size));
+    }
+  }
+  return image;
+}
+
+// Decoders that follow the D3D10 spec, as the GPU would sample the blocks.
+void DecodeColorBlock(const uint8_t* block, bool has_alpha_block,
+                      uint8_t* bgra, size_t pitch) {
+  const uint16_t color0 = static_cast<uint16_t>(block[0] | (block[1] << 8));
+  const uint16_t color1 = static_cast<uint16_t>(block[2] | (block[3] << 8));
+  int palette[4][4];
+  for (int i = 0; i < 2; ++i) {
+    const uint16_t color = i == 0 ? color0 : color1;
+    const int b = color & 31, g = (color >> 5) & 63, r = color >> 11;
+    palette[i][0] = (b << 3) | (b >> 2);
+    palette[i][1] = (g << 2) | (g >> 4);
+    palette[i][2] = (r << 3) | (r >> 2);
+    palette[i][3] = 255;
+  }
+  // BC3 color blocks are always in four color mode.
+  const bool four_colors = has_alpha_block || color0 > color1;
+  for (int c = 0; c < 4; ++c) {
+    if (four_colors) {
+      palette[2][c] = (2 * palette[0][c] + palette[1][c] + 1) / 3;
+      palette[3][c] = (palette[0][c] + 2 * palette[1][c] + 1) / 3;
+    } else {
+      palette[2][c] = (palette[0][c] + palette[1][c]) / 2;
+      palette[3][c] = 0;
+    }
+  }
+  if (!four_colors) palette[2][3] = 255;
+  uint32_t indices = 0;
+  for (int i = 0; i < 4; ++i) indices |= uint32_t{block[4 + i]} << (8 * i);
+  for (int i = 0; i < 16; ++i) {
+    const int* color = palette[(indices >> (2 * i)) & 3];
+    uint8_t* texel = bgra + (i / 4) * pitch + (i % 4) * 4;
+    // BC3 alpha comes from the alpha block.
+    const int num_channels = has_alpha_block ? 3 : 4;
+    for (int c = 0; c < num_channels; ++c) {
+      texel[c] = static_cast<uint8_t>(color[c]);
+    }
+  }
+}
+
+void DecodeAlphaBlock(const uint8_t* block, uint8_t* bgra, size_t pitch) {
+  const int alpha0 = block[0], alpha1 = block[1];
+  int palette[8] = {alpha0, alpha1};
+  if (alpha0 > alpha1) {
+    for (int i = 1; i < 7; ++i) {
+      palette[i + 1] = ((7 - i) * alpha0 + i * alpha1) / 7;
+    }
+  } else {
+    for (int i = 1; i < 5; ++i) {
+      palette[i + 1] = ((5 - i) * alpha0 + i * alpha1) / 5;
+    }
+    palette[6] = 0;
+    palette[7] = 255;
+  }
+  uint64_t indices = 0;
+  for (int i = 0; i < 6; ++i) indices |= uint64_t{block[2 + i]} << (8 * i);
+  for (int i = 0; i < 16; ++i) {
+    bgra[(i / 4) * pitch + (i % 4) * 4 + 3] =
+        static_cast<uint8_t>(palette[(indices >> (3 * i)) & 7]);
+  }
+}
+
+std::vector<uint8_t> Encode(BcFormat format, const Image& image) {
+  const size_t dst_pitch = (image.width + 3) / 4 * BcBlockSize(format);
+  std::vector<uint8_t> encoded(dst_pitch * ((image.height + 3) / 4));
+  EncodeBcImage(format, image.bgra.data(), image.pitch(), image.width,
+                image.height, encoded.data(), dst_pitch);
+  return encoded;
+}
+
+Image Decode(BcFormat format, const std::vector<uint8_t>& encoded,
+             uint32_t width, uint32_t height) {
+  const uint32_t padded_width = (width + 3) / 4 * 4;
+  const uint32_t padded_height = (height + 3) / 4 * 4;
+  Image padded = MakeImage(padded_width, padded_height);
+  const uint8_t* block = encoded.data();
+  for (uint32_t y = 0; y < padded_height; y += 4) {
+    for (uint32_t x = 0; x < padded_width; x += 4) {
+      if (format == BcFormat::kBc3) {
+        DecodeAlphaBlock(block, padded.texel(x, y), padded.pitch());
+        block += 8;
+      }
+      DecodeColorBlock(block, format == BcFormat::kBc3, padded.texel(x, y),
+                       padded.pitch());
+      // BC1 alpha is only there in three color mode, which the encoder only
+      // uses for solid blocks. Those decode as opaque.
+      block += 8;
+    }
+  }
+  Image image = MakeImage(width, height);
+  for (uint32_t y = 0; y < height; ++y) {
+    std::copy_n(padded.texel(0, y), width * 4, image.texel(0, y));
+  }
+  return image;
+}
+
+// Root mean square error over the color channels, and alpha if asked.
+double Rmse(const Image& a, const Image& b, bool with_alpha) {
+  double sum = 0;
+  size_t count = 0;
+  for (size_t i = 0; i < a.bgra.size(); ++i) {
+    if (i % 4 == 3 && !with_alpha) continue;
+    const double error = a.bgra[i] - b.bgra[i];
+    sum += error * error;
+    ++count;
+  }
+  return std::sqrt(sum / count);
+}
+
+double RoundTripRmse(BcFormat format, const Image& image) {
+  return Rmse(image,
+              Decode(format, Encode(format, image), image.width, image.height),
+              format == BcFormat::kBc3);
+}
+
+TEST(SolidBlocksAreExact) {
+  Image image = MakeImage(8, 8);
+  for (uint32_t i = 0; i < 64; ++i) {
+    uint8_t* texel = image.texel(i % 8, i / 8);
+    // Colors that 565 represents exactly.
+    texel[0] = 0x84;
+    texel[1] = 0x82;
+    texel[2] = 0x08;
+    texel[3] = 0x40;
+  }
+  EXPECT(RoundTripRmse(BcFormat::kBc3, image) == 0);
+}
+
+TEST(GradientQuality) {
+  const Image image = Gradient(256);
+  EXPECT(RoundTripRmse(BcFormat::kBc1, image) < 2);
+  EXPECT(RoundTripRmse(BcFormat::kBc3, image) < 2);
+}
+
+TEST(NoiseQuality) {
+  std::mt19937 rng(1);
+  const Image image = Noisy(256, rng);
+  EXPECT(RoundTripRmse(BcFormat::kBc1, image) < 9);
+}
+
+TEST(AlphaQuality) {
+  const Image image = AlphaRamp(256);
+  EXPECT(RoundTripRmse(BcFormat::kBc3, image) < 2);
+}
+
+// Edge blocks of sizes that aren't a multiple of 4 encode as if the last row
+// and column were repeated to fill them.
+TEST(EdgeBlocksRepeatTheLastTexel) {
+  std::mt19937 rng(2);
+  for (const uint32_t width : {1u, 2u, 3u, 5u, 7u, 13u}) {
+    for (const uint32_t height : {1u, 2u, 3u, 6u, 9u}) {
+      Image image = MakeImage(width, height);
+      for (uint8_t& byte : image.bgra) byte = static_cast<uint8_t>(rng());
+      Image padded = MakeImage((width + 3) / 4 * 4, (height + 3) / 4 * 4);
+      for (uint32_t y = 0; y < padded.height; ++y) {
+        for (uint32_t x = 0; x < padded.width; ++x) {
+          std::copy_n(
+              image.texel(std::min(x, width - 1), std::min(y, height - 1)), 4,
+              padded.texel(x, y));
+        }
+      }
+      for (const BcFormat format : {BcFormat::kBc1, BcFormat::kBc3}) {
+        EXPECT(Encode(format, image) == Encode(format, padded));
+      }
+    }
+  }
+  Image single = MakeImage(1, 1);
+  single.texel(0, 0)[2] = 200;
+  single.texel(0, 0)[3] = 10;
+  const Image decoded =
+      Decode(BcFormat::kBc3, Encode(BcFormat::kBc3, single), 1, 1);
+  EXPECT(decoded.bgra[3] == 10);
+  EXPECT(std::abs(decoded.bgra[2] - 200) <= 4);
+}
+
+// The transcoder picks BC1 when every level is opaque, and BC3 otherwise,
+// since BC1 would drop the alpha.
+TEST(OpaqueImagesUseBc1) {
+  Image image = Gradient(16);
+  EXPECT(IsOpaque(image.bgra.data(), image.pitch(), 16, 16));
+
+  // A single translucent texel anywhere makes it BC3, including the last.
+  image.texel(15, 15)[3] = 254;
+  EXPECT(!IsOpaque(image.bgra.data(), image.pitch(), 16, 16));
+  // Padding past the width doesn't count.
+  EXPECT(IsOpaque(image.bgra.data(), image.pitch(), 15, 16));
+  EXPECT(IsOpaque(image.bgra.data(), image.pitch(), 16, 15));
+
+  const Image alpha = AlphaRamp(16);
+  EXPECT(!IsOpaque(alpha.bgra.data(), alpha.pitch(), 16, 16));
+  const Image bc1 = Decode(BcFormat::kBc1, Encode(BcFormat::kBc1, alpha), 16,
+                           16);
+  const Image bc3 = Decode(BcFormat::kBc3, Encode(BcFormat::kBc3, alpha), 16,
+                           16);
+  EXPECT(Rmse(alpha, bc3, true) < Rmse(alpha, bc1, true));
+}
+
+// Prints encoder throughput at 1024x1024.
+TEST(Throughput) {
+  std::mt19937 rng(3);
+  Image image = Noisy(1024, rng);
+  for (uint32_t i = 0; i < 1024 * 1024; ++i) {
+    image.bgra[i * 4 + 3] = static_cast<uint8_t>(i / 4096);
+  }
+  std::vector<uint8_t> encoded(1024 * 1024);
+  for (const BcFormat format : {BcFormat::kBc1, BcFormat::kBc3}) {
+    const double seconds = SecondsPerRun([&] {
+      EncodeBcImage(format, image.bgra.data(), image.pitch(), 1024, 1024,
+                    encoded.data(), 256 * BcBlockSize(format));
+    });
+    std::printf("  BC%d %6.0f MPix/s\n", format == BcFormat::kBc1 ? 1 : 3,
+                1024 * 1024 / seconds / 1e6);
+  }
+}
+
+}  // namespace
+}  // namespace Dx8to12
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <chrono>
+#include <cstdio>
+
+namespace Dx8to12::Testing {
+
+// Runs function until at least min_seconds have passed, and returns the
+// average seconds per run. For the throughput numbers that some tests print.
+// They only report; no test fails for being slow.
+template <typename Function>
+double SecondsPerRun(Function&& function, double min_seconds = 0.05) {
+  using Clock = std::chrono::steady_clock;
+  function();  // Warm up caches and lazily initialized state.
+  const Clock::time_point start = Clock::now();
+  int num_runs = 0;
+  double elapsed = 0;
+  do {
+    function();
+    ++num_runs;
+    elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+  } while (elapsed < min_seconds);
+  return elapsed / num_runs;
+}
+
+}  // namespace Dx8to12::Testing
@@ -0,0 +1,107 @@
+#include "utils/bindless_indices.h"
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <string>
+
+#include "test.h"
+
+namespace Dx8to12 {
+namespace {
+
+// The BindlessIndices cbuffer as ps_common.hlsl declares it, with HLSL's
+// packing: each uint4 array element takes one 16-byte register.
+struct ShaderCbuffer {
+  uint32_t g_texture_indices[2][4];
+  uint32_t g_sampler_indices[2][4];
+};
+
+// What TEXTURE_INDEX(stage) and SAMPLER_INDEX(stage) read.
+uint32_t TextureIndex(const ShaderCbuffer& cbuffer, int stage) {
+  return cbuffer.g_texture_indices[stage / 4][stage % 4];
+}
+uint32_t SamplerIndex(const ShaderCbuffer& cbuffer, int stage) {
+  return cbuffer.g_sampler_indices[stage / 4][stage % 4];
+}
+
+std::string ReadShader(const char* name) {
+  std::ifstream file(std::string(DX8TO12_SHADER_DIR) + "/" + name);
+  std::stringstream contents;
+  contents << file.rdbuf();
+  return contents.str();
+}
+
+TEST(LayoutMatchesTheRootSignature) {
+  EXPECT(kBindlessTextureIndicesOffset == 0);
+  EXPECT(kBindlessSamplerIndicesOffset == BindlessIndices::kNumStages);
+  EXPECT(kNumBindlessIndices == 2 * BindlessIndices::kNumStages);
+  // Root constants are limited to 64 DWORDs in all, shared with the rest of
+  // the root signature.
+  EXPECT(kNumBindlessIndices <= 32);
+  EXPECT(sizeof(ShaderCbuffer) == sizeof(BindlessIndices));
+}
+
+// Writes the two halves the way Device::SetBindlessTextures does, into the
+// root constants, and checks that every stage reads back its own indices
+// through the shader's view of them.
+TEST(ShadersReadEachStagesIndices) {
+  uint32_t root_constants[kNumBindlessIndices] = {};
+  uint32_t srv_indices[BindlessIndices::kNumStages];
+  uint32_t sampler_indices[BindlessIndices::kNumStages];
+  for (int i = 0; i < BindlessIndices::kNumStages; ++i) {
+    srv_indices[i] = 1000 + i * 7;
+    sampler_indices[i] = 20 + i * 3;
+  }
+  std::memcpy(root_constants + kBindlessTextureIndicesOffset, srv_indices,
+              sizeof(srv_indices));
+  std::memcpy(root_constants + kBindlessSamplerIndicesOffset, sampler_indices,
+              sizeof(sampler_indices));
+
+  ShaderCbuffer cbuffer;
+  std::memcpy(&cbuffer, root_constants, sizeof(cbuffer));
+  for (int stage = 0; stage < BindlessIndices::kNumStages; ++stage) {
+    EXPECT(TextureIndex(cbuffer, stage) == srv_indices[stage]);
+    EXPECT(SamplerIndex(cbuffer, stage) == sampler_indices[stage]);
+  }
+
+  // Only the sampler half changes when only samplers are dirty.
+  sampler_indices[5] = 99;
+  std::memcpy(root_constants + kBindlessSamplerIndicesOffset, sampler_indices,
+              sizeof(sampler_indices));
+  std::memcpy(&cbuffer, root_constants, sizeof(cbuffer));
+  EXPECT(SamplerIndex(cbuffer, 5) == 99);
+  EXPECT(TextureIndex(cbuffer, 5) == srv_indices[5]);
+}
+
+// ShaderCbuffer above is only right as long as ps_common.hlsl keeps declaring
+// and indexing the cbuffer this way.
+TEST(ShaderDeclaresTheSameLayout) {
+  const std::string hlsl = ReadShader("ps_common.hlsl");
+  EXPECT(!hlsl.empty());
+  const size_t cbuffer = hlsl.find("cbuffer BindlessIndices : register(b11)");
+  const size_t textures = hlsl.find("uint4 g_texture_indices[2];", cbuffer);
+  const size_t samplers = hlsl.find("uint4 g_sampler_indices[2];", textures);
+  EXPECT(cbuffer != std::string::npos);
+  EXPECT(textures != std::string::npos && samplers != std::string::npos);
+  EXPECT(hlsl.find("#define TEXTURE_INDEX(stage) "
+                   "g_texture_indices[(stage) / 4][(stage) % 4]") !=
+         std::string::npos);
+  EXPECT(hlsl.find("#define SAMPLER_INDEX(stage) "
+                   "g_sampler_indices[(stage) / 4][(stage) % 4]") !=
+         std::string::npos);
+  for (int stage = 0; stage < BindlessIndices::kNumStages; ++stage) {
+    const std::string n = std::to_string(stage);
+    EXPECT(hlsl.find("#define g_texture" + n + " g_textures[TEXTURE_INDEX(" +
+                     n + ")]") != std::string::npos);
+    EXPECT(hlsl.find("#define g_texCube" + n +
+                     " g_cube_textures[TEXTURE_INDEX(" + n + ")]") !=
+           std::string::npos);
+    EXPECT(hlsl.find("#define g_sampler" + n + " g_samplers[SAMPLER_INDEX(" +
+                     n + ")]") != std::string::npos);
+  }
+}
+
+}  // namespace
+}  // namespace Dx8to12
@@ -0,0 +1,202 @@
+#include "utils/blob_cache.h"
+
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "test.h"
+
+namespace Dx8to12 {
+namespace {
+
+using Key = BlobCache::Key;
+
+// A cache file in a fresh temporary directory, removed afterwards.
+class TempCacheFile {
+ public:
+  explicit TempCacheFile(const std::string& name)
+      : directory_(std::filesystem::temp_directory_path() /
+                   ("dx8to12_" + name)) {
+    std::filesystem::remove_all(directory_);
+    std::filesystem::create_directories(directory_);
+  }
+  ~TempCacheFile() { std::filesystem::remove_all(directory_); }
+
+  std::string path() const { return (directory_ / "cache.bin").string(); }
+  uint64_t size() const { return std::filesystem::file_size(path()); }
+
+ private:
+  std::filesystem::path directory_;
+};
+
+Key MakeKey(int index) {
+  return BlobCache::KeyBuilder().Add("shader").Add(index).Finish();
+}
+
+std::vector<char> MakeBlob(int index, size_t size = 100) {
+  std::vector<char> blob(size);
+  for (size_t i = 0; i < size; ++i) blob[i] = static_cast<char>(index + i);
+  return blob;
+}
+
+bool Holds(std::span<const char> found, const std::vector<char>& blob) {
+  return std::vector<char>(found.begin(), found.end()) == blob;
+}
+
+// Stands in for a shader compiler, counting how often it is called.
+struct FakeCompiler {
+  int num_calls = 0;
+
+  BlobCache::CompileFn For(int index) {
+    return [this, index](std::vector<char>* blob) {
+      ++num_calls;
+      *blob = MakeBlob(index);
+      return true;
+    };
+  }
+};
+
+TEST(CompilesOnMissAndHitsAcrossRuns) {
+  TempCacheFile file("hit_miss");
+  FakeCompiler compiler;
+  {
+    BlobCache cache;
+    EXPECT(cache.Open(file.path(), 1 << 20));
+    EXPECT(cache.Find(MakeKey(1)).empty());
+    EXPECT(Holds(cache.GetOrCompile(MakeKey(1), compiler.For(1)), MakeBlob(1)));
+    EXPECT(Holds(cache.GetOrCompile(MakeKey(1), compiler.For(1)), MakeBlob(1)));
+    EXPECT(compiler.num_calls == 1);
+    EXPECT(cache.stats().num_hits == 1 && cache.stats().num_misses == 1);
+  }
+  BlobCache cache;
+  EXPECT(cache.Open(file.path(), 1 << 20));
+  EXPECT(Holds(cache.GetOrCompile(MakeKey(1), compiler.For(1)), MakeBlob(1)));
+  EXPECT(compiler.num_calls == 1);
+  EXPECT(cache.stats().num_entries == 1);
+}
+
+TEST(FailedCompilesAreNotCached) {
+  TempCacheFile file("failed");
+  BlobCache cache;
+  EXPECT(cache.Open(file.path(), 1 << 20));
+  EXPECT(cache.GetOrCompile(MakeKey(1), [](std::vector<char>*) {
+    return false;
+  }).empty());
+  EXPECT(cache.stats().num_entries == 0);
+}
+
+TEST(KeyPartsAreLengthPrefixed) {
+  EXPECT(!(BlobCache::KeyBuilder().Add("ab").Add("c").Finish() ==
+           BlobCache::KeyBuilder().Add("a").Add("bc").Finish()));
+  EXPECT(BlobCache::KeyBuilder().Add("ab").Add("c").Finish() ==
+         BlobCache::KeyBuilder().Add("ab").Add("c").Finish());
+}
+
+TEST(ReplacedBlobsStayValid) {
+  TempCacheFile file("replace");
+  BlobCache cache;
+  EXPECT(cache.Open(file.path(), 1 << 20));
+  cache.Insert(MakeKey(1), MakeBlob(1));
+  const std::span<const char> first = cache.Find(MakeKey(1));
+  cache.Insert(MakeKey(1), MakeBlob(2, 5000));
+  EXPECT(Holds(first, MakeBlob(1)));
+  EXPECT(Holds(cache.Find(MakeKey(1)), MakeBlob(2, 5000)));
+
+  // A blob compiled while another thread inserted one loses.
+  FakeCompiler compiler;
+  const std::span<const char> compiled =
+      cache.GetOrCompile(MakeKey(3), [&](std::vector<char>* blob) {
+        cache.Insert(MakeKey(3), MakeBlob(3));
+        *blob = MakeBlob(4);
+        return true;
+      });
+  EXPECT(Holds(compiled, MakeBlob(3)));
+}
+
+TEST(TornRecordsAreDropped) {
+  TempCacheFile file("torn");
+  {
+    BlobCache cache;
+    EXPECT(cache.Open(file.path(), 1 << 20));
+    for (int i = 0; i < 3; ++i) cache.Insert(MakeKey(i), MakeBlob(i));
+  }
+  // As if the last write was cut short by a crash.
+  std::filesystem::resize_file(file.path(), file.size() - 30);
+  {
+    BlobCache cache;
+    EXPECT(cache.Open(file.path(), 1 << 20));
+    EXPECT(Holds(cache.Find(MakeKey(0)), MakeBlob(0)));
+    EXPECT(Holds(cache.Find(MakeKey(1)), MakeBlob(1)));
+    EXPECT(cache.Find(MakeKey(2)).empty());
+    cache.Insert(MakeKey(2), MakeBlob(2));
+  }
+  // The damaged tail was dropped, so records appended after it load again.
+  BlobCache cache;
+  EXPECT(cache.Open(file.path(), 1 << 20));
+  EXPECT(cache.stats().num_entries == 3);
+  EXPECT(Holds(cache.Find(MakeKey(2)), MakeBlob(2)));
+}
+
+TEST(CorruptBlobsAreRecompiled) {
+  TempCacheFile file("corrupt");
+  {
+    BlobCache cache;
+    EXPECT(cache.Open(file.path(), 1 << 20));
+    cache.Insert(MakeKey(0), MakeBlob(0));
+  }
+  // Flip the last byte of the blob, which its record header doesn't cover.
+  {
+    std::fstream stream(file.path(),
+                        std::ios::in | std::ios::out | std::ios::binary);
+    stream.seekg(-5, std::ios::end);
+    const char byte = static_cast<char>(stream.get());
+    stream.seekp(-5, std::ios::end);
+    stream.put(static_cast<char>(byte ^ 0x5a));
+  }
+  BlobCache cache;
+  EXPECT(cache.Open(file.path(), 1 << 20));
+  FakeCompiler compiler;
+  EXPECT(Holds(cache.GetOrCompile(MakeKey(0), compiler.For(0)), MakeBlob(0)));
+  EXPECT(compiler.num_calls == 1);
+  EXPECT(cache.stats().num_corrupt == 1);
+}
+
+TEST(CompactionKeepsTheMostRecentlyUsed) {
+  TempCacheFile file("compact");
+  constexpr int kNumEntries = 20;
+  constexpr size_t kBlobSize = 1000;
+  {
+    BlobCache cache;
+    EXPECT(cache.Open(file.path(), 1 << 20));
+    for (int i = 0; i < kNumEntries; ++i) {
+      cache.Insert(MakeKey(i), MakeBlob(i, kBlobSize));
+    }
+  }
+  // A later run uses the oldest few again.
+  {
+    BlobCache cache;
+    EXPECT(cache.Open(file.path(), 1 << 20));
+    for (int i = 0; i < 4; ++i) EXPECT(!cache.Find(MakeKey(i)).empty());
+  }
+  // Room for about 10 entries, so compaction keeps about 7.
+  constexpr uint64_t kMaxBytes = 10 * (kBlobSize + 48) + 16;
+  EXPECT(file.size() > kMaxBytes);
+  BlobCache cache;
+  EXPECT(cache.Open(file.path(), kMaxBytes));
+  EXPECT(file.size() <= kMaxBytes / 4 * 3);
+  const int num_entries = cache.stats().num_entries;
+  EXPECT(num_entries >= 5 && num_entries < 10);
+  for (int i = 0; i < 4; ++i) {
+    EXPECT(Holds(cache.Find(MakeKey(i)), MakeBlob(i, kBlobSize)));
+  }
+  // Then the newest of the rest.
+  for (int i = 4; i < kNumEntries; ++i) {
+    EXPECT(cache.Find(MakeKey(i)).empty() ==
+           (i < kNumEntries - (num_entries - 4)));
+  }
+}
+
+}  // namespace
+}  // namespace Dx8to12
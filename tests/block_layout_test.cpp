@@ -0,0 +1,179 @@
+#include "utils/block_layout.h"
+
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+#include "test.h"
+
+namespace Dx8to12 {
+namespace {
+
+// What dx_utils maps the DXGI formats to.
+constexpr BlockFormat kBc1 = {.block_dim = 4, .block_size = 8};
+constexpr BlockFormat kBc2 = {.block_dim = 4, .block_size = 16};
+constexpr BlockFormat kBc3 = kBc2;
+constexpr BlockFormat kB8G8R8A8 = {.block_dim = 1, .block_size = 4};
+// Locked R8G8B8 texels, before they are expanded on upload.
+constexpr BlockFormat kR8G8B8 = {.block_dim = 1, .block_size = 3};
+
+// Every level of a full mip chain, as BaseTexture creates them.
+std::vector<LevelLayout> MipChain(BlockFormat format, uint32_t width,
+                                  uint32_t height) {
+  std::vector<LevelLayout> levels;
+  const int num_mips = std::bit_width(std::max(width, height));
+  for (int mip = 0; mip < num_mips; ++mip) {
+    levels.push_back(GetLevelLayout(format, width, height, mip));
+  }
+  return levels;
+}
+
+TEST(BlockRowsAndPitches) {
+  EXPECT(NumBlockRows(kBc1, 1) == 1);
+  EXPECT(NumBlockRows(kBc1, 4) == 1);
+  EXPECT(NumBlockRows(kBc1, 5) == 2);
+  EXPECT(NumBlockRows(kB8G8R8A8, 5) == 5);
+  EXPECT(CompactRowPitch(kBc1, 1) == 8);
+  EXPECT(CompactRowPitch(kBc1, 9) == 24);
+  EXPECT(CompactRowPitch(kBc2, 3) == 16);
+  EXPECT(CompactRowPitch(kBc3, 8) == 32);
+  EXPECT(CompactRowPitch(kB8G8R8A8, 3) == 12);
+  EXPECT(CompactRowPitch(kR8G8B8, 5) == 15);
+}
+
+TEST(BlockOffsets) {
+  EXPECT(CompactBlockOffset(kBc1, 16, 0, 0) == 0);
+  EXPECT(CompactBlockOffset(kBc1, 16, 4, 4) == 24);
+  EXPECT(CompactBlockOffset(kBc3, 64, 8, 12) == 3 * 64 + 2 * 16);
+  EXPECT(CompactBlockOffset(kR8G8B8, 15, 2, 1) == 15 + 6);
+}
+
+// Levels of block-compressed textures that aren't a multiple of 4 in size are
+// locked as whole blocks, but report their real size down to 1x1.
+TEST(Bc1MipChain) {
+  const std::vector<LevelLayout> expected = {
+      {.width = 7, .height = 5, .row_pitch = 16, .num_rows = 2, .size = 32},
+      {.width = 3, .height = 2, .row_pitch = 8, .num_rows = 1, .size = 8},
+      {.width = 1, .height = 1, .row_pitch = 8, .num_rows = 1, .size = 8},
+  };
+  EXPECT(MipChain(kBc1, 7, 5) == expected);
+}
+
+TEST(Bc2MipChain) {
+  const std::vector<LevelLayout> expected = {
+      {.width = 1, .height = 9, .row_pitch = 16, .num_rows = 3, .size = 48},
+      {.width = 1, .height = 4, .row_pitch = 16, .num_rows = 1, .size = 16},
+      {.width = 1, .height = 2, .row_pitch = 16, .num_rows = 1, .size = 16},
+      {.width = 1, .height = 1, .row_pitch = 16, .num_rows = 1, .size = 16},
+  };
+  EXPECT(MipChain(kBc2, 1, 9) == expected);
+}
+
+TEST(Bc3MipChain) {
+  const std::vector<LevelLayout> expected = {
+      {.width = 13, .height = 3, .row_pitch = 64, .num_rows = 1, .size = 64},
+      {.width = 6, .height = 1, .row_pitch = 32, .num_rows = 1, .size = 32},
+      {.width = 3, .height = 1, .row_pitch = 16, .num_rows = 1, .size = 16},
+      {.width = 1, .height = 1, .row_pitch = 16, .num_rows = 1, .size = 16},
+  };
+  EXPECT(MipChain(kBc3, 13, 3) == expected);
+}
+
+// Checks every level of every size up to 64x64 against the per-texel rule: a
+// level is locked as the blocks covering it, and is never smaller than 1x1.
+TEST(AllSmallSizes) {
+  for (const BlockFormat format : {kBc1, kBc2, kB8G8R8A8, kR8G8B8}) {
+    for (uint32_t width = 1; width <= 64; ++width) {
+      for (uint32_t height = 1; height <= 64; ++height) {
+        const std::vector<LevelLayout> levels =
+            MipChain(format, width, height);
+        EXPECT(levels.back().width == 1 && levels.back().height == 1);
+        for (size_t mip = 0; mip < levels.size(); ++mip) {
+          const LevelLayout& level = levels[mip];
+          EXPECT(level.width == std::max<uint32_t>(1, width >> mip));
+          EXPECT(level.height == std::max<uint32_t>(1, height >> mip));
+          const uint32_t blocks_x =
+              (level.width + format.block_dim - 1) / format.block_dim;
+          const uint32_t blocks_y =
+              (level.height + format.block_dim - 1) / format.block_dim;
+          EXPECT(level.row_pitch == blocks_x * format.block_size);
+          EXPECT(level.num_rows == blocks_y);
+          EXPECT(level.size == blocks_x * blocks_y * format.block_size);
+          // The last block of the level ends where the level does.
+          EXPECT(CompactBlockOffset(format, level.row_pitch, level.width - 1,
+                                    level.height - 1) +
+                     format.block_size ==
+                 level.size);
+        }
+      }
+    }
+  }
+}
+
+TEST(FootprintRowPitch) {
+  EXPECT(FootprintRowPitch(kB8G8R8A8, 1) == 256);
+  EXPECT(FootprintRowPitch(kB8G8R8A8, 64) == 256);
+  EXPECT(FootprintRowPitch(kB8G8R8A8, 65) == 512);
+  EXPECT(FootprintRowPitch(kBc1, 1) == 256);
+  EXPECT(FootprintRowPitch(kBc1, 128) == 256);
+  EXPECT(FootprintRowPitch(kBc2, 68) == 512);
+  EXPECT(FootprintRowPitch(kR8G8B8, 100) == 512);
+  for (uint32_t width = 1; width <= 1024; ++width) {
+    const uint32_t pitch = FootprintRowPitch(kB8G8R8A8, width);
+    EXPECT(pitch % kFootprintPitchAlignment == 0);
+    EXPECT(pitch >= width * 4 && pitch < width * 4 + kFootprintPitchAlignment);
+  }
+}
+
+// Bytes that one lock of a dynamic texture moves with each strategy. kRingCopy
+// has the GPU copy the locked rect out of a ring footprint. kPerFrameTextures
+// has the CPU write the whole level into a fresh texture.
+struct DynamicTextureLock {
+  const char *name;
+  BlockFormat format;
+  uint32_t width;
+  uint32_t height;
+  uint32_t lock_width;
+  uint32_t lock_height;
+};
+
+uint64_t RingCopyBytes(const DynamicTextureLock &lock) {
+  return uint64_t{FootprintRowPitch(lock.format, lock.lock_width)} *
+         NumBlockRows(lock.format, lock.lock_height);
+}
+
+uint64_t PerFrameTextureBytes(const DynamicTextureLock &lock) {
+  return GetLevelLayout(lock.format, lock.width, lock.height, 0).size;
+}
+
+// Prints the comparison that the counters in Device::dynamic_texture_stats
+// report at run time, for typical dynamic textures.
+TEST(DynamicTextureStrategyBytes) {
+  const DynamicTextureLock locks[] = {
+      {"1280x720 video frame", kB8G8R8A8, 1280, 720, 1280, 720},
+      {"512x512 BC1, whole", kBc1, 512, 512, 512, 512},
+      {"256x256 atlas, 64x64 rect", kB8G8R8A8, 256, 256, 64, 64},
+      {"100x37 text", kB8G8R8A8, 100, 37, 100, 37},
+      {"24x24 BC1 cursor", kBc1, 24, 24, 24, 24},
+  };
+  for (const DynamicTextureLock &lock : locks) {
+    const uint64_t ring_bytes = RingCopyBytes(lock);
+    const uint64_t per_frame_bytes = PerFrameTextureBytes(lock);
+    std::printf("  %-28s ring copy %8llu, per-frame texture %8llu bytes\n",
+                lock.name, static_cast<unsigned long long>(ring_bytes),
+                static_cast<unsigned long long>(per_frame_bytes));
+  }
+  // Whole locks of pitch-aligned levels move the same bytes either way.
+  EXPECT(RingCopyBytes(locks[0]) == PerFrameTextureBytes(locks[0]));
+  EXPECT(RingCopyBytes(locks[1]) == PerFrameTextureBytes(locks[1]));
+  // Small rects only copy themselves with kRingCopy.
+  EXPECT(RingCopyBytes(locks[2]) * 16 == PerFrameTextureBytes(locks[2]));
+  // Narrow levels pay for the footprint pitch.
+  EXPECT(RingCopyBytes(locks[3]) > PerFrameTextureBytes(locks[3]));
+  EXPECT(RingCopyBytes(locks[4]) > PerFrameTextureBytes(locks[4]));
+}
+
+}  // namespace
+}  // namespace Dx8to12
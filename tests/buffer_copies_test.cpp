@@ -0,0 +1,154 @@
+#include "utils/buffer_copies.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <map>
+#include <random>
+#include <utility>
+#include <vector>
+
+#include "bench.h"
+#include "test.h"
+
+namespace Dx8to12 {
+namespace {
+
+using Testing::SecondsPerRun;
+
+struct FakeResource {};
+using Copy = BufferCopy<FakeResource>;
+
+bool SameCopy(const Copy &a, const Copy &b) {
+  return a.dest == b.dest && a.dest_offset == b.dest_offset &&
+         a.src == b.src && a.src_offset == b.src_offset &&
+         a.num_bytes == b.num_bytes;
+}
+
+// Maps every destination byte to the source byte it is copied from.
+std::map<std::pair<FakeResource *, int64_t>,
+         std::pair<FakeResource *, int64_t>>
+ByteMap(const std::vector<Copy> &copies) {
+  std::map<std::pair<FakeResource *, int64_t>,
+           std::pair<FakeResource *, int64_t>>
+      bytes;
+  for (const Copy &copy : copies) {
+    for (int64_t i = 0; i < copy.num_bytes; ++i) {
+      bytes[{copy.dest, copy.dest_offset + i}] = {copy.src,
+                                                  copy.src_offset + i};
+    }
+  }
+  return bytes;
+}
+
+TEST(MergesContiguousCopies) {
+  FakeResource dest, src;
+  std::vector<Copy> copies = {{&dest, 16, &src, 116, 8},
+                              {&dest, 0, &src, 100, 16},
+                              {&dest, 24, &src, 124, 4}};
+  SortAndMergeCopies(&copies);
+  EXPECT(copies.size() == 1);
+  EXPECT(SameCopy(copies[0], {&dest, 0, &src, 100, 28}));
+}
+
+TEST(KeepsCopiesThatAreNotContiguous) {
+  FakeResource dest, src, other_src;
+  std::vector<Copy> copies = {
+      // Contiguous in the destination only.
+      {&dest, 0, &src, 0, 16},
+      {&dest, 16, &src, 32, 16},
+      // Contiguous in both, but from another source.
+      {&dest, 32, &other_src, 48, 16},
+      // A gap in the destination.
+      {&dest, 52, &other_src, 64, 4}};
+  const std::vector<Copy> expected = copies;
+  std::reverse(copies.begin(), copies.end());
+  SortAndMergeCopies(&copies);
+  EXPECT(copies.size() == expected.size());
+  for (size_t i = 0; i < copies.size(); ++i) {
+    EXPECT(SameCopy(copies[i], expected[i]));
+  }
+}
+
+TEST(GroupsCopiesByDestination) {
+  FakeResource dests[3], src;
+  std::vector<Copy> copies;
+  for (int i = 0; i < 12; ++i) {
+    copies.push_back({&dests[i % 3], 64 * (i / 3), &src, 64 * i, 16});
+  }
+  SortAndMergeCopies(&copies);
+  EXPECT(copies.size() == 12);
+  for (size_t i = 1; i < copies.size(); ++i) {
+    const Copy &prev = copies[i - 1];
+    if (prev.dest == copies[i].dest) {
+      EXPECT(prev.dest_offset < copies[i].dest_offset);
+    } else {
+      // Each destination appears in a single run.
+      EXPECT(std::find_if(copies.begin() + i, copies.end(),
+                          [&](const Copy &c) { return c.dest == prev.dest; }) ==
+             copies.end());
+    }
+  }
+}
+
+// Random disjoint writes to random buffers must copy the same bytes after
+// merging, and nothing that is left can be merged further.
+TEST(RandomCopiesKeepTheSameBytes) {
+  std::mt19937 rng(1);
+  std::vector<FakeResource> resources(8);
+  for (int run = 0; run < 200; ++run) {
+    std::vector<Copy> copies;
+    for (FakeResource &dest : resources) {
+      int64_t offset = 0;
+      while (offset < 512) {
+        const int64_t size = 1 + rng() % 32;
+        if (rng() % 3 != 0) {
+          FakeResource *src = &resources[rng() % 2];
+          copies.push_back({&dest, offset, src, offset, size});
+        }
+        offset += size + (rng() % 4 == 0 ? rng() % 8 : 0);
+      }
+    }
+    std::shuffle(copies.begin(), copies.end(), rng);
+    const auto expected = ByteMap(copies);
+    SortAndMergeCopies(&copies);
+    EXPECT(ByteMap(copies) == expected);
+    for (size_t i = 1; i < copies.size(); ++i) {
+      const Copy &prev = copies[i - 1];
+      EXPECT(!(prev.dest == copies[i].dest && prev.src == copies[i].src &&
+               prev.dest_offset + prev.num_bytes == copies[i].dest_offset &&
+               prev.src_offset + prev.num_bytes == copies[i].src_offset));
+    }
+  }
+}
+
+// Prints the cost of sorting and merging the copies of 5000 dynamic buffers
+// with four written ranges each, two of which are contiguous.
+TEST(Throughput) {
+  constexpr int kNumBuffers = 5000;
+  std::mt19937 rng(2);
+  std::vector<FakeResource> dests(kNumBuffers);
+  FakeResource src;
+  std::vector<Copy> queued;
+  for (int i = 0; i < kNumBuffers; ++i) {
+    const int64_t base = int64_t{4096} * i;
+    queued.push_back({&dests[i], 0, &src, base, 256});
+    queued.push_back({&dests[i], 256, &src, base + 256, 256});
+    queued.push_back({&dests[i], 1024, &src, base + 1024, 128});
+    queued.push_back({&dests[i], 2048, &src, base + 2048, 512});
+  }
+  std::shuffle(queued.begin(), queued.end(), rng);
+  std::vector<Copy> copies;
+  size_t num_merged = 0;
+  const double seconds = SecondsPerRun([&] {
+    copies = queued;
+    SortAndMergeCopies(&copies);
+    num_merged = copies.size();
+  });
+  EXPECT(num_merged == 3 * kNumBuffers);
+  std::printf("  %zu copies merged to %zu in %.3f ms\n", queued.size(),
+              num_merged, seconds * 1e3);
+}
+
+}  // namespace
+}  // namespace Dx8to12
@@ -0,0 +1,234 @@
+#include "utils/copy_queue_sync.h"
+
+#include <algorithm>
+#include <deque>
+#include <functional>
+#include <random>
+#include <vector>
+
+#include "test.h"
+
+namespace Dx8to12 {
+namespace {
+
+TEST(BatchesWaitForTheLastFrameThatUsedTheirTextures) {
+  CopyQueueSync sync;
+  EXPECT(!sync.has_open_batch());
+  EXPECT(sync.AddUpload(0) == 1);
+  EXPECT(sync.AddUpload(3) == 1);
+  EXPECT(sync.AddUpload(2) == 1);
+  EXPECT(sync.IsOpen(1));
+  const CopyQueueSync::Batch first = sync.SubmitBatch(4);
+  EXPECT(first.signal_value == 1 && first.direct_wait_value == 3);
+  EXPECT(!sync.IsOpen(1));
+
+  EXPECT(sync.AddUpload(0) == 2);
+  const CopyQueueSync::Batch second = sync.SubmitBatch(4);
+  EXPECT(second.signal_value == 2 && second.direct_wait_value == 0);
+}
+
+TEST(DirectListsOnlyWaitWhenNeeded) {
+  CopyQueueSync sync;
+  // Nothing uploaded.
+  sync.RequireForDirect(0);
+  EXPECT(sync.TakeDirectWait(0) == 0);
+
+  sync.AddUpload(0);
+  sync.SubmitBatch(1);
+  sync.RequireForDirect(1);
+  EXPECT(sync.TakeDirectWait(0) == 1);
+  // Already waited for.
+  sync.RequireForDirect(1);
+  EXPECT(sync.TakeDirectWait(0) == 0);
+
+  sync.AddUpload(0);
+  sync.SubmitBatch(1);
+  sync.RequireForDirect(2);
+  // Already complete.
+  EXPECT(sync.TakeDirectWait(2) == 0);
+}
+
+TEST(FramesCompleteWithTheirBatches) {
+  CopyQueueSync sync;
+  sync.AddUpload(0);
+  sync.SubmitBatch(2);
+  sync.AddUpload(0);
+  sync.SubmitBatch(3);
+  EXPECT(sync.CopyValueFor(1) == 0);
+  EXPECT(sync.CopyValueFor(2) == 1);
+  EXPECT(sync.CopyValueFor(5) == 2);
+
+  EXPECT(sync.CompletedFrame(5, 0) == 1);
+  EXPECT(sync.CompletedFrame(5, 1) == 2);
+  EXPECT(sync.CompletedFrame(5, 2) == 5);
+  EXPECT(sync.CompletedFrame(1, 2) == 1);
+
+  sync.Retire(1);
+  EXPECT(sync.CopyValueFor(2) == 0);
+  EXPECT(sync.CompletedFrame(5, 1) == 2);
+}
+
+// Stand-ins for a queue and its fence. Operations run in order, and one that
+// waits for a fence blocks the rest of its queue.
+struct Fence {
+  uint64_t value = 0;
+};
+
+struct Operation {
+  const Fence* wait_fence = nullptr;
+  uint64_t wait_value = 0;
+  Fence* signal_fence = nullptr;
+  uint64_t signal_value = 0;
+  std::function<void()> work = {};
+};
+
+struct Queue {
+  std::deque<Operation> operations;
+
+  bool Step() {
+    if (operations.empty()) return false;
+    Operation& operation = operations.front();
+    if (operation.wait_fence &&
+        operation.wait_fence->value < operation.wait_value) {
+      return false;
+    }
+    if (operation.work) operation.work();
+    if (operation.signal_fence) {
+      operation.signal_fence->value = operation.signal_value;
+    }
+    operations.pop_front();
+    return true;
+  }
+};
+
+// Records random uploads and draws of a few textures, the way Device does,
+// and runs the two queues in random interleavings. Draws must see the latest
+// upload, uploads must not overwrite texels that a draw still reads, and a
+// frame's ring memory must outlive the uploads that use it.
+class Simulation {
+ public:
+  explicit Simulation(uint32_t seed) : rng_(seed) {}
+
+  void Run() {
+    for (int step = 0; step < 80; ++step) {
+      const int texture = static_cast<int>(rng_() % kNumTextures);
+      switch (rng_() % 4) {
+        case 0:
+          Upload(texture);
+          break;
+        case 1:
+          Draw(texture);
+          break;
+        case 2:
+          SubmitDirect();
+          break;
+        default:
+          Progress();
+          break;
+      }
+    }
+    SubmitDirect();
+    while (copy_.Step() || direct_.Step()) {
+    }
+    EXPECT(copy_.operations.empty() && direct_.operations.empty());
+    EXPECT(sync_.CopyValueFor(frame_) <= copy_fence_.value);
+    EXPECT(sync_.CompletedFrame(direct_fence_.value, copy_fence_.value) ==
+           frame_ - 1);
+  }
+
+ private:
+  static constexpr int kNumTextures = 4;
+
+  void Upload(int texture) {
+    // Device draws from the CPU copy instead when a texture is uploaded
+    // again in the frame that uses it.
+    if (last_used_[texture] == frame_) return;
+    copy_values_[texture] = sync_.AddUpload(last_used_[texture]);
+    const int version = ++cpu_versions_[texture];
+    const uint64_t frame = frame_;
+    const uint64_t last_used = last_used_[texture];
+    open_copy_.push_back({.work = [=, this] {
+      EXPECT(frame > freed_through_);
+      EXPECT(last_used <= direct_fence_.value);
+      gpu_versions_[texture] = version;
+    }});
+  }
+
+  void Draw(int texture) {
+    last_used_[texture] = frame_;
+    if (sync_.IsOpen(copy_values_[texture])) SubmitCopy();
+    sync_.RequireForDirect(copy_values_[texture]);
+    const int version = cpu_versions_[texture];
+    open_direct_.push_back({.work = [=, this] {
+      EXPECT(gpu_versions_[texture] == version);
+    }});
+  }
+
+  void SubmitCopy() {
+    if (!sync_.has_open_batch()) return;
+    const CopyQueueSync::Batch batch = sync_.SubmitBatch(frame_);
+    if (batch.direct_wait_value != 0) {
+      copy_.operations.push_back({.wait_fence = &direct_fence_,
+                                  .wait_value = batch.direct_wait_value});
+    }
+    copy_.operations.insert(copy_.operations.end(), open_copy_.begin(),
+                            open_copy_.end());
+    open_copy_.clear();
+    copy_.operations.push_back({.signal_fence = &copy_fence_,
+                                .signal_value = batch.signal_value});
+  }
+
+  void SubmitDirect() {
+    SubmitCopy();
+    if (const uint64_t wait = sync_.TakeDirectWait(copy_fence_.value)) {
+      direct_.operations.push_back(
+          {.wait_fence = &copy_fence_, .wait_value = wait});
+    }
+    direct_.operations.insert(direct_.operations.end(), open_direct_.begin(),
+                              open_direct_.end());
+    open_direct_.clear();
+    direct_.operations.push_back(
+        {.signal_fence = &direct_fence_, .signal_value = frame_});
+    ++frame_;
+  }
+
+  void Progress() {
+    for (int i = static_cast<int>(rng_() % 6); i > 0; --i) {
+      if (rng_() % 2 != 0) {
+        if (!copy_.Step()) direct_.Step();
+      } else if (!direct_.Step()) {
+        copy_.Step();
+      }
+    }
+    const uint64_t completed =
+        sync_.CompletedFrame(direct_fence_.value, copy_fence_.value);
+    EXPECT(completed >= freed_through_);
+    freed_through_ = completed;
+    sync_.Retire(copy_fence_.value);
+  }
+
+  std::mt19937 rng_;
+  CopyQueueSync sync_;
+  Fence direct_fence_;
+  Fence copy_fence_;
+  Queue direct_;
+  Queue copy_;
+  std::vector<Operation> open_copy_;
+  std::vector<Operation> open_direct_;
+  uint64_t frame_ = 1;
+  // Last frame whose ring memory has been reused.
+  uint64_t freed_through_ = 0;
+  std::vector<int> cpu_versions_ = std::vector<int>(kNumTextures, 0);
+  std::vector<int> gpu_versions_ = std::vector<int>(kNumTextures, 0);
+  std::vector<uint64_t> last_used_ = std::vector<uint64_t>(kNumTextures, 0);
+  std::vector<uint64_t> copy_values_ = std::vector<uint64_t>(kNumTextures, 0);
+};
+
+TEST(RandomUploadsAndDrawsDontRace) {
+  for (uint32_t seed = 1; seed <= 2000; ++seed) {
+    Simulation(seed).Run();
+  }
+}
+
+}  // namespace
+}  // namespace Dx8to12
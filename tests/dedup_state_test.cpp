@@ -0,0 +1,80 @@
+#include "utils/dedup_state.h"
+
+#include "test.h"
+
+namespace Dx8to12 {
+namespace {
+
+// What GpuTexture and TextureDeduplicator do with the state, without the
+// textures themselves.
+struct Texture {
+  DedupState state = DedupState::kNone;
+  int num_jobs_queued = 0;
+  int num_jobs_cancelled = 0;
+  bool has_own_copy = true;
+
+  // GpuTexture::LockRect, AddDirtyRect and Device::CopyRects.
+  void Write() {
+    const DedupWrite write = DedupStateForWrite(state);
+    if (write.leave_group) has_own_copy = true;
+    if (write.cancel_job) ++num_jobs_cancelled;
+    state = write.next_state;
+  }
+  // Device::PrepareTextureForDraw.
+  void Draw() {
+    if (!ShouldQueueForDedup(state)) return;
+    state = DedupState::kQueued;
+    ++num_jobs_queued;
+  }
+};
+
+TEST(TexturesFilledBeforeTheirFirstDrawGetHashed) {
+  Texture texture;
+  // Each level is locked and unlocked in turn.
+  for (int level = 0; level < 4; ++level) texture.Write();
+  EXPECT(texture.state == DedupState::kNone);
+  texture.Draw();
+  EXPECT(texture.state == DedupState::kQueued);
+  EXPECT(texture.num_jobs_queued == 1);
+  // Later draws don't queue it again.
+  texture.Draw();
+  EXPECT(texture.num_jobs_queued == 1);
+}
+
+TEST(WritesWhileQueuedHashAgain) {
+  Texture texture;
+  texture.Draw();
+  texture.Write();
+  EXPECT(texture.state == DedupState::kNone);
+  EXPECT(texture.num_jobs_cancelled == 1);
+  texture.Draw();
+  EXPECT(texture.state == DedupState::kQueued);
+  EXPECT(texture.num_jobs_queued == 2);
+}
+
+TEST(WritesAfterHashingStopSharingForGood) {
+  Texture hashed;
+  hashed.state = DedupState::kHashed;
+  EXPECT(DedupStateForWrite(DedupState::kHashed).forget_hash);
+  hashed.Write();
+  EXPECT(hashed.state == DedupState::kNever);
+
+  Texture shared;
+  shared.state = DedupState::kShared;
+  shared.has_own_copy = false;
+  shared.Write();
+  EXPECT(shared.state == DedupState::kNever);
+  EXPECT(shared.has_own_copy);
+  shared.Draw();
+  EXPECT(shared.num_jobs_queued == 0);
+}
+
+TEST(IneligibleTexturesStayThatWay) {
+  const DedupWrite write = DedupStateForWrite(DedupState::kNever);
+  EXPECT(write.next_state == DedupState::kNever);
+  EXPECT(!write.cancel_job && !write.forget_hash && !write.leave_group);
+  EXPECT(!ShouldQueueForDedup(DedupState::kNever));
+}
+
+}  // namespace
+}  // namespace Dx8to12
@@ -0,0 +1,165 @@
+#include "utils/descriptor_bitmap.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <random>
+#include <utility>
+#include <vector>
+
+#include "bench.h"
+#include "test.h"
+
+namespace Dx8to12 {
+namespace {
+
+using Testing::SecondsPerRun;
+
+// The first-fit rule the bitmap implements, one descriptor at a time.
+int NaiveFindRun(const std::vector<bool>& used, int count) {
+  int run = 0;
+  for (int i = 0; i < static_cast<int>(used.size()); ++i) {
+    run = used[i] ? 0 : run + 1;
+    if (run == count) return i - count + 1;
+  }
+  return -1;
+}
+
+TEST(AllocatesLowestFirst) {
+  DescriptorBitmap bitmap(100);
+  EXPECT(bitmap.Allocate() == 0);
+  EXPECT(bitmap.Allocate() == 1);
+  EXPECT(bitmap.Allocate() == 2);
+  bitmap.Free(1);
+  EXPECT(bitmap.Allocate() == 1);
+  EXPECT(bitmap.num_used() == 3);
+}
+
+// Sizes that aren't a multiple of 64 have no phantom descriptors at the end.
+TEST(FullHeapReturnsMinusOne) {
+  DescriptorBitmap bitmap(70);
+  for (int i = 0; i < 70; ++i) EXPECT(bitmap.Allocate() == i);
+  EXPECT(bitmap.Allocate() == -1);
+  EXPECT(bitmap.AllocateRange(2) == -1);
+  bitmap.Free(69);
+  EXPECT(bitmap.AllocateRange(2) == -1);
+  EXPECT(bitmap.Allocate() == 69);
+}
+
+TEST(RangesCrossWords) {
+  DescriptorBitmap bitmap(300);
+  // Leave free [60, 200).
+  EXPECT(bitmap.AllocateRange(60) == 0);
+  EXPECT(bitmap.AllocateRange(140) == 60);
+  EXPECT(bitmap.AllocateRange(100) == 200);
+  for (int i = 60; i < 200; ++i) bitmap.Free(i);
+  // Spans a partial word, a full word and another partial word.
+  EXPECT(bitmap.AllocateRange(130) == 60);
+  EXPECT(bitmap.AllocateRange(11) == -1);
+  EXPECT(bitmap.AllocateRange(10) == 190);
+}
+
+// The summary level lets whole used stretches of 64 words be skipped.
+TEST(SkipsFullSummaryWords) {
+  DescriptorBitmap bitmap(3 * 64 * 64);
+  EXPECT(bitmap.AllocateRange(64 * 64 + 5) == 0);
+  EXPECT(bitmap.Allocate() == 64 * 64 + 5);
+  EXPECT(bitmap.AllocateRange(64 * 64) == 64 * 64 + 6);
+  bitmap.Free(7);
+  EXPECT(bitmap.AllocateRange(2) == 2 * 64 * 64 + 6);
+  EXPECT(bitmap.Allocate() == 7);
+}
+
+TEST(GenerationsChangeOnFree) {
+  DescriptorBitmap bitmap(10);
+  const int index = bitmap.Allocate();
+  const uint32_t generation = bitmap.generation(index);
+  bitmap.Free(index);
+  EXPECT(bitmap.IsFree(index));
+  EXPECT(bitmap.generation(index) != generation);
+  const int range = bitmap.AllocateRange(3);
+  const uint32_t range_generation = bitmap.generation(range);
+  bitmap.FreeAll();
+  EXPECT(bitmap.generation(range) != range_generation);
+  EXPECT(bitmap.num_used() == 0);
+}
+
+TEST(Stats) {
+  DescriptorBitmap bitmap(64);
+  DescriptorBitmap::Stats stats = bitmap.stats();
+  EXPECT(stats.num_free == 64 && stats.largest_free_range == 64);
+  EXPECT(stats.fragmentation == 0.0f);
+  bitmap.AllocateRange(16);
+  const int middle = bitmap.AllocateRange(16);
+  bitmap.AllocateRange(16);
+  for (int i = middle; i < middle + 16; ++i) bitmap.Free(i);
+  stats = bitmap.stats();
+  EXPECT(stats.num_used == 32 && stats.num_free == 32);
+  EXPECT(stats.peak_used == 48);
+  EXPECT(stats.largest_free_range == 16);
+  EXPECT(stats.fragmentation == 0.5f);
+}
+
+// Mixed single and range allocations against a naive model, which must agree
+// on every index handed out.
+TEST(RandomChurnMatchesModel) {
+  constexpr int kSize = 4096 + 37;
+  std::mt19937 rng(1);
+  DescriptorBitmap bitmap(kSize);
+  std::vector<bool> used(kSize);
+  // First index and count of each live allocation.
+  std::vector<std::pair<int, int>> live;
+  for (int step = 0; step < 100000; ++step) {
+    if (!live.empty() && rng() % 2 == 0) {
+      const size_t i = rng() % live.size();
+      const auto [index, count] = live[i];
+      for (int j = index; j < index + count; ++j) {
+        EXPECT(!bitmap.IsFree(j));
+        bitmap.Free(j);
+        used[j] = false;
+      }
+      live[i] = live.back();
+      live.pop_back();
+      continue;
+    }
+    const int count = rng() % 4 == 0 ? 1 + rng() % 200 : 1;
+    const int expected = NaiveFindRun(used, count);
+    const int index =
+        count == 1 ? bitmap.Allocate() : bitmap.AllocateRange(count);
+    EXPECT(index == expected);
+    if (index < 0) continue;
+    for (int j = index; j < index + count; ++j) used[j] = true;
+    live.push_back({index, count});
+  }
+  int num_used = 0;
+  for (const bool is_used : used) num_used += is_used;
+  EXPECT(bitmap.num_used() == num_used);
+}
+
+// Prints the cost of an allocate/free pair on a half full, fragmented heap of
+// the size of the SRV heap.
+TEST(Throughput) {
+  constexpr int kSize = 1000000;
+  std::mt19937 rng(2);
+  DescriptorBitmap bitmap(kSize);
+  std::vector<int> live;
+  for (int i = 0; i < kSize / 2; ++i) live.push_back(bitmap.Allocate());
+  for (int i = 0; i < kSize / 4; ++i) {
+    const size_t j = rng() % live.size();
+    bitmap.Free(live[j]);
+    live[j] = live.back();
+    live.pop_back();
+  }
+  constexpr int kOps = 100000;
+  const double seconds = SecondsPerRun([&] {
+    for (int i = 0; i < kOps; ++i) {
+      const size_t j = rng() % live.size();
+      bitmap.Free(live[j]);
+      live[j] = i % 8 == 0 ? bitmap.AllocateRange(1) : bitmap.Allocate();
+    }
+  });
+  std::printf("  %.1f ns per free and allocate, %.2f ms per %d\n",
+              seconds / kOps * 1e9, seconds * 1e3, kOps);
+}
+
+}  // namespace
+}  // namespace Dx8to12
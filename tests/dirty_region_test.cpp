@@ -0,0 +1,103 @@
+#include "utils/dirty_region.h"
+
+#include <random>
+#include <vector>
+
+#include "test.h"
+
+namespace Dx8to12 {
+namespace {
+
+bool Covers(const DirtyRegion& region, uint32_t x, uint32_t y) {
+  for (const DirtyRect& rect : region.rects()) {
+    if (x >= rect.left && x < rect.right && y >= rect.top && y < rect.bottom) {
+      return true;
+    }
+  }
+  return false;
+}
+
+TEST(IgnoresEmptyRects) {
+  DirtyRegion region(4);
+  region.Add({.left = 4, .top = 0, .right = 4, .bottom = 8});
+  region.Add({.left = 0, .top = 8, .right = 4, .bottom = 2});
+  EXPECT(region.empty());
+}
+
+TEST(RepeatedLocksDontAddUp) {
+  DirtyRegion region(4);
+  for (int i = 0; i < 10; ++i) {
+    region.Add({.left = 16, .top = 16, .right = 32, .bottom = 32});
+  }
+  EXPECT(region.rects().size() == 1);
+  // Inside the first.
+  region.Add({.left = 20, .top = 20, .right = 24, .bottom = 24});
+  EXPECT(region.rects().size() == 1);
+  // Covers the first.
+  region.Add({.left = 0, .top = 0, .right = 64, .bottom = 64});
+  EXPECT(region.rects().size() == 1);
+  EXPECT(region.rects()[0].area() == 64 * 64);
+  region.Clear();
+  EXPECT(region.empty());
+}
+
+TEST(MergesNeighbours) {
+  DirtyRegion region(4);
+  region.Add({.left = 0, .top = 0, .right = 8, .bottom = 8});
+  region.Add({.left = 8, .top = 0, .right = 16, .bottom = 8});
+  EXPECT(region.rects().size() == 1);
+  EXPECT(region.rects()[0].right == 16);
+}
+
+TEST(KeepsDistantRectsApart) {
+  DirtyRegion region(4);
+  region.Add({.left = 0, .top = 0, .right = 4, .bottom = 4});
+  region.Add({.left = 100, .top = 100, .right = 104, .bottom = 104});
+  EXPECT(region.rects().size() == 2);
+}
+
+TEST(MergesTheCheapestPairPastMaxRects) {
+  DirtyRegion region(2);
+  region.Add({.left = 0, .top = 0, .right = 4, .bottom = 4});
+  region.Add({.left = 200, .top = 200, .right = 204, .bottom = 204});
+  region.Add({.left = 6, .top = 0, .right = 10, .bottom = 4});
+  EXPECT(region.rects().size() == 2);
+  EXPECT(Covers(region, 5, 2));
+  EXPECT(!Covers(region, 100, 100));
+}
+
+// Never more than max_rects, and every texel that was added stays covered.
+TEST(RandomRectsStayCovered) {
+  constexpr uint32_t kSize = 64;
+  std::mt19937 rng(1);
+  for (int iteration = 0; iteration < 200; ++iteration) {
+    const int max_rects = 1 + static_cast<int>(rng() % 6);
+    DirtyRegion region(max_rects);
+    std::vector<bool> dirty(kSize * kSize, false);
+    for (int step = 0; step < 20; ++step) {
+      const uint32_t left = rng() % kSize;
+      const uint32_t top = rng() % kSize;
+      const uint32_t width = 1 + rng() % (kSize - left);
+      const uint32_t height = 1 + rng() % (kSize - top);
+      const DirtyRect rect = {.left = left,
+                              .top = top,
+                              .right = left + width,
+                              .bottom = top + height};
+      region.Add(rect);
+      for (uint32_t y = rect.top; y < rect.bottom; ++y) {
+        for (uint32_t x = rect.left; x < rect.right; ++x) {
+          dirty[y * kSize + x] = true;
+        }
+      }
+      EXPECT(static_cast<int>(region.rects().size()) <= max_rects);
+      for (uint32_t y = 0; y < kSize; ++y) {
+        for (uint32_t x = 0; x < kSize; ++x) {
+          if (dirty[y * kSize + x]) EXPECT(Covers(region, x, y));
+        }
+      }
+    }
+  }
+}
+
+}  // namespace
+}  // namespace Dx8to12
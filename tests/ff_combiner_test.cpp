@@ -0,0 +1,263 @@
+#include "utils/ff_combiner.h"
+
+#include <vector>
+
+#include "test.h"
+
+namespace Dx8to12 {
+namespace {
+
+using namespace Combiner;
+
+// Values that are exact in binary, so that results compare equal.
+constexpr Float4 kDiffuse = {0.5f, 0.25f, 0.75f, 0.5f};
+constexpr Float4 kSpecular = {0.125f, 0.25f, 0.375f, 0.5f};
+constexpr Float4 kTextureFactor = {0.25f, 0.5f, 0.75f, 0.25f};
+constexpr Float4 kTexture = {0.75f, 0.5f, 0.25f, 0.75f};
+
+CombinerInputs Inputs(float alpha_ref = 0.5f) {
+  CombinerInputs inputs = {.diffuse = kDiffuse,
+                           .specular = kSpecular,
+                           .texture_factor = kTextureFactor,
+                           .alpha_ref = alpha_ref,
+                           .textures = {}};
+  inputs.textures.fill(kTexture);
+  return inputs;
+}
+
+CombinerStage Stage(uint32_t color_op, uint32_t color_arg1,
+                    uint32_t color_arg2, uint32_t alpha_op = kOpDisable,
+                    uint32_t alpha_arg1 = kArgCurrent,
+                    uint32_t alpha_arg2 = kArgCurrent) {
+  return {.color_op = color_op,
+          .color_arg1 = color_arg1,
+          .color_arg2 = color_arg2,
+          .alpha_op = alpha_op,
+          .alpha_arg1 = alpha_arg1,
+          .alpha_arg2 = alpha_arg2,
+          .texcoord_index = 0,
+          .has_texture = true};
+}
+
+CombinerState State(const std::vector<CombinerStage>& stages,
+                    uint32_t alpha_func = kCmpAlways) {
+  CombinerState state = {};
+  for (CombinerStage& stage : state.stages) {
+    stage = Stage(kOpDisable, kArgCurrent, kArgCurrent);
+  }
+  for (size_t i = 0; i < stages.size(); ++i) state.stages[i] = stages[i];
+  state.alpha_func = alpha_func;
+  return state;
+}
+
+CombinerOutput Evaluate(const CombinerState& state,
+                        const CombinerInputs& inputs = Inputs()) {
+  EXPECT(CanUseUbershader(state));
+  return EvaluateCombiner(PackUbershaderConstants(state), inputs);
+}
+
+// The color ops write rgb and leave alpha alone.
+Float4 Rgb(float r, float g, float b) { return {r, g, b, kDiffuse[3]}; }
+
+TEST(ColorOps) {
+  struct Case {
+    uint32_t op;
+    Float4 expected;
+  };
+  // arg1 is the texture, arg2 the diffuse color. The blend ops follow
+  // CreatePixelShaderFromState.
+  const Case cases[] = {
+      {kOpSelectArg1, Rgb(0.75f, 0.5f, 0.25f)},
+      {kOpSelectArg2, Rgb(0.5f, 0.25f, 0.75f)},
+      {kOpModulate, Rgb(0.375f, 0.125f, 0.1875f)},
+      {kOpModulate2x, Rgb(0.75f, 0.25f, 0.375f)},
+      // Not clamped.
+      {kOpModulate4x, Rgb(1.5f, 0.5f, 0.75f)},
+      {kOpAdd, Rgb(1.25f, 0.75f, 1.0f)},
+      {kOpAddSigned, Rgb(0.75f, 0.25f, 0.5f)},
+      // arg1 + arg2 * (1 - texture alpha).
+      {kOpBlendTextureAlpha, Rgb(0.875f, 0.5625f, 0.4375f)},
+      // arg1 * factor alpha + arg2 * (1 - factor alpha).
+      {kOpBlendFactorAlpha, Rgb(0.5625f, 0.3125f, 0.625f)},
+      // arg1 + arg2 * (1 - current alpha).
+      {kOpBlendCurrentAlpha, Rgb(1.0f, 0.625f, 0.625f)},
+  };
+  for (const Case& c : cases) {
+    const CombinerOutput output =
+        Evaluate(State({Stage(c.op, kArgTexture, kArgDiffuse)}));
+    EXPECT(output.color == c.expected);
+    EXPECT(!output.discarded);
+  }
+}
+
+TEST(DotProduct3) {
+  // (0.25, 0, -0.25, 0.25) dotted with itself, replicated to all of rgb.
+  const CombinerOutput output =
+      Evaluate(State({Stage(kOpDotProduct3, kArgTexture, kArgTexture)}));
+  EXPECT(output.color == Rgb(0.1875f, 0.1875f, 0.1875f));
+  // Negative dot products clamp to 0.
+  const CombinerOutput negative =
+      Evaluate(State({Stage(kOpDotProduct3, kArgTexture, kArgTFactor)}));
+  EXPECT(negative.color == Rgb(0.0f, 0.0f, 0.0f));
+}
+
+TEST(ArgSources) {
+  struct Case {
+    uint32_t arg;
+    Float4 expected;
+  };
+  const Case cases[] = {
+      {kArgDiffuse, Rgb(0.5f, 0.25f, 0.75f)},
+      // The first stage's current color is the diffuse color.
+      {kArgCurrent, Rgb(0.5f, 0.25f, 0.75f)},
+      {kArgTexture, Rgb(0.75f, 0.5f, 0.25f)},
+      {kArgTFactor, Rgb(0.25f, 0.5f, 0.75f)},
+      {kArgSpecular, Rgb(0.125f, 0.25f, 0.375f)},
+      {kArgDiffuse | kArgComplement, Rgb(0.5f, 0.75f, 0.25f)},
+      {kArgTexture | kArgComplement, Rgb(0.25f, 0.5f, 0.75f)},
+      {kArgTFactor | kArgComplement, Rgb(0.75f, 0.5f, 0.25f)},
+      {kArgSpecular | kArgComplement, Rgb(0.875f, 0.75f, 0.625f)},
+  };
+  for (const Case& c : cases) {
+    EXPECT(Evaluate(State({Stage(kOpSelectArg1, c.arg, kArgDiffuse)})).color ==
+           c.expected);
+    EXPECT(Evaluate(State({Stage(kOpSelectArg2, kArgDiffuse, c.arg)})).color ==
+           c.expected);
+  }
+}
+
+TEST(StagesWithoutATextureReadWhite) {
+  CombinerStage stage = Stage(kOpSelectArg1, kArgTexture, kArgDiffuse);
+  stage.has_texture = false;
+  EXPECT(Evaluate(State({stage})).color == Rgb(1.0f, 1.0f, 1.0f));
+}
+
+TEST(StagesChainWithoutClamping) {
+  const CombinerOutput output =
+      Evaluate(State({Stage(kOpModulate4x, kArgTexture, kArgDiffuse),
+                      Stage(kOpModulate, kArgCurrent, kArgTFactor)}));
+  // (1.5, 0.5, 0.75) * (0.25, 0.5, 0.75).
+  EXPECT(output.color == Rgb(0.375f, 0.25f, 0.5625f));
+}
+
+TEST(StopsAtTheFirstDisabledStage) {
+  const CombinerState state =
+      State({Stage(kOpSelectArg1, kArgTexture, kArgDiffuse),
+             Stage(kOpDisable, kArgCurrent, kArgCurrent),
+             Stage(kOpSelectArg1, kArgTFactor, kArgDiffuse, kOpSelectArg1,
+                   kArgTFactor)});
+  EXPECT(Evaluate(state).color == Rgb(0.75f, 0.5f, 0.25f));
+  // Nothing past it is packed.
+  const UbershaderConstants constants = PackUbershaderConstants(state);
+  for (int i = 2; i < 2 * kNumStages; ++i) EXPECT(constants.stages[i] == 0);
+  // Nor checked.
+  CombinerState unsupported = state;
+  unsupported.stages[2].color_op = 9;
+  EXPECT(CanUseUbershader(unsupported));
+}
+
+TEST(DisabledAlphaOpsPassAlphaThrough) {
+  const CombinerOutput output = Evaluate(
+      State({Stage(kOpSelectArg1, kArgDiffuse, kArgDiffuse, kOpSelectArg1,
+                   kArgTexture),
+             Stage(kOpSelectArg1, kArgTFactor, kArgDiffuse, kOpDisable)}));
+  EXPECT(output.color[3] == kTexture[3]);
+  EXPECT(output.color[0] == kTextureFactor[0]);
+
+  const CombinerOutput modulated = Evaluate(State({Stage(
+      kOpSelectArg1, kArgDiffuse, kArgDiffuse, kOpModulate, kArgTexture,
+      kArgTFactor)}));
+  EXPECT(modulated.color[3] == kTexture[3] * kTextureFactor[3]);
+}
+
+TEST(AlphaFuncs) {
+  struct Case {
+    uint32_t func;
+    // Whether alpha 0.5 passes against refs 0.25, 0.5 and 0.75.
+    bool passes[3];
+  };
+  const Case cases[] = {
+      {kCmpNever, {false, false, false}},
+      {kCmpLess, {false, false, true}},
+      {kCmpEqual, {false, true, false}},
+      {kCmpLessEqual, {false, true, true}},
+      {kCmpGreater, {true, false, false}},
+      {kCmpNotEqual, {true, false, true}},
+      {kCmpGreaterEqual, {true, true, false}},
+      {kCmpAlways, {true, true, true}},
+  };
+  const float refs[] = {0.25f, 0.5f, 0.75f};
+  for (const Case& c : cases) {
+    const CombinerState state =
+        State({Stage(kOpSelectArg1, kArgDiffuse, kArgDiffuse)}, c.func);
+    for (int i = 0; i < 3; ++i) {
+      EXPECT(Evaluate(state, Inputs(refs[i])).discarded != c.passes[i]);
+    }
+  }
+}
+
+TEST(PackedConstantsRoundTrip) {
+  CombinerState state =
+      State({Stage(kOpModulate2x, kArgTexture | kArgComplement, kArgDiffuse,
+                   kOpBlendFactorAlpha, kArgSpecular, kArgCurrent),
+             Stage(kOpDotProduct3, kArgCurrent, kArgTFactor)},
+            kCmpGreaterEqual);
+  state.stages[1].texcoord_index = 5;
+  state.stages[1].has_texture = false;
+  EXPECT(CanUseUbershader(state));
+  const UbershaderConstants constants = PackUbershaderConstants(state);
+  EXPECT(constants.alpha_func == kCmpGreaterEqual);
+  for (int i = 0; i < 2; ++i) {
+    const CombinerStage& stage = state.stages[i];
+    const uint32_t color = constants.stages[2 * i];
+    const uint32_t alpha = constants.stages[2 * i + 1];
+    EXPECT((color & 0xff) == stage.color_op);
+    EXPECT(((color >> 8) & 0xff) == stage.color_arg1);
+    EXPECT(((color >> 16) & 0xff) == stage.color_arg2);
+    EXPECT(((color >> 24) & 0x7f) == stage.texcoord_index);
+    EXPECT((color >> 31 != 0) == stage.has_texture);
+    if (stage.alpha_op == kOpDisable) {
+      EXPECT(alpha == 0);
+    } else {
+      EXPECT((alpha & 0xff) == stage.alpha_op);
+      EXPECT(((alpha >> 8) & 0xff) == stage.alpha_arg1);
+      EXPECT(((alpha >> 16) & 0xff) == stage.alpha_arg2);
+    }
+  }
+  // Packing is deterministic, so the device can compare constants to see
+  // whether the cbuffer changed.
+  EXPECT(PackUbershaderConstants(state) == constants);
+}
+
+TEST(RejectsWhatTheUbershaderCantDo) {
+  const CombinerState supported =
+      State({Stage(kOpModulate, kArgTexture, kArgDiffuse)});
+  EXPECT(CanUseUbershader(supported));
+
+  CombinerState state = supported;
+  // ADDSIGNED2X.
+  state.stages[0].color_op = 9;
+  EXPECT(!CanUseUbershader(state));
+  state = supported;
+  state.stages[0].alpha_op = 9;
+  EXPECT(!CanUseUbershader(state));
+  state = supported;
+  state.stages[0].color_arg1 = kArgTexture | kArgAlphaReplicate;
+  EXPECT(!CanUseUbershader(state));
+  state = supported;
+  state.stages[0].alpha_arg2 = 5;
+  state.stages[0].alpha_op = kOpSelectArg2;
+  EXPECT(!CanUseUbershader(state));
+  // Auto-generated texture coordinates.
+  state = supported;
+  state.stages[0].texcoord_index = 0x10000;
+  EXPECT(!CanUseUbershader(state));
+  state = supported;
+  state.alpha_func = 0;
+  EXPECT(!CanUseUbershader(state));
+  state.alpha_func = kCmpAlways + 1;
+  EXPECT(!CanUseUbershader(state));
+}
+
+}  // namespace
+}  // namespace Dx8to12
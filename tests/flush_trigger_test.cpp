@@ -0,0 +1,142 @@
+#include "utils/flush_trigger.h"
+
+#include <algorithm>
+#include <climits>
+#include <cstdint>
+#include <cstdio>
+#include <random>
+#include <unordered_map>
+#include <vector>
+
+#include "bench.h"
+#include "device_limits.h"
+#include "test.h"
+#include "utils/descriptor_bitmap.h"
+#include "utils/segmented_ring.h"
+
+namespace Dx8to12 {
+namespace {
+
+using Testing::SecondsPerRun;
+
+constexpr FlushWatermarks kWatermarks = {
+    .ring_bytes = kFlushRingBytesWatermark,
+    .recorded_commands = kFlushMaxRecordedCommands,
+    .min_free_samplers = kFlushMinFreeSamplers};
+
+TEST(FlushesAtEachWatermark) {
+  const FlushWatermarks watermarks = {
+      .ring_bytes = 1000, .recorded_commands = 10, .min_free_samplers = 8};
+  EXPECT(!GetFlushReasons(watermarks, 999, 9, 8).any());
+  const FlushReasons ring = GetFlushReasons(watermarks, 1000, 9, 8);
+  EXPECT(ring.ring && !ring.commands && !ring.samplers);
+  const FlushReasons commands = GetFlushReasons(watermarks, 0, 10, 8);
+  EXPECT(!commands.ring && commands.commands && !commands.samplers);
+  const FlushReasons samplers = GetFlushReasons(watermarks, 0, 0, 7);
+  EXPECT(!samplers.ring && !samplers.commands && samplers.samplers);
+  const FlushReasons all = GetFlushReasons(watermarks, 5000, 50, 0);
+  EXPECT(all.ring && all.commands && all.samplers);
+}
+
+struct RecordingResult {
+  int num_draws;
+  int ring_flushes;
+  int command_flushes;
+  int sampler_flushes;
+  // Largest total size of the ring's segments.
+  size_t peak_ring_size;
+};
+
+// A stand-in for Device's recording: every draw takes dynamic ring memory and
+// looks up samplers in a cache that never forgets, and MaybeFlushCommandList
+// decides whether the command list gets submitted first. The GPU finishes
+// each submission when the next one is made. Like FlushCommandList, running
+// out of samplers waits for the GPU and empties the cache.
+RecordingResult Record(const FlushWatermarks &watermarks, int num_frames,
+                       int draws_per_frame) {
+  std::mt19937 rng(1);
+  SegmentedRing ring(kDynamicRingBufferSize, 64 * 1024, 256,
+                     kDynamicRingBufferSegmentIdleFrames);
+  DescriptorBitmap samplers(kMaxSamplerStates);
+  std::unordered_map<uint32_t, int> sampler_cache;
+  std::vector<int> retired;
+  RecordingResult result = {};
+  int num_recorded_commands = 0;
+  auto submit = [&] {
+    ring.SetCurrentFrame(ring.current_frame() + 1);
+    ring.HasCompletedFrame(ring.current_frame() - 2, &retired);
+    num_recorded_commands = 0;
+  };
+  ring.SetCurrentFrame(1);
+  for (int frame = 0; frame < num_frames; ++frame) {
+    for (int draw = 0; draw < draws_per_frame; ++draw) {
+      const FlushReasons reasons =
+          GetFlushReasons(watermarks, ring.stats().frame_bytes,
+                          num_recorded_commands,
+                          samplers.size() - samplers.num_used());
+      if (reasons.any()) {
+        result.ring_flushes += reasons.ring;
+        result.command_flushes += reasons.commands;
+        result.sampler_flushes += reasons.samplers;
+        submit();
+        if (reasons.samplers) {
+          sampler_cache.clear();
+          samplers.FreeAll();
+        }
+      }
+      ++num_recorded_commands;
+      ++result.num_draws;
+      // Vertex and constant data, 256 bytes to 64 KiB.
+      bool new_segment;
+      ring.Allocate(256 << (rng() % 9), 256, &new_segment);
+      for (int stage = 0; stage < 2 + static_cast<int>(rng() % 3); ++stage) {
+        // Each frame brings a few new sampler states.
+        const uint32_t state = frame * 16 + rng() % 40;
+        if (!sampler_cache.count(state)) {
+          const int index = samplers.Allocate();
+          EXPECT(index >= 0);
+          sampler_cache[state] = index;
+        }
+      }
+      result.peak_ring_size =
+          std::max(result.peak_ring_size, ring.stats().total_size);
+    }
+    // Present.
+    submit();
+  }
+  return result;
+}
+
+TEST(FlushingBoundsTheRing) {
+  const RecordingResult flushed = Record(kWatermarks, 8, 10000);
+  EXPECT(flushed.ring_flushes > 0 && flushed.sampler_flushes > 0);
+  // The GPU lags a submission behind, so two watermarks' worth of draws can be
+  // in flight, plus the allocations that cross them.
+  EXPECT(flushed.peak_ring_size <= 2 * kDynamicRingBufferSize);
+  // Without the ring and command watermarks, the ring has to hold whole
+  // frames.
+  const FlushWatermarks samplers_only = {.ring_bytes = SIZE_MAX,
+                                         .recorded_commands = INT_MAX,
+                                         .min_free_samplers =
+                                             kFlushMinFreeSamplers};
+  const RecordingResult unflushed = Record(samplers_only, 8, 10000);
+  EXPECT(unflushed.ring_flushes == 0 && unflushed.command_flushes == 0);
+  EXPECT(unflushed.peak_ring_size > 4 * kDynamicRingBufferSize);
+}
+
+// Prints the flushes a heavy frame needs with the device's watermarks, and
+// what the check and the bookkeeping around it cost per draw.
+TEST(Throughput) {
+  RecordingResult result;
+  const double seconds =
+      SecondsPerRun([&] { result = Record(kWatermarks, 8, 10000); });
+  std::printf(
+      "  %d draws: %d ring, %d command and %d sampler flushes, peak ring "
+      "%.1f MB, %.1f ns per draw\n",
+      result.num_draws, result.ring_flushes, result.command_flushes,
+      result.sampler_flushes, result.peak_ring_size / 1e6,
+      seconds / result.num_draws * 1e9);
+}
+
+}  // namespace
+}  // namespace Dx8to12
@@ -0,0 +1,191 @@
+#include "utils/format_conversion.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+#include "bench.h"
+#include "test.h"
+#include "utils/cpu_features.h"
+
+namespace Dx8to12 {
+namespace {
+
+using Testing::SecondsPerRun;
+
+const FormatConversion kConversions[] = {
+    FormatConversion::kR8G8B8ToB8G8R8X8,
+    FormatConversion::kA4L4ToR8G8,
+    FormatConversion::kR3G3B2ToB8G8R8X8,
+    FormatConversion::kA8R3G3B2ToB8G8R8A8,
+    FormatConversion::kP8ToB8G8R8A8,
+};
+
+const char* Name(FormatConversion conversion) {
+  switch (conversion) {
+    case FormatConversion::kR8G8B8ToB8G8R8X8:
+      return "R8G8B8";
+    case FormatConversion::kA4L4ToR8G8:
+      return "A4L4";
+    case FormatConversion::kR3G3B2ToB8G8R8X8:
+      return "R3G3B2";
+    case FormatConversion::kA8R3G3B2ToB8G8R8A8:
+      return "A8R3G3B2";
+    case FormatConversion::kP8ToB8G8R8A8:
+      return "P8";
+    case FormatConversion::kNone:
+      break;
+  }
+  return "None";
+}
+
+std::vector<ConversionKernel> SupportedKernels() {
+  std::vector<ConversionKernel> kernels = {ConversionKernel::kScalar};
+  if (GetCpuFeatures().sse2) kernels.push_back(ConversionKernel::kSse2);
+  if (GetCpuFeatures().ssse3) kernels.push_back(ConversionKernel::kSsse3);
+  return kernels;
+}
+
+std::vector<uint32_t> RandomPalette(std::mt19937& rng) {
+  std::vector<uint32_t> palette(256);
+  for (uint32_t& color : palette) color = static_cast<uint32_t>(rng());
+  return palette;
+}
+
+// Converts into a destination filled with a marker byte, so that writes past
+// the end of a row show up.
+std::vector<uint8_t> Convert(ConversionKernel kernel,
+                             FormatConversion conversion,
+                             const std::vector<uint8_t>& src,
+                             size_t src_pitch, size_t dst_pitch,
+                             uint32_t width, uint32_t num_rows,
+                             const uint32_t* palette) {
+  std::vector<uint8_t> dst(dst_pitch * num_rows + 64, 0xcd);
+  ConvertRowsWith(kernel, conversion, dst.data(), dst_pitch, src.data(),
+                  src_pitch, width, num_rows, palette);
+  return dst;
+}
+
+TEST(TexelSizes) {
+  EXPECT(SourceTexelSize(FormatConversion::kR8G8B8ToB8G8R8X8) == 3);
+  EXPECT(SourceTexelSize(FormatConversion::kA8R3G3B2ToB8G8R8A8) == 2);
+  EXPECT(SourceTexelSize(FormatConversion::kA4L4ToR8G8) == 1);
+  EXPECT(DestTexelSize(FormatConversion::kA4L4ToR8G8) == 2);
+  EXPECT(DestTexelSize(FormatConversion::kP8ToB8G8R8A8) == 4);
+  EXPECT(SourceTexelSize(FormatConversion::kNone) == 0);
+}
+
+// Spot checks of the scalar reference, including bit replication.
+TEST(ScalarExpandsChannels) {
+  const uint8_t r8g8b8[] = {0x11, 0x22, 0x33};
+  uint32_t b8g8r8x8 = 0;
+  ConvertRowsWith(ConversionKernel::kScalar,
+                  FormatConversion::kR8G8B8ToB8G8R8X8, &b8g8r8x8, 4, r8g8b8,
+                  3, 1, 1, nullptr);
+  EXPECT(b8g8r8x8 == 0xFF332211);
+
+  const uint8_t a4l4 = 0x5A;
+  uint8_t r8g8[2] = {};
+  ConvertRowsWith(ConversionKernel::kScalar, FormatConversion::kA4L4ToR8G8,
+                  r8g8, 2, &a4l4, 1, 1, 1, nullptr);
+  EXPECT(r8g8[0] == 0xAA && r8g8[1] == 0x55);
+
+  // Red 7, green 0, blue 3.
+  const uint16_t a8r3g3b2 = 0x80E3;
+  uint32_t b8g8r8a8 = 0;
+  ConvertRowsWith(ConversionKernel::kScalar,
+                  FormatConversion::kA8R3G3B2ToB8G8R8A8, &b8g8r8a8, 4,
+                  &a8r3g3b2, 2, 1, 1, nullptr);
+  EXPECT(b8g8r8a8 == 0x80FF00FF);
+
+  const uint8_t index = 7;
+  std::vector<uint32_t> palette(256);
+  palette[7] = 0x12345678;
+  uint32_t color = 0;
+  ConvertRowsWith(ConversionKernel::kScalar, FormatConversion::kP8ToB8G8R8A8,
+                  &color, 4, &index, 1, 1, 1, palette.data());
+  EXPECT(color == 0x12345678);
+}
+
+TEST(BestKernelIsSupported) {
+  const ConversionKernel best = BestConversionKernel();
+  EXPECT(best != ConversionKernel::kSse2 || GetCpuFeatures().sse2);
+  EXPECT(best != ConversionKernel::kSsse3 || GetCpuFeatures().ssse3);
+}
+
+// Every supported kernel gives the same bytes as kScalar, for every width up
+// to a few vector lengths past the widest kernel (so every tail length), and
+// for compact, 256-byte aligned and odd pitches.
+TEST(KernelsMatchScalar) {
+  std::mt19937 rng(1);
+  const std::vector<uint32_t> palette = RandomPalette(rng);
+  for (const FormatConversion conversion : kConversions) {
+    const size_t src_texel = SourceTexelSize(conversion);
+    const size_t dst_texel = DestTexelSize(conversion);
+    for (uint32_t width = 1; width <= 69; ++width) {
+      const size_t dst_row = width * dst_texel;
+      for (const size_t dst_pitch :
+           {dst_row, (dst_row + 255) / 256 * 256, dst_row + 3}) {
+        // A8R3G3B2 reads 16-bit texels, which D3D8 pitches keep aligned.
+        const size_t src_pitch = width * src_texel + rng() % 4 * src_texel;
+        const uint32_t num_rows = 1 + rng() % 5;
+        std::vector<uint8_t> src(src_pitch * num_rows);
+        for (uint8_t& byte : src) byte = static_cast<uint8_t>(rng());
+
+        const std::vector<uint8_t> expected =
+            Convert(ConversionKernel::kScalar, conversion, src, src_pitch,
+                    dst_pitch, width, num_rows, palette.data());
+        for (const ConversionKernel kernel : SupportedKernels()) {
+          EXPECT(Convert(kernel, conversion, src, src_pitch, dst_pitch, width,
+                         num_rows, palette.data()) == expected);
+        }
+      }
+    }
+  }
+}
+
+TEST(ConvertRowsMatchesScalar) {
+  std::mt19937 rng(2);
+  const std::vector<uint32_t> palette = RandomPalette(rng);
+  std::vector<uint8_t> src(300 * 3 * 5);
+  for (uint8_t& byte : src) byte = static_cast<uint8_t>(rng());
+  for (const FormatConversion conversion : kConversions) {
+    std::vector<uint8_t> expected(1024 * 5, 0);
+    std::vector<uint8_t> actual(1024 * 5, 0);
+    const size_t src_pitch = 300 * SourceTexelSize(conversion);
+    ConvertRowsWith(ConversionKernel::kScalar, conversion, expected.data(),
+                    1024, src.data(), src_pitch, 250, 5, palette.data());
+    ConvertRows(conversion, actual.data(), 1024, src.data(), src_pitch, 250,
+                5, palette.data());
+    EXPECT(actual == expected);
+  }
+}
+
+// Prints the throughput of each kernel at 1024x1024.
+TEST(Throughput) {
+  constexpr uint32_t kSize = 1024;
+  std::mt19937 rng(3);
+  const std::vector<uint32_t> palette = RandomPalette(rng);
+  std::vector<uint8_t> src(kSize * kSize * 3);
+  for (uint8_t& byte : src) byte = static_cast<uint8_t>(rng());
+  std::vector<uint8_t> dst(kSize * kSize * 4);
+  const char* kernel_names[] = {"scalar", "sse2", "ssse3"};
+  for (const FormatConversion conversion : kConversions) {
+    std::printf("  %-9s", Name(conversion));
+    for (const ConversionKernel kernel : SupportedKernels()) {
+      const double seconds = SecondsPerRun([&] {
+        ConvertRowsWith(kernel, conversion, dst.data(),
+                        kSize * DestTexelSize(conversion), src.data(),
+                        kSize * SourceTexelSize(conversion), kSize, kSize,
+                        palette.data());
+      });
+      std::printf(" %s %6.0f MPix/s", kernel_names[static_cast<int>(kernel)],
+                  kSize * kSize / seconds / 1e6);
+    }
+    std::printf("\n");
+  }
+}
+
+}  // namespace
+}  // namespace Dx8to12
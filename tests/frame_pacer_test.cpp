@@ -0,0 +1,78 @@
+#include "utils/frame_pacer.h"
+
+#include <algorithm>
+#include <vector>
+
+#include "test.h"
+
+namespace Dx8to12 {
+namespace {
+
+TEST(CyclesThroughSlots) {
+  FramePacer pacer(3);
+  EXPECT(pacer.frames_in_flight() == 3);
+  EXPECT(pacer.current_slot() == 0);
+  // The first frames_in_flight frames have nothing to wait for.
+  EXPECT(pacer.EndFrame(1) == 0);
+  EXPECT(pacer.current_slot() == 1);
+  EXPECT(pacer.EndFrame(2) == 0);
+  EXPECT(pacer.current_slot() == 2);
+  // Then each slot waits for the last frame recorded into it.
+  EXPECT(pacer.EndFrame(3) == 1);
+  EXPECT(pacer.current_slot() == 0);
+  EXPECT(pacer.EndFrame(4) == 2);
+  EXPECT(pacer.fence_value(0) == 4);
+  EXPECT(pacer.fence_value(1) == 2);
+  EXPECT(pacer.fence_value(2) == 3);
+}
+
+TEST(OneFrameInFlightWaitsForEveryFrame) {
+  FramePacer pacer(1);
+  for (uint64_t frame = 1; frame <= 5; ++frame) {
+    EXPECT(pacer.EndFrame(frame) == frame);
+    EXPECT(pacer.current_slot() == 0);
+  }
+}
+
+TEST(FenceValuesMaySkip) {
+  // Frames that submit several command lists end with larger steps.
+  FramePacer pacer(2);
+  EXPECT(pacer.EndFrame(3) == 0);
+  EXPECT(pacer.EndFrame(7) == 3);
+  EXPECT(pacer.EndFrame(8) == 7);
+}
+
+// Runs frames against a stand-in GPU that executes them in order, each
+// taking gpu_ms once it is submitted and the previous one is done. Returns
+// the average time between frames.
+double FrameTime(int frames_in_flight, double cpu_ms, double gpu_ms) {
+  constexpr int kNumFrames = 500;
+  FramePacer pacer(frames_in_flight);
+  // done_at[v] is the time at which fence value v completes.
+  std::vector<double> done_at = {0.0};
+  double now = 0.0;
+  for (uint64_t frame = 1; frame <= kNumFrames; ++frame) {
+    // The slot being recorded into is never still in use by the GPU.
+    EXPECT(done_at[pacer.fence_value(pacer.current_slot())] <= now);
+    now += cpu_ms;
+    done_at.push_back(std::max(now, done_at.back()) + gpu_ms);
+    // The CPU is never more than frames_in_flight frames ahead.
+    const uint64_t wait = pacer.EndFrame(frame);
+    EXPECT(wait + frames_in_flight >= frame);
+    now = std::max(now, done_at[wait]);
+  }
+  return done_at.back() / kNumFrames;
+}
+
+TEST(MoreFramesInFlightOverlapCpuAndGpu) {
+  // A single frame in flight serializes the CPU and GPU.
+  EXPECT(FrameTime(1, 8.0, 8.0) > 15.9);
+  // Two are enough to hide the faster of the two.
+  EXPECT(FrameTime(2, 8.0, 8.0) < 8.1);
+  EXPECT(FrameTime(2, 4.0, 12.0) < 12.1);
+  EXPECT(FrameTime(2, 12.0, 4.0) < 12.1);
+  EXPECT(FrameTime(3, 4.0, 12.0) < 12.1);
+}
+
+}  // namespace
+}  // namespace Dx8to12
@@ -0,0 +1,127 @@
+#include "utils/pipeline_digest.h"
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "test.h"
+
+namespace Dx8to12 {
+namespace {
+
+// Backing storage for a PipelineFields, which only holds views.
+struct Pipeline {
+  std::string device_id = "10de:2484 rs=3";
+  std::string render_state = std::string("\x01\x00\x00\x00\x05\x00", 6);
+  std::vector<InputElementFields> input_elements = {
+      {"POSITION", 0, 6, 0, 0, 0, 0},
+      {"TEXCOORD", 1, 16, 1, 12, 1, 1},
+  };
+  std::string vs_bytecode = "DXBC vertex shader";
+  std::string ps_bytecode = "DXBC pixel shader";
+  uint32_t primitive_type = 3;
+  uint32_t rtv_format = 87;
+  uint32_t dsv_format = 45;
+
+  BlobCache::Key Digest() const {
+    return DigestPipeline({
+        .device_id = device_id,
+        .render_state = render_state,
+        .input_elements = input_elements,
+        .vs_bytecode = vs_bytecode,
+        .ps_bytecode = ps_bytecode,
+        .primitive_type = primitive_type,
+        .rtv_format = rtv_format,
+        .dsv_format = dsv_format,
+    });
+  }
+};
+
+// Keys persist across runs, so the digest of the same fields must never change
+// without a kPipelineDigestVersion bump. If this fails after an intended
+// change to the digest, bump the version and update the key.
+TEST(KeyIsStable) {
+  const BlobCache::Key key = Pipeline().Digest();
+  EXPECT(key.fnv_hash == 0xf61d231f7ecccc4c);
+  EXPECT(key.murmur_hash == 0xe3757c9a);
+  // The version, the device ID, the render states, the element count, 2
+  // elements of a name and 6 uint32s, both shaders and 3 formats. Strings are
+  // prefixed with their length.
+  EXPECT(key.size == 4 + (4 + 14) + (4 + 6) + 4 + 2 * (4 + 8 + 6 * 4) +
+                         (4 + 18) + (4 + 17) + 3 * 4);
+}
+
+TEST(EveryFieldChangesTheKey) {
+  const BlobCache::Key base = Pipeline().Digest();
+  const std::vector<std::function<void(Pipeline&)>> changes = {
+      [](Pipeline& p) { p.device_id[0] = '8'; },
+      [](Pipeline& p) { p.render_state[5] = 1; },
+      [](Pipeline& p) { p.render_state.pop_back(); },
+      [](Pipeline& p) { p.input_elements.pop_back(); },
+      [](Pipeline& p) { p.input_elements[1].semantic_name = "NORMAL"; },
+      [](Pipeline& p) { p.input_elements[1].semantic_index = 0; },
+      [](Pipeline& p) { p.input_elements[1].format = 2; },
+      [](Pipeline& p) { p.input_elements[1].input_slot = 2; },
+      [](Pipeline& p) { p.input_elements[1].aligned_byte_offset = 16; },
+      [](Pipeline& p) { p.input_elements[1].input_slot_class = 0; },
+      [](Pipeline& p) { p.input_elements[1].instance_data_step_rate = 2; },
+      [](Pipeline& p) { std::swap(p.input_elements[0], p.input_elements[1]); },
+      [](Pipeline& p) { p.vs_bytecode.back() = 'R'; },
+      [](Pipeline& p) { p.ps_bytecode.back() = 'R'; },
+      [](Pipeline& p) { p.ps_bytecode.clear(); },
+      [](Pipeline& p) { p.primitive_type = 4; },
+      [](Pipeline& p) { p.rtv_format = 28; },
+      [](Pipeline& p) { p.dsv_format = 40; },
+  };
+  std::vector<BlobCache::Key> keys = {base};
+  for (const auto& change : changes) {
+    Pipeline pipeline;
+    change(pipeline);
+    const BlobCache::Key key = pipeline.Digest();
+    for (const BlobCache::Key& other : keys) EXPECT(!(key == other));
+    keys.push_back(key);
+  }
+  EXPECT(Pipeline().Digest() == base);
+}
+
+// Parts are length-prefixed, so the same bytes split differently between
+// neighbouring parts give different keys.
+TEST(MovingBytesBetweenPartsChangesTheKey) {
+  Pipeline a;
+  a.vs_bytecode = "abcd";
+  a.ps_bytecode = "ef";
+  Pipeline b = a;
+  b.vs_bytecode = "abc";
+  b.ps_bytecode = "def";
+  EXPECT(!(a.Digest() == b.Digest()));
+
+  Pipeline c;
+  c.device_id = "ab";
+  c.render_state = "cd";
+  Pipeline d = c;
+  d.device_id = "abcd";
+  d.render_state.clear();
+  EXPECT(!(c.Digest() == d.Digest()));
+
+  // An empty shader isn't the same as no bytes moved into the next part.
+  Pipeline e;
+  e.vs_bytecode = "";
+  e.ps_bytecode = "xyz";
+  Pipeline f = e;
+  f.vs_bytecode = "xyz";
+  f.ps_bytecode = "";
+  EXPECT(!(e.Digest() == f.Digest()));
+
+  Pipeline g;
+  g.input_elements[0].semantic_name = "TEXCOORD";
+  g.input_elements[1].semantic_name = "";
+  Pipeline h = g;
+  h.input_elements[0].semantic_name = "";
+  h.input_elements[1].semantic_name = "TEXCOORD";
+  EXPECT(!(g.Digest() == h.Digest()));
+}
+
+}  // namespace
+}  // namespace Dx8to12
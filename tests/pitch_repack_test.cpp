@@ -0,0 +1,93 @@
+#include "utils/pitch_repack.h"
+
+#include <cstdint>
+#include <cstring>
+#include <random>
+#include <vector>
+
+#include "test.h"
+#include "utils/cpu_features.h"
+
+namespace Dx8to12 {
+namespace {
+
+std::vector<RepackKernel> SupportedKernels() {
+  std::vector<RepackKernel> kernels = {RepackKernel::kScalar};
+  if (GetCpuFeatures().sse2) kernels.push_back(RepackKernel::kSse2);
+  if (GetCpuFeatures().avx2) kernels.push_back(RepackKernel::kAvx2);
+  return kernels;
+}
+
+// Repacks into a destination filled with a marker byte, so that writes past
+// a row or before the start show up.
+std::vector<uint8_t> Repack(RepackKernel kernel,
+                            const std::vector<uint8_t>& src, size_t src_pitch,
+                            size_t dst_offset, size_t dst_pitch,
+                            size_t row_bytes, uint32_t num_rows) {
+  std::vector<uint8_t> dst(dst_offset + dst_pitch * num_rows + 64, 0xcd);
+  RepackRowsWith(kernel, dst.data() + dst_offset, dst_pitch, src.data(),
+                 src_pitch, row_bytes, num_rows);
+  return dst;
+}
+
+TEST(ScalarMatchesMemcpy) {
+  std::vector<uint8_t> src(10 * 7);
+  for (size_t i = 0; i < src.size(); ++i) src[i] = static_cast<uint8_t>(i);
+  const std::vector<uint8_t> dst =
+      Repack(RepackKernel::kScalar, src, 10, 0, 16, 7, 7);
+  for (uint32_t row = 0; row < 7; ++row) {
+    EXPECT(std::memcmp(&dst[row * 16], &src[row * 10], 7) == 0);
+    for (size_t i = 7; i < 16; ++i) EXPECT(dst[row * 16 + i] == 0xcd);
+  }
+}
+
+TEST(BestKernelIsSupported) {
+  const RepackKernel best = BestRepackKernel();
+  EXPECT(best != RepackKernel::kSse2 || GetCpuFeatures().sse2);
+  EXPECT(best != RepackKernel::kAvx2 || GetCpuFeatures().avx2);
+}
+
+// Every supported kernel gives the same bytes as kScalar, for narrow and wide
+// rows, aligned and unaligned destinations, and pitches that are and aren't
+// multiples of the vector width.
+TEST(KernelsMatchScalar) {
+  std::mt19937 rng(1);
+  const std::vector<size_t> row_sizes = {1,  2,  3,  4,  7,   8,   15,
+                                         16, 17, 31, 32, 33,  63,  64,
+                                         65, 100, 128, 255, 256, 1000, 4096};
+  for (const size_t row_bytes : row_sizes) {
+    for (const size_t dst_offset : {0, 1, 16, 32}) {
+      // Compact, 256-byte aligned like a D3D12 footprint, and unaligned.
+      const size_t aligned_pitch = (row_bytes + 255) / 256 * 256;
+      for (const size_t dst_pitch :
+           {row_bytes, aligned_pitch, aligned_pitch + 3}) {
+        const size_t src_pitch = row_bytes + rng() % 5;
+        const uint32_t num_rows = 1 + rng() % 9;
+        std::vector<uint8_t> src(src_pitch * num_rows);
+        for (uint8_t& byte : src) byte = static_cast<uint8_t>(rng());
+
+        const std::vector<uint8_t> expected =
+            Repack(RepackKernel::kScalar, src, src_pitch, dst_offset,
+                   dst_pitch, row_bytes, num_rows);
+        for (const RepackKernel kernel : SupportedKernels()) {
+          EXPECT(Repack(kernel, src, src_pitch, dst_offset, dst_pitch,
+                        row_bytes, num_rows) == expected);
+        }
+      }
+    }
+  }
+}
+
+TEST(RepackRowsMatchesScalar) {
+  std::vector<uint8_t> src(300 * 5);
+  for (size_t i = 0; i < src.size(); ++i) src[i] = static_cast<uint8_t>(i * 7);
+  std::vector<uint8_t> expected(512 * 5, 0);
+  std::vector<uint8_t> actual(512 * 5, 0);
+  RepackRowsWith(RepackKernel::kScalar, expected.data(), 512, src.data(), 300,
+                 300, 5);
+  RepackRows(actual.data(), 512, src.data(), 300, 300, 5);
+  EXPECT(actual == expected);
+}
+
+}  // namespace
+}  // namespace Dx8to12
@@ -0,0 +1,111 @@
+#include "utils/range_set.h"
+
+#include <random>
+#include <vector>
+
+#include "test.h"
+
+namespace Dx8to12 {
+namespace {
+
+using Range = RangeSet::Range;
+
+std::vector<Range> Ranges(const RangeSet& set) {
+  return std::vector<Range>(set.begin(), set.end());
+}
+
+TEST(InsertMergesOverlappingAndTouchingRanges) {
+  RangeSet set;
+  set.insert({.offset = 10, .size = 10});
+  set.insert({.offset = 30, .size = 10});
+  EXPECT(set.size() == 2);
+  // Touches the first range on the right.
+  set.insert({.offset = 20, .size = 5});
+  EXPECT((Ranges(set) == std::vector<Range>{{10, 15}, {30, 10}}));
+  // Bridges both.
+  set.insert({.offset = 22, .size = 10});
+  EXPECT((Ranges(set) == std::vector<Range>{{10, 30}}));
+  // Already covered.
+  set.insert({.offset = 12, .size = 3});
+  EXPECT((Ranges(set) == std::vector<Range>{{10, 30}}));
+}
+
+TEST(InsertIgnoresEmptyRanges) {
+  RangeSet set;
+  set.insert({.offset = 5, .size = 0});
+  set.insert({.offset = 5, .size = -3});
+  EXPECT(set.empty());
+}
+
+TEST(EraseTrimsAndSplitsRanges) {
+  RangeSet set;
+  set.insert({.offset = 0, .size = 100});
+  set.erase({.offset = 40, .size = 20});
+  EXPECT((Ranges(set) == std::vector<Range>{{0, 40}, {60, 40}}));
+  // Trims the end of one range and the start of the next.
+  set.erase({.offset = 30, .size = 40});
+  EXPECT((Ranges(set) == std::vector<Range>{{0, 30}, {70, 30}}));
+  // Covers a whole range exactly.
+  set.erase({.offset = 70, .size = 30});
+  EXPECT((Ranges(set) == std::vector<Range>{{0, 30}}));
+  set.erase({.offset = 0, .size = 30});
+  EXPECT(set.empty());
+}
+
+TEST(SubtractRemovesEveryRangeOfTheOther) {
+  RangeSet set;
+  set.insert({.offset = 0, .size = 64});
+  RangeSet other;
+  other.insert({.offset = 8, .size = 8});
+  other.insert({.offset = 32, .size = 40});
+  set.subtract(other);
+  EXPECT((Ranges(set) == std::vector<Range>{{0, 8}, {16, 16}}));
+}
+
+TEST(IteratesBothWays) {
+  RangeSet set;
+  set.insert({.offset = 1, .size = 1});
+  set.insert({.offset = 5, .size = 2});
+  auto iter = set.end();
+  --iter;
+  EXPECT((*iter == Range{5, 2}));
+  --iter;
+  EXPECT((*iter == Range{1, 1}));
+  EXPECT(iter == set.begin());
+}
+
+// Checks the set against a bitmap of the same bytes after random inserts and
+// erases.
+TEST(MatchesABitmap) {
+  constexpr int kSize = 256;
+  std::mt19937 rng(1);
+  for (int iteration = 0; iteration < 200; ++iteration) {
+    RangeSet set;
+    std::vector<bool> bytes(kSize, false);
+    for (int step = 0; step < 50; ++step) {
+      const int offset = static_cast<int>(rng() % kSize);
+      const int size = static_cast<int>(rng() % (kSize - offset + 1));
+      const bool insert = rng() % 3 != 0;
+      if (insert) {
+        set.insert({.offset = offset, .size = size});
+      } else {
+        set.erase({.offset = offset, .size = size});
+      }
+      for (int i = offset; i < offset + size; ++i) bytes[i] = insert;
+
+      std::vector<bool> covered(kSize, false);
+      int previous_end = -1;
+      for (const Range range : set) {
+        // Disjoint, sorted, and never touching.
+        EXPECT(range.size > 0 && range.offset > previous_end);
+        previous_end = range.offset + range.size;
+        for (int i = range.offset; i < previous_end; ++i) covered[i] = true;
+      }
+      EXPECT(covered == bytes);
+      for (int i = 0; i < kSize; ++i) EXPECT(set.contains(i) == bytes[i]);
+    }
+  }
+}
+
+}  // namespace
+}  // namespace Dx8to12
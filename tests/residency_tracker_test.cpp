@@ -0,0 +1,194 @@
+#include "utils/residency_tracker.h"
+
+#include <map>
+#include <random>
+#include <vector>
+
+#include "test.h"
+
+namespace Dx8to12 {
+namespace {
+
+// Owners are only compared, so any distinct pointers do.
+void* Owner(int index) {
+  static char owners[64];
+  return &owners[index];
+}
+
+TEST(EvictsLeastRecentlyUsedFirst) {
+  ResidencyTracker tracker(1000);
+  const int a = tracker.Add(Owner(0), 300, 1);
+  const int b = tracker.Add(Owner(1), 300, 1);
+  const int c = tracker.Add(Owner(2), 300, 2);
+  // a is now the most recently used.
+  tracker.MarkUsed(a, 3);
+  EXPECT(tracker.EvictToFit(400, 3) == std::vector<void*>{Owner(1)});
+  EXPECT(tracker.IsResident(a) && tracker.IsResident(c));
+  EXPECT(!tracker.IsResident(b));
+  EXPECT(tracker.available_bytes() == 400);
+  EXPECT(tracker.EvictToFit(700, 3) == std::vector<void*>{Owner(2)});
+  EXPECT(tracker.IsResident(a));
+}
+
+TEST(NeverEvictsWhatTheGpuMayStillUse) {
+  ResidencyTracker tracker(1000);
+  const int a = tracker.Add(Owner(0), 400, 1);
+  const int b = tracker.Add(Owner(1), 400, 5);
+  // Frame 5 hasn't completed, so only a can go.
+  std::vector<void*> evicted = tracker.EvictToFit(1000, 4);
+  EXPECT((evicted == std::vector<void*>{Owner(0)}));
+  EXPECT(tracker.IsResident(b));
+  // Marking a frame as used holds it back too.
+  tracker.MakeResident(a, 6);
+  EXPECT(tracker.EvictToFit(1000, 5) == std::vector<void*>{Owner(1)});
+  EXPECT(tracker.IsResident(a));
+  EXPECT(tracker.EvictToFit(1000, 6) == std::vector<void*>{Owner(0)});
+}
+
+TEST(EvictToFitOnlyEvictsWhatItHasTo) {
+  ResidencyTracker tracker(1000);
+  tracker.Add(Owner(0), 300, 1);
+  tracker.Add(Owner(1), 300, 1);
+  EXPECT(tracker.EvictToFit(400, 1).empty());
+  EXPECT(tracker.EvictToFit(401, 1).size() == 1);
+  // Evict with 0 bytes evicts everything that can go.
+  tracker.Add(Owner(2), 300, 2);
+  EXPECT(tracker.Evict(0, 1).size() == 1);
+  EXPECT(tracker.stats().num_resident == 1);
+}
+
+TEST(TracksResidentEvictedAndPinnedBytes) {
+  ResidencyTracker tracker(1000);
+  const int a = tracker.Add(Owner(0), 100, 1);
+  const int b = tracker.Add(Owner(1), 200, 1);
+  tracker.AddPinnedBytes(50);
+  ResidencyTracker::Stats stats = tracker.stats();
+  EXPECT(stats.resident_bytes == 300 && stats.pinned_bytes == 50);
+  EXPECT(tracker.available_bytes() == 650);
+
+  tracker.Evict(100, 1);
+  stats = tracker.stats();
+  EXPECT(stats.resident_bytes == 200 && stats.evicted_bytes == 100);
+  EXPECT(stats.num_resident == 1 && stats.num_evicted == 1);
+  EXPECT(stats.num_evictions == 1);
+
+  // Resizing counts against whichever side the allocation is on.
+  tracker.Resize(a, 150);
+  tracker.Resize(b, 250);
+  stats = tracker.stats();
+  EXPECT(stats.resident_bytes == 250 && stats.evicted_bytes == 150);
+
+  tracker.MakeResident(a, 2);
+  stats = tracker.stats();
+  EXPECT(stats.resident_bytes == 400 && stats.evicted_bytes == 0);
+  EXPECT(stats.num_evicted == 0);
+
+  tracker.Remove(b);
+  tracker.RemovePinnedBytes(50);
+  stats = tracker.stats();
+  EXPECT(stats.resident_bytes == 150 && stats.pinned_bytes == 0);
+  EXPECT(stats.num_resident == 1);
+  tracker.Evict(0, 2);
+  tracker.Remove(a);
+  stats = tracker.stats();
+  EXPECT(stats.evicted_bytes == 0 && stats.num_evicted == 0);
+  EXPECT(stats.num_resident == 0);
+}
+
+TEST(AvailableBytesClampsAtZero) {
+  ResidencyTracker tracker(1000);
+  const int a = tracker.Add(Owner(0), 800, 1);
+  tracker.AddPinnedBytes(100);
+  EXPECT(tracker.available_bytes() == 100);
+  // Growing never evicts, and may go over the budget.
+  tracker.Resize(a, 2000);
+  EXPECT(tracker.available_bytes() == 0);
+  tracker.AddPinnedBytes(5000);
+  EXPECT(tracker.available_bytes() == 0);
+}
+
+// Random adds, uses, resizes and removes against a fake fence that completes
+// frames a few behind the CPU. Checks the policy and the byte counts against
+// a simple model.
+TEST(RandomWorkloadKeepsItsInvariants) {
+  struct Model {
+    uint64_t num_bytes;
+    uint64_t last_used_frame;
+    bool resident;
+  };
+  constexpr uint64_t kBudget = 10000;
+  std::mt19937 rng(1);
+  ResidencyTracker tracker(kBudget);
+  std::map<int, Model> model;
+  std::map<void*, int> handles;
+  int next_owner = 0;
+  uint64_t frame = 1;
+  for (int step = 0; step < 20000; ++step) {
+    const uint64_t completed_frame = frame > 3 ? frame - 3 : 0;
+    switch (rng() % 6) {
+      case 0: {
+        if (next_owner == 64) break;
+        const uint64_t num_bytes = 1 + rng() % 2000;
+        const std::vector<void*> evicted =
+            tracker.EvictToFit(num_bytes, completed_frame);
+        for (void* owner : evicted) {
+          Model& entry = model.at(handles.at(owner));
+          EXPECT(entry.resident);
+          EXPECT(entry.last_used_frame <= completed_frame);
+          entry.resident = false;
+        }
+        void* owner = Owner(next_owner++);
+        const int handle = tracker.Add(owner, num_bytes, frame);
+        handles[owner] = handle;
+        model[handle] = {num_bytes, frame, true};
+        break;
+      }
+      case 1:
+      case 2: {
+        if (model.empty()) break;
+        auto it = std::next(model.begin(), rng() % model.size());
+        if (it->second.resident) {
+          tracker.MarkUsed(it->first, frame);
+        } else {
+          tracker.MakeResident(it->first, frame);
+          it->second.resident = true;
+        }
+        it->second.last_used_frame = frame;
+        break;
+      }
+      case 3: {
+        if (model.empty()) break;
+        auto it = std::next(model.begin(), rng() % model.size());
+        it->second.num_bytes = 1 + rng() % 2000;
+        tracker.Resize(it->first, it->second.num_bytes);
+        break;
+      }
+      case 4: {
+        if (model.empty() || rng() % 4 != 0) break;
+        auto it = std::next(model.begin(), rng() % model.size());
+        tracker.Remove(it->first);
+        model.erase(it);
+        break;
+      }
+      default:
+        ++frame;
+        break;
+    }
+
+    uint64_t resident_bytes = 0;
+    uint64_t evicted_bytes = 0;
+    for (const auto& [handle, entry] : model) {
+      EXPECT(tracker.IsResident(handle) == entry.resident);
+      (entry.resident ? resident_bytes : evicted_bytes) += entry.num_bytes;
+    }
+    const ResidencyTracker::Stats stats = tracker.stats();
+    EXPECT(stats.resident_bytes == resident_bytes);
+    EXPECT(stats.evicted_bytes == evicted_bytes);
+    EXPECT(tracker.available_bytes() ==
+           (resident_bytes >= kBudget ? 0 : kBudget - resident_bytes));
+    if (next_owner == 64 && model.empty()) next_owner = 0;
+  }
+}
+
+}  // namespace
+}  // namespace Dx8to12
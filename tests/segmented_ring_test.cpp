@@ -0,0 +1,242 @@
+#include "utils/segmented_ring.h"
+
+#include <algorithm>
+#include <map>
+#include <random>
+#include <vector>
+
+#include "test.h"
+
+namespace Dx8to12 {
+namespace {
+
+using Allocation = SegmentedRing::Allocation;
+
+constexpr size_t kSegmentAlignment = 4096;
+constexpr size_t kBaseSize = 4 * kSegmentAlignment;
+constexpr uint32_t kMinAlignment = 256;
+constexpr uint64_t kIdleFrames = 10;
+
+SegmentedRing MakeRing() {
+  SegmentedRing ring(kBaseSize, kSegmentAlignment, kMinAlignment,
+                     kIdleFrames);
+  ring.SetCurrentFrame(1);
+  return ring;
+}
+
+Allocation Allocate(SegmentedRing& ring, size_t num_bytes,
+                    uint32_t alignment = 1, bool* new_segment = nullptr) {
+  bool added = false;
+  const Allocation alloc = ring.Allocate(num_bytes, alignment, &added);
+  if (new_segment != nullptr) *new_segment = added;
+  return alloc;
+}
+
+// Moves to the next frame, and lets the GPU finish completed_frame.
+void NextFrame(SegmentedRing& ring, uint64_t completed_frame,
+               std::vector<int>* retired = nullptr) {
+  std::vector<int> ignored;
+  ring.SetCurrentFrame(ring.current_frame() + 1);
+  ring.HasCompletedFrame(completed_frame, retired ? retired : &ignored);
+}
+
+TEST(StartsWithOneAlignedSegment) {
+  SegmentedRing ring(kBaseSize - 100, kSegmentAlignment, kMinAlignment,
+                     kIdleFrames);
+  EXPECT(ring.num_slots() == 1 && ring.is_live(0));
+  EXPECT(ring.segment_size(0) == kBaseSize);
+  EXPECT(ring.stats().total_size == kBaseSize);
+  EXPECT(ring.stats().num_segments == 1);
+}
+
+TEST(AllocationsAreAligned) {
+  SegmentedRing ring = MakeRing();
+  const Allocation a = Allocate(ring, 10);
+  const Allocation b = Allocate(ring, 10);
+  const Allocation c = Allocate(ring, 10, 1024);
+  EXPECT(a.segment == 0 && a.offset == 0 && a.size == 10 && a.frame == 1);
+  EXPECT(b.offset == 256);
+  EXPECT(c.offset == 1024);
+}
+
+TEST(WrapsAroundOnceTheGpuIsDone) {
+  SegmentedRing ring = MakeRing();
+  const Allocation a = Allocate(ring, kBaseSize / 2);
+  NextFrame(ring, 0);
+  const Allocation b = Allocate(ring, kBaseSize / 4);
+  EXPECT(a.offset == 0 && b.offset == kBaseSize / 2);
+  NextFrame(ring, 1);
+  // Frame 1 is done, so its half of the segment is free again.
+  bool new_segment = true;
+  const Allocation c = Allocate(ring, kBaseSize / 2 - 1, 1, &new_segment);
+  EXPECT(!new_segment);
+  EXPECT(c.segment == 0);
+  // It doesn't fit after b, so it wraps to the start.
+  EXPECT(c.offset == 0);
+}
+
+// The tail may never catch up with the head, since head == tail means empty.
+TEST(TailNeverCatchesUpWithTheHead) {
+  SegmentedRing ring = MakeRing();
+  Allocate(ring, kBaseSize / 2);
+  NextFrame(ring, 0);
+  Allocate(ring, kBaseSize / 2);
+  NextFrame(ring, 1);
+  // Frame 2 still holds [kBaseSize / 2, kBaseSize). Exactly filling the free
+  // half would make tail == head.
+  bool new_segment = false;
+  const Allocation a = Allocate(ring, kBaseSize / 2, 1, &new_segment);
+  EXPECT(new_segment && a.segment == 1);
+  const Allocation b = Allocate(ring, kBaseSize / 2 - 256, 1, &new_segment);
+  EXPECT(!new_segment && b.segment == 0 && b.offset == 0);
+}
+
+TEST(ReusesTheSegmentOnceEveryFrameIsDone) {
+  SegmentedRing ring = MakeRing();
+  Allocate(ring, kBaseSize - 256);
+  NextFrame(ring, 0);
+  NextFrame(ring, 2);
+  bool new_segment = true;
+  const Allocation a = Allocate(ring, kBaseSize / 2, 1, &new_segment);
+  EXPECT(!new_segment && a.offset == 0);
+}
+
+TEST(GrowsWhenFull) {
+  SegmentedRing ring = MakeRing();
+  bool new_segment = false;
+  Allocate(ring, kBaseSize, 1, &new_segment);
+  EXPECT(!new_segment);
+  const Allocation a = Allocate(ring, 1, 1, &new_segment);
+  EXPECT(new_segment && a.segment == 1 && a.offset == 0);
+  EXPECT(ring.segment_size(1) == kBaseSize);
+  // Allocations larger than a segment get a segment of their own.
+  const Allocation big = Allocate(ring, 3 * kBaseSize, 1, &new_segment);
+  EXPECT(new_segment && big.segment == 2 && big.offset == 0);
+  EXPECT(ring.segment_size(2) ==
+         (3 * kBaseSize + kMinAlignment + kSegmentAlignment - 1) /
+             kSegmentAlignment * kSegmentAlignment);
+  const SegmentedRing::Stats stats = ring.stats();
+  EXPECT(stats.num_segments == 3);
+  EXPECT(stats.total_size == 2 * kBaseSize + ring.segment_size(2));
+  EXPECT(stats.frame_bytes == 4 * kBaseSize + 1);
+}
+
+// A segment added mid-frame holds the rest of that frame until it completes.
+TEST(SegmentsAddedMidFrameKeepTheirFrame) {
+  SegmentedRing ring = MakeRing();
+  NextFrame(ring, 0);
+  Allocate(ring, kBaseSize);
+  const Allocation a = Allocate(ring, kBaseSize / 2);
+  EXPECT(a.segment == 1);
+  NextFrame(ring, 1);
+  // Frame 2 hasn't completed, so a can't be overwritten.
+  const Allocation b = Allocate(ring, kBaseSize / 2 - 256);
+  EXPECT(b.segment == 1 && b.offset == kBaseSize / 2);
+}
+
+TEST(RetiresIdleSegments) {
+  SegmentedRing ring = MakeRing();
+  Allocate(ring, kBaseSize);
+  Allocate(ring, kBaseSize);
+  Allocate(ring, kBaseSize);
+  EXPECT(ring.num_slots() == 3);
+  std::vector<int> retired;
+  // Frames 2 to kIdleFrames use only the first segment.
+  for (uint64_t frame = 1; frame < kIdleFrames; ++frame) {
+    NextFrame(ring, frame, &retired);
+    Allocate(ring, 1);
+    EXPECT(retired.empty());
+  }
+  NextFrame(ring, kIdleFrames, &retired);
+  EXPECT((retired == std::vector<int>{1, 2}));
+  EXPECT(ring.num_slots() == 1 && ring.is_live(0));
+  EXPECT(ring.stats().num_segments == 1);
+  EXPECT(ring.stats().high_water_bytes == 3 * kBaseSize);
+}
+
+TEST(NeverRetiresWhatTheGpuMayStillUse) {
+  SegmentedRing ring = MakeRing();
+  Allocate(ring, kBaseSize);
+  Allocate(ring, 1);
+  std::vector<int> retired;
+  // The GPU is stuck on frame 0, so segment 1 stays however idle it gets.
+  for (uint64_t frame = 1; frame < 3 * kIdleFrames; ++frame) {
+    NextFrame(ring, 0, &retired);
+  }
+  EXPECT(retired.empty() && ring.is_live(1));
+  NextFrame(ring, 1, &retired);
+  EXPECT(retired == std::vector<int>{1});
+}
+
+// The first segment stays, and retired slots in the middle are reused so that
+// indices of other segments don't move.
+TEST(ReusesRetiredSlots) {
+  SegmentedRing ring = MakeRing();
+  Allocate(ring, kBaseSize);
+  Allocate(ring, kBaseSize);
+  Allocate(ring, 3 * kBaseSize);
+  EXPECT(ring.num_slots() == 3);
+  std::vector<int> retired;
+  // From here on, only segment 2 is large enough.
+  for (uint64_t frame = 1; frame <= kIdleFrames; ++frame) {
+    NextFrame(ring, frame, &retired);
+    EXPECT(Allocate(ring, kBaseSize + 1).segment == 2);
+  }
+  EXPECT(retired == std::vector<int>{1});
+  EXPECT(ring.is_live(0) && !ring.is_live(1) && ring.is_live(2));
+  EXPECT(ring.num_slots() == 3);
+  bool new_segment = false;
+  const Allocation a = Allocate(ring, 4 * kBaseSize, 1, &new_segment);
+  EXPECT(new_segment && a.segment == 1);
+}
+
+// Random allocations with a GPU that finishes frames a few behind the CPU. No
+// allocation may overlap one from a frame the GPU may still be reading.
+TEST(RandomWorkloadNeverOverlapsInFlightData) {
+  struct Range {
+    uint64_t frame;
+    size_t begin;
+    size_t end;
+  };
+  std::mt19937 rng(1);
+  SegmentedRing ring = MakeRing();
+  std::map<int, std::vector<Range>> in_flight;
+  uint64_t completed_frame = 0;
+  for (int step = 0; step < 20000; ++step) {
+    if (rng() % 8 == 0) {
+      const uint64_t lag = rng() % 4;
+      const uint64_t frame = ring.current_frame();
+      completed_frame = std::max(completed_frame, frame > lag ? frame - lag
+                                                              : 0);
+      std::vector<int> retired;
+      ring.SetCurrentFrame(frame + 1);
+      ring.HasCompletedFrame(completed_frame, &retired);
+      for (auto& [segment, ranges] : in_flight) {
+        std::erase_if(ranges, [&](const Range& range) {
+          return range.frame <= completed_frame;
+        });
+      }
+      for (const int segment : retired) EXPECT(in_flight[segment].empty());
+      continue;
+    }
+    const size_t num_bytes = 1 + rng() % (rng() % 16 == 0 ? 2 * kBaseSize
+                                                           : kBaseSize / 8);
+    const uint32_t alignment = 1u << (rng() % 12);
+    bool new_segment = false;
+    const Allocation alloc = ring.Allocate(num_bytes, alignment, &new_segment);
+    EXPECT(ring.is_live(alloc.segment));
+    EXPECT(alloc.offset % std::max(alignment, kMinAlignment) == 0);
+    EXPECT(alloc.offset + num_bytes <= ring.segment_size(alloc.segment));
+    std::vector<Range>& ranges = in_flight[alloc.segment];
+    if (new_segment) EXPECT(ranges.empty());
+    const Range range = {ring.current_frame(), size_t(alloc.offset),
+                         alloc.offset + num_bytes};
+    for (const Range& other : ranges) {
+      EXPECT(range.end <= other.begin || other.end <= range.begin);
+    }
+    ranges.push_back(range);
+  }
+}
+
+}  // namespace
+}  // namespace Dx8to12
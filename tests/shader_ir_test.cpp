@@ -0,0 +1,474 @@
+#include "utils/shader_ir.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstring>
+#include <map>
+#include <random>
+#include <utility>
+#include <vector>
+
+#include "test.h"
+
+namespace Dx8to12 {
+namespace {
+
+using namespace ShaderToken;
+using Vector = std::array<float, 4>;
+
+constexpr uint32_t kVertexShader11 = 0xfffe0101;
+constexpr uint32_t kPixelShader11 = 0xffff0101;
+constexpr uint32_t kSwizzleIdentity = 0xe4;
+constexpr uint32_t kSwizzleX = 0x00;
+
+uint32_t Dst(uint32_t type, int number, uint32_t write_mask = 0xf,
+             bool saturate = false) {
+  return 0x80000000u | (type << kRegTypeShift) | number |
+         (write_mask << kWriteMaskShift) | (saturate ? kDstModSaturate : 0);
+}
+
+uint32_t Src(uint32_t type, int number, uint32_t swizzle = kSwizzleIdentity,
+             bool negate = false, bool relative = false) {
+  return 0x80000000u | (type << kRegTypeShift) | number |
+         (swizzle << kSwizzleShift) | (negate ? kSrcModNeg : 0) |
+         (relative ? kAddrModeRelative : 0);
+}
+
+uint32_t FloatBits(float value) {
+  uint32_t bits;
+  std::memcpy(&bits, &value, sizeof(bits));
+  return bits;
+}
+
+int NumSources(uint32_t opcode) {
+  switch (opcode) {
+    case kOpTex:
+      return 0;
+    case kOpMov:
+    case kOpRcp:
+    case kOpRsq:
+      return 1;
+    case kOpMad:
+    case kOpLrp:
+      return 3;
+    default:
+      return 2;
+  }
+}
+
+// Registers, constants and inputs of a shader being interpreted.
+struct Machine {
+  std::map<std::pair<uint32_t, int>, Vector> registers;
+  std::array<Vector, 16> constants = {};
+  std::array<Vector, 4> inputs = {};
+  // What tex reads into each texture register.
+  std::array<Vector, 4> textures = {};
+
+  Vector& Register(uint32_t type, int number) {
+    return registers[{type, number}];
+  }
+  int AddressOffset() {
+    return static_cast<int>(std::floor(Register(kRegAddr, 0)[0]));
+  }
+};
+
+Vector Apply(uint32_t opcode, const Vector& a, const Vector& b,
+             const Vector& c) {
+  Vector result = {};
+  if (opcode == kOpDp3 || opcode == kOpDp4) {
+    float sum = 0.0f;
+    for (int i = 0; i < (opcode == kOpDp3 ? 3 : 4); ++i) sum += a[i] * b[i];
+    result.fill(sum);
+    return result;
+  }
+  for (int i = 0; i < 4; ++i) {
+    switch (opcode) {
+      case kOpMov:
+        result[i] = a[i];
+        break;
+      case kOpAdd:
+        result[i] = a[i] + b[i];
+        break;
+      case kOpSub:
+        result[i] = a[i] - b[i];
+        break;
+      case kOpMad:
+        result[i] = a[i] * b[i] + c[i];
+        break;
+      case kOpMul:
+        result[i] = a[i] * b[i];
+        break;
+      case kOpRcp:
+        result[i] = 1.0f / a[i];
+        break;
+      case kOpRsq:
+        result[i] = 1.0f / std::sqrt(a[i]);
+        break;
+      case kOpMin:
+        result[i] = std::min(a[i], b[i]);
+        break;
+      case kOpMax:
+        result[i] = std::max(a[i], b[i]);
+        break;
+      case kOpSge:
+        result[i] = a[i] >= b[i] ? 1.0f : 0.0f;
+        break;
+      case kOpLrp:
+        result[i] = a[i] * b[i] + (1.0f - a[i]) * c[i];
+        break;
+      default:
+        EXPECT(false);
+        break;
+    }
+  }
+  return result;
+}
+
+void Write(Machine* machine, const ShaderRegister& dest, uint32_t write_mask,
+           bool saturate, Vector result) {
+  if (saturate) {
+    for (float& value : result) value = std::clamp(value, 0.0f, 1.0f);
+  }
+  Vector& reg = machine->Register(dest.type, dest.number);
+  for (int i = 0; i < 4; ++i) {
+    if (write_mask & (1 << i)) reg[i] = result[i];
+  }
+}
+
+// Runs a token stream the way D3D8 specifies it, independently of
+// DecodeShader.
+void RunTokens(const std::vector<uint32_t>& tokens, Machine* machine) {
+  std::map<int, Vector> defs;
+  for (size_t pos = 1;;) {
+    const uint32_t token = tokens[pos++];
+    const uint32_t opcode = token & kOpcodeMask;
+    if (opcode == kOpEnd) break;
+    if (opcode == kOpComment) {
+      pos += (token & kCommentSizeMask) >> kCommentSizeShift;
+      continue;
+    }
+    if (opcode == kOpDef) {
+      Vector value;
+      std::memcpy(&value, &tokens[pos + 1], sizeof(value));
+      defs[tokens[pos] & kRegNumMask] = value;
+      pos += 5;
+      continue;
+    }
+    const uint32_t dst = tokens[pos++];
+    std::array<Vector, 3> sources = {};
+    for (int s = 0; s < NumSources(opcode); ++s) {
+      const uint32_t src = tokens[pos++];
+      const uint32_t type = (src & kRegTypeMask) >> kRegTypeShift;
+      int number = src & kRegNumMask;
+      Vector raw;
+      if (type == kRegConst && (src & kAddrModeRelative)) {
+        raw = machine->constants[number + machine->AddressOffset()];
+      } else if (type == kRegConst) {
+        raw = defs.contains(number) ? defs[number]
+                                    : machine->constants[number];
+      } else if (type == kRegInput) {
+        raw = machine->inputs[number];
+      } else {
+        raw = machine->Register(type, number);
+      }
+      for (int i = 0; i < 4; ++i) {
+        const float value = raw[(src >> (kSwizzleShift + 2 * i)) & 3];
+        sources[s][i] = (src & kSrcModNeg) ? -value : value;
+      }
+    }
+    const ShaderRegister dest = {
+        .type = (dst & kRegTypeMask) >> kRegTypeShift,
+        .number = static_cast<int>(dst & kRegNumMask)};
+    Write(machine, dest, (dst & kWriteMaskAll) >> kWriteMaskShift,
+          (dst & kDstModSaturate) != 0,
+          opcode == kOpTex
+              ? machine->textures[dest.number]
+              : Apply(opcode, sources[0], sources[1], sources[2]));
+  }
+}
+
+void RunProgram(const ShaderProgram& program, Machine* machine) {
+  for (const ShaderInstruction& inst : program.instructions) {
+    if (inst.opcode == kOpNop) continue;
+    std::array<Vector, 3> sources = {};
+    for (int s = 0; s < inst.num_sources; ++s) {
+      const ShaderSource& src = inst.sources[s];
+      if (src.is_literal) {
+        sources[s] = src.literal;
+        continue;
+      }
+      Vector raw;
+      if (src.reg.type == kRegConst) {
+        raw = machine->constants[src.reg.number +
+                                 (src.relative ? machine->AddressOffset() : 0)];
+      } else if (src.reg.type == kRegInput) {
+        raw = machine->inputs[src.reg.number];
+      } else {
+        raw = machine->Register(src.reg.type, src.reg.number);
+      }
+      for (int i = 0; i < 4; ++i) {
+        const float value = raw[src.swizzle[i]];
+        sources[s][i] = src.negate ? -value : value;
+      }
+    }
+    Write(machine, inst.dest, inst.write_mask, inst.saturate,
+          inst.opcode == kOpTex
+              ? machine->textures[inst.dest.number]
+              : Apply(inst.opcode, sources[0], sources[1], sources[2]));
+  }
+}
+
+bool Same(float a, float b) {
+  if (std::isnan(a) && std::isnan(b)) return true;
+  return a == b || std::fabs(a - b) <= 1e-5f * std::max(1.0f, std::fabs(a));
+}
+
+// A random vs_1_1 or ps_1_1 token stream, with the mix of registers,
+// swizzles, modifiers, defs, comments and relative addressing that the
+// passes have to get right.
+class RandomShader {
+ public:
+  explicit RandomShader(std::mt19937* rng) : rng_(*rng) {}
+
+  std::vector<uint32_t> Generate(bool is_pixel_shader) {
+    is_pixel_shader_ = is_pixel_shader;
+    has_address_ = false;
+    std::vector<uint32_t> tokens = {is_pixel_shader ? kPixelShader11
+                                                    : kVertexShader11};
+    if (is_pixel_shader) {
+      for (int number = 0; number < 3; ++number) {
+        if (Random(2) == 0) continue;
+        tokens.push_back(kOpDef);
+        tokens.push_back(Dst(kRegConst, number));
+        for (int i = 0; i < 4; ++i) {
+          tokens.push_back(FloatBits(std::round(RandomFloat() * 4) / 4));
+        }
+      }
+    }
+    if (Random(4) == 0) {
+      tokens.insert(tokens.end(),
+                    {(2u << kCommentSizeShift) | kOpComment, 0x41414141, 0});
+    }
+    static constexpr uint32_t kOpcodes[] = {
+        kOpMov, kOpMov, kOpMov, kOpAdd, kOpSub, kOpMad, kOpMul, kOpRcp,
+        kOpRsq, kOpDp3, kOpDp4, kOpMin, kOpMax, kOpSge, kOpLrp};
+    for (int length = 1 + Random(14); length > 0; --length) {
+      if (!is_pixel_shader && Random(10) == 0) {
+        // mov a0.x, c7.x, which the test sets to an integer.
+        tokens.insert(tokens.end(), {kOpMov, Dst(kRegAddr, 0, 0x1),
+                                     Src(kRegConst, 7, kSwizzleX)});
+        has_address_ = true;
+        continue;
+      }
+      if (is_pixel_shader && Random(6) == 0) {
+        tokens.insert(tokens.end(), {kOpTex, Dst(kRegAddr, Random(2))});
+        continue;
+      }
+      const uint32_t opcode = kOpcodes[Random(std::size(kOpcodes))];
+      const uint32_t write_mask = Random(2) == 0 ? 0xf : 1 + Random(15);
+      tokens.push_back(opcode);
+      tokens.push_back(RandomDest(write_mask, Random(5) == 0));
+      for (int s = 0; s < NumSources(opcode); ++s) {
+        tokens.push_back(RandomSource());
+      }
+    }
+    tokens.push_back(kOpEnd);
+    return tokens;
+  }
+
+  int Random(size_t n) { return static_cast<int>(rng_() % n); }
+  float RandomFloat() {
+    return std::uniform_real_distribution<float>(-2.0f, 2.0f)(rng_);
+  }
+
+ private:
+  uint32_t RandomDest(uint32_t write_mask, bool saturate) {
+    if (is_pixel_shader_ || Random(3) != 0) {
+      return Dst(kRegTemp, Random(4), write_mask, saturate);
+    }
+    switch (Random(4)) {
+      case 0:
+        return Dst(kRegRastOut, kRastOutPosition, write_mask, saturate);
+      case 1:
+        return Dst(kRegRastOut, kRastOutFog, write_mask, saturate);
+      case 2:
+        return Dst(kRegAttrOut, Random(2), write_mask, saturate);
+      default:
+        return Dst(kRegTexCoordOut, Random(4), write_mask, saturate);
+    }
+  }
+
+  uint32_t RandomSource() {
+    const uint32_t swizzle =
+        Random(3) != 0 ? kSwizzleIdentity : static_cast<uint32_t>(Random(256));
+    const bool negate = Random(4) == 0;
+    switch (Random(is_pixel_shader_ ? 4 : 5)) {
+      case 0:
+        return Src(kRegTemp, Random(4), swizzle, negate);
+      case 1:
+        return Src(kRegInput, Random(4), swizzle, negate);
+      case 2:
+        return Src(kRegConst, Random(6), swizzle, negate);
+      case 3:
+        return is_pixel_shader_ ? Src(kRegAddr, Random(2), swizzle, negate)
+                                : Src(kRegTemp, Random(4), swizzle, negate);
+      default:
+        return has_address_
+                   ? Src(kRegConst, Random(4), swizzle, negate, true)
+                   : Src(kRegConst, Random(6), swizzle, negate);
+    }
+  }
+
+  std::mt19937& rng_;
+  bool is_pixel_shader_ = false;
+  bool has_address_ = false;
+};
+
+// The outputs that OptimizeShader has to keep, with their live components.
+std::vector<std::pair<ShaderRegister, uint32_t>> CheckedOutputs(
+    bool is_pixel_shader, const LiveOutputs& outputs) {
+  if (is_pixel_shader) return {{{.type = kRegTemp, .number = 0}, 0xf}};
+  std::vector<std::pair<ShaderRegister, uint32_t>> checked = {
+      {{.type = kRegRastOut, .number = kRastOutPosition}, outputs.position},
+      {{.type = kRegRastOut, .number = kRastOutFog}, outputs.fog},
+      {{.type = kRegAttrOut, .number = 0}, outputs.colors[0]},
+      {{.type = kRegAttrOut, .number = 1}, outputs.colors[1]}};
+  for (int i = 0; i < 8; ++i) {
+    checked.push_back(
+        {{.type = kRegTexCoordOut, .number = i}, outputs.texcoords[i]});
+  }
+  return checked;
+}
+
+// Decoded and optimized programs compute the same live outputs as the token
+// stream they came from, for random shaders and inputs.
+TEST(OptimizedShadersMatchTheTokenStream) {
+  std::mt19937 rng(1);
+  RandomShader generator(&rng);
+  int num_decoded = 0;
+  int num_optimized = 0;
+  for (int iteration = 0; iteration < 5000; ++iteration) {
+    const bool is_pixel_shader = generator.Random(2) == 0;
+    const std::vector<uint32_t> tokens = generator.Generate(is_pixel_shader);
+    LiveOutputs outputs;
+    if (generator.Random(2) == 0) {
+      outputs.texcoords.fill(0x3);
+      outputs.colors[1] = generator.Random(16);
+    }
+    const ShaderProgram decoded = DecodeShader(tokens.data());
+    EXPECT(decoded.is_pixel_shader == is_pixel_shader);
+    ShaderProgram optimized = decoded;
+    OptimizeShader(&optimized, outputs);
+    num_decoded += decoded.CountInstructions();
+    num_optimized += optimized.CountInstructions();
+    EXPECT(optimized.CountInstructions() <= decoded.CountInstructions());
+    EXPECT(!EmitShaderHlsl(optimized).empty() ||
+           optimized.CountInstructions() == 0);
+
+    for (int trial = 0; trial < 4; ++trial) {
+      Machine reference;
+      for (Vector& constant : reference.constants) {
+        for (float& value : constant) value = generator.RandomFloat();
+      }
+      reference.constants[7][0] = static_cast<float>(generator.Random(4));
+      for (Vector& input : reference.inputs) {
+        for (float& value : input) value = generator.RandomFloat();
+      }
+      for (Vector& texture : reference.textures) {
+        for (float& value : texture) {
+          value = generator.RandomFloat() * 0.5f + 0.5f;
+        }
+      }
+      Machine decoded_machine = reference;
+      Machine optimized_machine = reference;
+      RunTokens(tokens, &reference);
+      RunProgram(decoded, &decoded_machine);
+      RunProgram(optimized, &optimized_machine);
+      for (const auto& [reg, mask] :
+           CheckedOutputs(is_pixel_shader, outputs)) {
+        for (int i = 0; i < 4; ++i) {
+          if ((mask & (1 << i)) == 0) continue;
+          const float expected = reference.Register(reg.type, reg.number)[i];
+          EXPECT(Same(expected,
+                      decoded_machine.Register(reg.type, reg.number)[i]));
+          EXPECT(Same(expected,
+                      optimized_machine.Register(reg.type, reg.number)[i]));
+        }
+      }
+    }
+  }
+  // The passes do find something to remove.
+  EXPECT(num_optimized < num_decoded);
+}
+
+TEST(DecodeTurnsDefsIntoLiterals) {
+  const std::vector<uint32_t> tokens = {
+      kPixelShader11,
+      kOpDef, Dst(kRegConst, 0), FloatBits(0.5f), FloatBits(0.25f),
+      FloatBits(1.0f), FloatBits(0.0f),
+      kOpMov, Dst(kRegTemp, 0), Src(kRegConst, 0, 0x1b, true),
+      kOpEnd};
+  const ShaderProgram program = DecodeShader(tokens.data());
+  EXPECT(program.is_pixel_shader);
+  EXPECT(program.CountInstructions() == 1);
+  const ShaderSource& source = program.instructions[0].sources[0];
+  EXPECT(source.is_literal);
+  EXPECT((source.literal == Vector{-0.0f, -1.0f, -0.25f, -0.5f}));
+}
+
+TEST(PropagateCopiesComposesSwizzles) {
+  const std::vector<uint32_t> tokens = {
+      kVertexShader11,
+      // mov r0, v0.wzyx
+      kOpMov, Dst(kRegTemp, 0), Src(kRegInput, 0, 0x1b),
+      // add oPos, r0.xxyy, c0
+      kOpAdd, Dst(kRegRastOut, kRastOutPosition), Src(kRegTemp, 0, 0x50),
+      Src(kRegConst, 0),
+      kOpEnd};
+  ShaderProgram program = DecodeShader(tokens.data());
+  PropagateCopies(&program);
+  const ShaderSource& source = program.instructions[1].sources[0];
+  EXPECT((source.reg == ShaderRegister{.type = kRegInput, .number = 0}));
+  EXPECT((source.swizzle == std::array<uint8_t, 4>{3, 3, 2, 2}));
+}
+
+TEST(FoldConstantsEvaluatesLiteralInstructions) {
+  const std::vector<uint32_t> tokens = {
+      kPixelShader11,
+      kOpDef, Dst(kRegConst, 0), FloatBits(0.5f), FloatBits(0.25f),
+      FloatBits(1.0f), FloatBits(0.0f),
+      kOpDef, Dst(kRegConst, 1), FloatBits(2.0f), FloatBits(2.0f),
+      FloatBits(2.0f), FloatBits(1.0f),
+      kOpMul, Dst(kRegTemp, 1), Src(kRegConst, 0), Src(kRegConst, 1),
+      kOpAdd, Dst(kRegTemp, 0), Src(kRegTemp, 1), Src(kRegInput, 0),
+      kOpEnd};
+  ShaderProgram program = DecodeShader(tokens.data());
+  FoldConstants(&program);
+  const ShaderInstruction& folded = program.instructions[0];
+  EXPECT(folded.opcode == kOpMov && folded.sources[0].is_literal);
+  EXPECT((folded.sources[0].literal == Vector{1.0f, 0.5f, 2.0f, 0.0f}));
+  // The add reads the folded value as a literal.
+  EXPECT(program.instructions[1].sources[0].is_literal);
+}
+
+TEST(RemoveDeadCodeNarrowsWriteMasks) {
+  const std::vector<uint32_t> tokens = {
+      kVertexShader11,
+      kOpMov, Dst(kRegTemp, 0), Src(kRegInput, 0),
+      // Dead: r1 is never read.
+      kOpMov, Dst(kRegTemp, 1), Src(kRegInput, 1),
+      kOpMov, Dst(kRegTexCoordOut, 0), Src(kRegTemp, 0),
+      kOpEnd};
+  LiveOutputs outputs;
+  outputs.texcoords[0] = 0x3;
+  ShaderProgram program = DecodeShader(tokens.data());
+  RemoveDeadCode(&program, outputs);
+  EXPECT(program.CountInstructions() == 2);
+  EXPECT(program.instructions[0].write_mask == 0x3);
+  EXPECT(program.instructions[1].opcode == kOpNop);
+  EXPECT(program.instructions[2].write_mask == 0x3);
+}
+
+}  // namespace
+}  // namespace Dx8to12
@@ -0,0 +1,124 @@
+#include "utils/size_class_allocator.h"
+
+#include <iterator>
+#include <map>
+#include <random>
+#include <utility>
+#include <vector>
+
+#include "test.h"
+
+namespace Dx8to12 {
+namespace {
+
+using Allocation = SizeClassAllocator::Allocation;
+
+constexpr int kMinSize = 256;
+constexpr int kMaxSize = 16 * 1024;
+constexpr int kPageSize = 64 * 1024;
+constexpr int kBlockSize = 4 * kPageSize;
+
+TEST(RoundsUpToTheSizeClass) {
+  SizeClassAllocator allocator(kMinSize, kMaxSize, kPageSize, kBlockSize);
+  bool new_block = false;
+  const Allocation small = allocator.Allocate(1, &new_block);
+  EXPECT(new_block && allocator.num_blocks() == 1);
+  EXPECT(allocator.ClassSize(small.size_class) == kMinSize);
+  const Allocation exact = allocator.Allocate(kMinSize * 2, &new_block);
+  EXPECT(!new_block);
+  EXPECT(allocator.ClassSize(exact.size_class) == kMinSize * 2);
+  const Allocation over = allocator.Allocate(kMinSize * 2 + 1, &new_block);
+  EXPECT(allocator.ClassSize(over.size_class) == kMinSize * 4);
+
+  const SizeClassAllocator::Stats stats = allocator.stats();
+  EXPECT(stats.bytes_requested == 1 + kMinSize * 2 + kMinSize * 2 + 1);
+  EXPECT(stats.bytes_allocated == kMinSize * 7);
+  EXPECT(stats.bytes_reserved == kBlockSize);
+  EXPECT(stats.num_allocations == 3);
+  EXPECT(stats.internal_fragmentation > 0.0f);
+}
+
+TEST(CanAllocate) {
+  SizeClassAllocator allocator(kMinSize, kMaxSize, kPageSize, kBlockSize);
+  EXPECT(!allocator.CanAllocate(0));
+  EXPECT(allocator.CanAllocate(1));
+  EXPECT(allocator.CanAllocate(kMaxSize));
+  EXPECT(!allocator.CanAllocate(kMaxSize + 1));
+}
+
+TEST(ReusesFreedSlots) {
+  SizeClassAllocator allocator(kMinSize, kMaxSize, kPageSize, kBlockSize);
+  bool new_block = false;
+  const Allocation first = allocator.Allocate(1000, &new_block);
+  allocator.Free(first);
+  const Allocation second = allocator.Allocate(900, &new_block);
+  EXPECT(!new_block);
+  EXPECT(second.block == first.block && second.offset == first.offset);
+  allocator.Free(second);
+  EXPECT(allocator.stats().num_allocations == 0);
+  EXPECT(allocator.stats().bytes_allocated == 0);
+  EXPECT(allocator.stats().internal_fragmentation == 0.0f);
+}
+
+TEST(AddsBlocksWhenPagesRunOut) {
+  SizeClassAllocator allocator(kMinSize, kMaxSize, kPageSize, kBlockSize);
+  const int per_block = kBlockSize / kMaxSize;
+  int num_new_blocks = 0;
+  for (int i = 0; i < per_block * 3; ++i) {
+    bool new_block = false;
+    const Allocation alloc = allocator.Allocate(kMaxSize, &new_block);
+    if (new_block) {
+      ++num_new_blocks;
+      EXPECT(i % per_block == 0);
+      EXPECT(alloc.block == allocator.num_blocks() - 1);
+    }
+  }
+  EXPECT(num_new_blocks == 3 && allocator.num_blocks() == 3);
+}
+
+// Random allocations and frees never overlap, stay aligned to their size
+// class, and keep the stats in sync.
+TEST(RandomAllocationsDontOverlap) {
+  SizeClassAllocator allocator(kMinSize, kMaxSize, kPageSize, kBlockSize);
+  std::mt19937 rng(1);
+  std::vector<Allocation> live;
+  size_t bytes_requested = 0;
+  for (int step = 0; step < 20000; ++step) {
+    if (live.empty() || rng() % 5 < 3) {
+      const int size = 1 + static_cast<int>(rng() % kMaxSize);
+      bool new_block = false;
+      const Allocation alloc = allocator.Allocate(size, &new_block);
+      const int slot_size = allocator.ClassSize(alloc.size_class);
+      EXPECT(slot_size >= size);
+      EXPECT(slot_size == kMinSize || slot_size < 2 * size);
+      EXPECT(alloc.offset % slot_size == 0);
+      EXPECT(alloc.offset + slot_size <= kBlockSize);
+      live.push_back(alloc);
+      bytes_requested += size;
+    } else {
+      const size_t index = rng() % live.size();
+      allocator.Free(live[index]);
+      bytes_requested -= live[index].size;
+      live[index] = live.back();
+      live.pop_back();
+    }
+  }
+
+  std::map<std::pair<int, int>, int> ends;
+  for (const Allocation& alloc : live) {
+    ends[{alloc.block, alloc.offset}] =
+        alloc.offset + allocator.ClassSize(alloc.size_class);
+  }
+  EXPECT(ends.size() == live.size());
+  for (auto iter = ends.begin(); iter != ends.end(); ++iter) {
+    const auto next = std::next(iter);
+    if (next != ends.end() && next->first.first == iter->first.first) {
+      EXPECT(iter->second <= next->first.second);
+    }
+  }
+  EXPECT(allocator.stats().num_allocations == static_cast<int>(live.size()));
+  EXPECT(allocator.stats().bytes_requested == bytes_requested);
+}
+
+}  // namespace
+}  // namespace Dx8to12
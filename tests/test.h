@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstdio>
+#include <vector>
+
+namespace Dx8to12::Testing {
+
+// Just enough of a test framework for the host tests of the D3D-free code in
+// src/utils. Each test binary is one *_test.cpp file linked with
+// test_main.cpp, which runs every TEST in it.
+struct TestCase {
+  const char* name;
+  void (*function)();
+};
+
+std::vector<TestCase>& Registry();
+// Number of failed EXPECTs in the running test.
+int& NumFailures();
+
+inline bool Register(const char* name, void (*function)()) {
+  Registry().push_back({name, function});
+  return true;
+}
+
+}  // namespace Dx8to12::Testing
+
+#define TEST(name)                                \
+  static void name();                             \
+  static const bool name##_registered =           \
+      ::Dx8to12::Testing::Register(#name, &name); \
+  static void name()
+
+#define EXPECT(expr)                                                    \
+  do {                                                                  \
+    if (!(expr)) {                                                      \
+      std::fprintf(stderr, "%s:%d: Expected %s\n", __FILE__, __LINE__,  \
+                   #expr);                                              \
+      ++::Dx8to12::Testing::NumFailures();                              \
+    }                                                                   \
+  } while (0)
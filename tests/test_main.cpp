@@ -0,0 +1,31 @@
+#include <cstdio>
+
+#include "test.h"
+
+namespace Dx8to12::Testing {
+
+std::vector<TestCase>& Registry() {
+  static std::vector<TestCase> registry;
+  return registry;
+}
+
+int& NumFailures() {
+  static int num_failures = 0;
+  return num_failures;
+}
+
+}  // namespace Dx8to12::Testing
+
+int main() {
+  using namespace Dx8to12::Testing;
+  int num_failed_tests = 0;
+  for (const TestCase& test : Registry()) {
+    NumFailures() = 0;
+    test.function();
+    std::printf("%s %s\n", NumFailures() == 0 ? "[  OK  ]" : "[FAILED]",
+                test.name);
+    if (NumFailures() != 0) ++num_failed_tests;
+  }
+  std::printf("%zu tests, %d failed.\n", Registry().size(), num_failed_tests);
+  return num_failed_tests == 0 ? 0 : 1;
+}
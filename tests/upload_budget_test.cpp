@@ -0,0 +1,177 @@
+#include "utils/upload_budget.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <random>
+#include <vector>
+
+#include "bench.h"
+#include "device_limits.h"
+#include "test.h"
+#include "utils/pitch_repack.h"
+
+namespace Dx8to12 {
+namespace {
+
+using Testing::SecondsPerRun;
+
+TEST(SplitsIntoChunks) {
+  UploadBudget budget(1024, 1 << 20);
+  EXPECT(budget.NextChunkRows(100, 256, false) == 4);
+  EXPECT(budget.NextChunkRows(3, 256, false) == 3);
+  EXPECT(budget.NextChunkRows(100, 300, false) == 3);
+  // Rows wider than a chunk still go one at a time.
+  EXPECT(budget.NextChunkRows(100, 4096, false) == 1);
+}
+
+TEST(StopsAtInFlightLimit) {
+  UploadBudget budget(1024, 4096);
+  budget.Record(1, 3584);
+  EXPECT(budget.NextChunkRows(100, 256, false) == 2);
+  EXPECT(budget.NextChunkRows(100, 300, false) == 1);
+  EXPECT(budget.NextChunkRows(100, 1024, false) == 0);
+  EXPECT(budget.NextChunkRows(100, 256, true) == 4);
+  // Forced chunks can go over the limit.
+  budget.Record(1, 1024);
+  EXPECT(budget.in_flight_bytes() == 4608);
+  EXPECT(budget.NextChunkRows(100, 256, false) == 0);
+  EXPECT(budget.NextChunkRows(100, 256, true) == 4);
+}
+
+TEST(RetiresCompletedFrames) {
+  UploadBudget budget(1024, 4096);
+  budget.Record(1, 1000);
+  budget.Record(2, 200);
+  budget.Record(2, 300);
+  budget.Record(4, 50);
+  EXPECT(budget.in_flight_bytes() == 1550);
+  budget.Retire(0);
+  EXPECT(budget.in_flight_bytes() == 1550);
+  budget.Retire(3);
+  EXPECT(budget.in_flight_bytes() == 50);
+  budget.Retire(4);
+  EXPECT(budget.in_flight_bytes() == 0);
+  const UploadBudget::Stats stats = budget.stats();
+  EXPECT(stats.bytes_uploaded == 1550 && stats.frame_bytes == 1550);
+  EXPECT(stats.num_chunks == 4 && stats.in_flight_bytes == 0);
+  EXPECT(budget.EndFrame() == 1550);
+  EXPECT(budget.stats().frame_bytes == 0);
+}
+
+struct ReplayUpload {
+  uint32_t num_rows;
+  uint32_t row_bytes;
+  uint32_t row_pitch;
+  uint32_t next_row = 0;
+};
+
+struct ReplayResult {
+  uint64_t bytes;
+  uint64_t num_chunks;
+  uint64_t peak_in_flight_bytes;
+  int num_frames;
+};
+
+// Replays a level load: uploads_per_frame new uploads start every frame, and
+// the GPU completes frames two behind. Pending uploads are recorded oldest
+// first, the way TextureUploader does, with every band repacked into ring
+// memory.
+ReplayResult Replay(const std::vector<ReplayUpload> &uploads,
+                    int uploads_per_frame, uint64_t chunk_size,
+                    uint64_t max_in_flight_bytes, const char *src,
+                    char *ring) {
+  UploadBudget budget(chunk_size, max_in_flight_bytes);
+  std::deque<ReplayUpload> pending;
+  ReplayResult result = {};
+  size_t next_upload = 0;
+  uint64_t frame = 1;
+  while (next_upload < uploads.size() || !pending.empty()) {
+    if (frame > 2) budget.Retire(frame - 2);
+    for (int i = 0; i < uploads_per_frame && next_upload < uploads.size();
+         ++i) {
+      pending.push_back(uploads[next_upload++]);
+    }
+    while (!pending.empty()) {
+      ReplayUpload &upload = pending.front();
+      while (upload.next_row < upload.num_rows) {
+        const uint32_t num_rows = budget.NextChunkRows(
+            upload.num_rows - upload.next_row, upload.row_pitch, false);
+        if (num_rows == 0) break;
+        // Every row comes from the same source row.
+        RepackRows(ring, upload.row_pitch, src, 0, upload.row_bytes,
+                   num_rows);
+        budget.Record(frame, uint64_t{num_rows} * upload.row_pitch);
+        upload.next_row += num_rows;
+      }
+      result.peak_in_flight_bytes =
+          std::max(result.peak_in_flight_bytes, budget.in_flight_bytes());
+      if (upload.next_row < upload.num_rows) break;
+      pending.pop_front();
+    }
+    budget.EndFrame();
+    ++frame;
+  }
+  const UploadBudget::Stats stats = budget.stats();
+  result.bytes = stats.bytes_uploaded;
+  result.num_chunks = stats.num_chunks;
+  result.num_frames = static_cast<int>(frame - 1);
+  return result;
+}
+
+// 500 uploads of RGBA8 and BC1 mip chains from 64x64 to 2048x2048, started
+// 50 per frame.
+std::vector<ReplayUpload> LevelLoad() {
+  std::mt19937 rng(1);
+  std::vector<ReplayUpload> uploads;
+  while (uploads.size() < 500) {
+    uint32_t size = 64u << (rng() % 6);
+    const bool is_bc1 = rng() % 2 == 0;
+    for (; size >= 1 && uploads.size() < 500; size /= 2) {
+      const uint32_t num_rows = is_bc1 ? std::max(1u, size / 4) : size;
+      const uint32_t row_bytes =
+          is_bc1 ? std::max(1u, size / 4) * 8 : size * 4;
+      uploads.push_back({.num_rows = num_rows,
+                         .row_bytes = row_bytes,
+                         .row_pitch = (row_bytes + 255) / 256 * 256});
+    }
+  }
+  return uploads;
+}
+
+TEST(ReplayStaysUnderLimit) {
+  const std::vector<ReplayUpload> uploads = LevelLoad();
+  uint64_t expected_bytes = 0;
+  for (const ReplayUpload &upload : uploads) {
+    expected_bytes += uint64_t{upload.num_rows} * upload.row_pitch;
+  }
+  std::vector<char> src(2048 * 4), ring(kTextureUploadChunkSize);
+  const ReplayResult result =
+      Replay(uploads, 50, kTextureUploadChunkSize,
+             kTextureUploadMaxInFlightBytes, src.data(), ring.data());
+  EXPECT(result.bytes == expected_bytes);
+  EXPECT(result.peak_in_flight_bytes <= kTextureUploadMaxInFlightBytes);
+  EXPECT(result.num_frames > 10);
+}
+
+// Prints how long recording a 500-upload level load takes with the limits of
+// TextureUploader, and how many frames it is spread over.
+TEST(ReplayThroughput) {
+  const std::vector<ReplayUpload> uploads = LevelLoad();
+  std::vector<char> src(2048 * 4), ring(kTextureUploadChunkSize);
+  ReplayResult result;
+  const double seconds = SecondsPerRun([&] {
+    result = Replay(uploads, 50, kTextureUploadChunkSize,
+                    kTextureUploadMaxInFlightBytes, src.data(), ring.data());
+  });
+  std::printf(
+      "  %.1f MB in %llu chunks over %d frames, peak %.1f MB in flight, "
+      "%.2f ms (%.0f MB/s)\n",
+      result.bytes / 1e6, static_cast<unsigned long long>(result.num_chunks),
+      result.num_frames, result.peak_in_flight_bytes / 1e6, seconds * 1e3,
+      result.bytes / 1e6 / seconds);
+}
+
+}  // namespace
+}  // namespace Dx8to12